@@ -6,7 +6,8 @@ public partial class App {
 	private MainWindow? _mainWindow;
 
 	private void OnStartup(object sender, StartupEventArgs e) {
-		_mainWindow = new MainWindow();
+		// `SpawnCamper.Server.exe <trace-file>` shows a trace recorded with `SpawnCamper.Tracer --record`
+		_mainWindow = new MainWindow(e.Args.Length > 0 ? e.Args[0] : null);
 		MainWindow = _mainWindow;
 		_mainWindow.Show();
 	}
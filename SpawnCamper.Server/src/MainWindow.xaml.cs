@@ -1,3 +1,4 @@
+using System.Diagnostics;
 using System.Threading.Channels;
 using System.Windows;
 using System.Windows.Controls;
@@ -16,10 +17,13 @@ public partial class MainWindow {
             Channel.CreateUnbounded<LogServer.ProcessEvent>(new UnboundedChannelOptions {SingleReader = true});
 
     private readonly MainWindowViewModel _viewModel;
+    /// If set, the events are replayed from this trace file instead of running the server.
+    private readonly string? _tracePath;
     private Task? _serverTask;
     private Task? _eventProcessingTask;
 
-    public MainWindow() {
+    public MainWindow(string? tracePath = null) {
+        _tracePath = tracePath;
         InitializeComponent();
         _viewModel = new MainWindowViewModel(Dispatcher, _processTree);
         DataContext = _viewModel;
@@ -86,10 +90,14 @@ public partial class MainWindow {
     private void StartServer() {
         _serverTask = Task.Run(async () => {
             try {
-                await _logServer.RunAsync(evt => {
-                    // enqueue events without blocking - client processes won't wait for GUI
-                    _eventChannel.Writer.TryWrite(evt);
-                }, _cts.Token);
+                // enqueue events without blocking - client processes won't wait for GUI
+                Action<LogServer.ProcessEvent> eventCb = evt => _eventChannel.Writer.TryWrite(evt);
+                if (_tracePath != null) {
+                    using var reader = new TraceFileReader(_tracePath);
+                    await reader.ReplayAsync(eventCb, _cts.Token);
+                } else {
+                    await _logServer.RunAsync(eventCb, _cts.Token);
+                }
             } catch (OperationCanceledException) {
                 // expected on shutdown
             } catch (Exception ex) {
@@ -98,13 +106,22 @@ public partial class MainWindow {
         });
     }
 
+    /// How often the received events are applied to the process tree.
+    private static readonly TimeSpan EventBatchInterval = TimeSpan.FromMilliseconds(100);
+    /// Upper bound on the time spent applying a single batch, so that the UI stays responsive during large builds.
+    private static readonly TimeSpan EventBatchBudget = TimeSpan.FromMilliseconds(50);
+
     private async Task ProcessEventsAsync(CancellationToken token) {
         while (await _eventChannel.Reader.WaitToReadAsync(token)) {
-            // batch-process all available events; WPF will only re-render the UI once we let go of the UI thread,
+            // batch-process the available events; WPF will only re-render the UI once we let go of the UI thread,
             //  so this effectively batches the processing to avoid expensive repaints
-            while (_eventChannel.Reader.TryRead(out var e)) {
+            var start = Stopwatch.GetTimestamp();
+            while (Stopwatch.GetElapsedTime(start) < EventBatchBudget && _eventChannel.Reader.TryRead(out var e)) {
                 _processTree.HandleEvent(e);
             }
+            _viewModel.RefreshStatistics();
+            // let the next batch accumulate, instead of updating the tree after each event of a busy build
+            await Task.Delay(EventBatchInterval, token);
         }
     }
 
@@ -0,0 +1,35 @@
+using System.ComponentModel;
+using System.IO;
+using SpawnCamper.Core;
+
+namespace SpawnCamper.Server.ViewModels;
+
+/// A row of the statistics table. The group is updated in place by the process tree, `Refresh` notifies the view.
+/// Times are in seconds, so that the table sorts them numerically.
+public class ExecutableStatisticsViewModel(ExecutableStatistics.Group group) : INotifyPropertyChanged {
+    private static readonly string[] RefreshedProperties = [
+        nameof(Runs), nameof(Running), nameof(Failed), nameof(Unknown), nameof(TotalSeconds), nameof(MeanSeconds),
+        nameof(P50Seconds), nameof(P90Seconds), nameof(P99Seconds), nameof(MaxSeconds),
+    ];
+
+    public event PropertyChangedEventHandler? PropertyChanged;
+
+    public string ExePath => group.ExePath;
+    public string ExeName => Path.GetFileName(group.ExePath);
+    public long Runs => group.Started;
+    public long Running => group.Running;
+    public long Failed => group.Failed;
+    public long Unknown => group.Unknown;
+    public double TotalSeconds => group.Durations.Total.TotalSeconds;
+    public double MeanSeconds => group.Durations.Mean.TotalSeconds;
+    public double P50Seconds => group.Durations.Percentile(50).TotalSeconds;
+    public double P90Seconds => group.Durations.Percentile(90).TotalSeconds;
+    public double P99Seconds => group.Durations.Percentile(99).TotalSeconds;
+    public double MaxSeconds => group.Durations.Max.TotalSeconds;
+
+    public void Refresh() {
+        foreach (var name in RefreshedProperties) {
+            PropertyChanged?.Invoke(this, new PropertyChangedEventArgs(name));
+        }
+    }
+}
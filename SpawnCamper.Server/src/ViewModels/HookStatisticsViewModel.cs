@@ -0,0 +1,41 @@
+using System.ComponentModel;
+using SpawnCamper.Core;
+
+namespace SpawnCamper.Server.ViewModels;
+
+/// A row of the hook overhead table, one of the distributions of `HookStatistics`. The histogram is updated in place by
+/// the process tree, `Refresh` notifies the view. Times are in milliseconds.
+public class HookStatisticsViewModel(string name, DurationHistogram histogram) : INotifyPropertyChanged {
+    private static readonly string[] RefreshedProperties = [
+        nameof(Count), nameof(MeanMilliseconds), nameof(P50Milliseconds), nameof(P90Milliseconds),
+        nameof(P99Milliseconds), nameof(MaxMilliseconds),
+    ];
+
+    public event PropertyChangedEventHandler? PropertyChanged;
+
+    public string Name => name;
+    public long Count => histogram.Count;
+    public double MeanMilliseconds => histogram.Mean.TotalMilliseconds;
+    public double P50Milliseconds => histogram.Percentile(50).TotalMilliseconds;
+    public double P90Milliseconds => histogram.Percentile(90).TotalMilliseconds;
+    public double P99Milliseconds => histogram.Percentile(99).TotalMilliseconds;
+    public double MaxMilliseconds => histogram.Max.TotalMilliseconds;
+
+    /// The rows of the table, in the same order as the overhead table of `SpawnCamper.ServerCli`.
+    public static List<HookStatisticsViewModel> CreateRows(HookStatistics stats) => [
+        new("Spawn latency (CreateProcess to hook loaded)", stats.SpawnLatency),
+        new("CreateProcess call", stats.CreateProcess),
+        new("CreateProcess detour overhead", stats.CreateProcessOverhead),
+        new("Total overhead per process", stats.Overhead),
+        new("Loading the hook (DllMain)", stats.Attach),
+        new("Connecting to the server", stats.Connect),
+        new("Reporting the start", stats.LogAttach),
+        new("Writing messages", stats.WriteTime),
+    ];
+
+    public void Refresh() {
+        foreach (var propertyName in RefreshedProperties) {
+            PropertyChanged?.Invoke(this, new PropertyChangedEventArgs(propertyName));
+        }
+    }
+}
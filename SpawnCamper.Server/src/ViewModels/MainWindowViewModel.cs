@@ -2,6 +2,7 @@ using System.Collections.ObjectModel;
 using System.Collections.Specialized;
 using System.ComponentModel;
 using System.Runtime.CompilerServices;
+using System.Windows.Data;
 using System.Windows.Threading;
 using SpawnCamper.Core;
 
@@ -12,6 +13,42 @@ public class MainWindowViewModel : INotifyPropertyChanged {
     public event PropertyChangedEventHandler? PropertyChanged;
     public ObservableCollection<ProcessNodeViewModel> RootProcesses {get;}
 
+    private readonly ExecutableStatistics _statistics;
+    private readonly Dictionary<ExecutableStatistics.Group, ExecutableStatisticsViewModel> _statisticsRows = [];
+
+    /// Per-executable statistics, sorted by the total time.
+    public ObservableCollection<ExecutableStatisticsViewModel> Statistics {get;} = [];
+
+    /// The statistics are only refreshed while they are shown.
+    public bool IsStatisticsVisible {
+        get;
+        set {
+            UpdateProperty(out field, value);
+            if (value) {
+                RefreshStatistics();
+            }
+        }
+    }
+
+    private readonly HookStatistics _hookStatistics;
+
+    /// Distributions of the hook overhead over all finished processes.
+    public ObservableCollection<HookStatisticsViewModel> HookStatistics {get;}
+
+    /// How many times a hook found all pipe instances of the server busy.
+    public long HookBusyWaits => _hookStatistics.BusyWaits;
+
+    /// Like the statistics, only refreshed while shown.
+    public bool IsHookStatisticsVisible {
+        get;
+        set {
+            UpdateProperty(out field, value);
+            if (value) {
+                RefreshStatistics();
+            }
+        }
+    }
+
     public ProcessNodeViewModel? SelectedProcess {
         get;
         set => UpdateProperty(out field, value);
@@ -20,6 +57,17 @@ public class MainWindowViewModel : INotifyPropertyChanged {
     public MainWindowViewModel(Dispatcher dispatcher, TracedProcessTree processTree) {
         _dispatcher = dispatcher;
         RootProcesses = [];
+        _statistics = processTree.Statistics;
+        _hookStatistics = processTree.HookStatistics;
+        HookStatistics = new(HookStatisticsViewModel.CreateRows(_hookStatistics));
+
+        var statisticsView = CollectionViewSource.GetDefaultView(Statistics);
+        statisticsView.SortDescriptions.Add(new SortDescription(
+                nameof(ExecutableStatisticsViewModel.TotalSeconds), ListSortDirection.Descending));
+        if (statisticsView is ICollectionViewLiveShaping {CanChangeLiveSorting: true} liveView) {
+            liveView.LiveSortingProperties.Add(nameof(ExecutableStatisticsViewModel.TotalSeconds));
+            liveView.IsLiveSorting = true;
+        }
 
         // Subscribe to root process changes
         ((INotifyCollectionChanged)processTree.RootProcesses).CollectionChanged += OnRootProcessesChanged;
@@ -47,6 +95,26 @@ public class MainWindowViewModel : INotifyPropertyChanged {
         // Handle other collection change types if needed (Reset, Remove, etc.)
     }
 
+    /// Updates the statistics tables from the process tree, called after each batch of events.
+    public void RefreshStatistics() {
+        if (IsStatisticsVisible) {
+            foreach (var group in _statistics.ByExecutable) {
+                if (_statisticsRows.TryGetValue(group, out var row)) {
+                    row.Refresh();
+                } else {
+                    _statisticsRows[group] = row = new ExecutableStatisticsViewModel(group);
+                    Statistics.Add(row);
+                }
+            }
+        }
+        if (IsHookStatisticsVisible) {
+            foreach (var row in HookStatistics) {
+                row.Refresh();
+            }
+            PropertyChanged?.Invoke(this, new(nameof(HookBusyWaits)));
+        }
+    }
+
     private void UpdateProperty<T>(out T prop, T value, [CallerMemberName] string propName = "") {
         prop = value;
         PropertyChanged?.Invoke(this, new(propName));
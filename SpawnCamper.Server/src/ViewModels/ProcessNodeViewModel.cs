@@ -19,13 +19,6 @@ public class ProcessNodeViewModel : INotifyPropertyChanged {
 
     public ProcessNodeViewModel(TracedProcessTree.Node node) {
         _node = node;
-
-        // Subscribe to child collection changes
-        _node.Children.CollectionChanged += OnChildrenCollectionChanged;
-        // Initialize children
-        foreach (var childNode in _node.Children) {
-            Children.Add(new ProcessNodeViewModel(childNode));
-        }
         // Subscribe to property changes on the process
         _node.Process.PropertyChanged += OnProcessPropertyChanged;
     }
@@ -33,7 +26,7 @@ public class ProcessNodeViewModel : INotifyPropertyChanged {
     private void OnChildrenCollectionChanged(object? sender, NotifyCollectionChangedEventArgs e) {
         if (e.Action == NotifyCollectionChangedAction.Add && e.NewItems != null) {
             foreach (TracedProcessTree.Node node in e.NewItems) {
-                Children.Add(new ProcessNodeViewModel(node));
+                _children!.Add(new ProcessNodeViewModel(node));
             }
         }
     }
@@ -57,6 +50,13 @@ public class ProcessNodeViewModel : INotifyPropertyChanged {
                 OnPropertyChanged(nameof(IsDetached));
                 OnPropertyChanged(nameof(ExitStatusDisplay)); // Exit display depends on IsActive and IsDetached
                 break;
+            case nameof(TracedProcess.HookTimings):
+                OnPropertyChanged(nameof(HookOverheadDisplay));
+                OnPropertyChanged(nameof(SpawnLatencyDisplay));
+                break;
+            case nameof(TracedProcess.Spawns):
+                OnPropertyChanged(nameof(SpawnsDisplay));
+                break;
         }
     }
 
@@ -69,7 +69,22 @@ public class ProcessNodeViewModel : INotifyPropertyChanged {
     private TracedProcess Process => _node.Process;
     public int ProcessId => Process.ProcessId;
     public double IndentWidth => _node.Depth * 18.0; // 18 pixels per level
-    public ObservableCollection<ProcessNodeViewModel> Children {get;} = [];
+
+    private ObservableCollection<ProcessNodeViewModel>? _children;
+
+    /// Created when the tree view first asks for the children, which only happens once this node is shown; with
+    /// virtualization, large builds only get view models for the processes that were scrolled into view.
+    public ObservableCollection<ProcessNodeViewModel> Children {
+        get {
+            if (_children == null) {
+                _children = new ObservableCollection<ProcessNodeViewModel>(
+                        _node.Children.Select(n => new ProcessNodeViewModel(n)));
+                // Subscribe to child collection changes
+                _node.Children.CollectionChanged += OnChildrenCollectionChanged;
+            }
+            return _children;
+        }
+    }
 
     public Dictionary<string, string> EnvironmentVariables => Process.Environment;
 
@@ -141,6 +156,46 @@ public class ProcessNodeViewModel : INotifyPropertyChanged {
         }
     }
 
+    /// Time the hook delayed the process by, with its parts; the hook reports it right after the process starts, and
+    /// again before it exits.
+    public string HookOverheadDisplay {
+        get {
+            if (Process.HookTimings is not {} t) {
+                return "(not reported)";
+            }
+            return $"{FormatMilliseconds(t.Overhead)} (loading {FormatMilliseconds(t.Attach)}, " +
+                   $"connecting {FormatMilliseconds(t.Connect)}, " +
+                   $"reporting the start {FormatMilliseconds(t.LogAttach)}, " +
+                   $"writing {t.Writes} messages {FormatMilliseconds(t.WriteTime)}; " +
+                   $"server busy {t.BusyWaits} times)";
+        }
+    }
+
+    /// From the parent calling `CreateProcess` until the hook was loaded into this process.
+    public string SpawnLatencyDisplay => Process.HookTimings?.SpawnLatency is {} latency
+            ? FormatMilliseconds(latency)
+            : "(not reported)";
+
+    /// `CreateProcess` calls of this process, with the time spent in the calls and in the hook around them.
+    public string SpawnsDisplay {
+        get {
+            var spawns = Process.Spawns;
+            if (spawns.Count == 0) {
+                return "—";
+            }
+            var createProcess = TimeSpan.Zero;
+            var detour = TimeSpan.Zero;
+            foreach (var spawn in spawns) {
+                createProcess += spawn.CreateProcess;
+                detour += spawn.Detour;
+            }
+            return $"{spawns.Count} (CreateProcess {FormatMilliseconds(createProcess)}, " +
+                   $"hook overhead {FormatMilliseconds(detour - createProcess)})";
+        }
+    }
+
+    private static string FormatMilliseconds(TimeSpan time) => $"{time.TotalMilliseconds:F3} ms";
+
     public bool HasEnvironment => Process.Environment.Count > 0;
     public bool HasEnvironmentDifferences => Process.EnvironmentDiff is {Count: > 0};
 
@@ -0,0 +1,90 @@
+﻿using System.Buffers.Binary;
+using System.Diagnostics;
+using System.Globalization;
+using System.IO.Pipes;
+using SpawnCamper.Core;
+
+namespace SpawnCamper.ServerBenchmark;
+
+/// Stress test of the connection handling of `LogServer`: connects a burst of clients at the same time, like a parallel
+/// build starting many processes at once, with a single listener (the server before the listener pool) and with the
+/// default pool. The result is printed in the same format as `ParserBenchmark`, with the client-side connect latency
+/// and how many times all pipe instances of the server were busy.
+internal static class ConnectionBenchmark {
+    private static readonly TimeSpan ConnectTimeout = TimeSpan.FromSeconds(30);
+
+    public static async Task RunAsync(int clientCount, TextWriter output) {
+        // warm up the JIT
+        await RunAsync(Math.Min(clientCount, 16), LogServer.DefaultListenerCount);
+
+        foreach (var listenerCount in new[] {1, LogServer.DefaultListenerCount}) {
+            var (elapsed, latencies, listeners) = await RunAsync(clientCount, listenerCount);
+            await output.WriteLineAsync(string.Create(CultureInfo.InvariantCulture,
+                    $"{{\"name\":\"connect/listeners={listenerCount}\",\"size\":{clientCount}," +
+                    $"\"nsPerOp\":{elapsed.TotalNanoseconds / clientCount:F1}," +
+                    $"\"connectP50Us\":{latencies.Percentile(50).TotalMicroseconds:F1}," +
+                    $"\"connectP99Us\":{latencies.Percentile(99).TotalMicroseconds:F1}," +
+                    $"\"connectMaxUs\":{latencies.Max.TotalMicroseconds:F1}," +
+                    $"\"exhausted\":{listeners.Exhausted}," +
+                    $"\"exhaustedUs\":{listeners.ExhaustedTime.TotalMicroseconds:F1}," +
+                    $"\"refillP99Us\":{listeners.RefillTimes.Percentile(99).TotalMicroseconds:F1}}}"));
+        }
+    }
+
+    private static async Task<(TimeSpan Elapsed, DurationHistogram Latencies, LogServer.ListenerMetrics Listeners)>
+            RunAsync(int clientCount, int listenerCount) {
+        var pipeName = $"SpawnCamper.Benchmark.{Environment.ProcessId}.{Guid.NewGuid():N}";
+        var server = new LogServer(pipeName, 0, listenerCount);
+        using var cts = new CancellationTokenSource();
+
+        var detached = 0;
+        var allDetached = new TaskCompletionSource();
+        var serverTask = server.RunAsync(e => {
+            if (e is LogServer.ProcessDetach && Interlocked.Increment(ref detached) == clientCount) {
+                allDetached.SetResult();
+            }
+        }, cts.Token);
+
+        // wait until all listeners are ready, a real server is started well before the build
+        while (server.Listeners.Pending < listenerCount) {
+            await Task.Delay(1);
+        }
+
+        var start = new TaskCompletionSource();
+        var clients = Enumerable.Range(0, clientCount).Select(_ => Task.Run(async () => {
+            await start.Task;
+            return await ConnectAsync(pipeName);
+        })).ToList();
+        var stopwatch = Stopwatch.StartNew();
+        start.SetResult();
+        var latencies = new DurationHistogram();
+        foreach (var latency in await Task.WhenAll(clients)) {
+            latencies.Add(latency);
+        }
+        await allDetached.Task.WaitAsync(ConnectTimeout);
+        var elapsed = stopwatch.Elapsed;
+
+        await cts.CancelAsync();
+        try {
+            await serverTask;
+        } catch (OperationCanceledException) {}
+        return (elapsed, latencies, server.Listeners);
+    }
+
+    /// Connects like a hook using protocol version 2 that exits without sending any message, returns the time it took
+    /// to connect.
+    private static async Task<TimeSpan> ConnectAsync(string pipeName) {
+        var stopwatch = Stopwatch.StartNew();
+        await using var pipe = new NamedPipeClientStream(".", pipeName, PipeDirection.InOut, PipeOptions.Asynchronous);
+        await pipe.ConnectAsync((int) ConnectTimeout.TotalMilliseconds);
+        var latency = stopwatch.Elapsed;
+
+        var version = new byte[4];
+        await pipe.ReadExactlyAsync(version);
+        var preamble = new byte[8];
+        BinaryPrimitives.WriteUInt32LittleEndian(preamble, 0x32504353);
+        BinaryPrimitives.WriteUInt32LittleEndian(preamble.AsSpan(4), 2);
+        await pipe.WriteAsync(preamble);
+        return latency;
+    }
+}
@@ -0,0 +1,99 @@
+﻿using System.Buffers.Binary;
+using System.Diagnostics;
+using System.Globalization;
+using SpawnCamper.Core;
+
+namespace SpawnCamper.ServerBenchmark;
+
+/// Measures the server-side message parsing by replaying the messages of a recorded trace file through the parser,
+/// without the cost of the transport. Each result is printed as a JSON object per line, in the same format as
+/// `SpawnCamper.Benchmark`, so that runs can be compared.
+internal static class ParserBenchmark {
+    /// Minimum time of each benchmark.
+    private static readonly TimeSpan MinTime = TimeSpan.FromSeconds(1);
+
+    /// `stream` parses the messages of each process from a single stream, like the messages received through a pipe;
+    /// `record` parses each message separately, like the records of the shared memory ring and trace files.
+    public static async Task RunAsync(string tracePath, TextWriter output) {
+        using var trace = new TraceFileReader(tracePath);
+        var version = trace.ProtocolVersion;
+        var records = new List<(int ProcessId, byte[] Payload)>();
+        await foreach (var (processId, payload) in trace.ReadRecordsAsync(CancellationToken.None)) {
+            records.Add((processId, payload.AsSpan().ToArray()));
+        }
+        var bytes = records.Sum(r => (long) r.Payload.Length);
+
+        // the byte stream each process would send through its pipe, in the order the processes started
+        var streams = records.GroupBy(r => r.ProcessId).Select(g => {
+            var stream = new MemoryStream();
+            if (version > 1) {
+                Span<byte> preamble = stackalloc byte[8];
+                BinaryPrimitives.WriteUInt32LittleEndian(preamble, 0x32504353);
+                BinaryPrimitives.WriteUInt32LittleEndian(preamble[4..], (uint) version);
+                stream.Write(preamble);
+            }
+            foreach (var (_, payload) in g) {
+                stream.Write(payload);
+            }
+            return (ProcessId: g.Key, Messages: g.Count(), Data: stream.ToArray());
+        }).ToList();
+
+        await RunAsync(output, "parse/stream", records.Count, bytes, async (envCache, eventCb) => {
+            foreach (var (processId, messages, data) in streams) {
+                using var reader = new LogReader(new PipeLikeStream(data));
+                var parser = new MessageParser(
+                        reader, (await reader.ReadProtocolVersionAsync(CancellationToken.None))!.Value,
+                        processId, envCache, eventCb);
+                // the server reads until the end of the stream, but the exception would dominate the measurement
+                for (var i = 0; i < messages; i++) {
+                    await parser.ReadMessageAsync(CancellationToken.None);
+                }
+            }
+        });
+
+        await RunAsync(output, "parse/record", records.Count, bytes, async (envCache, eventCb) => {
+            foreach (var (processId, payload) in records) {
+                using var reader = new LogReader(new ArraySegment<byte>(payload));
+                await new MessageParser(reader, version, processId, envCache, eventCb)
+                        .ReadMessageAsync(CancellationToken.None);
+            }
+        });
+    }
+
+    /// Calls `fn` repeatedly until the minimum time elapses, each call parses all `messages` of the trace.
+    private static async Task RunAsync(TextWriter output, string name, int messages, long bytes,
+            Func<EnvironmentCache, Action<LogServer.ProcessEvent>, Task> fn) {
+        // the events are discarded, only the parsing is measured
+        Action<LogServer.ProcessEvent> eventCb = _ => {};
+        // warm up the JIT and the buffer pools
+        await fn(new EnvironmentCache(), eventCb);
+
+        var iterations = 0L;
+        var stopwatch = Stopwatch.StartNew();
+        while (stopwatch.Elapsed < MinTime) {
+            // a fresh cache, so that the environments are stored again in each iteration
+            await fn(new EnvironmentCache(), eventCb);
+            iterations++;
+        }
+
+        var nsPerMessage = stopwatch.Elapsed.TotalNanoseconds / iterations / messages;
+        var bytesPerSecond = bytes / (nsPerMessage * messages) * 1e9;
+        await output.WriteLineAsync(string.Create(CultureInfo.InvariantCulture,
+                $"{{\"name\":\"{name}\",\"size\":{messages},\"iterations\":{iterations}," +
+                $"\"nsPerOp\":{nsPerMessage:F1},\"bytesPerSecond\":{bytesPerSecond:F0}}}"));
+    }
+
+    /// Returns at most 4 KB from each read, like a pipe that the client writes to in small batches, so that messages
+    /// end up split across reads.
+    private sealed class PipeLikeStream(byte[] data) : MemoryStream(data, false) {
+        private const int MaxRead = 4096;
+
+        public override int Read(Span<byte> buffer) {
+            return base.Read(buffer[..Math.Min(buffer.Length, MaxRead)]);
+        }
+
+        public override ValueTask<int> ReadAsync(Memory<byte> buffer, CancellationToken token = default) {
+            return base.ReadAsync(buffer[..Math.Min(buffer.Length, MaxRead)], token);
+        }
+    }
+}
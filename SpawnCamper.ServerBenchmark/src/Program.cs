@@ -0,0 +1,29 @@
+namespace SpawnCamper.ServerBenchmark;
+
+/// Benchmarks of the server side. Each result is printed as a JSON object on its own line, in the same format as
+/// `SpawnCamper.Benchmark` of the hook, so that the output of two builds can be compared.
+public static class Program {
+    public static async Task<int> Main(string[] args) {
+        switch (args) {
+            case ["parse", var tracePath]:
+                await ParserBenchmark.RunAsync(tracePath, Console.Out);
+                return 0;
+            case ["tree", var processCountStr] when int.TryParse(processCountStr, out var processCount):
+                await TreeBenchmark.RunAsync(processCount, Console.Out);
+                return 0;
+            case ["tree", var tracePath]:
+                await TreeBenchmark.RunTraceAsync(tracePath, Console.Out);
+                return 0;
+            case ["connect", var clientCountStr] when int.TryParse(clientCountStr, out var clientCount)
+                                                      && clientCount > 0:
+                await ConnectionBenchmark.RunAsync(clientCount, Console.Out);
+                return 0;
+            default:
+                await Console.Error.WriteLineAsync(
+                        "Usage: SpawnCamper.ServerBenchmark parse <trace file>\n" +
+                        "       SpawnCamper.ServerBenchmark tree <process count | trace file>\n" +
+                        "       SpawnCamper.ServerBenchmark connect <client count>");
+                return 1;
+        }
+    }
+}
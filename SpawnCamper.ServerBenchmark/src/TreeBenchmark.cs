@@ -0,0 +1,114 @@
+﻿using System.Diagnostics;
+using System.Globalization;
+using SpawnCamper.Core;
+
+namespace SpawnCamper.ServerBenchmark;
+
+/// Synthetic load generator for `TracedProcessTree`: pushes the events of a large parallel build through
+/// `HandleEvent` and measures the ingestion rate and the memory retained by the tree. The result is printed
+/// in the same format as `ParserBenchmark`.
+internal static class TreeBenchmark {
+    /// Number of processes running at the same time, i.e., started but not exited yet.
+    private const int Parallelism = 32;
+    /// Number of build nodes (e.g., MSBuild workers) under the root, which start the compilers.
+    private const int WorkerCount = 16;
+
+    public static async Task RunAsync(int processCount, TextWriter output) {
+        // warm up the JIT
+        Ingest(GenerateEvents(Math.Min(processCount, 1000)));
+
+        var events = GenerateEvents(processCount);
+        var memoryBefore = GC.GetTotalMemory(true);
+        var stopwatch = Stopwatch.StartNew();
+        var tree = Ingest(events);
+        var elapsed = stopwatch.Elapsed;
+        var memoryAfter = GC.GetTotalMemory(true);
+        GC.KeepAlive(tree);
+
+        await output.WriteLineAsync(string.Create(CultureInfo.InvariantCulture,
+                $"{{\"name\":\"tree/ingest\",\"size\":{processCount},\"events\":{events.Count}," +
+                $"\"nsPerOp\":{elapsed.TotalNanoseconds / events.Count:F1}," +
+                $"\"bytesPerProcess\":{(double) (memoryAfter - memoryBefore) / processCount:F0}}}"));
+    }
+
+    /// Replays a recorded trace into a process tree and measures the memory retained by the tree, including the
+    /// parsed environments and strings.
+    public static async Task RunTraceAsync(string tracePath, TextWriter output) {
+        var memoryBefore = GC.GetTotalMemory(true);
+        var tree = new TracedProcessTree();
+        var processCount = 0;
+        using (var reader = new TraceFileReader(tracePath)) {
+            await reader.ReplayAsync(e => {
+                processCount += e is LogServer.ProcessInfo ? 1 : 0;
+                tree.HandleEvent(e);
+            }, CancellationToken.None);
+        }
+        var memoryAfter = GC.GetTotalMemory(true);
+        GC.KeepAlive(tree);
+
+        await output.WriteLineAsync(string.Create(CultureInfo.InvariantCulture,
+                $"{{\"name\":\"tree/replay\",\"size\":{processCount}," +
+                $"\"bytesPerProcess\":{(double) (memoryAfter - memoryBefore) / processCount:F0}}}"));
+    }
+
+    private static TracedProcessTree Ingest(List<LogServer.ProcessEvent> events) {
+        var tree = new TracedProcessTree();
+        foreach (var e in events) {
+            tree.HandleEvent(e);
+        }
+        return tree;
+    }
+
+    /// Events of a build with a root process, `WorkerCount` workers under it, and compilers started by the workers,
+    /// `processCount` processes in total. Like with the real server, processes that inherit the environment unchanged
+    /// share the instance with their parent; every 8th compiler has a modified environment.
+    private static List<LogServer.ProcessEvent> GenerateEvents(int processCount) {
+        var events = new List<LogServer.ProcessEvent>(processCount * 3);
+        var time = new DateTime(2025, 1, 1, 0, 0, 0, DateTimeKind.Utc);
+        var env = new Dictionary<string, string>(StringComparer.InvariantCultureIgnoreCase);
+        for (var i = 0; i < 60; i++) {
+            env[$"VARIABLE_{i}"] = $@"C:\Program Files\Tool {i}\bin;C:\Windows\System32";
+        }
+
+        void Start(int pid, int parentId, string exePath, string commandLine, Dictionary<string, string> processEnv) {
+            time = time.AddTicks(1000);
+            events.Add(new LogServer.ProcessInfo(time, pid, parentId, exePath, commandLine, @"C:\src", processEnv));
+        }
+
+        void Finish(int pid) {
+            time = time.AddTicks(1000);
+            events.Add(new LogServer.ProcessExit(time, pid, 0));
+            events.Add(new LogServer.ProcessDetach(time, pid));
+        }
+
+        const int rootId = 1000;
+        Start(rootId, 1, @"C:\Program Files\MSBuild\msbuild.exe", "msbuild /m", env);
+        var workers = Math.Min(WorkerCount, processCount - 1);
+        for (var w = 1; w <= workers; w++) {
+            Start(rootId + w, rootId, @"C:\Program Files\MSBuild\msbuild.exe", $"msbuild /nodemode:1 /node:{w}", env);
+        }
+
+        var running = new Queue<int>();
+        for (var i = 1 + workers; i < processCount; i++) {
+            var pid = rootId + i;
+            var processEnv = env;
+            if (i % 8 == 0) {
+                processEnv = new Dictionary<string, string>(env, env.Comparer) {["TMP"] = $@"C:\tmp\{i}"};
+            }
+            Start(pid, rootId + 1 + i % workers, @"C:\Program Files\MSVC\bin\cl.exe",
+                    $@"cl.exe /nologo /c /O2 /I C:\src\include C:\src\file{i}.cpp", processEnv);
+            running.Enqueue(pid);
+            if (running.Count > Parallelism) {
+                Finish(running.Dequeue());
+            }
+        }
+        while (running.Count > 0) {
+            Finish(running.Dequeue());
+        }
+        for (var w = workers; w >= 1; w--) {
+            Finish(rootId + w);
+        }
+        Finish(rootId);
+        return events;
+    }
+}
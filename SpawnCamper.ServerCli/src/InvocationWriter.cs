@@ -0,0 +1,139 @@
+using System.Buffers;
+using System.Text;
+using System.Text.Json;
+using SpawnCamper.Core;
+
+namespace SpawnCamper.ServerCli;
+
+/// How the environment of each invocation is printed.
+public enum EnvironmentOutput {
+    /// The full environment, in the `environment` field.
+    Full,
+    /// Only the variables that differ from the parent process, in the `environmentDiff` field (`null` for removed
+    /// variables); processes without a known parent still print the full environment.
+    Diff,
+    None,
+}
+
+/// Prints finished invocations as JSON objects, one per line (NDJSON). The writer and its buffer are reused for all
+/// invocations, and each line is written to the output with a single call.
+public sealed class InvocationWriter(Stream output, EnvironmentOutput environment) {
+    private static readonly byte[] NewLine = Encoding.UTF8.GetBytes(Environment.NewLine);
+
+    private readonly ArrayBufferWriter<byte> _buffer = new();
+    private readonly Utf8JsonWriter _json = new(Stream.Null);
+
+    public void Write(TracedProcess process) {
+        _buffer.ResetWrittenCount();
+        _json.Reset(_buffer);
+
+        _json.WriteStartObject();
+        _json.WriteNumber("processId", process.ProcessId);
+        WriteNullable("parentProcessId", process.Parent?.ProcessId);
+        _json.WriteString("exePath", process.ExePath);
+        _json.WriteString("commandLine", process.CommandLine);
+        _json.WriteString("workingDirectory", process.WorkingDirectory);
+        switch (environment) {
+            case EnvironmentOutput.Diff when process.EnvironmentDiff is {} diff:
+                _json.WriteStartObject("environmentDiff");
+                foreach (var (name, (_, value)) in diff) {
+                    _json.WriteString(name, value);
+                }
+                _json.WriteEndObject();
+                break;
+            case EnvironmentOutput.Full or EnvironmentOutput.Diff:
+                _json.WriteStartObject("environment");
+                foreach (var (name, value) in process.Environment) {
+                    _json.WriteString(name, value);
+                }
+                _json.WriteEndObject();
+                break;
+        }
+        _json.WriteString("startTime", process.StartTime);
+        if (process.EndTime is {} endTime) {
+            _json.WriteString("endTime", endTime);
+        } else {
+            _json.WriteNull("endTime");
+        }
+        WriteNullable("exitCode", process.ExitCode);
+        _json.WriteBoolean("terminated", process.Terminated);
+        _json.WriteBoolean("filtered", process.Filtered);
+        _json.WriteBoolean("environmentIncomplete", process.EnvironmentIncomplete);
+        if (process.Resources is {} r) {
+            _json.WriteStartObject("resources");
+            _json.WriteNumber("userTimeSeconds", r.UserTime.TotalSeconds);
+            _json.WriteNumber("kernelTimeSeconds", r.KernelTime.TotalSeconds);
+            _json.WriteNumber("peakWorkingSet", r.PeakWorkingSet);
+            _json.WriteNumber("peakCommit", r.PeakCommit);
+            _json.WriteNumber("readBytes", r.ReadBytes);
+            _json.WriteNumber("writeBytes", r.WriteBytes);
+            _json.WriteNumber("readOperations", r.ReadOperations);
+            _json.WriteNumber("writeOperations", r.WriteOperations);
+            _json.WriteNumber("handleCount", r.HandleCount);
+            _json.WriteNumber("threadCount", r.ThreadCount);
+            _json.WriteEndObject();
+        } else {
+            _json.WriteNull("resources");
+        }
+        if (process.DroppedMessages is {} dropped) {
+            _json.WriteNumber("droppedMessages", dropped);
+        } else {
+            _json.WriteNull("droppedMessages");
+        }
+        if (process.HookTimings is {} h) {
+            _json.WriteStartObject("hook");
+            _json.WriteNumber("overheadSeconds", h.Overhead.TotalSeconds);
+            _json.WriteNumber("attachSeconds", h.Attach.TotalSeconds);
+            _json.WriteNumber("connectSeconds", h.Connect.TotalSeconds);
+            _json.WriteNumber("busyWaits", h.BusyWaits);
+            _json.WriteNumber("logAttachSeconds", h.LogAttach.TotalSeconds);
+            _json.WriteNumber("writeSeconds", h.WriteTime.TotalSeconds);
+            _json.WriteNumber("writes", h.Writes);
+            if (h.SpawnLatency is {} latency) {
+                _json.WriteNumber("spawnLatencySeconds", latency.TotalSeconds);
+            } else {
+                _json.WriteNull("spawnLatencySeconds");
+            }
+            _json.WriteStartArray("spawns");
+            foreach (var spawn in process.Spawns) {
+                _json.WriteStartObject();
+                _json.WriteNumber("processId", spawn.ProcessId);
+                _json.WriteNumber("createProcessSeconds", spawn.CreateProcess.TotalSeconds);
+                _json.WriteNumber("detourSeconds", spawn.Detour.TotalSeconds);
+                _json.WriteEndObject();
+            }
+            _json.WriteEndArray();
+            _json.WriteEndObject();
+        } else {
+            _json.WriteNull("hook");
+        }
+        if (process.Files.Count > 0) {
+            _json.WriteStartArray("files");
+            foreach (var f in process.Files.Values) {
+                _json.WriteStartObject();
+                _json.WriteString("path", f.Path);
+                _json.WriteString("access", f.Kind.ToString());
+                _json.WriteNumber("opens", f.Opens);
+                _json.WriteNumber("failedOpens", f.FailedOpens);
+                _json.WriteEndObject();
+            }
+            _json.WriteEndArray();
+        } else {
+            _json.WriteNull("files");
+        }
+        _json.WriteEndObject();
+        _json.Flush();
+
+        _buffer.Write(NewLine);
+        output.Write(_buffer.WrittenSpan);
+        output.Flush();
+    }
+
+    private void WriteNullable(string name, int? value) {
+        if (value is {} v) {
+            _json.WriteNumber(name, v);
+        } else {
+            _json.WriteNull(name);
+        }
+    }
+}
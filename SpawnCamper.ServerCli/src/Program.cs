@@ -1,20 +1,88 @@
+using System.Globalization;
 using SpawnCamper.Core;
-using System.Text.Json;
 
 namespace SpawnCamper.ServerCli;
 
 public static class Program {
-    private static readonly JsonSerializerOptions JsonOptions = new() {
-        WriteIndented = false,
-    };
-
     public static async Task<int> Main(string[] args) {
-        var pipeName = args.Length > 0 ? args[0] : "SpawnCamper";
+        var environment = EnvironmentOutput.Full;
+        var evictFinished = false;
+        StatisticsOutput? statistics = null;
+        var listenerCount = LogServer.DefaultListenerCount;
+        var rerun = new RerunBenchmark.Options();
+        int? rerunSubtree = null;
+        var positional = new List<string>();
+        foreach (var arg in args) {
+            if (arg.StartsWith("--stats-interval=")
+                && double.TryParse(arg["--stats-interval=".Length..], CultureInfo.InvariantCulture, out var seconds)
+                && seconds > 0) {
+                statistics = (statistics ?? new StatisticsOutput(false, null)) with {
+                    Interval = TimeSpan.FromSeconds(seconds),
+                };
+                continue;
+            }
+            if (arg.StartsWith("--listeners=") && int.TryParse(arg["--listeners=".Length..], out var listeners)
+                && listeners > 0) {
+                listenerCount = listeners;
+                continue;
+            }
+            if (arg.StartsWith("--exe=")) {
+                rerun = rerun with {ExeGlobs = [..rerun.ExeGlobs ?? [], arg["--exe=".Length..]]};
+                continue;
+            }
+            if (arg.StartsWith("--repeat=") && int.TryParse(arg["--repeat=".Length..], out var repeat) && repeat > 0) {
+                rerun = rerun with {Repeat = repeat};
+                continue;
+            }
+            if (arg.StartsWith("--parallel=") && int.TryParse(arg["--parallel=".Length..], out var parallel)
+                && parallel > 0) {
+                rerun = rerun with {Parallelism = parallel};
+                continue;
+            }
+            if (arg.StartsWith("--subtree=") && int.TryParse(arg["--subtree=".Length..], out var subtree)) {
+                rerunSubtree = subtree;
+                continue;
+            }
+            switch (arg) {
+                case "--stream":
+                    evictFinished = true;
+                    break;
+                case "--env=full":
+                    environment = EnvironmentOutput.Full;
+                    break;
+                case "--env=diff":
+                    environment = EnvironmentOutput.Diff;
+                    break;
+                case "--env=none":
+                    environment = EnvironmentOutput.None;
+                    break;
+                case "--stats":
+                    statistics = (statistics ?? new StatisticsOutput(false, null)) with {ByCommandLine = false};
+                    break;
+                case "--stats=cmdline":
+                    statistics = (statistics ?? new StatisticsOutput(false, null)) with {ByCommandLine = true};
+                    break;
+                default:
+                    positional.Add(arg);
+                    break;
+            }
+        }
+        var output = new Output(new InvocationWriter(Console.OpenStandardOutput(), environment), evictFinished,
+                statistics);
+
+        if (positional is ["--replay", var tracePath]) {
+            return await ReplayAsync(tracePath, output);
+        }
+        if (positional is ["--rerun", var rerunTracePath]) {
+            return await RerunAsync(rerunTracePath, rerunSubtree, rerun);
+        }
+
+        var pipeName = positional.Count > 0 ? positional[0] : "SpawnCamper";
 
         await Console.Error.WriteLineAsync($"Starting SpawnCamper CLI server (pipe: {pipeName})...");
 
-        var logServer = new LogServer(pipeName);
-        var processTree = new TracedProcessTree();
+        var logServer = new LogServer(pipeName, listenerCount: listenerCount);
+        var processTree = CreateTree(output);
         var cts = new CancellationTokenSource();
 
         // Handle Ctrl+C gracefully
@@ -24,15 +92,24 @@ public static class Program {
         };
 
         var treeMutex = new object();
+        if (output.Statistics?.Interval is {} interval) {
+            _ = OutputStatisticsPeriodicallyAsync(processTree, treeMutex, output.Statistics, interval, cts.Token);
+        }
         try {
             await logServer.RunAsync(evt => {
                 // only a single task should work with the processTree in parallel
                 lock (treeMutex) {
-                    HandleEvent(evt, processTree);
+                    processTree.HandleEvent(evt);
                 }
             }, cts.Token);
         } catch (OperationCanceledException) {
             await Console.Error.WriteLineAsync("Server shutting down...");
+            lock (treeMutex) {
+                OutputMostReopenedFiles(processTree);
+                OutputHookStatistics(processTree);
+                OutputStatistics(processTree, output.Statistics);
+            }
+            OutputListenerMetrics(logServer.Listeners, listenerCount);
             return 0;
         } catch (Exception ex) {
             await Console.Error.WriteLineAsync($"Error: {ex.Message}");
@@ -42,19 +119,132 @@ public static class Program {
         return 0;
     }
 
-    private static void HandleEvent(LogServer.ProcessEvent e, TracedProcessTree processTree) {
-        processTree.HandleEvent(e);
+    /// Outputs the invocations from a trace file recorded with `SpawnCamper.Tracer --record`.
+    private static async Task<int> ReplayAsync(string tracePath, Output output) {
+        var processTree = CreateTree(output);
+        try {
+            using var reader = new TraceFileReader(tracePath);
+            if (reader.DroppedMessages > 0) {
+                await Console.Error.WriteLineAsync(
+                        $"Warning: the trace file is incomplete, {reader.DroppedMessages} messages did not fit.");
+            }
+            await reader.ReplayAsync(processTree.HandleEvent, CancellationToken.None);
+            OutputMostReopenedFiles(processTree);
+            OutputHookStatistics(processTree);
+            OutputStatistics(processTree, output.Statistics);
+        } catch (Exception ex) when (ex is IOException or InvalidDataException) {
+            await Console.Error.WriteLineAsync($"Error: {ex.Message}");
+            return 1;
+        }
+        return 0;
+    }
 
-        // Output finished invocations
-        switch (e) {
-            case LogServer.ProcessDetach detach:
-                // Process has detached - output if we have info about it
-                var process = processTree.GetProcess(detach.ProcessId);
-                if (process != null) {
-                    OutputFinishedInvocation(process);
-                }
-                break;
+    /// Re-executes the invocations of a trace file (or of the subtree of the first process with the PID `subtree`)
+    /// and prints their wall time distributions and changed exit codes.
+    private static async Task<int> RerunAsync(string tracePath, int? subtree, RerunBenchmark.Options options) {
+        var processTree = new TracedProcessTree();
+        try {
+            using var reader = new TraceFileReader(tracePath);
+            await reader.ReplayAsync(processTree.HandleEvent, CancellationToken.None);
+        } catch (Exception ex) when (ex is IOException or InvalidDataException) {
+            await Console.Error.WriteLineAsync($"Error: {ex.Message}");
+            return 1;
         }
+
+        IReadOnlyList<TracedProcessTree.Node> roots = processTree.RootProcesses;
+        if (subtree != null) {
+            var root = FindFirstNode(processTree.RootProcesses, subtree.Value);
+            if (root == null) {
+                await Console.Error.WriteLineAsync($"Error: the trace contains no process with PID {subtree}.");
+                return 1;
+            }
+            roots = [root.Value];
+        }
+
+        var cts = new CancellationTokenSource();
+        Console.CancelKeyPress += (_, e) => {
+            e.Cancel = true;
+            cts.Cancel();
+        };
+        RerunBenchmark.Result result;
+        try {
+            result = await new RerunBenchmark(options).RunAsync(roots, cts.Token);
+        } catch (OperationCanceledException) {
+            await Console.Error.WriteLineAsync("Cancelled.");
+            return 1;
+        }
+        OutputRerunResult(result, options);
+        return result.Invocations.Any(i => i.ExitCodeMismatches > 0 || i.FailedStarts > 0) ? 2 : 0;
+    }
+
+    private static TracedProcessTree.Node? FindFirstNode(IEnumerable<TracedProcessTree.Node> nodes, int processId) {
+        // the PID of the earliest process, if it was reused
+        return nodes.SelectMany(Descendants).Where(n => n.Process.ProcessId == processId)
+                .OrderBy(n => n.Process.StartTime).Cast<TracedProcessTree.Node?>().FirstOrDefault();
+
+        static IEnumerable<TracedProcessTree.Node> Descendants(TracedProcessTree.Node node) {
+            return node.Children.SelectMany(Descendants).Prepend(node);
+        }
+    }
+
+    private static void OutputRerunResult(RerunBenchmark.Result result, RerunBenchmark.Options options) {
+        string Seconds(TimeSpan? time, int width) {
+            return (time?.TotalSeconds.ToString("F3", CultureInfo.InvariantCulture) ?? "-").PadLeft(width);
+        }
+
+        var wall = result.WallTimes;
+        Console.WriteLine($"Executed {result.Invocations.Count} invocations {options.Repeat} times with parallelism "
+                          + $"{options.Parallelism}, {result.Skipped} skipped (recorded without a command line "
+                          + "or environment).");
+        Console.WriteLine($"Wall time [s]: recorded {Seconds(result.RecordedWallTime, 0)}, min {Seconds(wall.Min, 0)}, "
+                          + $"p50 {Seconds(wall.Percentile(50), 0)}, mean {Seconds(wall.Mean, 0)}, "
+                          + $"max {Seconds(wall.Max, 0)}");
+
+        Console.WriteLine("Invocations with the largest mean time:");
+        Console.WriteLine($"{"runs",6} {"exit!=",6} {"failed",6} {"recorded [s]",12} {"min [s]",9} {"p50 [s]",9} "
+                          + $"{"mean [s]",9} {"max [s]",9}  command line");
+        foreach (var i in result.Invocations.OrderByDescending(i => i.Durations.Mean).Take(20)) {
+            // the minimum of an empty histogram is `TimeSpan.MaxValue`
+            TimeSpan? min = i.Durations.Count > 0 ? i.Durations.Min : null;
+            Console.WriteLine($"{i.Durations.Count,6} {i.ExitCodeMismatches,6} {i.FailedStarts,6} "
+                              + $"{Seconds(i.RecordedDuration, 12)} {Seconds(min, 9)} "
+                              + $"{Seconds(i.Durations.Percentile(50), 9)} {Seconds(i.Durations.Mean, 9)} "
+                              + $"{Seconds(i.Durations.Max, 9)}  {i.Process.CommandLine}");
+        }
+
+        var mismatched = result.Invocations.Where(i => i.ExitCodeMismatches > 0 || i.FailedStarts > 0).ToList();
+        if (mismatched.Count > 0) {
+            Console.WriteLine($"Invocations with a different exit code than recorded ({mismatched.Count}):");
+            foreach (var i in mismatched) {
+                var outcome = i.FailedStarts > 0
+                        ? $"failed to start {i.FailedStarts} times: {i.LastError}"
+                        : $"exit code {i.LastMismatchedExitCode} in {i.ExitCodeMismatches} of {i.Durations.Count} runs";
+                Console.WriteLine($"  [{i.Process.ProcessId}] recorded {i.Process.ExitCode}, {outcome}: "
+                                  + i.Process.CommandLine);
+            }
+        }
+    }
+
+    /// Where finished invocations are printed; with `EvictFinished` (`--stream`), they are also removed from the tree
+    /// once their descendants finished, so that a session traced for days does not keep all processes in memory.
+    private sealed record Output(InvocationWriter Writer, bool EvictFinished, StatisticsOutput? Statistics);
+
+    /// `--stats`: per-executable statistics printed when the session ends, and also every `Interval` while it runs.
+    private sealed record StatisticsOutput(bool ByCommandLine, TimeSpan? Interval);
+
+    private static TracedProcessTree CreateTree(Output output) {
+        var processTree = new TracedProcessTree {
+            Statistics = new ExecutableStatistics(output.Statistics?.ByCommandLine ?? false),
+        };
+        // output finished invocations; a process usually finishes when it detaches, a killed one may finish later,
+        //  when its parent reports its exit code, and a Linux program image when `execve` replaces it
+        processTree.ProcessFinished += process => {
+            output.Writer.Write(process);
+            if (output.EvictFinished) {
+                processTree.EvictFinished(process.ProcessId);
+            }
+        };
+        return processTree;
     }
 
     private static void LogEvent(LogServer.ProcessEvent e) {
@@ -72,23 +262,141 @@ public static class Program {
             case LogServer.ProcessExit:
                 Log("exit");
                 break;
+            case LogServer.ProcessMessagesDropped d:
+                Log($"dropped {d.Count} messages");
+                break;
+            case LogServer.ProcessFileAccesses f:
+                Log($"{f.Files.Length} files");
+                break;
+            case LogServer.ProcessHookTimings h:
+                Log($"hook overhead {h.Timings.Overhead.TotalMilliseconds:F3} ms, {h.Spawns.Length} spawns");
+                break;
+            case LogServer.ProcessExitObserved o:
+                Log($"exit observed by the parent, exit code {o.ExitCode}");
+                break;
             case LogServer.ProcessInfo:
                 Log("info");
                 break;
         }
     }
 
-    private static void OutputFinishedInvocation(TracedProcess process) {
-        Console.Out.WriteLine(JsonSerializer.Serialize(new {
-            processId = process.ProcessId,
-            parentProcessId = process.Parent?.ProcessId,
-            exePath = process.ExePath,
-            commandLine = process.CommandLine,
-            workingDirectory = process.WorkingDirectory,
-            environment = process.Environment,
-            startTime = process.StartTime,
-            endTime = process.EndTime,
-            exitCode = process.ExitCode,
-        }, JsonOptions));
+    private static async Task OutputStatisticsPeriodicallyAsync(TracedProcessTree processTree, object treeMutex,
+            StatisticsOutput statistics, TimeSpan interval, CancellationToken token) {
+        using var timer = new PeriodicTimer(interval);
+        try {
+            while (await timer.WaitForNextTickAsync(token)) {
+                lock (treeMutex) {
+                    OutputStatistics(processTree, statistics);
+                }
+            }
+        } catch (OperationCanceledException) {
+            // shutting down, the final statistics are printed by the caller
+        }
+    }
+
+    /// Prints the runs, failures and duration percentiles of each executable (and command line template), sorted by the
+    /// total time spent in them.
+    private static void OutputStatistics(TracedProcessTree processTree, StatisticsOutput? statistics) {
+        if (statistics == null) {
+            return;
+        }
+        var all = new DurationHistogram();
+        foreach (var group in processTree.Statistics.ByExecutable) {
+            all.Add(group.Durations);
+        }
+        var header = $"{"runs",8} {"running",8} {"failed",8} {"unknown",8} {"total [s]",10} {"mean [s]",9} "
+                     + $"{"p50 [s]",9} {"p90 [s]",9} {"p99 [s]",9} {"max [s]",9}  ";
+        Console.Error.WriteLine("Executables by total time:");
+        Console.Error.WriteLine(header + "executable");
+        foreach (var group in processTree.Statistics.ByExecutable.OrderByDescending(g => g.Durations.Total)) {
+            Console.Error.WriteLine(FormatStatistics(group, group.Durations) + group.ExePath);
+        }
+        var started = processTree.Statistics.ByExecutable.Sum(g => g.Started);
+        Console.Error.WriteLine(FormatStatistics(started, started - all.Count,
+                processTree.Statistics.ByExecutable.Sum(g => g.Failed),
+                processTree.Statistics.ByExecutable.Sum(g => g.Unknown), all) + "(all)");
+
+        if (statistics.ByCommandLine) {
+            Console.Error.WriteLine("Command lines with the largest total time:");
+            Console.Error.WriteLine(header + "command line template");
+            foreach (var group in processTree.Statistics.ByCommandLine.OrderByDescending(g => g.Durations.Total).Take(20)) {
+                // the hook may run on Windows or Linux
+                var exeName = group.ExePath[(group.ExePath.LastIndexOfAny(['\\', '/']) + 1)..];
+                Console.Error.WriteLine(FormatStatistics(group, group.Durations) + $"{exeName} {group.CommandLineTemplate}");
+            }
+        }
+    }
+
+    private static string FormatStatistics(ExecutableStatistics.Group group, DurationHistogram durations) {
+        return FormatStatistics(group.Started, group.Running, group.Failed, group.Unknown, durations);
+    }
+
+    private static string FormatStatistics(
+            long started, long running, long failed, long unknown, DurationHistogram durations) {
+        string Seconds(TimeSpan time, int width) {
+            return time.TotalSeconds.ToString("F3", CultureInfo.InvariantCulture).PadLeft(width);
+        }
+
+        return $"{started,8} {running,8} {failed,8} {unknown,8} {Seconds(durations.Total, 10)} "
+               + $"{Seconds(durations.Mean, 9)} {Seconds(durations.Percentile(50), 9)} "
+               + $"{Seconds(durations.Percentile(90), 9)} {Seconds(durations.Percentile(99), 9)} "
+               + $"{Seconds(durations.Max, 9)}  ";
+    }
+
+    /// Prints how often all pipe instances were busy, so that `--listeners` can be sized for the traced builds.
+    private static void OutputListenerMetrics(LogServer.ListenerMetrics listeners, int listenerCount) {
+        var refillTimes = listeners.RefillTimes;
+        Console.Error.WriteLine(string.Create(CultureInfo.InvariantCulture,
+                $"Pipe listeners: {listenerCount}, {listeners.Accepted} connections accepted, all listeners busy " +
+                $"{listeners.Exhausted} times for {listeners.ExhaustedTime.TotalMilliseconds:F1} ms in total, " +
+                $"refill p50 {refillTimes.Percentile(50).TotalMicroseconds:F0} us, " +
+                $"p99 {refillTimes.Percentile(99).TotalMicroseconds:F0} us"));
+    }
+
+    /// Prints the distributions of the time spent by the hook, if the hooks reported it.
+    private static void OutputHookStatistics(TracedProcessTree processTree) {
+        var stats = processTree.HookStatistics;
+        if (stats.Overhead.Count == 0 && stats.CreateProcess.Count == 0) {
+            return;
+        }
+        string Milliseconds(TimeSpan time) {
+            return time.TotalMilliseconds.ToString("F3", CultureInfo.InvariantCulture).PadLeft(10);
+        }
+
+        Console.Error.WriteLine($"Hook overhead ({stats.BusyWaits} busy waits for the server):");
+        Console.Error.WriteLine($"{"count",8} {"mean [ms]",10} {"p50 [ms]",10} {"p90 [ms]",10} {"p99 [ms]",10} "
+                                + $"{"max [ms]",10}  ");
+        foreach (var (name, histogram) in new[] {
+                     ("spawn latency (CreateProcess to hook loaded)", stats.SpawnLatency),
+                     ("CreateProcess call", stats.CreateProcess),
+                     ("CreateProcess detour overhead", stats.CreateProcessOverhead),
+                     ("total overhead per process", stats.Overhead),
+                     ("  loading the hook (DllMain)", stats.Attach),
+                     ("  connecting to the server", stats.Connect),
+                     ("  reporting the start", stats.LogAttach),
+                     ("  writing messages", stats.WriteTime),
+                 }) {
+            if (histogram.Count == 0) {
+                continue;
+            }
+            Console.Error.WriteLine($"{histogram.Count,8} {Milliseconds(histogram.Mean)} "
+                                    + $"{Milliseconds(histogram.Percentile(50))} "
+                                    + $"{Milliseconds(histogram.Percentile(90))} "
+                                    + $"{Milliseconds(histogram.Percentile(99))} "
+                                    + $"{Milliseconds(histogram.Max)}  {name}");
+        }
+    }
+
+    /// Prints the files opened the most times by all processes, if the hooks traced file accesses.
+    private static void OutputMostReopenedFiles(TracedProcessTree processTree) {
+        var files = processTree.MostReopenedFiles(20);
+        if (files.Count == 0) {
+            return;
+        }
+        Console.Error.WriteLine("Most reopened files:");
+        Console.Error.WriteLine($"{"opens",10} {"failed",10} {"processes",10}  path");
+        foreach (var f in files) {
+            Console.Error.WriteLine($"{f.Opens,10} {f.FailedOpens,10} {f.Processes,10}  {f.Path}");
+        }
     }
 }
\ No newline at end of file
@@ -0,0 +1,82 @@
+﻿using System.Diagnostics.CodeAnalysis;
+
+namespace SpawnCamper.Core;
+
+/// Environments received from traced processes, keyed by the hash of the raw environment block. Child processes
+/// typically only send a delta against the environment of their parent, which is resolved through this cache.
+/// Entries that are not used for a while are evicted; the environment of a long-running parent is used by each of its
+/// children, so it stays in the cache as long as it keeps spawning them.
+internal sealed class EnvironmentCache(int capacity = 4096) {
+    private readonly object _lock = new();
+    private readonly Dictionary<ulong, LinkedListNode<Entry>> _entries = [];
+    /// Most recently used entries first.
+    private readonly LinkedList<Entry> _recency = [];
+
+    private sealed record Entry(ulong Hash, TaskCompletionSource<Dictionary<string, string>> Environment);
+
+    /// 64-bit FNV-1a hash, must match `Environment::hash` in the hook.
+    public static ulong Hash(ReadOnlySpan<byte> data) {
+        var hash = 0xcbf29ce484222325;
+        foreach (var b in data) {
+            hash ^= b;
+            hash *= 0x100000001b3;
+        }
+        return hash;
+    }
+
+    public void Add(ulong hash, Dictionary<string, string> env) {
+        lock (_lock) {
+            GetEntry(hash).Environment.TrySetResult(env);
+        }
+    }
+
+    /// Returns the environment stored under `hash`, if it already arrived. Identical environments are only parsed once
+    /// and share a single instance, which must not be modified.
+    public bool TryGet(ulong hash, [NotNullWhen(true)] out Dictionary<string, string>? env) {
+        lock (_lock) {
+            if (_entries.TryGetValue(hash, out var node) && node.Value.Environment.Task.IsCompletedSuccessfully) {
+                Touch(node);
+                env = node.Value.Environment.Task.Result;
+                return true;
+            }
+        }
+        env = null;
+        return false;
+    }
+
+    /// Returns the environment stored under `hash`. Since the parent and the child report through separate
+    /// connections, the base environment may arrive slightly later than the delta, so wait for it up to `timeout`.
+    public async Task<Dictionary<string, string>?> GetAsync(ulong hash, TimeSpan timeout, CancellationToken token) {
+        Task<Dictionary<string, string>> task;
+        lock (_lock) {
+            task = GetEntry(hash).Environment.Task;
+        }
+
+        try {
+            return await task.WaitAsync(timeout, token);
+        } catch (TimeoutException) {
+            return null;
+        }
+    }
+
+    private Entry GetEntry(ulong hash) {
+        if (_entries.TryGetValue(hash, out var node)) {
+            Touch(node);
+            return node.Value;
+        }
+
+        var entry = new Entry(hash, new(TaskCreationOptions.RunContinuationsAsynchronously));
+        _entries.Add(hash, _recency.AddFirst(entry));
+        // evict the least recently used entries; in typical builds, there are only a few distinct environments
+        while (_recency.Count > capacity) {
+            _entries.Remove(_recency.Last!.Value.Hash);
+            _recency.RemoveLast();
+        }
+        return entry;
+    }
+
+    private void Touch(LinkedListNode<Entry> node) {
+        _recency.Remove(node);
+        _recency.AddFirst(node);
+    }
+}
@@ -0,0 +1,141 @@
+﻿using System.Text;
+
+namespace SpawnCamper.Core;
+
+/// Statistics of the traced processes grouped by executable, and optionally by command line template, updated
+/// incrementally as the processes start and finish, so that they can be queried at any time during a session. Each
+/// update is a dictionary lookup and a histogram increment, independent of the number of processes seen so far.
+public sealed class ExecutableStatistics(bool byCommandLine = false) {
+    private readonly Dictionary<string, Group> _byExecutable = new(StringComparer.OrdinalIgnoreCase);
+    private readonly Dictionary<(string, string), Group> _byCommandLine = [];
+
+    /// Runs of a single executable, or of a single command line template of the executable.
+    public sealed class Group(string exePath, string? commandLineTemplate) {
+        public string ExePath {get;} = exePath;
+        /// `null` for the groups of whole executables.
+        public string? CommandLineTemplate {get;} = commandLineTemplate;
+        public long Started {get; internal set;}
+        /// Processes that finished with a non-zero exit code.
+        public long Failed {get; internal set;}
+        /// Processes that finished without reporting an exit code, e.g., because they were killed.
+        public long Unknown {get; internal set;}
+        /// Durations of the finished processes.
+        public DurationHistogram Durations {get;} = new();
+
+        public long Finished => Durations.Count;
+        public long Running => Started - Finished;
+    }
+
+    public IReadOnlyCollection<Group> ByExecutable => _byExecutable.Values;
+
+    /// Empty unless grouping by command line was enabled.
+    public IReadOnlyCollection<Group> ByCommandLine => _byCommandLine.Values;
+
+    public void ProcessStarted(TracedProcess process) {
+        foreach (var group in GroupsOf(process)) {
+            group.Started++;
+        }
+    }
+
+    /// Must be called once for each started process, after its `EndTime` is set.
+    public void ProcessFinished(TracedProcess process) {
+        var duration = process.EndTime!.Value - process.StartTime;
+        foreach (var group in GroupsOf(process)) {
+            group.Durations.Add(duration);
+            if (process.ExitCode == null) {
+                group.Unknown++;
+            } else if (process.ExitCode != 0) {
+                group.Failed++;
+            }
+        }
+    }
+
+    private IEnumerable<Group> GroupsOf(TracedProcess process) {
+        if (!_byExecutable.TryGetValue(process.ExePath, out var exe)) {
+            _byExecutable[process.ExePath] = exe = new Group(process.ExePath, null);
+        }
+        yield return exe;
+
+        if (byCommandLine) {
+            var key = (process.ExePath, CommandLineTemplate(process.CommandLine));
+            if (!_byCommandLine.TryGetValue(key, out var cmd)) {
+                _byCommandLine[key] = cmd = new Group(key.ExePath, key.Item2);
+            }
+            yield return cmd;
+        }
+    }
+
+    /// Replaces the arguments of a command line that usually differ between the invocations of a tool (paths, file
+    /// names and numbers) with placeholders, keeping the options; e.g., all compiler invocations with the same flags
+    /// share a template. Digits in other arguments than options are replaced by `#`. The program name is left out,
+    /// the template is always grouped with the executable.
+    public static string CommandLineTemplate(string commandLine) {
+        var result = new StringBuilder();
+        var first = true;
+        foreach (var arg in SplitArguments(commandLine)) {
+            if (first) {
+                first = false;
+                continue;
+            }
+            if (result.Length > 0) {
+                result.Append(' ');
+            }
+            if (IsNumber(arg)) {
+                result.Append('#');
+            } else if (IsPath(arg)) {
+                result.Append("<path>");
+            } else if (arg.StartsWith('-') || arg.StartsWith('/')) {
+                result.Append(arg);
+            } else {
+                for (var i = 0; i < arg.Length; i++) {
+                    if (!char.IsAsciiDigit(arg[i])) {
+                        result.Append(arg[i]);
+                    } else if (i == 0 || !char.IsAsciiDigit(arg[i - 1])) {
+                        result.Append('#');
+                    }
+                }
+            }
+        }
+        return result.ToString();
+    }
+
+    /// Splits at whitespace outside of double quotes, the quotes are kept. This is not exactly how programs parse
+    /// their command lines, but it is enough to tell the arguments apart.
+    private static IEnumerable<string> SplitArguments(string commandLine) {
+        var start = -1;
+        var quoted = false;
+        for (var i = 0; i < commandLine.Length; i++) {
+            var c = commandLine[i];
+            if (c == '"') {
+                quoted = !quoted;
+            }
+            if (char.IsWhiteSpace(c) && !quoted) {
+                if (start >= 0) {
+                    yield return commandLine[start..i];
+                    start = -1;
+                }
+            } else if (start < 0) {
+                start = i;
+            }
+        }
+        if (start >= 0) {
+            yield return commandLine[start..];
+        }
+    }
+
+    private static bool IsNumber(string arg) => arg.Length > 0 && arg.All(char.IsAsciiDigit);
+
+    private static bool IsPath(string arg) {
+        var unquoted = arg.Trim('"');
+        // a separator after the first character, so that `/c`-style options are kept
+        if (unquoted.IndexOfAny(['\\', '/'], Math.Min(1, unquoted.Length)) >= 0) {
+            return true;
+        }
+        if (unquoted.StartsWith('-') || unquoted.StartsWith('/')) {
+            return false;
+        }
+        // a file name with an extension
+        var dot = unquoted.LastIndexOf('.');
+        return dot > 0 && dot < unquoted.Length - 1 && unquoted[(dot + 1)..].All(char.IsAsciiLetterOrDigit);
+    }
+}
@@ -0,0 +1,46 @@
+﻿namespace SpawnCamper.Core;
+
+/// Distributions of the time the hook spent in the traced processes (`LogServer.HookTimings`), to show how much
+/// tracing slows down a build. Each process is added when it finishes, with its final timings.
+public sealed class HookStatistics {
+    /// From the parent calling `CreateProcess` until the hook was loaded into the child.
+    public DurationHistogram SpawnLatency {get;} = new();
+    /// `CreateProcess` calls, including the injection of the hook.
+    public DurationHistogram CreateProcess {get;} = new();
+    /// Time the `CreateProcess` detours spent outside the call creating the process (e.g., copying the environment).
+    public DurationHistogram CreateProcessOverhead {get;} = new();
+    /// `DllMain` of the hook.
+    public DurationHistogram Attach {get;} = new();
+    public DurationHistogram Connect {get;} = new();
+    /// Reporting the process start, on a separate thread.
+    public DurationHistogram LogAttach {get;} = new();
+    /// Time each process spent writing messages, including waiting for the server.
+    public DurationHistogram WriteTime {get;} = new();
+    /// Total overhead of each process, see `LogServer.HookTimings.Overhead`.
+    public DurationHistogram Overhead {get;} = new();
+    /// Number of times a process found all pipe instances of the server busy.
+    public long BusyWaits {get; private set;}
+
+    internal void SpawnsReported(IEnumerable<LogServer.ChildSpawn> spawns) {
+        foreach (var spawn in spawns) {
+            CreateProcess.Add(spawn.CreateProcess);
+            CreateProcessOverhead.Add(spawn.Detour - spawn.CreateProcess);
+        }
+    }
+
+    /// Must be called once for each finished process.
+    internal void ProcessFinished(TracedProcess process) {
+        if (process.HookTimings is not {} timings) {
+            return;
+        }
+        if (timings.SpawnLatency is {} latency) {
+            SpawnLatency.Add(latency);
+        }
+        Attach.Add(timings.Attach);
+        Connect.Add(timings.Connect);
+        LogAttach.Add(timings.LogAttach);
+        WriteTime.Add(timings.WriteTime);
+        Overhead.Add(timings.Overhead);
+        BusyWaits += timings.BusyWaits;
+    }
+}
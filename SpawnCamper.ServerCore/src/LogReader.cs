@@ -1,22 +1,191 @@
-﻿using System.Runtime.InteropServices;
+﻿using System.Buffers;
+using System.Buffers.Binary;
+using System.Net.Sockets;
+using System.Runtime.InteropServices;
 using System.Text;
 
 namespace SpawnCamper.Core;
 
-internal sealed class LogReader(Stream stream) : IDisposable {
-    private byte[] _buffer = new byte[1024];
+/// Buffered reader of the data sent by a single hook. Data is read from the stream in large chunks into a pooled
+/// buffer, and the fields are then parsed from it synchronously; the `...Async` methods only wait when the buffer does
+/// not contain enough data. This way, a burst of messages costs a single read instead of one for each field.
+internal sealed class LogReader : IDisposable {
+    /// `Protocol::PREAMBLE_MAGIC` ("SCP2"), followed by the `uint` protocol version.
+    private const uint PreambleMagic = 0x32504353;
+    private const int PreambleSize = 8;
+    /// Initial buffer size, enough for a burst of typical messages; grows for large messages.
+    private const int InitialBufferSize = 16 * 1024;
+
+    private readonly Stream? _stream;
+    private byte[] _buffer;
+    /// False if `_buffer` is the data passed to the constructor, which must not be returned to the pool.
+    private bool _pooled;
+    /// Range of `_buffer` with data that was not consumed yet.
+    private int _start, _end;
+
+    public LogReader(Stream stream) {
+        _stream = stream;
+        _buffer = ArrayPool<byte>.Shared.Rent(InitialBufferSize);
+        _pooled = true;
+    }
+
+    /// Reads data that is already in memory (a shared ring or trace file record), without copying it.
+    public LogReader(ArraySegment<byte> data) {
+        _buffer = data.Array!;
+        _start = data.Offset;
+        _end = data.Offset + data.Count;
+    }
 
     public void Dispose() {
-        stream.Dispose();
+        _stream?.Dispose();
+        if (_pooled) {
+            ArrayPool<byte>.Shared.Return(_buffer);
+            _pooled = false;
+        }
     }
 
-    public async ValueTask<T> ReadAsync<T>(CancellationToken token) where T : unmanaged {
+    private int Buffered => _end - _start;
+
+    /// Reads the stream preamble and returns the protocol version of the stream, or `null` if the stream is empty.
+    /// Version 1 streams have no preamble, they start directly with the first message.
+    public async ValueTask<int?> ReadProtocolVersionAsync(CancellationToken token) {
+        if (!await TryFillAsync(PreambleSize, token)) {
+            return Buffered == 0 ? null : throw new EndOfStreamException();
+        }
+        var preamble = _buffer.AsSpan(_start, PreambleSize);
+        if (BinaryPrimitives.ReadUInt32LittleEndian(preamble) != PreambleMagic) {
+            // the first message, leave it in the buffer
+            return 1;
+        }
+        _start += PreambleSize;
+        return (int) BinaryPrimitives.ReadUInt32LittleEndian(preamble[4..]);
+    }
+
+    /// Ensures that at least `count` bytes are buffered.
+    private ValueTask EnsureAsync(int count, CancellationToken token) {
+        return Buffered >= count ? ValueTask.CompletedTask : FillAsync(count, token);
+    }
+
+    private async ValueTask FillAsync(int count, CancellationToken token) {
+        if (!await TryFillAsync(count, token)) {
+            throw new EndOfStreamException();
+        }
+    }
+
+    /// Reads from the stream until at least `count` bytes are buffered. Returns false if the stream ended first.
+    private async ValueTask<bool> TryFillAsync(int count, CancellationToken token) {
+        if (Buffered >= count) {
+            return true;
+        }
+        if (_stream == null) {
+            return false;
+        }
+        if (_buffer.Length < count) {
+            // a message larger than the buffer, usually a large environment block
+            var buffer = ArrayPool<byte>.Shared.Rent(count);
+            _buffer.AsSpan(_start, Buffered).CopyTo(buffer);
+            ArrayPool<byte>.Shared.Return(_buffer);
+            (_buffer, _end, _start) = (buffer, Buffered, 0);
+        } else if (_start > 0) {
+            // only a partial message remains, move it to the start to make room for the rest
+            _buffer.AsSpan(_start, Buffered).CopyTo(_buffer);
+            (_end, _start) = (Buffered, 0);
+        }
+
+        while (Buffered < count) {
+            int read;
+            try {
+                read = await _stream.ReadAsync(_buffer.AsMemory(_end), token);
+            } catch (IOException e)
+                    when (e.InnerException is SocketException {SocketErrorCode: SocketError.ConnectionReset}) {
+                // on Linux, a client that exits without reading a reply (see `MessageParser`) resets the connection;
+                //  the error is only reported after everything the client sent was read
+                read = 0;
+            }
+            if (read == 0) {
+                return false;
+            }
+            _end += read;
+        }
+        return true;
+    }
+
+    /// Consumes `count` buffered bytes.
+    private ReadOnlySpan<byte> Consume(int count) {
+        var result = _buffer.AsSpan(_start, count);
+        _start += count;
+        return result;
+    }
+
+    public ValueTask<T> ReadAsync<T>(CancellationToken token) where T : unmanaged {
         int size;
         unsafe {
             size = sizeof(T);
         }
-        await stream.ReadExactlyAsync(_buffer, 0, size, token);
-        return MemoryMarshal.Read<T>(_buffer);
+        if (Buffered >= size) {
+            return new ValueTask<T>(MemoryMarshal.Read<T>(Consume(size)));
+        }
+        return ReadSlowAsync<T>(size, token);
+    }
+
+    private async ValueTask<T> ReadSlowAsync<T>(int size, CancellationToken token) where T : unmanaged {
+        await FillAsync(size, token);
+        return MemoryMarshal.Read<T>(Consume(size));
+    }
+
+    /// Reads a LEB128-encoded unsigned integer.
+    public ValueTask<ulong> ReadVarintAsync(CancellationToken token) {
+        // the varint is usually buffered in full, only wait for more data if its last byte is missing
+        var end = _buffer.AsSpan(_start, Buffered).IndexOfAnyInRange((byte) 0, (byte) 0x7f);
+        if (end >= 0) {
+            return new ValueTask<ulong>(DecodeVarint(Consume(end + 1)));
+        }
+        return ReadVarintSlowAsync(token);
+    }
+
+    private async ValueTask<ulong> ReadVarintSlowAsync(CancellationToken token) {
+        var size = Buffered;
+        while (true) {
+            if (size >= MaxVarintSize) {
+                throw new InvalidDataException("Malformed message from the traced process, varint is too long.");
+            }
+            await FillAsync(++size, token);
+            if (_buffer[_start + size - 1] < 0x80) {
+                return DecodeVarint(Consume(size));
+            }
+        }
+    }
+
+    private const int MaxVarintSize = 10;
+
+    private static ulong DecodeVarint(ReadOnlySpan<byte> bytes) {
+        if (bytes.Length > MaxVarintSize) {
+            throw new InvalidDataException("Malformed message from the traced process, varint is too long.");
+        }
+        var value = 0ul;
+        for (var i = 0; i < bytes.Length; i++) {
+            value |= (ulong) (bytes[i] & 0x7f) << (7 * i);
+        }
+        return value;
+    }
+
+    /// Reads `length` bytes, the returned memory is only valid until the next read.
+    public ValueTask<ReadOnlyMemory<byte>> ReadBlockAsync(int length, CancellationToken token) {
+        if (Buffered >= length) {
+            return new ValueTask<ReadOnlyMemory<byte>>(ConsumeMemory(length));
+        }
+        return ReadBlockSlowAsync(length, token);
+    }
+
+    private async ValueTask<ReadOnlyMemory<byte>> ReadBlockSlowAsync(int length, CancellationToken token) {
+        await FillAsync(length, token);
+        return ConsumeMemory(length);
+    }
+
+    private ReadOnlyMemory<byte> ConsumeMemory(int count) {
+        var result = _buffer.AsMemory(_start, count);
+        _start += count;
+        return result;
     }
 
     public async ValueTask VerifyTerminatorAsync(CancellationToken token) {
@@ -26,46 +195,83 @@ internal sealed class LogReader(Stream stream) : IDisposable {
         }
     }
 
-    public async ValueTask<string?> ReadStringAsync(Encoding encoding, CancellationToken token) {
+    /// Reads a length-prefixed buffer, or returns `null` if the buffer is null. The returned memory is only valid
+    /// until the next read.
+    private async ValueTask<ReadOnlyMemory<byte>?> ReadBufferAsync(CancellationToken token) {
         var len = await ReadAsync<ulong>(token);
         if (len == unchecked((ulong) -1)) {
             return null;
         }
+        return await ReadBlockAsync(checked((int) len), token);
+    }
+
+    public async ValueTask<string?> ReadStringAsync(Encoding encoding, CancellationToken token) {
+        var buffer = await ReadBufferAsync(token);
+        return buffer == null ? null : encoding.GetString(buffer.Value.Span);
+    }
 
-        if ((int) len > _buffer.LongLength) {
-            _buffer = new byte[len];
+    /// Same as `ReadStringAsync`, for strings that repeat across processes (paths), which are taken from
+    /// `StringPool.Shared`.
+    public async ValueTask<string?> ReadPooledStringAsync(Encoding encoding, CancellationToken token) {
+        var buffer = await ReadBufferAsync(token);
+        return buffer == null ? null : StringPool.Shared.Intern(buffer.Value.Span, encoding);
+    }
+
+    /// Reads an environment block, together with its hash that child processes use to reference it. If `cache`
+    /// already contains an identical environment, it is returned instead of parsing the block again.
+    public async ValueTask<(Dictionary<string, string> Env, ulong Hash)> ReadEnvironmentBlockAsync(
+            Encoding encoding, EnvironmentCache? cache, CancellationToken token) {
+        var buffer = await ReadBufferAsync(token);
+        if (buffer == null) {
+            throw new InvalidDataException("Malformed message from the traced process, missing environment block.");
         }
+        var hash = EnvironmentCache.Hash(buffer.Value.Span);
+        if (cache != null && cache.TryGet(hash, out var env)) {
+            return (env, hash);
+        }
+        return (ParseEnvironmentBlock(buffer.Value.Span, encoding), hash);
+    }
 
-        await stream.ReadExactlyAsync(_buffer, 0, (int) len, token);
-        return encoding.GetString(_buffer, 0, (int) len);
+    /// Reads a null-terminated list of names (used for removed variables in an environment delta).
+    public async ValueTask<string[]> ReadNameListAsync(Encoding encoding, CancellationToken token) {
+        var str = (await ReadStringAsync(encoding, token))!;
+        return str.Split((char) 0, StringSplitOptions.RemoveEmptyEntries);
     }
 
-    public async ValueTask<Dictionary<string, string>> ReadEnvironmentBlockAsync(
-            Encoding encoding, CancellationToken token) {
+    /// Decodes an environment block into a pooled buffer instead of a string, since only the variables are kept.
+    internal static Dictionary<string, string> ParseEnvironmentBlock(ReadOnlySpan<byte> bytes, Encoding encoding) {
+        var chars = ArrayPool<char>.Shared.Rent(encoding.GetMaxCharCount(bytes.Length));
+        try {
+            return ParseEnvironmentBlock(chars.AsSpan(0, encoding.GetChars(bytes, chars)));
+        } finally {
+            ArrayPool<char>.Shared.Return(chars);
+        }
+    }
+
+    internal static Dictionary<string, string> ParseEnvironmentBlock(ReadOnlySpan<char> str) {
         // this is a horrible hack, but doing this properly is even more horrible (I tried for ~2 hours and mostly failed)
         // we decode the whole buffer, including the null terminators, and hope that the encoding leaves them alone
-        var str = await ReadStringAsync(encoding, token);
-
         var result = new Dictionary<string, string>(StringComparer.InvariantCultureIgnoreCase);
-        var rest = str.AsSpan();
+        var rest = str;
         while (!rest.IsEmpty) {
             var eqI = rest.IndexOf('=');
-            var key = rest[..eqI].ToString();
+            var key = rest[..eqI];
             rest = rest[(eqI + 1)..];
 
             var endI = rest.IndexOf((char) 0);
             if (endI == -1) {
                 throw new FormatException("Invalid environment block, last value does not have a null terminator.");
             }
-            var value = rest[..endI].ToString();
+            var value = rest[..endI];
             rest = rest[(endI + 1)..];
 
-            if (key == "") {
+            if (key.IsEmpty) {
                 // special env vars like `=::=::\` and `=D:=...`, used by cmd.exe to track per-drive working directories
                 // ignore them, the format is weird and, e.g., .NET also ignores them
                 continue;
             }
-            result.Add(key, value);
+            // the same variables repeat in the environments of most processes
+            result.Add(StringPool.Shared.Intern(key), StringPool.Shared.Intern(value));
         }
         return result;
     }
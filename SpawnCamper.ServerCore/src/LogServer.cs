@@ -1,20 +1,108 @@
-﻿using System.IO.Pipes;
-using System.Runtime.CompilerServices;
-using System.Text;
+﻿using System.Diagnostics;
+using System.IO.Pipes;
 using SpawnCamper.Core.Utils;
 
 namespace SpawnCamper.Core;
 
-public class LogServer(string pipeName) {
+/// Receives messages from hooked processes, either through per-process connections to a named pipe, or through
+/// a shared ring buffer (Windows-only, pass `ringCapacity: 0` to disable it).
+///
+/// `listenerCount` pipe instances wait for connections at the same time, so that a burst of processes started
+/// together (e.g., by a parallel build) does not find all instances busy; a client that does spins in
+/// `WaitNamedPipeW` until the server opens the next instance. See `Listeners` for metrics to size the pool.
+public class LogServer(
+        string pipeName,
+        long ringCapacity = LogServer.DefaultRingCapacity,
+        int listenerCount = LogServer.DefaultListenerCount) {
+    public const long DefaultRingCapacity = 64 * 1024 * 1024;
+    public const int DefaultListenerCount = 16;
+
     public abstract record ProcessEvent(DateTime Timestamp, int ProcessId);
 
     public record ProcessAttach(DateTime Timestamp, int ProcessId) : ProcessEvent(Timestamp, ProcessId);
 
     public record ProcessDetach(DateTime Timestamp, int ProcessId) : ProcessEvent(Timestamp, ProcessId);
 
-    public record ProcessExit(DateTime Timestamp, int ProcessId, int ExitCode) : ProcessEvent(Timestamp, ProcessId);
+    public record ProcessExit(DateTime Timestamp, int ProcessId, int ExitCode, ResourceUsage? Resources = null)
+            : ProcessEvent(Timestamp, ProcessId);
+
+    /// Resources used by a process over its lifetime, sent with the exit code by hooks using protocol version 2.
+    /// Handle and thread counts are taken at exit.
+    public record ResourceUsage(
+            TimeSpan UserTime,
+            TimeSpan KernelTime,
+            ulong PeakWorkingSet,
+            ulong PeakCommit,
+            ulong ReadBytes,
+            ulong WriteBytes,
+            ulong ReadOperations,
+            ulong WriteOperations,
+            uint HandleCount,
+            uint ThreadCount);
+
+    /// How a process accessed a file, a combination of flags; must match `FileAccess` in the hook.
+    [Flags]
+    public enum FileAccessKind : uint {
+        None = 0,
+        /// Opened without access to the data (attributes, existence checks, directory handles).
+        Query = 1 << 0,
+        /// Opened for reading; for directories, listed.
+        Read = 1 << 1,
+        /// Opened for writing, or created or overwritten.
+        Write = 1 << 2,
+        Delete = 1 << 3,
+        RenamedFrom = 1 << 4,
+        RenamedTo = 1 << 5,
+    }
+
+    /// A file accessed by a process, with the number of times the process opened it. Failed opens are usually
+    /// lookups of missing files (e.g., include directory searches).
+    public record struct FileAccess(string Path, FileAccessKind Kind, uint Opens, uint FailedOpens);
+
+    /// Files accessed by a process traced with `--trace-files`. The hook reports them when the process exits, and also
+    /// earlier if it accessed many files, so a path may be repeated in several events of the same process.
+    public record ProcessFileAccesses(DateTime Timestamp, int ProcessId, FileAccess[] Files)
+            : ProcessEvent(Timestamp, ProcessId);
+
+    /// Time the hook spent in a process, cumulative over its lifetime, see `Protocol::Messages::HookTimings` in the
+    /// hook. `BusyWaits` counts how many times all pipe instances of the server were busy when the hook connected.
+    /// `SpawnLatency` is the time from the parent calling `CreateProcess` until the hook was loaded into the process,
+    /// `null` if unknown (e.g., on Linux).
+    public record HookTimings(
+            TimeSpan Attach,
+            TimeSpan Connect,
+            uint BusyWaits,
+            TimeSpan LogAttach,
+            TimeSpan WriteTime,
+            ulong Writes,
+            TimeSpan? SpawnLatency) {
+        /// Time the hook delayed the process by, not including the `CreateProcess` detours. Reporting the start
+        /// runs on a separate thread, so it only delays the process if it waits for it.
+        public TimeSpan Overhead => Attach + Connect + LogAttach + WriteTime;
+    }
+
+    /// A `CreateProcess` call of a traced process: the PID of the created child, the duration of the call creating it,
+    /// and of the whole detour, including copying the hook configuration and the environment into the child.
+    public record struct ChildSpawn(int ProcessId, TimeSpan CreateProcess, TimeSpan Detour);
+
+    /// Sent by processes using protocol version 2 once their start is reported, before they exit, and whenever they
+    /// started many children. `Timings` are cumulative and replace the previous ones, `Spawns` are the `CreateProcess`
+    /// calls since the previous event of the process.
+    public record ProcessHookTimings(DateTime Timestamp, int ProcessId, HookTimings Timings, ChildSpawn[] Spawns)
+            : ProcessEvent(Timestamp, ProcessId);
 
-    /// Log from a started-up process.
+    /// Exit of the process `ProcessId` observed by its parent (Windows hooks using protocol version 2), with the exit
+    /// time reported by the OS as `Timestamp`. Sent for all children, including those that were killed or crashed
+    /// and never sent `ProcessExit`; for the others, it duplicates their own exit and is ignored.
+    public record ProcessExitObserved(DateTime Timestamp, int ProcessId, int ExitCode)
+            : ProcessEvent(Timestamp, ProcessId);
+
+    /// Sent before exit by processes that discarded some messages because the server was not reading them fast enough.
+    public record ProcessMessagesDropped(DateTime Timestamp, int ProcessId, ulong Count)
+            : ProcessEvent(Timestamp, ProcessId);
+
+    /// Log from a started-up process. Processes with identical environments share a single `Environment` instance,
+    /// which must not be modified.
     public record ProcessInfo(
             DateTime Timestamp,
             int ProcessId,
@@ -22,51 +110,173 @@ public class LogServer(string pipeName) {
             string ExePath,
             string CommandLine,
             string WorkingDirectory,
-            Dictionary<string, string> Environment) : ProcessEvent(Timestamp, ProcessId);
+            Dictionary<string, string> Environment) : ProcessEvent(Timestamp, ProcessId) {
+        /// The process matched the filter rules of the hook, which did not send its command line, working directory
+        /// and environment.
+        public bool Filtered {get; init;}
 
-    private class Client(NamedPipeServerStream pipe, Action<ProcessEvent> eventCb) : IDisposable {
-        private readonly LogReader _reader = new(pipe);
-        private readonly int _clientId = Native.GetNamedPipeClientProcessId(pipe.SafePipeHandle);
+        /// The hook sent the environment as a delta against the environment of its parent, which the server does not
+        /// know, and did not send the full environment when asked; `Environment` only contains the changed variables.
+        public bool EnvironmentIncomplete {get; init;}
 
-        public void Dispose() {
-            _reader.Dispose();
+        /// The parent hook, or the tracer for the process it started, watches the process and reports its exit
+        /// (`ProcessExitObserved`), even if the process is killed before reporting it itself.
+        public bool ExitWatched {get; init;}
+    }
+
+    /// Metrics of the pipe instances waiting for connections, updated from all listeners.
+    public sealed class ListenerMetrics {
+        private readonly object _lock = new();
+        private readonly DurationHistogram _refillTimes = new();
+        private int _pending;
+        private long _accepted;
+        private long _exhausted;
+        private TimeSpan _exhaustedTime;
+        /// `Stopwatch` timestamp when the last pending instance was taken, 0 while some instance is pending.
+        private long _exhaustedSince;
+
+        /// Number of pipe instances currently waiting for a connection.
+        public int Pending {
+            get {
+                lock (_lock) {
+                    return _pending;
+                }
+            }
         }
 
-        private enum MessageType {
-            ExitProcess,
-            ProcessStart,
-        };
+        public long Accepted {
+            get {
+                lock (_lock) {
+                    return _accepted;
+                }
+            }
+        }
 
-        private async ValueTask ReadMessageAsync(CancellationToken token) {
-            var timestamp = DateTime.FromFileTimeUtc((long) await _reader.ReadAsync<ulong>(token));
-            var type = (MessageType) await _reader.ReadAsync<ushort>(token);
-            switch (type) {
-                case MessageType.ExitProcess: {
-                    var exitCode = await _reader.ReadAsync<int>(token);
-                    await _reader.VerifyTerminatorAsync(token);
-                    eventCb(new ProcessExit(timestamp, _clientId, exitCode));
-                    break;
+        /// How many times a connection took the last pending instance. Until a listener opens a new one, connecting
+        /// clients get `ERROR_PIPE_BUSY` and wait, so a non-zero value means that the pool is too small.
+        public long Exhausted {
+            get {
+                lock (_lock) {
+                    return _exhausted;
                 }
-                case MessageType.ProcessStart: {
-                    var parentId = await _reader.ReadAsync<int>(token);
-                    var exePath = (await _reader.ReadStringAsync(Encoding.Unicode, token))!;
-                    var cmdLine = (await _reader.ReadStringAsync(Encoding.Unicode, token))!;
-                    var workingDirectory = (await _reader.ReadStringAsync(Encoding.Unicode, token))!;
-                    var env = await _reader.ReadEnvironmentBlockAsync(Encoding.Unicode, token);
-                    await _reader.VerifyTerminatorAsync(token);
-                    eventCb(new ProcessInfo(timestamp, _clientId, parentId, exePath, cmdLine, workingDirectory, env));
-                    break;
+            }
+        }
+
+        /// Total time when no instance was pending, including the current period.
+        public TimeSpan ExhaustedTime {
+            get {
+                lock (_lock) {
+                    return _exhaustedSince == 0
+                            ? _exhaustedTime
+                            : _exhaustedTime + Stopwatch.GetElapsedTime(_exhaustedSince);
+                }
+            }
+        }
+
+        /// Time from accepting a connection until the listener that accepted it waits for the next one; the pool is
+        /// one instance short in the meantime.
+        public DurationHistogram RefillTimes {
+            get {
+                var copy = new DurationHistogram();
+                lock (_lock) {
+                    copy.Add(_refillTimes);
+                }
+                return copy;
+            }
+        }
+
+        /// `acceptedAt` is the timestamp of the connection accepted by the previous instance of the listener, 0 for
+        /// its first instance.
+        internal void ListenerWaiting(long acceptedAt) {
+            var now = Stopwatch.GetTimestamp();
+            lock (_lock) {
+                if (_pending++ == 0 && _exhaustedSince != 0) {
+                    _exhaustedTime += Stopwatch.GetElapsedTime(_exhaustedSince, now);
+                    _exhaustedSince = 0;
+                }
+                if (acceptedAt != 0) {
+                    _refillTimes.Add(Stopwatch.GetElapsedTime(acceptedAt, now));
                 }
-                default:
-                    throw new SwitchExpressionException($"Received an unknown message type from the client: {type}");
             }
         }
 
+        /// The instance accepted a connection at `timestamp`, the listener opens a new instance next.
+        internal void ConnectionAccepted(long timestamp) {
+            lock (_lock) {
+                _accepted++;
+                if (--_pending == 0) {
+                    _exhausted++;
+                    _exhaustedSince = timestamp;
+                }
+            }
+        }
+
+        /// The instance failed and the listener opens a new one, or stops when `replaced` is false (shutdown).
+        internal void ListenerFailed(bool replaced) {
+            lock (_lock) {
+                if (--_pending == 0 && replaced) {
+                    _exhaustedSince = Stopwatch.GetTimestamp();
+                }
+            }
+        }
+    }
+
+    public ListenerMetrics Listeners {get;} = new();
+
+    private readonly EnvironmentCache _envCache = new();
+
+    /// How long to wait for the parent environment referenced by an environment delta before asking the hook for its
+    /// full environment. The parent reports it through its own connection before starting the child, so it is
+    /// usually already known.
+    private static readonly TimeSpan PipeBaseEnvironmentTimeout = TimeSpan.FromSeconds(1);
+    /// Records in the ring are ordered, the parent environment is only late if the parent queues its messages
+    /// (`--async`). Short, since waiting blocks the only reader of the ring, and there is no connection to ask the
+    /// hook for its full environment.
+    private static readonly TimeSpan RingBaseEnvironmentTimeout = TimeSpan.FromMilliseconds(100);
+
+    /// Sent to each client after it connects, see `Protocol.hpp` in the hook.
+    private static readonly byte[] ProtocolVersionMessage =
+            BitConverter.GetBytes((uint) MessageParser.MaxProtocolVersion);
+
+    private class Client(NamedPipeServerStream pipe, EnvironmentCache envCache, Action<ProcessEvent> eventCb)
+            : IDisposable {
+        private readonly LogReader _reader = new(pipe);
+        private readonly int _clientId = Native.GetNamedPipeClientProcessId(pipe.SafePipeHandle);
+
+        public void Dispose() {
+            _reader.Dispose();
+        }
+
         public async Task RunAsync(CancellationToken token) {
+            int? protocolVersion;
+            try {
+                // offer our version, the client chooses the version it speaks through the stream preamble
+                try {
+                    await pipe.WriteAsync(ProtocolVersionMessage, token);
+                } catch (IOException) {
+                    // old clients open the pipe write-only and may have already disconnected, their messages
+                    //  are still buffered in the pipe
+                }
+                protocolVersion = await _reader.ReadProtocolVersionAsync(token);
+            } catch (EndOfStreamException) {
+                protocolVersion = null;
+            }
+            if (protocolVersion == null) {
+                // the tracer probing our protocol version, or a client that disconnected without sending anything
+                return;
+            }
+            if (protocolVersion > MessageParser.MaxProtocolVersion) {
+                throw new InvalidDataException($"Client uses an unsupported protocol version: {protocolVersion}");
+            }
+
+            var parser = new MessageParser(
+                    _reader, protocolVersion.Value, _clientId, envCache, eventCb, pipe, PipeBaseEnvironmentTimeout);
             eventCb(new ProcessAttach(DateTime.UtcNow, _clientId));
-            while (pipe.IsConnected) {
+            // read until the end of the stream, not while `pipe.IsConnected`, which turns false after a failed reply
+            //  to a client that already exited, while its last messages are still buffered in the pipe
+            while (true) {
                 try {
-                    await ReadMessageAsync(token);
+                    await parser.ReadMessageAsync(token);
                 } catch (EndOfStreamException) {
                     break;
                 }
@@ -77,25 +287,95 @@ public class LogServer(string pipeName) {
 
     public async Task RunAsync(Action<ProcessEvent> eventCb, CancellationToken token) {
         using var cts = CancellationTokenSource.CreateLinkedTokenSource(token);
+        using var ring = CreateRing();
+        if (ring != null) {
+            RunTask(RunRingAsync(ring, eventCb, cts.Token));
+        }
+
+        var listeners = Enumerable.Range(0, Math.Max(1, listenerCount))
+                .Select(_ => ListenAsync(eventCb, cts.Token)).ToList();
+        // the listeners only stop on an error or cancellation; stop the others and rethrow the first exception
+        var first = await Task.WhenAny(listeners);
+        await cts.CancelAsync();
+        try {
+            await Task.WhenAll(listeners);
+        } catch {
+            // rethrown from `first` below
+        }
+        await first;
+    }
+
+    /// Keeps one pipe instance waiting for a connection, and opens the next one right after a client connects.
+    private async Task ListenAsync(Action<ProcessEvent> eventCb, CancellationToken token) {
+        var acceptedAt = 0L;
         while (true) {
-            var pipeServer = new NamedPipeServerStream(pipeName, PipeDirection.In,
-                    NamedPipeServerStream.MaxAllowedServerInstances, PipeTransmissionMode.Byte, PipeOptions.Asynchronous);
+            // bidirectional to send the protocol version to the client; the explicit output buffer ensures that
+            //  writing the version does not block on clients that never read it
+            var pipeServer = new NamedPipeServerStream(pipeName, PipeDirection.InOut,
+                    NamedPipeServerStream.MaxAllowedServerInstances, PipeTransmissionMode.Byte, PipeOptions.Asynchronous,
+                    0, 64);
 
+            Listeners.ListenerWaiting(acceptedAt);
             try {
-                await pipeServer.WaitForConnectionAsync(cts.Token);
+                await pipeServer.WaitForConnectionAsync(token);
             } catch (IOException e) when (e.HResult == unchecked((int)0x800700E8)) {
                 // The pipe is being closed.
                 // this exception is sporadically thrown when a client attempts to connect while the server is initializing,
                 //  I'm not yet sure why this happens
+                Listeners.ListenerFailed(true);
+                acceptedAt = 0;
                 await pipeServer.DisposeAsync();
                 continue; // retry
             } catch {
+                Listeners.ListenerFailed(false);
                 await pipeServer.DisposeAsync();
                 throw;
             }
+            acceptedAt = Stopwatch.GetTimestamp();
+            Listeners.ConnectionAccepted(acceptedAt);
 
             // do not block the connection loop
-            RunTask(new Client(pipeServer, eventCb).RunAsync(cts.Token));
+            RunTask(new Client(pipeServer, _envCache, eventCb).RunAsync(token));
+        }
+    }
+
+    private SharedRingReader? CreateRing() {
+        if (ringCapacity == 0 || !OperatingSystem.IsWindows()) {
+            return null;
+        }
+        try {
+            return new SharedRingReader($@"Local\{pipeName}.Ring", $@"Local\{pipeName}.Ring.Event", ringCapacity);
+        } catch (IOException) {
+            // another server instance already owns the ring, hooks will write to that one
+            return null;
+        }
+    }
+
+    private async Task RunRingAsync(SharedRingReader ring, Action<ProcessEvent> eventCb, CancellationToken token) {
+        try {
+            // records are ordered, all records of a child precede the exit observed by its parent; detach
+            //  the children that did not send their exit record, like `TraceFileReader` does
+            var running = new HashSet<int>();
+            var ringCb = (ProcessEvent e) => {
+                eventCb(e);
+                if (e is ProcessExitObserved exit && running.Remove(exit.ProcessId)) {
+                    eventCb(new ProcessDetach(exit.Timestamp, exit.ProcessId));
+                }
+            };
+            await ring.RunAsync(async (processId, payload) => {
+                using var reader = new LogReader(payload);
+                var type = await new MessageParser(reader, ring.ProtocolVersion, processId, _envCache, ringCb,
+                        baseEnvironmentTimeout: RingBaseEnvironmentTimeout).ReadMessageAsync(token);
+                if (type == MessageType.ExitProcess) {
+                    // there is no connection that would be closed, the exit record is the last message
+                    running.Remove(processId);
+                    eventCb(new ProcessDetach(DateTime.UtcNow, processId));
+                } else {
+                    running.Add(processId);
+                }
+            }, token);
+        } catch (OperationCanceledException) {
+            // shutting down
         }
     }
 
@@ -0,0 +1,337 @@
+﻿using System.Runtime.CompilerServices;
+using System.Text;
+
+namespace SpawnCamper.Core;
+
+/// Message types sent by the hook, must match `Protocol::MessageType`.
+internal enum MessageType : ushort {
+    ExitProcess,
+    ProcessStart,
+    ProcessStartEnvDelta,
+    EnvironmentSnapshot,
+    DroppedMessages,
+    ProcessStartMinimal,
+    FileAccesses,
+    HookTimings,
+    ChildExit,
+}
+
+/// Flags of a process start, must match `Protocol::StartFlags`.
+[Flags]
+internal enum StartFlags : uint {
+    None = 0,
+    ExitWatched = 1,
+}
+
+/// Replies sent back to the hook for each environment delta, must match `Protocol::EnvironmentReply`.
+internal enum EnvironmentReply : byte {
+    Resolved,
+    SendFull,
+}
+
+/// Parses messages sent by a single traced process, independently of the transport they arrived through.
+/// The wire format is described in `Protocol.hpp` in the hook.
+///
+/// `replies` is the connection back to the hook, if the transport has one. When the base of an environment delta does
+/// not arrive within `baseEnvironmentTimeout`, the parser asks the hook for its full environment through it; without
+/// it, the process is reported with the part of the environment it sent, see `ProcessInfo.EnvironmentIncomplete`.
+internal sealed class MessageParser(
+        LogReader reader, int protocolVersion, int processId, EnvironmentCache envCache,
+        Action<LogServer.ProcessEvent> eventCb, Stream? replies = null, TimeSpan baseEnvironmentTimeout = default) {
+    /// Highest protocol version understood by the server, offered to the hooks when they connect.
+    public const int MaxProtocolVersion = 2;
+
+    /// Messages read while waiting for the full environment requested from the hook, reported after its start.
+    private readonly Queue<Message> _deferred = [];
+    /// The stream ended while waiting for the full environment, reported after the deferred messages.
+    private bool _ended;
+
+    // decoded messages, independent of the protocol version
+    private abstract record Message(DateTime Timestamp);
+
+    private sealed record ExitMessage(DateTime Timestamp, int ExitCode, LogServer.ResourceUsage? Resources = null)
+            : Message(Timestamp);
+
+    private sealed record StartMessage(
+            DateTime Timestamp, int ParentId, string ExePath, string CommandLine, string WorkingDirectory,
+            Dictionary<string, string> Env, ulong EnvHash, bool ExitWatched = false) : Message(Timestamp);
+
+    private sealed record StartEnvDeltaMessage(
+            DateTime Timestamp, int ParentId, string ExePath, string CommandLine, string WorkingDirectory,
+            ulong EnvHash, ulong BaseHash, string[] Removed, Dictionary<string, string> Changed,
+            bool ExitWatched = false) : Message(Timestamp);
+
+    private sealed record StartMinimalMessage(DateTime Timestamp, int ParentId, string ExePath, bool ExitWatched)
+            : Message(Timestamp);
+
+    private sealed record EnvironmentMessage(DateTime Timestamp, Dictionary<string, string> Env, ulong EnvHash)
+            : Message(Timestamp);
+
+    private sealed record DroppedMessage(DateTime Timestamp, ulong Count) : Message(Timestamp);
+
+    private sealed record FileAccessesMessage(DateTime Timestamp, LogServer.FileAccess[] Files) : Message(Timestamp);
+
+    private sealed record HookTimingsMessage(
+            DateTime Timestamp, LogServer.HookTimings Timings, LogServer.ChildSpawn[] Spawns) : Message(Timestamp);
+
+    private sealed record ChildExitMessage(DateTime Timestamp, int ChildId, int ExitCode) : Message(Timestamp);
+
+    /// Reads a single message and reports it through `eventCb`. Returns the type of the message.
+    public async ValueTask<MessageType> ReadMessageAsync(CancellationToken token) {
+        var (type, message) = await ReadAnyMessageAsync(token);
+        // null: a message type added in a newer protocol version, skipped
+        if (message != null) {
+            await ReportAsync(message, token);
+        }
+        while (_deferred.TryDequeue(out var deferred)) {
+            await ReportAsync(deferred, token);
+        }
+        if (_ended) {
+            throw new EndOfStreamException();
+        }
+        return type;
+    }
+
+    private async ValueTask ReportAsync(Message message, CancellationToken token) {
+        switch (message) {
+            case ExitMessage m:
+                eventCb(new LogServer.ProcessExit(m.Timestamp, processId, m.ExitCode, m.Resources));
+                break;
+            case StartMessage m:
+                envCache.Add(m.EnvHash, m.Env);
+                eventCb(new LogServer.ProcessInfo(
+                        m.Timestamp, processId, m.ParentId, m.ExePath, m.CommandLine, m.WorkingDirectory, m.Env)
+                        {ExitWatched = m.ExitWatched});
+                break;
+            case StartEnvDeltaMessage m: {
+                var env = await ResolveEnvironmentAsync(m, token);
+                eventCb(new LogServer.ProcessInfo(
+                        m.Timestamp, processId, m.ParentId, m.ExePath, m.CommandLine, m.WorkingDirectory,
+                        env ?? m.Changed) {EnvironmentIncomplete = env == null, ExitWatched = m.ExitWatched});
+                break;
+            }
+            case StartMinimalMessage m:
+                eventCb(new LogServer.ProcessInfo(m.Timestamp, processId, m.ParentId, m.ExePath, "", "", [])
+                        {Filtered = true, ExitWatched = m.ExitWatched});
+                break;
+            case EnvironmentMessage m:
+                envCache.Add(m.EnvHash, m.Env);
+                break;
+            case DroppedMessage m:
+                eventCb(new LogServer.ProcessMessagesDropped(m.Timestamp, processId, m.Count));
+                break;
+            case FileAccessesMessage m:
+                eventCb(new LogServer.ProcessFileAccesses(m.Timestamp, processId, m.Files));
+                break;
+            case HookTimingsMessage m:
+                eventCb(new LogServer.ProcessHookTimings(m.Timestamp, processId, m.Timings, m.Spawns));
+                break;
+            case ChildExitMessage m:
+                eventCb(new LogServer.ProcessExitObserved(m.Timestamp, m.ChildId, m.ExitCode));
+                break;
+        }
+    }
+
+    /// Returns the full environment of a process that sent a delta, `null` if neither its base nor the full environment
+    /// arrived.
+    private async ValueTask<Dictionary<string, string>?> ResolveEnvironmentAsync(
+            StartEnvDeltaMessage m, CancellationToken token) {
+        // processes started the same way (e.g., all compiler invocations of a build) end up with the same
+        //  environment, share a single instance
+        if (!envCache.TryGet(m.EnvHash, out var env)) {
+            var baseEnv = await envCache.GetAsync(m.BaseHash, baseEnvironmentTimeout, token);
+            if (baseEnv == null) {
+                // the parent's report was lost (e.g., dropped, or its connection broke) or evicted from the cache;
+                //  never cache the partial environment, it would be used for other processes with the same hash
+                return await RequestEnvironmentAsync(m.EnvHash, token);
+            }
+            env = ApplyEnvironmentDelta(baseEnv, m.Removed, m.Changed);
+            envCache.Add(m.EnvHash, env);
+        }
+        await ReplyAsync(EnvironmentReply.Resolved, m.EnvHash, token);
+        return env;
+    }
+
+    /// Asks the hook for the environment `envHash` and reads messages until it arrives; the other messages are
+    /// deferred until the process start is reported.
+    private async ValueTask<Dictionary<string, string>?> RequestEnvironmentAsync(
+            ulong envHash, CancellationToken token) {
+        if (!await ReplyAsync(EnvironmentReply.SendFull, envHash, token)) {
+            return null;
+        }
+        while (true) {
+            Message? message;
+            try {
+                (_, message) = await ReadAnyMessageAsync(token);
+            } catch (EndOfStreamException) {
+                // the process exited or was killed before it got to send the environment
+                _ended = true;
+                return null;
+            }
+            if (message is EnvironmentMessage e && e.EnvHash == envHash) {
+                envCache.Add(e.EnvHash, e.Env);
+                return e.Env;
+            }
+            if (message != null) {
+                _deferred.Enqueue(message);
+            }
+        }
+    }
+
+    /// Returns `false` if the reply cannot be sent, in which case the hook will not answer it.
+    private async ValueTask<bool> ReplyAsync(EnvironmentReply reply, ulong envHash, CancellationToken token) {
+        if (replies == null || protocolVersion == 1) {
+            return false;
+        }
+        var buffer = new byte[9];
+        buffer[0] = (byte) reply;
+        BitConverter.TryWriteBytes(buffer.AsSpan(1), envHash);
+        try {
+            await replies.WriteAsync(buffer, token);
+            return true;
+        } catch (IOException) {
+            // the client disconnected, or it is an older hook which opened the pipe write-only
+            return false;
+        }
+    }
+
+    private async ValueTask<(MessageType, Message?)> ReadAnyMessageAsync(CancellationToken token) {
+        return protocolVersion == 1 ? await ReadMessageV1Async(token) : await ReadMessageV2Async(token);
+    }
+
+    /// Version 1: fixed-size fields, UTF-16 strings and a terminator after each message.
+    private async ValueTask<(MessageType, Message?)> ReadMessageV1Async(CancellationToken token) {
+        var timestamp = DateTime.FromFileTimeUtc((long) await reader.ReadAsync<ulong>(token));
+        var type = (MessageType) await reader.ReadAsync<ushort>(token);
+        Message message;
+        switch (type) {
+            case MessageType.ExitProcess: {
+                message = new ExitMessage(timestamp, await reader.ReadAsync<int>(token));
+                break;
+            }
+            case MessageType.ProcessStart: {
+                var parentId = await reader.ReadAsync<int>(token);
+                var exePath = (await reader.ReadPooledStringAsync(Encoding.Unicode, token))!;
+                var cmdLine = (await reader.ReadStringAsync(Encoding.Unicode, token))!;
+                var workingDirectory = (await reader.ReadPooledStringAsync(Encoding.Unicode, token))!;
+                var (env, envHash) = await reader.ReadEnvironmentBlockAsync(Encoding.Unicode, envCache, token);
+                message = new StartMessage(timestamp, parentId, exePath, cmdLine, workingDirectory, env, envHash);
+                break;
+            }
+            case MessageType.ProcessStartEnvDelta: {
+                var parentId = await reader.ReadAsync<int>(token);
+                var exePath = (await reader.ReadPooledStringAsync(Encoding.Unicode, token))!;
+                var cmdLine = (await reader.ReadStringAsync(Encoding.Unicode, token))!;
+                var workingDirectory = (await reader.ReadPooledStringAsync(Encoding.Unicode, token))!;
+                var envHash = await reader.ReadAsync<ulong>(token);
+                var baseHash = await reader.ReadAsync<ulong>(token);
+                var removed = await reader.ReadNameListAsync(Encoding.Unicode, token);
+                var (changed, _) = await reader.ReadEnvironmentBlockAsync(Encoding.Unicode, null, token);
+                message = new StartEnvDeltaMessage(timestamp, parentId, exePath, cmdLine, workingDirectory,
+                        envHash, baseHash, removed, changed);
+                break;
+            }
+            case MessageType.EnvironmentSnapshot: {
+                var (env, envHash) = await reader.ReadEnvironmentBlockAsync(Encoding.Unicode, envCache, token);
+                message = new EnvironmentMessage(timestamp, env, envHash);
+                break;
+            }
+            case MessageType.DroppedMessages: {
+                message = new DroppedMessage(timestamp, await reader.ReadAsync<ulong>(token));
+                break;
+            }
+            default:
+                throw new SwitchExpressionException($"Received an unknown message type from the client: {type}");
+        }
+        await reader.VerifyTerminatorAsync(token);
+        return (type, message);
+    }
+
+    /// Version 2: length-prefixed messages with varint integers and compact strings.
+    private async ValueTask<(MessageType, Message?)> ReadMessageV2Async(CancellationToken token) {
+        var length = await reader.ReadVarintAsync(token);
+        var body = await reader.ReadBlockAsync(checked((int) length), token);
+        return DecodeMessageV2(body.Span);
+    }
+
+    private (MessageType, Message?) DecodeMessageV2(ReadOnlySpan<byte> body) {
+        var r = new MessageReader(body);
+        var type = (MessageType) r.ReadByte();
+        var timestamp = DateTime.FromFileTimeUtc((long) r.ReadFixed64());
+        switch (type) {
+            case MessageType.ExitProcess: {
+                var exitCode = (int) r.ReadVarint32();
+                // optional, not sent by the Linux hook
+                var resources = r.AtEnd ? null : r.ReadResourceUsage();
+                return (type, new ExitMessage(timestamp, exitCode, resources));
+            }
+            case MessageType.ProcessStart: {
+                var parentId = (int) r.ReadVarint32();
+                var exePath = r.ReadPooledString()!;
+                var cmdLine = r.ReadString()!;
+                var workingDirectory = r.ReadPooledString()!;
+                var (env, envHash) = r.ReadEnvironmentBlock(envCache);
+                var flags = r.ReadStartFlags();
+                return (type, new StartMessage(timestamp, parentId, exePath, cmdLine, workingDirectory, env, envHash,
+                        flags.HasFlag(StartFlags.ExitWatched)));
+            }
+            case MessageType.ProcessStartEnvDelta: {
+                var parentId = (int) r.ReadVarint32();
+                var exePath = r.ReadPooledString()!;
+                var cmdLine = r.ReadString()!;
+                var workingDirectory = r.ReadPooledString()!;
+                var envHash = r.ReadFixed64();
+                var baseHash = r.ReadFixed64();
+                var removed = r.ReadNameList();
+                var (changed, _) = r.ReadEnvironmentBlock();
+                var flags = r.ReadStartFlags();
+                return (type, new StartEnvDeltaMessage(timestamp, parentId, exePath, cmdLine, workingDirectory,
+                        envHash, baseHash, removed, changed, flags.HasFlag(StartFlags.ExitWatched)));
+            }
+            case MessageType.ProcessStartMinimal: {
+                var parentId = (int) r.ReadVarint32();
+                var exePath = r.ReadPooledString()!;
+                var flags = r.ReadStartFlags();
+                return (type, new StartMinimalMessage(timestamp, parentId, exePath,
+                        flags.HasFlag(StartFlags.ExitWatched)));
+            }
+            case MessageType.EnvironmentSnapshot: {
+                var (env, envHash) = r.ReadEnvironmentBlock(envCache);
+                return (type, new EnvironmentMessage(timestamp, env, envHash));
+            }
+            case MessageType.DroppedMessages:
+                return (type, new DroppedMessage(timestamp, r.ReadVarint()));
+            case MessageType.FileAccesses:
+                return (type, new FileAccessesMessage(timestamp, r.ReadFileAccesses()));
+            case MessageType.HookTimings: {
+                var timings = r.ReadHookTimings();
+                return (type, new HookTimingsMessage(timestamp, timings, r.ReadChildSpawns()));
+            }
+            case MessageType.ChildExit: {
+                var childId = (int) r.ReadVarint32();
+                return (type, new ChildExitMessage(timestamp, childId, (int) r.ReadVarint32()));
+            }
+            default:
+                // the length prefix allows skipping messages we do not understand
+                return (type, null);
+        }
+    }
+
+    private static Dictionary<string, string> ApplyEnvironmentDelta(
+            Dictionary<string, string> baseEnv, string[] removed, Dictionary<string, string> changed) {
+        if (removed.Length == 0 && changed.Count == 0) {
+            // most processes inherit the environment unchanged, share the instance
+            return baseEnv;
+        }
+
+        var env = new Dictionary<string, string>(baseEnv, baseEnv.Comparer);
+        // remove first, the hook compares names case-sensitively, so a variable may be both removed and changed
+        foreach (var key in removed) {
+            env.Remove(key);
+        }
+        foreach (var (key, value) in changed) {
+            env[key] = value;
+        }
+        return env;
+    }
+}
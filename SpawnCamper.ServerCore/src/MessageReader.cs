@@ -0,0 +1,181 @@
+﻿using System.Buffers;
+using System.Buffers.Binary;
+using System.Runtime.InteropServices;
+using System.Text;
+
+namespace SpawnCamper.Core;
+
+/// Reads the fields of a version 2 message body, which is received as a whole thanks to its length prefix.
+/// Fields following the ones the caller knows about (added in newer versions) are simply never read.
+internal ref struct MessageReader(ReadOnlySpan<byte> data) {
+    /// `Protocol::StringEncoding`
+    private enum StringEncoding : byte {
+        Latin1 = 0,
+        Utf8 = 1,
+        Utf16 = 2,
+        Null = 3,
+    }
+
+    private ReadOnlySpan<byte> _data = data;
+
+    /// True if all fields of the message were read, used for optional fields at the end of a message.
+    public bool AtEnd => _data.IsEmpty;
+
+    private ReadOnlySpan<byte> ReadBytes(int length) {
+        if ((uint) length > (uint) _data.Length) {
+            throw new InvalidDataException("Malformed message from the traced process, field extends past the end.");
+        }
+        var result = _data[..length];
+        _data = _data[length..];
+        return result;
+    }
+
+    public byte ReadByte() => ReadBytes(1)[0];
+
+    public ulong ReadFixed64() => BinaryPrimitives.ReadUInt64LittleEndian(ReadBytes(8));
+
+    public ulong ReadVarint() {
+        var value = 0ul;
+        for (var shift = 0; shift < 64; shift += 7) {
+            var b = ReadByte();
+            value |= (ulong) (b & 0x7f) << shift;
+            if ((b & 0x80) == 0) {
+                return value;
+            }
+        }
+        throw new InvalidDataException("Malformed message from the traced process, varint is too long.");
+    }
+
+    public uint ReadVarint32() => checked((uint) ReadVarint());
+
+    public string? ReadString() {
+        var tag = ReadVarint();
+        var encoding = (StringEncoding) (tag & 3);
+        if (encoding == StringEncoding.Null) {
+            return null;
+        }
+        var bytes = ReadBytes(checked((int) (tag >> 2)));
+        return encoding switch {
+            StringEncoding.Latin1 => Encoding.Latin1.GetString(bytes),
+            StringEncoding.Utf8 => Encoding.UTF8.GetString(bytes),
+            // Windows strings with unpaired surrogates, which `Encoding.Unicode` would replace; keep them as they are,
+            //  so that the environment hash matches the one computed by the hook
+            _ => new string(MemoryMarshal.Cast<byte, char>(bytes)),
+        };
+    }
+
+    /// Same as `ReadString`, for strings that repeat across processes (paths), which are taken from `StringPool.Shared`.
+    public string? ReadPooledString() {
+        var tag = ReadVarint();
+        var encoding = (StringEncoding) (tag & 3);
+        if (encoding == StringEncoding.Null) {
+            return null;
+        }
+        var bytes = ReadBytes(checked((int) (tag >> 2)));
+        return encoding switch {
+            StringEncoding.Latin1 => StringPool.Shared.Intern(bytes, Encoding.Latin1),
+            StringEncoding.Utf8 => StringPool.Shared.Intern(bytes, Encoding.UTF8),
+            _ => StringPool.Shared.Intern(MemoryMarshal.Cast<byte, char>(bytes)),
+        };
+    }
+
+    /// Reads an environment block, together with its hash that child processes use to reference it. The hook hashes
+    /// the UTF-16 environment block, which is what the decoded characters contain, regardless of the wire encoding.
+    /// The block is decoded into a pooled buffer instead of a string, since only the variables are kept. If `cache`
+    /// already contains an identical environment, it is returned instead of parsing the block again.
+    public (Dictionary<string, string> Env, ulong Hash) ReadEnvironmentBlock(EnvironmentCache? cache = null) {
+        var tag = ReadVarint();
+        var encoding = (StringEncoding) (tag & 3);
+        if (encoding == StringEncoding.Null) {
+            throw new InvalidDataException("Malformed message from the traced process, missing environment block.");
+        }
+        var bytes = ReadBytes(checked((int) (tag >> 2)));
+        if (encoding == StringEncoding.Utf16) {
+            return ParseEnvironmentBlock(MemoryMarshal.Cast<byte, char>(bytes), cache);
+        }
+
+        // Latin-1 and UTF-8 never decode to more characters than bytes
+        var chars = ArrayPool<char>.Shared.Rent(bytes.Length);
+        try {
+            var decoded = chars.AsSpan(0, (encoding == StringEncoding.Latin1 ? Encoding.Latin1 : Encoding.UTF8)
+                    .GetChars(bytes, chars));
+            return ParseEnvironmentBlock(decoded, cache);
+        } finally {
+            ArrayPool<char>.Shared.Return(chars);
+        }
+    }
+
+    private static (Dictionary<string, string> Env, ulong Hash) ParseEnvironmentBlock(
+            ReadOnlySpan<char> block, EnvironmentCache? cache) {
+        var hash = EnvironmentCache.Hash(MemoryMarshal.AsBytes(block));
+        if (cache != null && cache.TryGet(hash, out var env)) {
+            return (env, hash);
+        }
+        return (LogReader.ParseEnvironmentBlock(block), hash);
+    }
+
+    /// Reads `Protocol::Messages::ResourceUsageFields`.
+    public LogServer.ResourceUsage ReadResourceUsage() {
+        return new LogServer.ResourceUsage(
+                UserTime: TimeSpan.FromTicks(checked((long) ReadVarint())),
+                KernelTime: TimeSpan.FromTicks(checked((long) ReadVarint())),
+                PeakWorkingSet: ReadVarint(),
+                PeakCommit: ReadVarint(),
+                ReadBytes: ReadVarint(),
+                WriteBytes: ReadVarint(),
+                ReadOperations: ReadVarint(),
+                WriteOperations: ReadVarint(),
+                HandleCount: ReadVarint32(),
+                ThreadCount: ReadVarint32());
+    }
+
+    /// Reads `Protocol::Messages::StartFlagsField`, which is optional at the end of the process start messages.
+    public StartFlags ReadStartFlags() => AtEnd ? StartFlags.None : (StartFlags) ReadVarint32();
+
+    /// Reads `Protocol::Messages::FileAccesses`.
+    public LogServer.FileAccess[] ReadFileAccesses() {
+        var count = ReadVarint();
+        // each record takes at least 4 bytes, do not trust the count before reading them
+        var files = new List<LogServer.FileAccess>((int) Math.Min(count, (ulong) _data.Length / 4));
+        for (var i = 0ul; i < count; i++) {
+            files.Add(new LogServer.FileAccess(
+                    Path: ReadPooledString() ?? "",
+                    Kind: (LogServer.FileAccessKind) ReadVarint32(),
+                    Opens: ReadVarint32(),
+                    FailedOpens: ReadVarint32()));
+        }
+        return files.ToArray();
+    }
+
+    /// Reads the totals of `Protocol::Messages::HookTimings`, followed by the spawns (`ReadChildSpawns`).
+    public LogServer.HookTimings ReadHookTimings() {
+        var attach = ReadDuration();
+        var connect = ReadDuration();
+        var busyWaits = ReadVarint32();
+        var logAttach = ReadDuration();
+        var writeTime = ReadDuration();
+        var writes = ReadVarint();
+        var spawnLatency = ReadDuration();
+        return new LogServer.HookTimings(attach, connect, busyWaits, logAttach, writeTime, writes,
+                // 0 if the parent did not pass the time, e.g., on Linux
+                spawnLatency == TimeSpan.Zero ? null : spawnLatency);
+    }
+
+    public LogServer.ChildSpawn[] ReadChildSpawns() {
+        var count = ReadVarint();
+        // each record takes at least 3 bytes, do not trust the count before reading them
+        var spawns = new List<LogServer.ChildSpawn>((int) Math.Min(count, (ulong) _data.Length / 3));
+        for (var i = 0ul; i < count; i++) {
+            spawns.Add(new LogServer.ChildSpawn((int) ReadVarint32(), ReadDuration(), ReadDuration()));
+        }
+        return spawns.ToArray();
+    }
+
+    /// Reads a duration in 100ns units.
+    private TimeSpan ReadDuration() => TimeSpan.FromTicks(checked((long) ReadVarint()));
+
+    /// Reads a null-terminated list of names (used for removed variables in an environment delta).
+    public string[] ReadNameList() {
+        return ReadString()!.Split((char) 0, StringSplitOptions.RemoveEmptyEntries);
+    }
+}
@@ -0,0 +1,234 @@
+﻿using System.Diagnostics;
+using System.IO.Enumeration;
+using System.Text;
+
+namespace SpawnCamper.Core;
+
+/// Re-executes recorded invocations with their command line, working directory and environment, repeatedly, to turn
+/// a slow step of a traced build into a standalone benchmark.
+///
+/// Only the selected processes are executed; they start their own children again, so their traced descendants are not
+/// executed separately. Without `ExeGlobs`, the leaves of the tree (processes without traced children) are selected.
+/// Processes that were running at the same time in the recording may run in parallel, while a process only starts
+/// after the processes that exited before it started, including those in the subtrees of the preceding siblings
+/// of its ancestors, since their parents waited for them.
+public sealed class RerunBenchmark(RerunBenchmark.Options options) {
+    /// `ExeGlobs` select the processes to execute, with the same syntax as `--filter-exe` of the tracer: a glob
+    /// without a path separator is matched against the file name, otherwise against the full path.
+    public record Options(int Repeat = 1, int Parallelism = 1, IReadOnlyList<string>? ExeGlobs = null);
+
+    /// Runs of a single recorded process.
+    public sealed class Invocation(TracedProcess process) {
+        public TracedProcess Process {get;} = process;
+        /// Wall times of the runs that started.
+        public DurationHistogram Durations {get;} = new();
+        /// Runs that finished with a different exit code than the recorded one.
+        public int ExitCodeMismatches {get; internal set;}
+        /// Exit code of the last run with a different exit code than the recorded one.
+        public int? LastMismatchedExitCode {get; internal set;}
+        /// Runs that could not start, e.g., because the executable no longer exists.
+        public int FailedStarts {get; internal set;}
+        public string? LastError {get; internal set;}
+
+        public TimeSpan? RecordedDuration => Process.EndTime - Process.StartTime;
+    }
+
+    /// `Skipped` selected processes were recorded without their command line (filtered by the hook) or without their
+    /// full environment and could not be executed faithfully; `WallTimes` are the times of the whole selection in each repetition.
+    public record Result(
+            IReadOnlyList<Invocation> Invocations,
+            int Skipped,
+            DurationHistogram WallTimes,
+            TimeSpan? RecordedWallTime);
+
+    private readonly SemaphoreSlim _slots = new(Math.Max(1, options.Parallelism));
+    private readonly Dictionary<TracedProcess, Invocation> _invocations = new(ReferenceEqualityComparer.Instance);
+    private int _skipped;
+
+    public async Task<Result> RunAsync(IReadOnlyList<TracedProcessTree.Node> roots, CancellationToken token) {
+        // the tree may be updated by the server while the benchmark runs, work on a snapshot
+        var schedule = roots.Select(Snapshot).ToList();
+        var wallTimes = new DurationHistogram();
+        for (var i = 0; i < options.Repeat; i++) {
+            var stopwatch = Stopwatch.StartNew();
+            await RunSiblingsAsync(schedule, token);
+            wallTimes.Add(stopwatch.Elapsed);
+        }
+
+        var start = roots.Select(r => r.Process.StartTime).DefaultIfEmpty().Min();
+        var end = roots.Select(r => LastEndTime(r)).DefaultIfEmpty().Max();
+        return new Result(_invocations.Values.ToList(), _skipped, wallTimes, end - start);
+    }
+
+    /// A process to execute, or the selected processes in its subtree.
+    private record ScheduleNode(TracedProcess Process, Invocation? Invocation, List<ScheduleNode> Children);
+
+    private ScheduleNode Snapshot(TracedProcessTree.Node node) {
+        if (IsSelected(node)) {
+            if (!node.Process.Filtered && !node.Process.EnvironmentIncomplete) {
+                var invocation = new Invocation(node.Process);
+                _invocations[node.Process] = invocation;
+                return new ScheduleNode(node.Process, invocation, []);
+            }
+            _skipped++;
+        }
+        return new ScheduleNode(node.Process, null, node.Children.ToList().Select(Snapshot).ToList());
+    }
+
+    private bool IsSelected(TracedProcessTree.Node node) {
+        if (options.ExeGlobs is not {Count: > 0} globs) {
+            return node.Children.Count == 0;
+        }
+        var exeName = node.Process.ExePath[(node.Process.ExePath.LastIndexOfAny(['\\', '/']) + 1)..];
+        return globs.Any(g => FileSystemName.MatchesSimpleExpression(
+                g, g.IndexOfAny(['\\', '/']) < 0 ? exeName : node.Process.ExePath));
+    }
+
+    private static DateTime? LastEndTime(TracedProcessTree.Node node) {
+        return node.Children.Select(LastEndTime).Append(node.Process.EndTime).Max();
+    }
+
+    private Task RunAsync(ScheduleNode node, CancellationToken token) {
+        return node.Invocation != null ? ExecuteAsync(node.Invocation, token) : RunSiblingsAsync(node.Children, token);
+    }
+
+    /// Starts each sibling after the siblings that exited before it started in the recording.
+    private Task RunSiblingsAsync(List<ScheduleNode> siblings, CancellationToken token) {
+        var byStart = siblings.OrderBy(s => s.Process.StartTime).ToList();
+        // processes without an end time were still running, nothing waited for them
+        var byEnd = siblings.Where(s => s.Process.EndTime != null).OrderBy(s => s.Process.EndTime).ToList();
+        var tasks = new Dictionary<ScheduleNode, Task>(ReferenceEqualityComparer.Instance);
+        // all siblings that exited before the current one started, chained so that each sibling waits on a single task
+        var predecessors = Task.CompletedTask;
+        var ended = 0;
+        foreach (var sibling in byStart) {
+            for (; ended < byEnd.Count && byEnd[ended].Process.EndTime < sibling.Process.StartTime; ended++) {
+                // skip inconsistent timestamps (the end before the start), which would be a dependency on itself
+                if (tasks.TryGetValue(byEnd[ended], out var predecessor)) {
+                    predecessors = Task.WhenAll(predecessors, predecessor);
+                }
+            }
+            tasks[sibling] = RunAfterAsync(predecessors, sibling, token);
+        }
+        return Task.WhenAll(tasks.Values);
+    }
+
+    private async Task RunAfterAsync(Task predecessors, ScheduleNode node, CancellationToken token) {
+        await predecessors;
+        await RunAsync(node, token);
+    }
+
+    private async Task ExecuteAsync(Invocation invocation, CancellationToken token) {
+        await _slots.WaitAsync(token);
+        try {
+            var stopwatch = Stopwatch.StartNew();
+            Process process;
+            try {
+                process = Process.Start(CreateStartInfo(invocation.Process))!;
+            } catch (Exception e) when (e is System.ComponentModel.Win32Exception or IOException) {
+                lock (invocation) {
+                    invocation.FailedStarts++;
+                    invocation.LastError = e.Message;
+                }
+                return;
+            }
+            using (process) {
+                process.StandardInput.Close();
+                // the output is discarded; do not wait for the end of the streams, since a grandchild (e.g., a
+                //  compiler server) may keep them open after the process exits
+                _ = DiscardAsync(process.StandardOutput.BaseStream);
+                _ = DiscardAsync(process.StandardError.BaseStream);
+                await process.WaitForExitAsync(token);
+                var elapsed = stopwatch.Elapsed;
+                lock (invocation) {
+                    invocation.Durations.Add(elapsed);
+                    if (invocation.Process.ExitCode is {} expected && process.ExitCode != expected) {
+                        invocation.ExitCodeMismatches++;
+                        invocation.LastMismatchedExitCode = process.ExitCode;
+                    }
+                }
+            }
+        } finally {
+            _slots.Release();
+        }
+    }
+
+    private static async Task DiscardAsync(Stream stream) {
+        try {
+            await stream.CopyToAsync(Stream.Null);
+        } catch (Exception e) when (e is IOException or ObjectDisposedException) {
+            // the process was disposed
+        }
+    }
+
+    private static ProcessStartInfo CreateStartInfo(TracedProcess process) {
+        var startInfo = new ProcessStartInfo(process.ExePath) {
+            WorkingDirectory = process.WorkingDirectory,
+            UseShellExecute = false,
+            RedirectStandardInput = true,
+            RedirectStandardOutput = true,
+            RedirectStandardError = true,
+        };
+        if (OperatingSystem.IsWindows()) {
+            // .NET prepends the quoted executable path to the arguments, pass the rest of the command line verbatim
+            startInfo.Arguments = SkipProgramName(process.CommandLine);
+        } else {
+            foreach (var arg in SplitShellCommandLine(process.CommandLine).Skip(1)) {
+                startInfo.ArgumentList.Add(arg);
+            }
+        }
+        startInfo.Environment.Clear();
+        foreach (var (name, value) in process.Environment) {
+            startInfo.Environment[name] = value;
+        }
+        return startInfo;
+    }
+
+    /// Returns the arguments after the program name of a Windows command line, which `CreateProcess` parses without
+    /// escapes: up to the closing quote if quoted, otherwise up to the first whitespace.
+    internal static string SkipProgramName(string commandLine) {
+        int end;
+        if (commandLine.StartsWith('"')) {
+            end = commandLine.IndexOf('"', 1);
+            end = end < 0 ? commandLine.Length : end + 1;
+        } else {
+            end = commandLine.IndexOfAny([' ', '\t']);
+            end = end < 0 ? commandLine.Length : end;
+        }
+        return commandLine[end..].TrimStart(' ', '\t');
+    }
+
+    /// Splits a command line quoted by the Linux hook, which single-quotes arguments with special characters and
+    /// escapes single quotes as `'\''`.
+    internal static List<string> SplitShellCommandLine(string commandLine) {
+        var args = new List<string>();
+        var arg = new StringBuilder();
+        var inArg = false;
+        for (var i = 0; i < commandLine.Length; i++) {
+            var c = commandLine[i];
+            if (c == '\'') {
+                var close = commandLine.IndexOf('\'', i + 1);
+                close = close < 0 ? commandLine.Length : close;
+                arg.Append(commandLine, i + 1, close - i - 1);
+                i = close;
+                inArg = true;
+            } else if (c == '\\' && i + 1 < commandLine.Length) {
+                arg.Append(commandLine[++i]);
+                inArg = true;
+            } else if (c == ' ') {
+                if (inArg) {
+                    args.Add(arg.ToString());
+                    arg.Clear();
+                    inArg = false;
+                }
+            } else {
+                arg.Append(c);
+                inArg = true;
+            }
+        }
+        if (inArg) {
+            args.Add(arg.ToString());
+        }
+        return args;
+    }
+}
@@ -0,0 +1,190 @@
+﻿using System.Diagnostics;
+using System.IO.MemoryMappedFiles;
+using System.Numerics;
+using SpawnCamper.Core.Utils;
+
+namespace SpawnCamper.Core;
+
+/// Consumer side of the shared memory ring buffer that hooks write to with `--transport=shm`.
+/// The layout must match `SharedRing` in the hook (`SharedRing.hpp`).
+internal sealed class SharedRingReader : IDisposable {
+    private const uint Magic = 0x42524353; // "SCRB"
+    private const uint Version = 2;
+
+    // offsets in `SharedRing::Header`
+    private const int HeaderSize = 256;
+    private const int VersionOffset = 4;
+    private const int CapacityOffset = 8;
+    private const int ProtocolVersionOffset = 16;
+    private const int HeadOffset = 64;
+    private const int TailOffset = 128;
+    private const int ConsumerWaitingOffset = 192;
+
+    // `SharedRing::RecordHeader`
+    private const int RecordHeaderSize = 16;
+    private const uint StateWriting = 0;
+    private const uint StateCommitted = 1;
+
+    /// If a record stays uncommitted this long, the producer was most likely killed while writing it; it is discarded
+    /// once the producer is gone. See `SharedRing::try_read` in the hook.
+    private static readonly TimeSpan AbandonedRecordTimeout = TimeSpan.FromSeconds(5);
+    /// Upper bound on sleeping when the ring is empty, in case we miss a wakeup from a producer that was killed.
+    private static readonly TimeSpan IdleTimeout = TimeSpan.FromMilliseconds(100);
+
+    private readonly MemoryMappedFile _file;
+    private readonly MemoryMappedViewAccessor _view;
+    private readonly EventWaitHandle _event;
+    private readonly unsafe byte* _header;
+    private readonly unsafe byte* _data;
+    private readonly ulong _mask;
+    /// Copy of the record being processed, the ring space is released before the record is parsed.
+    private byte[] _payload = new byte[4096];
+
+    /// Protocol version of the record payloads, the highest one we support.
+    public int ProtocolVersion => MessageParser.MaxProtocolVersion;
+
+    /// Creates the ring, `capacity` must be a power of two.
+    public unsafe SharedRingReader(string name, string eventName, long capacity) {
+        if (capacity <= 0 || (capacity & (capacity - 1)) != 0) {
+            throw new ArgumentException("Ring capacity must be a power of two.", nameof(capacity));
+        }
+
+        _file = MemoryMappedFile.CreateNew(name, HeaderSize + capacity);
+        _view = _file.CreateViewAccessor();
+        _event = new EventWaitHandle(false, EventResetMode.AutoReset, eventName);
+
+        byte* ptr = null;
+        _view.SafeMemoryMappedViewHandle.AcquirePointer(ref ptr);
+        _header = ptr + _view.PointerOffset;
+        _data = _header + HeaderSize;
+        _mask = (ulong) capacity - 1;
+
+        // the mapping is zero-initialized, hooks start using the ring once they see the magic value
+        *(uint*) (_header + VersionOffset) = Version;
+        *(ulong*) (_header + CapacityOffset) = (ulong) capacity;
+        *(uint*) (_header + ProtocolVersionOffset) = (uint) ProtocolVersion;
+        Volatile.Write(ref *(uint*) _header, Magic);
+    }
+
+    public void Dispose() {
+        _view.SafeMemoryMappedViewHandle.ReleasePointer();
+        _view.Dispose();
+        _file.Dispose();
+        _event.Dispose();
+    }
+
+    private unsafe ref ulong Head => ref *(ulong*) (_header + HeadOffset);
+    private unsafe ref ulong Tail => ref *(ulong*) (_header + TailOffset);
+    private unsafe ref uint ConsumerWaiting => ref *(uint*) (_header + ConsumerWaitingOffset);
+
+    /// Reads records until cancelled and passes them to `recordCb` in the order they were reserved. The payload is
+    /// only valid until the returned task completes, the buffer is reused for the next record.
+    public async Task RunAsync(Func<int, ArraySegment<byte>, ValueTask> recordCb, CancellationToken token) {
+        var pendingSince = (Stopwatch?) null;
+        // records reserved before this position are discarded if they are not committed yet
+        var pendingHead = 0ul;
+        var abandonedBefore = 0ul;
+        while (!token.IsCancellationRequested) {
+            if (pendingSince?.Elapsed > AbandonedRecordTimeout) {
+                abandonedBefore = pendingHead;
+            }
+            switch (TryRead(abandonedBefore, out var processId, out var payload)) {
+                case ReadResult.Read:
+                    pendingSince = null;
+                    if (payload != null) {
+                        await recordCb(processId, payload.Value);
+                    }
+                    break;
+                case ReadResult.Pending:
+                    // a producer is in the middle of writing the next record
+                    if (pendingSince == null) {
+                        pendingSince = Stopwatch.StartNew();
+                        pendingHead = Volatile.Read(ref Head);
+                    }
+                    await Task.Yield();
+                    break;
+                case ReadResult.Empty:
+                    await WaitForRecordAsync(token);
+                    break;
+            }
+        }
+    }
+
+    private enum ReadResult { Read, Empty, Pending }
+
+    private unsafe ReadResult TryRead(ulong abandonedBefore, out int processId, out ArraySegment<byte>? payload) {
+        processId = 0;
+        payload = null;
+
+        if (IsEmpty) {
+            return ReadResult.Empty;
+        }
+
+        var tail = Volatile.Read(ref Tail);
+        var record = _data + (tail & _mask);
+        var size = Volatile.Read(ref *(uint*) record);
+        var abandoned = tail < abandonedBefore;
+        if (size == 0 && abandoned) {
+            // the producer was killed before it wrote the size, so the end of its record is unknown; `abandonedBefore`
+            //  is the only later position known to start a record, the words in between may be the payloads of other
+            //  records, which must not be mistaken for a record header
+            if (Volatile.Read(ref *(uint*) record) != 0) {
+                return ReadResult.Pending; // the producer was only stalled
+            }
+            Clear(tail, abandonedBefore);
+            Volatile.Write(ref Tail, abandonedBefore);
+            return ReadResult.Read;
+        }
+        if (size == 0) {
+            return ReadResult.Pending;
+        }
+        var state = Volatile.Read(ref *(uint*) (record + 4));
+        if (state == StateWriting && (!abandoned || !Native.HasExited((int) *(uint*) (record + 8)))) {
+            // a live producer still writes into the record, freeing it would corrupt the next records
+            return ReadResult.Pending;
+        }
+
+        if (state == StateCommitted) {
+            processId = (int) *(uint*) (record + 8);
+            var payloadSize = *(uint*) (record + 12);
+            if (_payload.Length < payloadSize) {
+                _payload = new byte[BitOperations.RoundUpToPowerOf2(payloadSize)];
+            }
+            new ReadOnlySpan<byte>(record + RecordHeaderSize, (int) payloadSize).CopyTo(_payload);
+            payload = new ArraySegment<byte>(_payload, 0, (int) payloadSize);
+        }
+
+        // producers rely on the memory being zeroed when they reserve it
+        new Span<byte>(record, (int) size).Clear();
+        Volatile.Write(ref Tail, tail + size);
+        return ReadResult.Read;
+    }
+
+    private bool IsEmpty => Volatile.Read(ref Tail) == Volatile.Read(ref Head);
+
+    /// Zeroes the data between the positions `begin` and `end`, which may wrap around the end of the buffer.
+    private unsafe void Clear(ulong begin, ulong end) {
+        while (begin < end) {
+            var contiguous = Math.Min(end - begin, _mask + 1 - (begin & _mask));
+            new Span<byte>(_data + (begin & _mask), (int) contiguous).Clear();
+            begin += contiguous;
+        }
+    }
+
+    private async Task WaitForRecordAsync(CancellationToken token) {
+        Volatile.Write(ref ConsumerWaiting, 1);
+        Interlocked.MemoryBarrier();
+        // re-check after announcing that we're waiting, otherwise we could miss the wakeup
+        if (IsEmpty) {
+            var tcs = new TaskCompletionSource(TaskCreationOptions.RunContinuationsAsynchronously);
+            var registration = ThreadPool.RegisterWaitForSingleObject(
+                    _event, (_, _) => tcs.TrySetResult(), null, IdleTimeout, executeOnlyOnce: true);
+            try {
+                await tcs.Task.WaitAsync(token);
+            } finally {
+                registration.Unregister(null);
+            }
+        }
+        Volatile.Write(ref ConsumerWaiting, 0);
+    }
+}
@@ -0,0 +1,83 @@
+﻿using System.Buffers;
+using System.Text;
+
+namespace SpawnCamper.Core;
+
+/// Pool of the strings that repeat across the processes of a build (environment variable names and values, executable
+/// paths, working directories, accessed files), so that each distinct string is stored only once, instead of once
+/// for each process. Strings are looked up by their characters, so looking up a pooled string does not allocate.
+///
+/// Open addressing with linear probing; to bound the memory used by strings that do not repeat, the pool starts over
+/// once it grows too large.
+internal sealed class StringPool(int maxCount = 1 << 20, long maxChars = 64 << 20) {
+    /// Pool shared by all connections, since processes of a build repeat the strings of other processes.
+    public static readonly StringPool Shared = new();
+
+    private struct Entry {
+        public int Hash;
+        public string? Value;
+    }
+
+    private readonly object _lock = new();
+    /// The size is a power of 2, at most half of the entries are used.
+    private Entry[] _entries = new Entry[1024];
+    private int _count;
+    private long _chars;
+
+    /// Returns the pooled string with the contents of `chars`, adding it if it is not in the pool yet.
+    public string Intern(ReadOnlySpan<char> chars) {
+        if (chars.IsEmpty) {
+            return "";
+        }
+        var hash = string.GetHashCode(chars);
+        lock (_lock) {
+            var mask = _entries.Length - 1;
+            var i = hash & mask;
+            for (; _entries[i].Value is {} value; i = (i + 1) & mask) {
+                if (_entries[i].Hash == hash && chars.SequenceEqual(value)) {
+                    return value;
+                }
+            }
+
+            var str = chars.ToString();
+            if (_count >= maxCount || _chars >= maxChars) {
+                // the strings that are still used are kept alive by their users, the pool just forgets them
+                Array.Clear(_entries);
+                (_count, _chars) = (0, 0);
+                i = hash & mask;
+            }
+            _entries[i] = new Entry {Hash = hash, Value = str};
+            _chars += str.Length;
+            if (++_count * 2 > _entries.Length) {
+                Grow();
+            }
+            return str;
+        }
+    }
+
+    /// Decodes `bytes` into a pooled buffer and returns the pooled string with its contents.
+    public string Intern(ReadOnlySpan<byte> bytes, Encoding encoding) {
+        var chars = ArrayPool<char>.Shared.Rent(encoding.GetMaxCharCount(bytes.Length));
+        try {
+            return Intern(chars.AsSpan(0, encoding.GetChars(bytes, chars)));
+        } finally {
+            ArrayPool<char>.Shared.Return(chars);
+        }
+    }
+
+    private void Grow() {
+        var entries = new Entry[_entries.Length * 2];
+        var mask = entries.Length - 1;
+        foreach (var entry in _entries) {
+            if (entry.Value == null) {
+                continue;
+            }
+            var i = entry.Hash & mask;
+            while (entries[i].Value != null) {
+                i = (i + 1) & mask;
+            }
+            entries[i] = entry;
+        }
+        _entries = entries;
+    }
+}
@@ -0,0 +1,137 @@
+﻿using System.Buffers.Binary;
+using System.Numerics;
+using System.Runtime.CompilerServices;
+
+namespace SpawnCamper.Core;
+
+/// Reads a trace file recorded by `SpawnCamper.Tracer --record` and replays it as if the messages arrived live.
+/// The layout must match `TraceFile` in the hook (`TraceFile.hpp`).
+public sealed class TraceFileReader : IDisposable {
+    private static readonly byte[] Magic = "SCTRACE\0"u8.ToArray();
+    private const uint Version = 1;
+
+    // offsets in `TraceFile::Header`
+    private const int DataOffset = 4096;
+    private const int VersionOffset = 8;
+    private const int ProtocolVersionOffset = 12;
+    private const int StartTimeOffset = 16;
+    private const int CapacityOffset = 24;
+    private const int EndOffset = 64;
+    private const int DroppedOffset = 128;
+
+    // `SharedRing::RecordHeader`
+    private const int RecordHeaderSize = 16;
+    private const uint StateCommitted = 1;
+
+    private readonly FileStream _file;
+    private readonly long _end;
+    private readonly int _protocolVersion;
+
+    /// Time when the recording started.
+    public DateTime StartTime {get;}
+    /// Number of messages that did not fit into the trace file.
+    public ulong DroppedMessages {get;}
+
+    public TraceFileReader(string path) {
+        // processes that outlived the traced command may still be appending to the file
+        _file = new FileStream(path, FileMode.Open, FileAccess.Read, FileShare.ReadWrite | FileShare.Delete);
+        try {
+            var header = new byte[DataOffset];
+            _file.ReadExactly(header);
+            if (!header.AsSpan(0, Magic.Length).SequenceEqual(Magic)) {
+                throw new InvalidDataException("Not a SpawnCamper trace file.");
+            }
+            _protocolVersion = (int) BinaryPrimitives.ReadUInt32LittleEndian(header.AsSpan(ProtocolVersionOffset));
+            if (BinaryPrimitives.ReadUInt32LittleEndian(header.AsSpan(VersionOffset)) != Version
+                || _protocolVersion < 1 || _protocolVersion > MessageParser.MaxProtocolVersion) {
+                throw new InvalidDataException("Unsupported trace file version.");
+            }
+
+            StartTime = DateTime.FromFileTimeUtc(BinaryPrimitives.ReadInt64LittleEndian(header.AsSpan(StartTimeOffset)));
+            DroppedMessages = BinaryPrimitives.ReadUInt64LittleEndian(header.AsSpan(DroppedOffset));
+            var capacity = BinaryPrimitives.ReadUInt64LittleEndian(header.AsSpan(CapacityOffset));
+            var end = BinaryPrimitives.ReadUInt64LittleEndian(header.AsSpan(EndOffset));
+            // `end` is past the capacity if the file filled up
+            _end = DataOffset + (long) Math.Min(Math.Min(end, capacity), (ulong) (_file.Length - DataOffset));
+        } catch {
+            _file.Dispose();
+            throw;
+        }
+    }
+
+    public void Dispose() {
+        _file.Dispose();
+    }
+
+    /// Reports all recorded messages through `eventCb`, in the order they were recorded. Same as with the shared
+    /// memory ring, `ProcessDetach` is reported after each exit record; processes that did not record an exit
+    /// (e.g., they were killed) are detached when their parent recorded their exit, or at the end of the trace.
+    public async Task ReplayAsync(Action<LogServer.ProcessEvent> eventCb, CancellationToken token) {
+        var envCache = new EnvironmentCache();
+        var running = new HashSet<int>();
+        var lastTimestamp = StartTime;
+        var trackingCb = (LogServer.ProcessEvent e) => {
+            lastTimestamp = e.Timestamp;
+            eventCb(e);
+            if (e is LogServer.ProcessExitObserved exit && running.Remove(exit.ProcessId)) {
+                eventCb(new LogServer.ProcessDetach(exit.Timestamp, exit.ProcessId));
+            }
+        };
+
+        await foreach (var (processId, payload) in ReadRecordsAsync(token)) {
+            using var reader = new LogReader(payload);
+            var type = await new MessageParser(reader, _protocolVersion, processId, envCache, trackingCb)
+                    .ReadMessageAsync(token);
+            if (type == MessageType.ExitProcess) {
+                running.Remove(processId);
+                eventCb(new LogServer.ProcessDetach(lastTimestamp, processId));
+            } else {
+                running.Add(processId);
+            }
+        }
+
+        foreach (var processId in running) {
+            eventCb(new LogServer.ProcessDetach(lastTimestamp, processId));
+        }
+    }
+
+    /// Protocol version of the recorded messages.
+    internal int ProtocolVersion => _protocolVersion;
+
+    /// Reads the committed records in the order they were recorded. The payload is only valid until the next record
+    /// is read, the buffer is reused.
+    internal async IAsyncEnumerable<(int ProcessId, ArraySegment<byte> Payload)> ReadRecordsAsync(
+            [EnumeratorCancellation] CancellationToken token) {
+        var recordHeader = new byte[RecordHeaderSize];
+        var payload = new byte[4096];
+        _file.Position = DataOffset;
+        while (_file.Position + RecordHeaderSize <= _end) {
+            await _file.ReadExactlyAsync(recordHeader, token);
+            var size = BinaryPrimitives.ReadUInt32LittleEndian(recordHeader);
+            var state = BinaryPrimitives.ReadUInt32LittleEndian(recordHeader.AsSpan(4));
+            var processId = BinaryPrimitives.ReadInt32LittleEndian(recordHeader.AsSpan(8));
+            var payloadSize = BinaryPrimitives.ReadInt32LittleEndian(recordHeader.AsSpan(12));
+            if (size == 0) {
+                // the writer was killed (or failed to map the file) before it wrote the record size; the reserved
+                //  space is still zeroed, so the next record starts at the first non-zero record header
+                continue;
+            }
+            var recordEnd = _file.Position - RecordHeaderSize + size;
+            if (size < RecordHeaderSize || recordEnd > _end) {
+                break;
+            }
+            if (state != StateCommitted) {
+                // the writer was killed while writing the record
+                _file.Position = recordEnd;
+                continue;
+            }
+
+            if (payload.Length < payloadSize) {
+                payload = new byte[BitOperations.RoundUpToPowerOf2((uint) payloadSize)];
+            }
+            await _file.ReadExactlyAsync(payload.AsMemory(0, payloadSize), token);
+            _file.Position = recordEnd;
+            yield return (processId, new ArraySegment<byte>(payload, 0, payloadSize));
+        }
+    }
+}
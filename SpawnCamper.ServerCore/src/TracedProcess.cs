@@ -14,8 +14,25 @@ public record TracedProcess(
 ) : INotifyPropertyChanged {
     public event PropertyChangedEventHandler? PropertyChanged;
 
-    public readonly Dictionary<string, (string?, string?)>? EnvironmentDiff =
-            Parent == null ? null : CalculateEnvironmentDiff(Parent.Environment, Environment);
+    private Dictionary<string, (string?, string?)>? _environmentDiff;
+
+    /// Differences from the environment of the parent, `null` for root processes. Computed on the first access, since
+    /// only the processes the user inspects need it.
+    public Dictionary<string, (string?, string?)>? EnvironmentDiff => Parent == null
+            ? null
+            : _environmentDiff ??= CalculateEnvironmentDiff(Parent.Environment, Environment);
+
+    /// The process matched the filter rules of the hook and only its executable path was captured; the command line and
+    /// working directory are empty and the environment is the one of the parent.
+    public bool Filtered {get; init;}
+
+    /// The server could not reconstruct the environment of the process, `Environment` only contains the variables
+    /// that differ from the environment of the parent.
+    public bool EnvironmentIncomplete {get; init;}
+
+    /// The hook in the parent (or the tracer, for the root) watches the process and reports its exit, which is waited
+    /// for if the process detaches without reporting its exit code (e.g., it was killed).
+    public bool ExitWatched {get; init;}
 
     public int? ExitCode {
         get;
@@ -27,9 +44,79 @@ public record TracedProcess(
         set => UpdateProperty(out field, value);
     }
 
+    /// The process ended without reporting its exit (e.g., it was killed or crashed), its exit code and end time were
+    /// reported by its parent.
+    public bool Terminated {
+        get;
+        set => UpdateProperty(out field, value);
+    }
+
+    /// Resources used by the process, if the hook reported them together with the exit code.
+    public LogServer.ResourceUsage? Resources {
+        get;
+        set => UpdateProperty(out field, value);
+    }
+
+    /// Number of messages the hook discarded, when running with a lossy overflow policy.
+    public ulong? DroppedMessages {
+        get;
+        set => UpdateProperty(out field, value);
+    }
+
+    /// Time the hook spent in the process, if the hook reported it before the process exited.
+    public LogServer.HookTimings? HookTimings {
+        get;
+        set => UpdateProperty(out field, value);
+    }
+
+    private readonly List<LogServer.ChildSpawn> _spawns = [];
+
+    /// `CreateProcess` calls of the process reported with the hook timings.
+    public IReadOnlyList<LogServer.ChildSpawn> Spawns => _spawns;
+
+    internal void AddSpawns(IEnumerable<LogServer.ChildSpawn> spawns) {
+        _spawns.AddRange(spawns);
+        PropertyChanged?.Invoke(this, new(nameof(Spawns)));
+    }
+
+    private readonly Dictionary<string, LogServer.FileAccess> _files = new(StringComparer.OrdinalIgnoreCase);
+
+    /// Files accessed by the process, by path; empty unless the hook traced file accesses (`--trace-files`).
+    public IReadOnlyDictionary<string, LogServer.FileAccess> Files => _files;
+
+    /// Paths of the files the process read.
+    public IEnumerable<string> ReadFiles =>
+            _files.Values.Where(f => f.Kind.HasFlag(LogServer.FileAccessKind.Read)).Select(f => f.Path);
+
+    /// Paths of the files the process created, wrote, deleted or renamed.
+    public IEnumerable<string> WrittenFiles =>
+            _files.Values.Where(f => (f.Kind & WriteKinds) != 0).Select(f => f.Path);
+
+    private const LogServer.FileAccessKind WriteKinds = LogServer.FileAccessKind.Write
+            | LogServer.FileAccessKind.Delete | LogServer.FileAccessKind.RenamedFrom
+            | LogServer.FileAccessKind.RenamedTo;
+
+    /// Merges reported file accesses, a path may be reported in several messages.
+    internal void AddFileAccesses(IEnumerable<LogServer.FileAccess> files) {
+        foreach (var f in files) {
+            _files[f.Path] = _files.TryGetValue(f.Path, out var existing)
+                    ? existing with {
+                        Kind = existing.Kind | f.Kind,
+                        Opens = existing.Opens + f.Opens,
+                        FailedOpens = existing.FailedOpens + f.FailedOpens,
+                    }
+                    : f;
+        }
+        PropertyChanged?.Invoke(this, new(nameof(Files)));
+    }
+
     private static Dictionary<string, (string?, string?)> CalculateEnvironmentDiff(
             Dictionary<string, string> parent, Dictionary<string, string> child) {
         var diff = new Dictionary<string, (string?, string?)>();
+        if (ReferenceEquals(parent, child)) {
+            // the child inherited the environment unchanged, the server shares the instance
+            return diff;
+        }
         // erase keys that are missing from the child
         foreach (var (k, v) in parent.Where(k => !child.ContainsKey(k.Key))) {
             diff[k] = (v, null);
@@ -10,8 +10,18 @@ internal static class DictionaryExtensions {
 
 public class TracedProcessTree {
     private readonly Dictionary<int, Node> _pidMap = [];
+    private readonly Dictionary<string, FileOpenStats> _fileStats = new(StringComparer.OrdinalIgnoreCase);
     private readonly ObservableCollection<Node> _rootProcesses = [];
 
+    /// Exits observed by the parents of processes that did not detach yet, applied when they detach.
+    private readonly Dictionary<TracedProcess, LogServer.ProcessExitObserved> _observedExits =
+            new(ReferenceEqualityComparer.Instance);
+    /// Processes that detached without an exit code, with the detach time, until their parent reports their exit.
+    private readonly Dictionary<TracedProcess, DateTime> _awaitingExit = new(ReferenceEqualityComparer.Instance);
+    /// Roots whose exit is watched by a process outside the tree (the tracer), until they finish or the watcher
+    /// disconnects.
+    private readonly List<(Node Root, int WatcherId)> _watchedRoots = [];
+
     public ReadOnlyObservableCollection<Node> RootProcesses {get;}
 
     public TracedProcessTree() {
@@ -20,6 +30,73 @@ public class TracedProcessTree {
 
     public TracedProcess? GetProcess(int id) => _pidMap.Get(id)?.Process;
 
+    /// Per-executable statistics of the processes added to the tree, kept even for processes removed by
+    /// `EvictFinished`.
+    public ExecutableStatistics Statistics {get; init;} = new();
+
+    /// Overhead of the hook in all processes that reported it, also kept for processes removed by `EvictFinished`.
+    public HookStatistics HookStatistics {get;} = new();
+
+    /// Raised when a process ends, after its `EndTime` is set. A process that detached without an exit code (e.g., it
+    /// was killed) ends once its parent reports its exit if the parent watches it (see `TracedProcess.ExitWatched`),
+    /// or when the parent itself ends; other processes end when they detach (e.g., on Linux, where the hook does not
+    /// report the exits of children).
+    public event Action<TracedProcess>? ProcessFinished;
+
+    /// Removes the process from the tree if it and all its descendants finished, together with the finished ancestors
+    /// that have no other descendants left, so that the memory of a long-running session is proportional to the number
+    /// of running processes. Returns true if the process was removed. Processes whose parent was already removed are
+    /// added as roots.
+    public bool EvictFinished(int processId) {
+        if (!_pidMap.TryGetValue(processId, out var node) || !IsFinished(node)) {
+            return false;
+        }
+        while (true) {
+            // the PID may have been reused by a newer process, which must stay in the map
+            if (_pidMap.TryGetValue(node.Process.ProcessId, out var current) && current.Process == node.Process) {
+                _pidMap.Remove(node.Process.ProcessId);
+            }
+
+            var parent = FindNode(node.Process.Parent);
+            var siblings = parent?.Children ?? _rootProcesses;
+            siblings.RemoveAt(IndexOf(siblings, node.Process));
+            if (parent == null || !IsFinished(parent.Value)) {
+                return true;
+            }
+            node = parent.Value;
+        }
+    }
+
+    private static bool IsFinished(Node node) => node.Process.EndTime != null && node.Children.Count == 0;
+
+    private Node? FindNode(TracedProcess? process) {
+        if (process == null) {
+            return null;
+        }
+        if (_pidMap.TryGetValue(process.ProcessId, out var node) && ReferenceEquals(node.Process, process)) {
+            return node;
+        }
+        // the PID was reused, search from the root of the process
+        var parent = FindNode(process.Parent);
+        var siblings = parent?.Children ?? _rootProcesses;
+        return siblings[IndexOf(siblings, process)];
+    }
+
+    private static int IndexOf(ObservableCollection<Node> nodes, TracedProcess process) {
+        // compare references, the records compare all fields
+        for (var i = 0; i < nodes.Count; i++) {
+            if (ReferenceEquals(nodes[i].Process, process)) {
+                return i;
+            }
+        }
+        throw new InvalidOperationException($"Process {process.ProcessId} is not in the tree.");
+    }
+
+    /// Files opened the most times in total by all processes, e.g., headers included by many compiler invocations.
+    public IReadOnlyList<FileOpenStats> MostReopenedFiles(int count) {
+        return _fileStats.Values.OrderByDescending(s => s.Opens).Take(count).ToList();
+    }
+
     public void HandleEvent(LogServer.ProcessEvent e) {
         switch (e) {
             case LogServer.ProcessAttach: {
@@ -29,32 +106,118 @@ public class TracedProcessTree {
             }
 
             case LogServer.ProcessDetach: {
+                if (_watchedRoots.Count > 0) {
+                    ReleaseWatchedRoots(e.ProcessId);
+                }
                 // if the process is not recorded yet, ignore this, probably just an existence check on the pipe
-                if (_pidMap.TryGetValue(e.ProcessId, out var node)) {
-                    node.Process.EndTime = e.Timestamp;
+                if (!_pidMap.TryGetValue(e.ProcessId, out var node) || node.Process.EndTime != null
+                    || _awaitingExit.ContainsKey(node.Process)) {
+                    break;
+                }
+                _observedExits.Remove(node.Process, out var observed);
+                if (node.Process.ExitCode != null) {
+                    Finish(node, e.Timestamp);
+                } else if (observed != null) {
+                    Terminate(node, observed);
+                } else if (node.Process is {ExitWatched: true, Parent.EndTime: null} || IsWatchedRoot(node.Process)) {
+                    // the parent reports the exit once it notices it, which may be after the connection closed
+                    _awaitingExit[node.Process] = e.Timestamp;
+                } else {
+                    Finish(node, e.Timestamp);
+                }
+                break;
+            }
+
+            case LogServer.ProcessExitObserved o: {
+                // processes that reported their own exit are complete; the PID may also be of a newer process
+                //  (e.g., a child skipped by the hook filter) than the one in the tree
+                if (!_pidMap.TryGetValue(e.ProcessId, out var node) || node.Process.ExitCode != null
+                    || o.Timestamp < node.Process.StartTime) {
+                    break;
+                }
+                if (_awaitingExit.Remove(node.Process)) {
+                    Terminate(node, o);
+                } else if (node.Process.EndTime == null) {
+                    // the messages of the process may still be arriving through its own connection
+                    _observedExits[node.Process] = o;
                 }
                 break;
             }
 
             case LogServer.ProcessInfo i: {
                 var parent = _pidMap.Get(i.ParentProcessId);
+                // assume that filtered processes inherited the environment, so that they do not show a spurious diff
+                var env = i.Filtered ? parent?.Process.Environment ?? [] : i.Environment;
                 var newProcess = new TracedProcess(
                         i.ProcessId, parent?.Process, i.Timestamp,
-                        i.ExePath, i.CommandLine, i.WorkingDirectory, i.Environment);
+                        i.ExePath, i.CommandLine, i.WorkingDirectory, env) {
+                    Filtered = i.Filtered,
+                    EnvironmentIncomplete = i.EnvironmentIncomplete,
+                    ExitWatched = i.ExitWatched,
+                };
                 // recording depth is useful in the GUI tree rendering, although it slightly breaks the abstraction
                 var node = new Node(newProcess, [], parent == null ? 0 : parent.Value.Depth + 1);
 
                 _pidMap[i.ProcessId] = node;
+                Statistics.ProcessStarted(newProcess);
                 if (parent == null) {
                     _rootProcesses.Add(node);
+                    if (i.ExitWatched) {
+                        _watchedRoots.Add((node, i.ParentProcessId));
+                    }
                 } else {
                     parent.Value.Children.Add(node);
                 }
+
+                if (parent != null && i.ParentProcessId == i.ProcessId && parent.Value.Process.EndTime == null) {
+                    // on Linux, `execve` replaces the program image of the process; the hook reports the new image
+                    //  as a child of the replaced one, which ends here
+                    Finish(parent.Value, i.Timestamp);
+                }
                 break;
             }
 
             case LogServer.ProcessExit ex: {
-                _pidMap[e.ProcessId].Process.ExitCode = ex.ExitCode;
+                // the start message may be missing if the hook dropped it due to a full queue
+                if (_pidMap.TryGetValue(e.ProcessId, out var node)) {
+                    node.Process.ExitCode = ex.ExitCode;
+                    if (ex.Resources != null) {
+                        node.Process.Resources = ex.Resources;
+                    }
+                }
+                break;
+            }
+
+            case LogServer.ProcessMessagesDropped d: {
+                if (_pidMap.TryGetValue(e.ProcessId, out var node)) {
+                    node.Process.DroppedMessages = d.Count;
+                }
+                break;
+            }
+
+            case LogServer.ProcessHookTimings h: {
+                if (_pidMap.TryGetValue(e.ProcessId, out var node)) {
+                    node.Process.HookTimings = h.Timings;
+                    node.Process.AddSpawns(h.Spawns);
+                    HookStatistics.SpawnsReported(h.Spawns);
+                }
+                break;
+            }
+
+            case LogServer.ProcessFileAccesses f: {
+                if (_pidMap.TryGetValue(e.ProcessId, out var node)) {
+                    foreach (var file in f.Files) {
+                        if (!_fileStats.TryGetValue(file.Path, out var stats)) {
+                            _fileStats[file.Path] = stats = new FileOpenStats(file.Path);
+                        }
+                        stats.Opens += file.Opens;
+                        stats.FailedOpens += file.FailedOpens;
+                        if (!node.Process.Files.ContainsKey(file.Path)) {
+                            stats.Processes++;
+                        }
+                    }
+                    node.Process.AddFileAccesses(f.Files);
+                }
                 break;
             }
 
@@ -64,6 +227,52 @@ public class TracedProcessTree {
         }
     }
 
+    /// Ends a process that did not report its exit, with the exit code and time observed by its parent.
+    private void Terminate(Node node, LogServer.ProcessExitObserved exit) {
+        node.Process.ExitCode = exit.ExitCode;
+        node.Process.Terminated = true;
+        Finish(node, exit.Timestamp);
+    }
+
+    private bool IsWatchedRoot(TracedProcess process) {
+        return _watchedRoots.Exists(r => ReferenceEquals(r.Root.Process, process));
+    }
+
+    /// The watcher of some roots disconnected, their exit will not be reported; roots waiting for it end when they
+    /// detached, the others when they detach.
+    private void ReleaseWatchedRoots(int watcherId) {
+        foreach (var (root, _) in _watchedRoots.Where(r => r.WatcherId == watcherId).ToList()) {
+            _watchedRoots.RemoveAll(r => ReferenceEquals(r.Root.Process, root.Process));
+            if (_awaitingExit.Remove(root.Process, out var detachTime)) {
+                Finish(root, detachTime);
+            }
+        }
+    }
+
+    private void Finish(Node node, DateTime endTime) {
+        if (node.Process.Parent == null && node.Process.ExitWatched) {
+            _watchedRoots.RemoveAll(r => ReferenceEquals(r.Root.Process, node.Process));
+        }
+        if (_awaitingExit.Count > 0) {
+            // children waiting for this process to report their exit will not get it
+            foreach (var child in node.Children.Where(c => _awaitingExit.ContainsKey(c.Process)).ToList()) {
+                _awaitingExit.Remove(child.Process, out var detachTime);
+                Finish(child, detachTime);
+            }
+        }
+        node.Process.EndTime = endTime;
+        Statistics.ProcessFinished(node.Process);
+        HookStatistics.ProcessFinished(node.Process);
+        ProcessFinished?.Invoke(node.Process);
+    }
+
+    /// Total opens of a file by all processes, and the number of processes that accessed it.
+    public record FileOpenStats(string Path) {
+        public ulong Opens {get; internal set;}
+        public ulong FailedOpens {get; internal set;}
+        public int Processes {get; internal set;}
+    }
+
     /// A tree node type that separates the process information from the hierarchy.
     public record struct Node(TracedProcess Process, ObservableCollection<Node> Children, uint Depth);
 }
\ No newline at end of file
@@ -0,0 +1,18 @@
+﻿using System.Runtime.InteropServices;
+
+namespace SpawnCamper.Core.Utils;
+
+public static partial class Linux {
+    public const int SolSocket = 1;
+    public const int SoPeerCred = 17;
+
+    [StructLayout(LayoutKind.Sequential)]
+    public struct UCred {
+        public int Pid;
+        public uint Uid;
+        public uint Gid;
+    }
+
+    [LibraryImport("libc", SetLastError = true)]
+    public static unsafe partial int getsockopt(SafeHandle socket, int level, int optName, void* optVal, ref uint optLen);
+}
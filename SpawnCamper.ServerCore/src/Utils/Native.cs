@@ -6,12 +6,36 @@ namespace SpawnCamper.Core.Utils;
 
 public class Native {
     public static int GetNamedPipeClientProcessId(SafePipeHandle pipe) {
+        if (OperatingSystem.IsLinux()) {
+            // on Unix, .NET implements named pipes as Unix domain sockets and the handle is the socket descriptor
+            return GetPeerProcessId(pipe);
+        }
         if (!Win32.GetNamedPipeClientProcessId(pipe, out var processId)) {
             Marshal.ThrowExceptionForHR(Marshal.GetHRForLastWin32Error());
         }
         return processId;
     }
 
+    private static unsafe int GetPeerProcessId(SafeHandle socket) {
+        var credentials = new Linux.UCred();
+        var size = (uint) sizeof(Linux.UCred);
+        if (Linux.getsockopt(socket, Linux.SolSocket, Linux.SoPeerCred, &credentials, ref size) != 0) {
+            throw new IOException($"getsockopt(SO_PEERCRED) failed: {Marshal.GetLastPInvokeErrorMessage()}");
+        }
+        return credentials.Pid;
+    }
+
+    /// Returns `true` if the process `processId` exited. Windows only, used for the producers of the shared memory
+    /// ring; a process that we are not allowed to open is assumed to be running.
+    public static bool HasExited(int processId) {
+        using var process = Win32.OpenProcess(Win32.Synchronize, false, processId);
+        if (process.IsInvalid) {
+            // no process has this ID (anymore); any other error means that it exists
+            return Marshal.GetLastPInvokeError() == Win32.ErrorInvalidParameter;
+        }
+        return Win32.WaitForSingleObject(process, 0) != Win32.WaitTimeout;
+    }
+
     public static unsafe void LocalFree(void* hMem) {
         if (Win32.LocalFree(hMem) != null) {
             Marshal.ThrowExceptionForHR(Marshal.GetHRForLastWin32Error());
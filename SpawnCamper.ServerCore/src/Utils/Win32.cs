@@ -14,4 +14,15 @@ public static partial class Win32 {
     [LibraryImport("kernel32.dll", SetLastError = true)]
     [return: MarshalAs(UnmanagedType.Bool)]
     public static partial bool GetNamedPipeClientProcessId(SafePipeHandle pipe, out int processId);
+
+    public const uint Synchronize = 0x00100000;
+    public const uint WaitTimeout = 0x102;
+    public const int ErrorInvalidParameter = 87;
+
+    [LibraryImport("kernel32.dll", SetLastError = true)]
+    public static partial SafeProcessHandle OpenProcess(
+            uint dwDesiredAccess, [MarshalAs(UnmanagedType.Bool)] bool bInheritHandle, int dwProcessId);
+
+    [LibraryImport("kernel32.dll", SetLastError = true)]
+    public static partial uint WaitForSingleObject(SafeProcessHandle hHandle, uint dwMilliseconds);
 }
\ No newline at end of file
@@ -0,0 +1,24 @@
+using System.Runtime.CompilerServices;
+
+namespace SpawnCamper.Tests;
+
+internal sealed class CheckFailedException(string message) : Exception(message);
+
+/// Assertions of the tests, like `CHECK` in the tests of the hook.
+internal static class Check {
+    public static void That(bool condition, [CallerArgumentExpression(nameof(condition))] string expression = "",
+            [CallerFilePath] string file = "", [CallerLineNumber] int line = 0) {
+        if (!condition) {
+            throw new CheckFailedException($"{Path.GetFileName(file)}:{line}: {expression} failed");
+        }
+    }
+
+    public static void Equal<T>(T expected, T actual,
+            [CallerArgumentExpression(nameof(actual))] string expression = "",
+            [CallerFilePath] string file = "", [CallerLineNumber] int line = 0) {
+        if (!EqualityComparer<T>.Default.Equals(expected, actual)) {
+            throw new CheckFailedException(
+                    $"{Path.GetFileName(file)}:{line}: {expression} is {actual}, expected {expected}");
+        }
+    }
+}
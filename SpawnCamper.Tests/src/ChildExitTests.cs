@@ -0,0 +1,106 @@
+using SpawnCamper.Core;
+
+namespace SpawnCamper.Tests;
+
+/// Children that disconnect without an exit code (e.g., they were killed): the process tree waits for the exit
+/// reported by the parent (`Messages::ChildExit`) only if the child reported that its parent watches it
+/// (`StartFlags::ExitWatched`).
+internal static class ChildExitTests {
+    private static readonly DateTime Start = new(2026, 1, 1, 0, 0, 0, DateTimeKind.Utc);
+
+    private static async Task<TracedProcessTree> StartAsync(bool exitWatched) {
+        var parent = await new MessageWriter()
+                .Message(MessageType.ProcessStartMinimal, Start, m => m.Varint(0).String(@"C:\build.exe"))
+                .ParseAsync(1);
+        var child = await new MessageWriter()
+                .Message(MessageType.ProcessStartMinimal, Start, m => {
+                    m.Varint(1).String(@"C:\cl.exe");
+                    if (exitWatched) {
+                        m.Varint((ulong) StartFlags.ExitWatched);
+                    }
+                })
+                .ParseAsync(2);
+        Check.Equal(exitWatched, child.OfType<LogServer.ProcessInfo>().Single().ExitWatched);
+
+        var tree = new TracedProcessTree();
+        foreach (var e in parent.Concat(child)) {
+            tree.HandleEvent(e);
+        }
+        return tree;
+    }
+
+    /// The child is parked until the parent reports its exit, which may arrive after the child disconnected.
+    public static async Task WatchedChildAsync() {
+        var tree = await StartAsync(true);
+        tree.HandleEvent(new LogServer.ProcessDetach(Start.AddSeconds(2), 2));
+        var child = tree.GetProcess(2)!;
+        Check.That(child.EndTime == null);
+
+        var exits = await new MessageWriter()
+                .Message(MessageType.ChildExit, Start.AddSeconds(1), m => m.Varint(2).Varint(1))
+                .ParseAsync(1);
+        tree.HandleEvent(exits.OfType<LogServer.ProcessExitObserved>().Single());
+        Check.Equal(Start.AddSeconds(1), child.EndTime);
+        Check.Equal(1, child.ExitCode);
+        Check.That(child.Terminated);
+    }
+
+    /// Without a parent watching it (e.g., on Linux, or with a version 1 server), nothing would report the exit, the
+    /// child ends when it disconnects.
+    public static async Task UnwatchedChildAsync() {
+        var tree = await StartAsync(false);
+        tree.HandleEvent(new LogServer.ProcessDetach(Start.AddSeconds(2), 2));
+        var child = tree.GetProcess(2)!;
+        Check.Equal(Start.AddSeconds(2), child.EndTime);
+        Check.That(child.ExitCode == null && !child.Terminated);
+    }
+
+    private const int TracerId = 100;
+
+    /// The root, started and watched by the tracer, which is not part of the tree.
+    private static async Task<TracedProcessTree> StartRootAsync() {
+        var root = await new MessageWriter()
+                .Message(MessageType.ProcessStartMinimal, Start, m => m
+                        .Varint(TracerId).String(@"C:uild.exe").Varint((ulong) StartFlags.ExitWatched))
+                .ParseAsync(1);
+        var tree = new TracedProcessTree();
+        foreach (var e in root) {
+            tree.HandleEvent(e);
+        }
+        Check.That(tree.RootProcesses.Single().Process.ExitWatched);
+        return tree;
+    }
+
+    /// The tracer reports the exit of the root through its own connection, after the root disconnected.
+    public static async Task WatchedRootAsync() {
+        var tree = await StartRootAsync();
+        tree.HandleEvent(new LogServer.ProcessDetach(Start.AddSeconds(2), 1));
+        var root = tree.GetProcess(1)!;
+        Check.That(root.EndTime == null);
+
+        var exits = await new MessageWriter()
+                .Message(MessageType.ChildExit, Start.AddSeconds(1), m => m.Varint(1).Varint(3))
+                .ParseAsync(TracerId);
+        tree.HandleEvent(exits.OfType<LogServer.ProcessExitObserved>().Single());
+        tree.HandleEvent(new LogServer.ProcessDetach(Start.AddSeconds(3), TracerId));
+        Check.Equal(Start.AddSeconds(1), root.EndTime);
+        Check.Equal(3, root.ExitCode);
+        Check.That(root.Terminated);
+    }
+
+    /// The tracer disconnected without reporting the exit (e.g., it was killed): the root ends when it disconnected, or
+    /// when it disconnects later.
+    public static async Task RootWatcherGoneAsync() {
+        var tree = await StartRootAsync();
+        tree.HandleEvent(new LogServer.ProcessDetach(Start.AddSeconds(2), 1));
+        tree.HandleEvent(new LogServer.ProcessDetach(Start.AddSeconds(3), TracerId));
+        var root = tree.GetProcess(1)!;
+        Check.Equal(Start.AddSeconds(2), root.EndTime);
+        Check.That(root.ExitCode == null && !root.Terminated);
+
+        tree = await StartRootAsync();
+        tree.HandleEvent(new LogServer.ProcessDetach(Start.AddSeconds(2), TracerId));
+        tree.HandleEvent(new LogServer.ProcessDetach(Start.AddSeconds(3), 1));
+        Check.Equal(Start.AddSeconds(3), tree.GetProcess(1)!.EndTime);
+    }
+}
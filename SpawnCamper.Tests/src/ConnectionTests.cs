@@ -0,0 +1,87 @@
+using System.Buffers.Binary;
+using System.IO.Pipes;
+using SpawnCamper.Core;
+
+namespace SpawnCamper.Tests;
+
+/// The listener pool of `LogServer`: a burst of clients connecting at once (a parallel build starting its processes)
+/// must always find a pending pipe instance, so `ListenerMetrics.Exhausted` stays 0.
+internal static class ConnectionTests {
+    private static readonly TimeSpan Timeout = TimeSpan.FromSeconds(30);
+
+    public static async Task PoolNotExhaustedAsync() {
+        // a burst smaller than the pool never takes the last pending instance; repeated bursts check that the pool
+        //  is refilled after each of them
+        const int bursts = 3;
+        var burstSize = LogServer.DefaultListenerCount - 1;
+        var listeners = await ConnectBurstsAsync(LogServer.DefaultListenerCount, bursts, burstSize);
+        Check.Equal(0L, listeners.Exhausted);
+        Check.Equal((long) bursts * burstSize, listeners.Accepted);
+    }
+
+    public static async Task SingleListenerExhaustedAsync() {
+        // without the pool, every accepted client leaves the server with no pending instance until it is replaced;
+        //  this is what the test above would measure if the pool was not used
+        const int clientCount = 4;
+        var listeners = await ConnectBurstsAsync(1, 1, clientCount);
+        Check.Equal((long) clientCount, listeners.Exhausted);
+        Check.Equal((long) clientCount, listeners.Accepted);
+    }
+
+    /// Runs a server with `listenerCount` listeners and connects `bursts` bursts of `burstSize` clients. Before each
+    /// burst, waits until all listeners are pending again, like a server started well before the build.
+    private static async Task<LogServer.ListenerMetrics> ConnectBurstsAsync(
+            int listenerCount, int bursts, int burstSize) {
+        var pipeName = $"SpawnCamper.Tests.{Environment.ProcessId}.{Guid.NewGuid():N}";
+        var server = new LogServer(pipeName, 0, listenerCount);
+        using var cts = new CancellationTokenSource();
+
+        var detached = 0;
+        var serverTask = server.RunAsync(e => {
+            if (e is LogServer.ProcessDetach) {
+                Interlocked.Increment(ref detached);
+            }
+        }, cts.Token);
+
+        try {
+            for (var i = 0; i < bursts; i++) {
+                await WaitUntilAsync(() => server.Listeners.Pending == listenerCount);
+                var start = new TaskCompletionSource();
+                var clients = Enumerable.Range(0, burstSize).Select(_ => Task.Run(async () => {
+                    await start.Task;
+                    await ConnectAsync(pipeName);
+                })).ToList();
+                start.SetResult();
+                await Task.WhenAll(clients).WaitAsync(Timeout);
+                var expected = (i + 1) * burstSize;
+                await WaitUntilAsync(() => Volatile.Read(ref detached) == expected);
+            }
+        } finally {
+            await cts.CancelAsync();
+            try {
+                await serverTask;
+            } catch (OperationCanceledException) {}
+        }
+        return server.Listeners;
+    }
+
+    private static async Task WaitUntilAsync(Func<bool> condition) {
+        var deadline = DateTime.UtcNow + Timeout;
+        while (!condition()) {
+            Check.That(DateTime.UtcNow < deadline);
+            await Task.Delay(1);
+        }
+    }
+
+    /// Connects like a hook using protocol version 2 that exits without sending any message.
+    private static async Task ConnectAsync(string pipeName) {
+        await using var pipe = new NamedPipeClientStream(".", pipeName, PipeDirection.InOut, PipeOptions.Asynchronous);
+        await pipe.ConnectAsync((int) Timeout.TotalMilliseconds);
+        var version = new byte[4];
+        await pipe.ReadExactlyAsync(version);
+        var preamble = new byte[8];
+        BinaryPrimitives.WriteUInt32LittleEndian(preamble, 0x32504353);
+        BinaryPrimitives.WriteUInt32LittleEndian(preamble.AsSpan(4), 2);
+        await pipe.WriteAsync(preamble);
+    }
+}
@@ -0,0 +1,120 @@
+using System.Runtime.InteropServices;
+using SpawnCamper.Core;
+
+namespace SpawnCamper.Tests;
+
+/// Environments sent as a delta against the environment of the parent (`Messages::ProcessStartEnvDelta`): the parser
+/// resolves them through `EnvironmentCache`, asks the hook for the full environment when the base is missing and
+/// defers the other messages of the process until it arrives.
+internal static class EnvironmentDeltaTests {
+    private static readonly DateTime Start = new(2026, 1, 1, 0, 0, 0, DateTimeKind.Utc);
+    private static readonly TimeSpan BaseTimeout = TimeSpan.FromMilliseconds(10);
+
+    private const string ParentEnv = "A=1\0B=2\0";
+    private const string ChildEnv = "A=1\0C=3\0";
+
+    /// Hash of an environment block, as computed by the hook.
+    private static ulong Hash(string block) => EnvironmentCache.Hash(MemoryMarshal.AsBytes(block.AsSpan()));
+
+    private static MessageWriter ParentStart(this MessageWriter writer, string env = ParentEnv) {
+        return writer.Message(MessageType.ProcessStart, Start, m => m
+                .Varint(0).String(@"C:\build.exe").String("build").String(@"C:\").String(env));
+    }
+
+    /// The child removes `B` and adds `C`.
+    private static MessageWriter ChildDelta(this MessageWriter writer) {
+        return writer.Message(MessageType.ProcessStartEnvDelta, Start, m => m
+                .Varint(1).String(@"C:\cl.exe").String("cl").String(@"C:\")
+                .Fixed64(Hash(ChildEnv)).Fixed64(Hash(ParentEnv)).String("B\0").String("C=3\0"));
+    }
+
+    private static MessageWriter Dropped(this MessageWriter writer, ulong count) {
+        return writer.Message(MessageType.DroppedMessages, Start, m => m.Varint(count));
+    }
+
+    private static byte[] Reply(EnvironmentReply reply, ulong envHash) {
+        return [(byte) reply, ..BitConverter.GetBytes(envHash)];
+    }
+
+    private static void CheckEnvironment(string expected, Dictionary<string, string> env) {
+        var entries = expected.Split('\0', StringSplitOptions.RemoveEmptyEntries);
+        Check.Equal(entries.Length, env.Count);
+        foreach (var entry in entries) {
+            var (name, value) = (entry[..entry.IndexOf('=')], entry[(entry.IndexOf('=') + 1)..]);
+            Check.Equal(value, env.GetValueOrDefault(name));
+        }
+    }
+
+    /// The parent reported its environment, the delta is applied to it and cached for other children.
+    public static async Task BaseResolvedAsync() {
+        var cache = new EnvironmentCache();
+        await new MessageWriter().ParentStart().ParseAsync(1, cache);
+        var replies = new MemoryStream();
+        var events = await new MessageWriter().ChildDelta().ParseAsync(2, cache, replies, BaseTimeout);
+
+        var info = events.OfType<LogServer.ProcessInfo>().Single();
+        Check.That(!info.EnvironmentIncomplete);
+        CheckEnvironment(ChildEnv, info.Environment);
+        Check.That(replies.ToArray().SequenceEqual(Reply(EnvironmentReply.Resolved, Hash(ChildEnv))));
+        Check.That(cache.TryGet(Hash(ChildEnv), out var cached) && ReferenceEquals(cached, info.Environment));
+    }
+
+    /// The base is missing: the hook is asked for the full environment, the messages sent before it are reported after
+    /// the start, in the order they were sent.
+    public static async Task FullEnvironmentDeferredAsync() {
+        var cache = new EnvironmentCache();
+        var replies = new MemoryStream();
+        var events = await new MessageWriter()
+                .ChildDelta()
+                .Dropped(1)
+                .Dropped(2)
+                .Message(MessageType.EnvironmentSnapshot, Start, m => m.String(ChildEnv))
+                .Dropped(3)
+                .Message(MessageType.ExitProcess, Start.AddSeconds(1), m => m.Varint(0))
+                .ParseAsync(2, cache, replies, BaseTimeout);
+
+        Check.That(replies.ToArray().SequenceEqual(Reply(EnvironmentReply.SendFull, Hash(ChildEnv))));
+        var info = (LogServer.ProcessInfo) events[0];
+        Check.That(!info.EnvironmentIncomplete);
+        CheckEnvironment(ChildEnv, info.Environment);
+        var dropped = events.OfType<LogServer.ProcessMessagesDropped>().Select(d => d.Count);
+        Check.That(dropped.SequenceEqual<ulong>([1, 2, 3]));
+        Check.That(events[^1] is LogServer.ProcessExit);
+        Check.That(cache.TryGet(Hash(ChildEnv), out _));
+    }
+
+    /// The process exits before sending the full environment: it is reported with the variables of the delta, which are
+    /// not cached, since other processes with the same hash have the full environment.
+    public static async Task StreamEndsAsync() {
+        var cache = new EnvironmentCache();
+        var replies = new MemoryStream();
+        var events = await new MessageWriter()
+                .ChildDelta()
+                .Dropped(1)
+                .ParseAsync(2, cache, replies, BaseTimeout);
+
+        Check.That(replies.ToArray().SequenceEqual(Reply(EnvironmentReply.SendFull, Hash(ChildEnv))));
+        Check.Equal(2, events.Count);
+        var info = (LogServer.ProcessInfo) events[0];
+        Check.That(info.EnvironmentIncomplete);
+        CheckEnvironment("C=3\0", info.Environment);
+        Check.That(events[1] is LogServer.ProcessMessagesDropped {Count: 1});
+        Check.That(!cache.TryGet(Hash(ChildEnv), out _));
+    }
+
+    /// The environment of the parent was evicted by newer ones; without a connection to ask the hook, the child is
+    /// reported with the variables of the delta.
+    public static async Task EvictedParentAsync() {
+        var cache = new EnvironmentCache(capacity: 2);
+        await new MessageWriter().ParentStart().ParseAsync(1, cache);
+        await new MessageWriter().ParentStart("X=1\0").ParseAsync(3, cache);
+        await new MessageWriter().ParentStart("Y=1\0").ParseAsync(4, cache);
+        Check.That(!cache.TryGet(Hash(ParentEnv), out _));
+
+        var events = await new MessageWriter().ChildDelta().ParseAsync(2, cache, null, BaseTimeout);
+        var info = events.OfType<LogServer.ProcessInfo>().Single();
+        Check.That(info.EnvironmentIncomplete);
+        CheckEnvironment("C=3\0", info.Environment);
+        Check.That(!cache.TryGet(Hash(ChildEnv), out _));
+    }
+}
@@ -0,0 +1,81 @@
+using SpawnCamper.Core;
+
+namespace SpawnCamper.Tests;
+
+/// `Messages::HookTimings`: the hook reports it once the start is reported and again before the process exits, with
+/// cumulative totals, so the process tree keeps the last one and the spawns of all of them.
+internal static class HookTimingsTests {
+    private static readonly DateTime Start = new(2026, 1, 1, 0, 0, 0, DateTimeKind.Utc);
+
+    private static readonly LogServer.HookTimings AttachTimings = new(
+            Attach: TimeSpan.FromTicks(100), Connect: TimeSpan.FromTicks(2000), BusyWaits: 1,
+            LogAttach: TimeSpan.FromTicks(300), WriteTime: TimeSpan.FromTicks(40), Writes: 1,
+            SpawnLatency: TimeSpan.FromTicks(5000));
+
+    private static MessageWriter Timings(this MessageWriter writer, DateTime timestamp,
+            LogServer.HookTimings timings, params LogServer.ChildSpawn[] spawns) {
+        return writer.Message(MessageType.HookTimings, timestamp, m => {
+            m.Varint((ulong) timings.Attach.Ticks).Varint((ulong) timings.Connect.Ticks).Varint(timings.BusyWaits)
+                    .Varint((ulong) timings.LogAttach.Ticks).Varint((ulong) timings.WriteTime.Ticks)
+                    .Varint(timings.Writes).Varint((ulong) (timings.SpawnLatency ?? TimeSpan.Zero).Ticks)
+                    .Varint((ulong) spawns.Length);
+            foreach (var spawn in spawns) {
+                m.Varint((ulong) spawn.ProcessId).Varint((ulong) spawn.CreateProcess.Ticks)
+                        .Varint((ulong) spawn.Detour.Ticks);
+            }
+        });
+    }
+
+    private static TracedProcessTree Replay(List<LogServer.ProcessEvent> events, DateTime detach) {
+        var tree = new TracedProcessTree();
+        foreach (var e in events) {
+            tree.HandleEvent(e);
+        }
+        tree.HandleEvent(new LogServer.ProcessDetach(detach, 1));
+        return tree;
+    }
+
+    /// A killed process never reaches `ExitProcess`, only the timings sent after the start are known.
+    public static async Task KilledProcessAsync() {
+        var events = await new MessageWriter()
+                .Message(MessageType.ProcessStartMinimal, Start, m => m.Varint(0).String(@"C:\a.exe"))
+                .Timings(Start, AttachTimings)
+                .ParseAsync();
+        var tree = Replay(events, Start.AddSeconds(1));
+
+        var process = tree.GetProcess(1)!;
+        Check.That(process.ExitCode == null);
+        Check.Equal(AttachTimings, process.HookTimings);
+        var stats = tree.HookStatistics;
+        Check.Equal(1L, stats.Overhead.Count);
+        Check.Equal(AttachTimings.Overhead, stats.Overhead.Total);
+        Check.Equal(1L, stats.SpawnLatency.Count);
+        Check.Equal(1L, stats.BusyWaits);
+    }
+
+    /// Later messages replace the totals and add their spawns; the process is counted once, with the last totals.
+    public static async Task RepeatedTimingsAsync() {
+        var exitTimings = AttachTimings with {WriteTime = TimeSpan.FromTicks(900), Writes = 7};
+        var first = new LogServer.ChildSpawn(2, TimeSpan.FromTicks(10000), TimeSpan.FromTicks(12000));
+        var second = new LogServer.ChildSpawn(3, TimeSpan.FromTicks(20000), TimeSpan.FromTicks(21000));
+        var events = await new MessageWriter()
+                .Message(MessageType.ProcessStartMinimal, Start, m => m.Varint(0).String(@"C:\a.exe"))
+                .Timings(Start, AttachTimings)
+                .Timings(Start.AddSeconds(1), AttachTimings with {Writes = 3}, first)
+                .Timings(Start.AddSeconds(2), exitTimings, second)
+                .Message(MessageType.ExitProcess, Start.AddSeconds(2), m => m.Varint(0))
+                .ParseAsync();
+        Check.Equal(3, events.OfType<LogServer.ProcessHookTimings>().Count());
+        var tree = Replay(events, Start.AddSeconds(2));
+
+        var process = tree.GetProcess(1)!;
+        Check.Equal(exitTimings, process.HookTimings);
+        Check.That(process.Spawns.SequenceEqual([first, second]));
+        var stats = tree.HookStatistics;
+        Check.Equal(1L, stats.Overhead.Count);
+        Check.Equal(exitTimings.Overhead, stats.Overhead.Total);
+        Check.Equal(1L, stats.BusyWaits);
+        Check.Equal(2L, stats.CreateProcess.Count);
+        Check.Equal(TimeSpan.FromTicks(3000), stats.CreateProcessOverhead.Total);
+    }
+}
@@ -0,0 +1,88 @@
+using System.Buffers.Binary;
+using SpawnCamper.Core;
+
+namespace SpawnCamper.Tests;
+
+/// Encodes messages in protocol version 2, like `Protocol::encode` in the hook, so that the tests can feed the parser
+/// exactly what a hook would send through its pipe.
+internal sealed class MessageWriter {
+    private readonly MemoryStream _stream = new();
+    private readonly MemoryStream _message = new();
+
+    public MessageWriter() {
+        Span<byte> preamble = stackalloc byte[8];
+        BinaryPrimitives.WriteUInt32LittleEndian(preamble, 0x32504353);
+        BinaryPrimitives.WriteUInt32LittleEndian(preamble[4..], 2);
+        _stream.Write(preamble);
+    }
+
+    /// Appends a message, `fields` writes its fields in the order of the message definition in `Protocol.hpp`.
+    public MessageWriter Message(MessageType type, DateTime timestamp, Action<MessageWriter> fields) {
+        _message.SetLength(0);
+        _message.WriteByte((byte) type);
+        Fixed64((ulong) timestamp.ToFileTimeUtc());
+        fields(this);
+        WriteVarint(_stream, (ulong) _message.Length);
+        _message.WriteTo(_stream);
+        return this;
+    }
+
+    public MessageWriter Varint(ulong value) {
+        WriteVarint(_message, value);
+        return this;
+    }
+
+    public MessageWriter Fixed64(ulong value) {
+        Span<byte> bytes = stackalloc byte[8];
+        BinaryPrimitives.WriteUInt64LittleEndian(bytes, value);
+        _message.Write(bytes);
+        return this;
+    }
+
+    /// Latin-1 if all characters fit, UTF-16 otherwise; `null` is a null string.
+    public MessageWriter String(string? value) {
+        if (value == null) {
+            return Varint(3);
+        }
+        if (value.All(c => c <= 0xff)) {
+            Varint((ulong) value.Length << 2);
+            foreach (var c in value) {
+                _message.WriteByte((byte) c);
+            }
+        } else {
+            Varint((ulong) value.Length * 2 << 2 | 2);
+            foreach (var c in value) {
+                _message.WriteByte((byte) c);
+                _message.WriteByte((byte) (c >> 8));
+            }
+        }
+        return this;
+    }
+
+    private static void WriteVarint(Stream stream, ulong value) {
+        while (value >= 0x80) {
+            stream.WriteByte((byte) (value | 0x80));
+            value >>= 7;
+        }
+        stream.WriteByte((byte) value);
+    }
+
+    /// Parses the written messages as a single pipe connection of process `processId` and returns the reported events.
+    /// Connections of processes sharing environments share `envCache`; the replies to environment deltas are written to
+    /// `replies`, the parser waits up to `baseEnvironmentTimeout` for a missing base environment.
+    public async Task<List<LogServer.ProcessEvent>> ParseAsync(
+            int processId = 1, EnvironmentCache? envCache = null, Stream? replies = null,
+            TimeSpan baseEnvironmentTimeout = default) {
+        var events = new List<LogServer.ProcessEvent>();
+        using var reader = new LogReader(new MemoryStream(_stream.ToArray()));
+        var version = (await reader.ReadProtocolVersionAsync(CancellationToken.None))!.Value;
+        var parser = new MessageParser(reader, version, processId, envCache ?? new EnvironmentCache(), events.Add,
+                replies, baseEnvironmentTimeout);
+        try {
+            while (true) {
+                await parser.ReadMessageAsync(CancellationToken.None);
+            }
+        } catch (EndOfStreamException) {}
+        return events;
+    }
+}
@@ -0,0 +1,45 @@
+namespace SpawnCamper.Tests;
+
+/// Checks of the server core that run without a hook or a traced process: `dotnet run --project SpawnCamper.Tests`
+/// runs all of them, test names passed as arguments select only some. The exit code is non-zero if any test failed.
+public static class Program {
+    private static readonly (string Name, Func<Task> Run)[] Tests = [
+        ("exit-resources", ResourceUsageTests.ExitWithResourcesAsync),
+        ("exit-without-resources", ResourceUsageTests.ExitWithoutResourcesAsync),
+        ("env-delta-resolved", EnvironmentDeltaTests.BaseResolvedAsync),
+        ("env-delta-full-deferred", EnvironmentDeltaTests.FullEnvironmentDeferredAsync),
+        ("env-delta-stream-ends", EnvironmentDeltaTests.StreamEndsAsync),
+        ("env-delta-evicted-parent", EnvironmentDeltaTests.EvictedParentAsync),
+        ("hook-timings-killed", HookTimingsTests.KilledProcessAsync),
+        ("hook-timings-repeated", HookTimingsTests.RepeatedTimingsAsync),
+        ("child-exit-watched", ChildExitTests.WatchedChildAsync),
+        ("child-exit-unwatched", ChildExitTests.UnwatchedChildAsync),
+        ("child-exit-watched-root", ChildExitTests.WatchedRootAsync),
+        ("child-exit-root-watcher-gone", ChildExitTests.RootWatcherGoneAsync),
+        ("tree-evict-finished", TreeTests.EvictFinishedAsync),
+        ("tree-evict-ancestors", TreeTests.EvictAncestorsAsync),
+        ("tree-evict-reused-pid", TreeTests.EvictReusedPidAsync),
+        ("tree-evict-replaced-image", TreeTests.EvictReplacedImageAsync),
+        ("tree-stream-bounded", TreeTests.StreamBoundedAsync),
+        ("listener-pool-not-exhausted", ConnectionTests.PoolNotExhaustedAsync),
+        ("single-listener-exhausted", ConnectionTests.SingleListenerExhaustedAsync),
+    ];
+
+    public static async Task<int> Main(string[] args) {
+        var failed = 0;
+        foreach (var (name, run) in Tests) {
+            if (args.Length > 0 && !args.Contains(name)) {
+                continue;
+            }
+            try {
+                await run();
+                Console.WriteLine($"{name}: ok");
+            } catch (Exception e) {
+                failed++;
+                Console.WriteLine($"{name}: FAILED");
+                Console.WriteLine(e);
+            }
+        }
+        return failed == 0 ? 0 : 1;
+    }
+}
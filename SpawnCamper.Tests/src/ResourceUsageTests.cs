@@ -0,0 +1,50 @@
+using SpawnCamper.Core;
+
+namespace SpawnCamper.Tests;
+
+/// The resource usage that the hook appends to `ExitProcess` (`Messages::ResourceUsageFields`), decoded by the parser
+/// and kept by the process tree.
+internal static class ResourceUsageTests {
+    private static readonly DateTime Start = new(2026, 1, 1, 0, 0, 0, DateTimeKind.Utc);
+
+    public static async Task ExitWithResourcesAsync() {
+        var expected = new LogServer.ResourceUsage(
+                UserTime: TimeSpan.FromTicks(1234567), KernelTime: TimeSpan.FromTicks(127),
+                PeakWorkingSet: 128, PeakCommit: 1ul << 40, ReadBytes: ulong.MaxValue, WriteBytes: 0,
+                ReadOperations: 16384, WriteOperations: 1, HandleCount: uint.MaxValue, ThreadCount: 3);
+        var events = await new MessageWriter()
+                .Message(MessageType.ProcessStartMinimal, Start, m => m.Varint(0).String(@"C:\a.exe"))
+                .Message(MessageType.ExitProcess, Start.AddSeconds(1), m => m
+                        .Varint(0xc0000005)
+                        .Varint((ulong) expected.UserTime.Ticks).Varint((ulong) expected.KernelTime.Ticks)
+                        .Varint(expected.PeakWorkingSet).Varint(expected.PeakCommit)
+                        .Varint(expected.ReadBytes).Varint(expected.WriteBytes)
+                        .Varint(expected.ReadOperations).Varint(expected.WriteOperations)
+                        .Varint(expected.HandleCount).Varint(expected.ThreadCount))
+                .ParseAsync();
+
+        var exit = events.OfType<LogServer.ProcessExit>().Single();
+        Check.Equal(unchecked((int) 0xc0000005), exit.ExitCode);
+        Check.Equal(expected, exit.Resources);
+
+        var tree = new TracedProcessTree();
+        foreach (var e in events) {
+            tree.HandleEvent(e);
+        }
+        tree.HandleEvent(new LogServer.ProcessDetach(Start.AddSeconds(1), 1));
+        Check.Equal(expected, tree.GetProcess(1)!.Resources);
+    }
+
+    /// Older hooks (and the Linux hook) send only the exit code.
+    public static async Task ExitWithoutResourcesAsync() {
+        var events = await new MessageWriter()
+                .Message(MessageType.ExitProcess, Start, m => m.Varint(3))
+                .Message(MessageType.DroppedMessages, Start, m => m.Varint(1))
+                .ParseAsync();
+        var exit = events.OfType<LogServer.ProcessExit>().Single();
+        Check.Equal(3, exit.ExitCode);
+        Check.That(exit.Resources == null);
+        // the message after the exit is still decoded, the parser did not read past the end of the exit message
+        Check.Equal(1ul, events.OfType<LogServer.ProcessMessagesDropped>().Single().Count);
+    }
+}
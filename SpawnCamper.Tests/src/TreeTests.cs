@@ -0,0 +1,166 @@
+using SpawnCamper.Core;
+
+namespace SpawnCamper.Tests;
+
+/// `TracedProcessTree.EvictFinished`, wired to `ProcessFinished` like `SpawnCamper.ServerCli --stream` does, so that
+/// the tree only holds the running processes and their ancestors.
+internal static class TreeTests {
+    private static readonly DateTime Start = new(2026, 1, 1, 0, 0, 0, DateTimeKind.Utc);
+
+    /// Events of a session, timestamps increase by a millisecond per event.
+    private sealed class Session {
+        public readonly TracedProcessTree Tree = new();
+        public readonly List<int> Finished = [];
+        private DateTime _time = Start;
+
+        public Session(bool evictFinished = true) {
+            Tree.ProcessFinished += process => {
+                Finished.Add(process.ProcessId);
+                if (evictFinished) {
+                    Tree.EvictFinished(process.ProcessId);
+                }
+            };
+        }
+
+        private DateTime Now() => _time = _time.AddMilliseconds(1);
+
+        public void StartProcess(int processId, int parentId) {
+            Tree.HandleEvent(new LogServer.ProcessInfo(
+                    Now(), processId, parentId, $"/bin/p{processId}", $"p{processId}", "/", []));
+        }
+
+        public void Exit(int processId, int exitCode = 0) {
+            Tree.HandleEvent(new LogServer.ProcessExit(Now(), processId, exitCode));
+            Tree.HandleEvent(new LogServer.ProcessDetach(Now(), processId));
+        }
+
+        public void Detach(int processId) {
+            Tree.HandleEvent(new LogServer.ProcessDetach(Now(), processId));
+        }
+
+        public int NodeCount() {
+            static int Count(IEnumerable<TracedProcessTree.Node> nodes) => nodes.Sum(n => 1 + Count(n.Children));
+            return Count(Tree.RootProcesses);
+        }
+    }
+
+    public static Task EvictFinishedAsync() {
+        // 1 -> 2 -> 4
+        //   -> 3
+        var s = new Session();
+        s.StartProcess(1, 0);
+        s.StartProcess(2, 1);
+        s.StartProcess(3, 1);
+        s.StartProcess(4, 2);
+        Check.Equal(4, s.NodeCount());
+        Check.That(!s.Tree.EvictFinished(1));
+
+        s.Exit(4);
+        // the parent is still running and stays
+        Check.Equal(3, s.NodeCount());
+        Check.That(s.Tree.GetProcess(4) == null);
+        Check.That(s.Tree.GetProcess(2) != null);
+        s.Exit(3);
+        s.Exit(2);
+        Check.Equal(1, s.NodeCount());
+        Check.Equal(0, s.Tree.RootProcesses.Single().Children.Count);
+        s.Exit(1);
+        Check.Equal(0, s.NodeCount());
+        Check.That(s.Finished.SequenceEqual([4, 3, 2, 1]));
+        Check.That(Enumerable.Range(1, 4).All(pid => s.Tree.GetProcess(pid) == null));
+        // the statistics are kept for the evicted processes
+        Check.Equal(4L, s.Tree.Statistics.ByExecutable.Sum(g => g.Finished));
+        return Task.CompletedTask;
+    }
+
+    /// A finished process stays while it has running descendants, and is evicted together with the last of them.
+    public static Task EvictAncestorsAsync() {
+        var s = new Session();
+        s.StartProcess(1, 0);
+        s.StartProcess(2, 1);
+        s.StartProcess(3, 2);
+        s.Exit(2);
+        s.Exit(1);
+        Check.Equal(3, s.NodeCount());
+        Check.That(s.Tree.GetProcess(1)!.EndTime != null);
+
+        s.Exit(3);
+        Check.Equal(0, s.NodeCount());
+        Check.That(s.Tree.GetProcess(1) == null && s.Tree.GetProcess(2) == null);
+
+        // a child of an evicted process is added as a root
+        s.StartProcess(4, 1);
+        var orphan = s.Tree.RootProcesses.Single();
+        Check.Equal(4, orphan.Process.ProcessId);
+        Check.That(orphan.Process.Parent == null);
+        Check.Equal(0u, orphan.Depth);
+        return Task.CompletedTask;
+    }
+
+    /// A process whose PID is reused while its finished predecessor is still in the tree.
+    public static Task EvictReusedPidAsync() {
+        var s = new Session();
+        s.StartProcess(1, 0);
+        s.StartProcess(2, 1);
+        s.StartProcess(3, 2);
+        s.Exit(2);
+        // PID 2 is reused for a new child of 1, while the old 2 waits for its child 3
+        s.StartProcess(2, 1);
+        var reused = s.Tree.GetProcess(2)!;
+        Check.That(reused.EndTime == null);
+
+        s.Exit(3);
+        // the old 2 is evicted with its last child, the new one stays in the tree and in the PID map
+        Check.That(ReferenceEquals(reused, s.Tree.GetProcess(2)));
+        Check.Equal(2, s.NodeCount());
+        Check.That(ReferenceEquals(reused, s.Tree.RootProcesses.Single().Children.Single().Process));
+
+        s.Exit(2);
+        s.Exit(1);
+        Check.Equal(0, s.NodeCount());
+        return Task.CompletedTask;
+    }
+
+    /// On Linux, `execve` reports the new program image as a child with the same PID, which ends the replaced one.
+    public static Task EvictReplacedImageAsync() {
+        var s = new Session();
+        s.StartProcess(1, 0);
+        s.StartProcess(2, 1);
+        s.StartProcess(2, 2);
+        Check.Equal(3, s.NodeCount());
+        Check.That(s.Finished.SequenceEqual([2]));
+
+        s.Exit(2);
+        Check.Equal(1, s.NodeCount());
+        Check.That(s.Tree.GetProcess(2) == null);
+        return Task.CompletedTask;
+    }
+
+    /// The memory of a long session is bounded by the running processes, not by all processes it ever had.
+    public static Task StreamBoundedAsync() {
+        var s = new Session();
+        s.StartProcess(1, 0);
+        var maxNodes = 0;
+        for (var i = 0; i < 10000; i++) {
+            // a few processes running at the same time, like the workers of a parallel build
+            var pid = 100 + i % 64;
+            s.StartProcess(pid, 1);
+            maxNodes = Math.Max(maxNodes, s.NodeCount());
+            if (i >= 8) {
+                s.Exit(100 + (i - 8) % 64);
+            }
+        }
+        Check.That(maxNodes <= 10);
+        Check.Equal(9, s.NodeCount());
+
+        // without eviction, the tree keeps everything
+        var full = new Session(evictFinished: false);
+        full.StartProcess(1, 0);
+        for (var i = 0; i < 100; i++) {
+            full.StartProcess(100 + i, 1);
+            full.Exit(100 + i);
+        }
+        Check.Equal(101, full.NodeCount());
+        return Task.CompletedTask;
+    }
+}
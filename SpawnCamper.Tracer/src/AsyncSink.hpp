@@ -0,0 +1,219 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "BoundedQueue.hpp"
+#include "MessageSink.hpp"
+#include "Protocol.hpp"
+#include "Utils.hpp"
+
+/// What to do with a new message when the queue of `AsyncSink` is full.
+enum class OverflowPolicy : uint32_t {
+    /// Wait until the writer thread makes space in the queue.
+    Block,
+    /// Discard the new message.
+    DropNewest,
+    /// Discard the oldest queued message to make space for the new one.
+    DropOldest,
+};
+
+/// Sink that queues messages and passes them to the inner sink on a background thread, so that a slow server
+///  does not stall the traced process.
+class AsyncSink final : public MessageSink {
+    std::unique_ptr<MessageSink> m_inner;
+    OverflowPolicy m_policy;
+    BoundedQueue<std::vector<std::byte>> m_queue;
+
+    /// Number of messages added to the queue.
+    std::atomic<uint64_t> m_pushed{0};
+    /// Number of messages removed from the queue, either written out or dropped by `OverflowPolicy::DropOldest`.
+    std::atomic<uint64_t> m_completed{0};
+    std::atomic<uint64_t> m_dropped{0};
+    /// Incremented to wake up the writer thread.
+    std::atomic<uint32_t> m_wake{0};
+    /// Once set, the writer thread no longer writes to the inner sink; it is checked with `m_write_mutex` held.
+    std::atomic<bool> m_stop{false};
+    /// Once set, messages are written directly on the calling thread.
+    std::atomic<bool> m_synchronous{false};
+    /// Serializes access to the inner sink from the writer thread and from synchronous writes.
+    std::mutex m_write_mutex;
+    /// Reply read by the writer thread, valid while `m_reply_ready` is set, see `read_reply`.
+    std::array<std::byte, Protocol::ENVIRONMENT_REPLY_SIZE> m_reply{};
+    std::atomic<bool> m_reply_ready{false};
+    std::thread m_writer;
+
+public:
+    AsyncSink(std::unique_ptr<MessageSink> inner, OverflowPolicy policy, size_t capacity)
+        : m_inner(std::move(inner)), m_policy(policy), m_queue(capacity) {
+        m_writer = std::thread([this] { run_writer(); });
+    }
+
+    ~AsyncSink() override {
+        m_stop = true;
+        m_wake.fetch_add(1);
+        m_wake.notify_one();
+        m_writer.join();
+    }
+
+    AsyncSink(const AsyncSink&) = delete;
+    AsyncSink& operator=(const AsyncSink&) = delete;
+
+    void write(std::span<const std::span<const std::byte>> chunks) override {
+        if (m_synchronous) {
+            std::unique_lock lock(m_write_mutex);
+            m_inner->write(chunks);
+            return;
+        }
+
+        auto fill = [&](std::vector<std::byte>& message) {
+            message.clear();
+            for (auto chunk : chunks) {
+                message.insert(message.end(), chunk.begin(), chunk.end());
+            }
+        };
+
+        while (!m_queue.try_push(fill)) {
+            if (m_policy == OverflowPolicy::DropNewest) {
+                m_dropped.fetch_add(1);
+                return;
+            }
+            if (m_policy == OverflowPolicy::DropOldest) {
+                if (m_queue.try_pop([](auto&) {})) {
+                    m_dropped.fetch_add(1);
+                    m_completed.fetch_add(1);
+                }
+                continue;
+            }
+
+            // OverflowPolicy::Block; retry once after loading the counter, so that we don't miss a wakeup
+            auto completed = m_completed.load();
+            if (m_queue.try_push(fill)) {
+                break;
+            }
+            m_completed.wait(completed);
+        }
+
+        m_pushed.fetch_add(1);
+        if (m_stop) {
+            // `drain` gave up on the writer thread while we were queueing the message
+            discard_queued();
+            return;
+        }
+        m_wake.fetch_add(1);
+        m_wake.notify_one();
+    }
+
+    bool connected() override {
+        return m_inner->connected();
+    }
+
+    /// If the queue is not empty after `timeout`, the writer thread is stopped and the queued messages are dropped,
+    ///  so that the following synchronous writes (e.g., the exit record) do not overtake them.
+    bool drain(std::chrono::milliseconds timeout) override {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (m_completed.load() != m_pushed.load()) {
+            if (std::chrono::steady_clock::now() >= deadline) {
+                m_stop = true;
+                {
+                    // waits for the message being written, if any; the writer thread checks `m_stop` before the next
+                    std::unique_lock lock(m_write_mutex);
+                    m_synchronous = true;
+                }
+                discard_queued();
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        m_synchronous = true;
+        return true;
+    }
+
+    uint64_t dropped_messages() override {
+        return m_dropped.load();
+    }
+
+    uint32_t busy_waits() override {
+        return m_inner->busy_waits();
+    }
+
+    uint32_t protocol_version() override {
+        return m_inner->protocol_version();
+    }
+
+    bool receives_replies() override {
+        return m_inner->receives_replies();
+    }
+
+    /// Replies are read by the writer thread after it writes out the queue, the calling thread only takes them over:
+    ///  reading a pipe on Windows waits for a pending write on the same handle, which blocks while the server is slow.
+    ///  Once the writes are synchronous, the replies are read directly.
+    bool read_reply(std::span<std::byte> reply) override {
+        if (m_synchronous) {
+            std::unique_lock lock(m_write_mutex);
+            return m_inner->read_reply(reply);
+        }
+        if (reply.size() != m_reply.size() || !m_reply_ready.load(std::memory_order_acquire)) {
+            return false;
+        }
+        memcpy(reply.data(), m_reply.data(), m_reply.size());
+        m_reply_ready.store(false, std::memory_order_release);
+        return true;
+    }
+
+private:
+    void run_writer() {
+        Utils::catch_abort([&] {
+            // the message is swapped out of its slot before it is written, a slot held during a slow write would keep
+            //  `OverflowPolicy::DropOldest` from pushing even after it dropped the whole queue
+            auto message = std::vector<std::byte>{};
+            while (!m_stop) {
+                auto wake = m_wake.load();
+                while (m_queue.try_pop([&](std::vector<std::byte>& queued) { std::swap(message, queued); })) {
+                    write_inner(message);
+                    m_completed.fetch_add(1);
+                    m_completed.notify_all();
+                }
+                poll_reply();
+                m_wake.wait(wake);
+            }
+        });
+    }
+
+    void write_inner(std::span<const std::byte> message) {
+        std::unique_lock lock(m_write_mutex);
+        if (m_stop) {
+            m_dropped.fetch_add(1); // popped before `drain` gave up, the synchronous writes already started
+            return;
+        }
+        auto chunk = message;
+        m_inner->write({&chunk, 1});
+    }
+
+    /// Publishes the next reply, once the calling thread took over the previous one.
+    void poll_reply() {
+        if (m_reply_ready.load(std::memory_order_acquire) || !m_inner->receives_replies()) {
+            return;
+        }
+        std::unique_lock lock(m_write_mutex);
+        if (!m_stop && m_inner->read_reply(m_reply)) {
+            m_reply_ready.store(true, std::memory_order_release);
+        }
+    }
+
+    /// Drops the queued messages, after the writer thread was stopped.
+    void discard_queued() {
+        while (m_queue.try_pop([](auto&) {})) {
+            m_dropped.fetch_add(1);
+            m_completed.fetch_add(1);
+            m_completed.notify_all();
+        }
+    }
+};
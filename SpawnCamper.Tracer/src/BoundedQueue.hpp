@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/// Bounded multi-producer multi-consumer queue (Dmitry Vyukov's algorithm). Slots are preallocated and their values
+///  are reused, so a queue of `std::vector`s does not allocate once the vectors reach their steady-state capacity.
+template<typename T>
+class BoundedQueue {
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Slot[]> m_slots;
+    size_t m_mask;
+    alignas(64) std::atomic<size_t> m_enqueue_pos{0};
+    alignas(64) std::atomic<size_t> m_dequeue_pos{0};
+
+public:
+    /// `capacity` is rounded up to a power of two.
+    explicit BoundedQueue(size_t capacity) {
+        capacity = std::bit_ceil(std::max<size_t>(capacity, 2));
+        m_slots = std::make_unique<Slot[]>(capacity);
+        m_mask = capacity - 1;
+        for (size_t i = 0; i < capacity; i++) {
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    [[nodiscard]] size_t capacity() const {
+        return m_mask + 1;
+    }
+
+    /// Reserves a slot and calls `fill(T&)` to store the value. Returns `false` if the queue is full.
+    bool try_push(auto&& fill) {
+        auto pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            auto& slot = m_slots[pos & m_mask];
+            auto seq = slot.sequence.load(std::memory_order_acquire);
+            auto diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    fill(slot.value);
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /// Takes the oldest value and passes it to `consume(T&)`. Returns `false` if the queue is empty.
+    bool try_pop(auto&& consume) {
+        auto pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            auto& slot = m_slots[pos & m_mask];
+            auto seq = slot.sequence.load(std::memory_order_acquire);
+            auto diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    consume(slot.value);
+                    slot.sequence.store(pos + m_mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+};
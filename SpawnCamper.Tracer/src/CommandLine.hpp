@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Scan.hpp"
+
+/// Helpers for splitting Windows command lines, which are passed to processes as a single string. Only uses
+///  `wchar_t`, so it builds on all platforms (e.g., for the benchmarks).
+namespace CommandLine {
+    /// Returns a pointer to the end of the argument starting at `it`. Only handles the rules for argv[0], which is
+    ///  sufficient for finding the start of the next argument.
+    inline const wchar_t* find_arg_end(const wchar_t* it) {
+        while (true) {
+            // skip to the next closing quote or argument delimiter
+            it = Scan::find_first_of<L'"', L' ', L'\t'>(it);
+            if (*it != L'"') {
+                // found the end
+                return it;
+            }
+            // inside quotes, whitespace does not end the argument
+            it = Scan::find_first_of<L'"'>(it + 1);
+            if (*it == 0) {
+                return it;
+            }
+            it++;
+        }
+    }
+
+    inline const wchar_t* skip_whitespace(const wchar_t* it) {
+        while (*it != 0 && (*it == L' ' || *it == L'\t')) it++;
+        return it;
+    }
+
+    inline const wchar_t* find_argv1(const wchar_t* cmd_line) {
+        // https://learn.microsoft.com/en-us/cpp/c-language/parsing-c-command-line-arguments?view=msvc-170
+        // The first argument (argv[0]) is treated specially. It represents the program name. Because it
+        // must be a valid pathname, parts surrounded by double quote marks (") are allowed. The double
+        // quote marks aren't included in the argv[0] output. The parts surrounded by double quote marks
+        // prevent interpretation of a space or tab character as the end of the argument.
+
+        // CommandLineToArgvW treats whitespace outside of quotation marks as argument delimiters.
+        // However, if lpCmdLine starts with any amount of whitespace, CommandLineToArgvW will consider
+        // the first argument to be an empty string. Excess whitespace at the end of lpCmdLine is ignored.
+
+        // find the end of argv[0] and skip whitespace before the first arg
+        return skip_whitespace(find_arg_end(cmd_line));
+    }
+}
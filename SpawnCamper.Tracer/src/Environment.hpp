@@ -0,0 +1,161 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Scan.hpp"
+
+/// Helpers for working with process environment blocks (null-terminated list of null-terminated `NAME=value` strings).
+namespace Environment {
+    /// Returns the size in bytes of a process environment block, excluding the final null terminator.
+    size_t peb_size(const auto* peb) {
+        return Scan::env_block_length(peb) * sizeof(*peb);
+    }
+
+    /// Iterator over an environment block (null-terminated list of null-terminated strings).
+    template<typename CharT>
+    class PebIterator {
+        CharT* m_ptr;
+
+    public:
+        explicit PebIterator(CharT* env) : m_ptr(env) {}
+
+        auto begin() const { return *this; }
+        auto end() const { return PebIterator(nullptr); }
+
+        PebIterator& operator++() {
+            m_ptr += Scan::length(m_ptr) + 1;
+            return *this;
+        }
+
+        bool operator==(const PebIterator& other) const {
+            if (other.m_ptr == nullptr && *m_ptr == 0) return true;
+            return other.m_ptr == m_ptr;
+        }
+
+        bool operator!=(const PebIterator& other) const {
+            return !(*this == other);
+        }
+
+        const CharT* operator*() const { return m_ptr; }
+    };
+
+    /// 64-bit FNV-1a hash of the raw bytes of an environment block. The server computes the same hash over
+    ///  the received bytes, so it must stay in sync with `EnvironmentCache.Hash` on the server side.
+    inline uint64_t hash(const void* data, size_t size) {
+        auto bytes = (const unsigned char*)data;
+        uint64_t hash = 0xcbf29ce484222325;
+        for (size_t i = 0; i < size; i++) {
+            hash ^= bytes[i];
+            hash *= 0x100000001b3;
+        }
+        return hash;
+    }
+
+    /// Difference between two environment blocks.
+    template<typename CharT>
+    struct Delta {
+        /// Names of removed variables, each terminated by a null character.
+        std::basic_string<CharT> removed;
+        /// Added or changed variables in the environment block format (`NAME=value\0`), without the final terminator.
+        std::basic_string<CharT> changed;
+    };
+
+    /// Returns the name part of a `NAME=value` entry. Entries used by cmd.exe to track per-drive working
+    ///  directories start with `=` (e.g., `=C:=C:\dir`), so the separator search starts at the second character.
+    template<typename CharT>
+    std::basic_string_view<CharT> entry_name(std::basic_string_view<CharT> entry) {
+        if (entry.empty()) return entry;
+        auto eq = Scan::find(entry.data() + 1, entry.data() + entry.size(), CharT('='));
+        return entry.substr(0, eq - entry.data());
+    }
+
+    /// Computes the difference between `base` and `env`. Variables are compared by exact name, which is fine even
+    ///  for case-insensitive environments, since the server applies all removals before the changes.
+    template<typename CharT>
+    Delta<CharT> compute_delta(const CharT* base, const CharT* env) {
+        using View = std::basic_string_view<CharT>;
+        std::unordered_set<View> base_entries{};
+        for (auto it = base; *it != 0;) {
+            auto entry = View(it, Scan::length(it));
+            base_entries.insert(entry);
+            it += entry.size() + 1;
+        }
+
+        Delta<CharT> delta{};
+        std::unordered_set<View> names{};
+        for (auto it = env; *it != 0;) {
+            auto entry = View(it, Scan::length(it));
+            it += entry.size() + 1;
+            names.insert(entry_name(entry));
+            if (!base_entries.contains(entry)) {
+                delta.changed.append(entry);
+                delta.changed.push_back(0);
+            }
+        }
+
+        for (auto entry : base_entries) {
+            auto name = entry_name(entry);
+            if (!names.contains(name)) {
+                delta.removed.append(name);
+                delta.removed.push_back(0);
+            }
+        }
+        return delta;
+    }
+
+    /// Reconstructs an environment block (without the final terminator) from `base` and a delta computed by
+    ///  `compute_delta`, the counterpart of `MessageParser.ApplyEnvironmentDelta` in the server. Names are compared
+    ///  case-insensitively (ASCII only), like the server does.
+    template<typename CharT>
+    std::basic_string<CharT> apply_delta(std::basic_string_view<CharT> base, std::basic_string_view<CharT> removed,
+                                         std::basic_string_view<CharT> changed) {
+        using View = std::basic_string_view<CharT>;
+        auto key = [](View name) {
+            auto result = std::basic_string<CharT>(name);
+            for (auto& c : result) {
+                if (c >= 'A' && c <= 'Z') c = CharT(c - 'A' + 'a');
+            }
+            return result;
+        };
+        auto split = [](View block, auto&& cb) {
+            while (!block.empty()) {
+                auto end = Scan::find(block.data(), block.data() + block.size(), CharT(0)) - block.data();
+                cb(block.substr(0, end));
+                block = (size_t)end == block.size() ? View{} : block.substr(end + 1);
+            }
+        };
+
+        // keep the order of the base entries, changed variables replace them in place
+        std::vector<View> entries{};
+        std::unordered_map<std::basic_string<CharT>, size_t> indices{};
+        split(base, [&](View entry) {
+            indices[key(entry_name(entry))] = entries.size();
+            entries.push_back(entry);
+        });
+        split(removed, [&](View name) {
+            if (auto it = indices.find(key(name)); it != indices.end()) {
+                entries[it->second] = {};
+                indices.erase(it);
+            }
+        });
+        split(changed, [&](View entry) {
+            auto [it, inserted] = indices.try_emplace(key(entry_name(entry)), entries.size());
+            if (inserted) entries.push_back(entry);
+            else entries[it->second] = entry;
+        });
+
+        std::basic_string<CharT> result{};
+        for (auto entry : entries) {
+            if (entry.empty()) continue;
+            result.append(entry);
+            result.push_back(0);
+        }
+        return result;
+    }
+}
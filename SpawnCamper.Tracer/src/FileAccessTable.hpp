@@ -0,0 +1,168 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// How a process accessed a file, a combination of flags. Must match `LogServer.FileAccessKind` on the server side.
+enum class FileAccess : uint32_t {
+    None = 0,
+    /// Opened without access to the data (attributes, existence checks, directory handles).
+    Query = 1 << 0,
+    Read = 1 << 1,
+    /// Opened for writing, or created or overwritten.
+    Write = 1 << 2,
+    Delete = 1 << 3,
+    RenamedFrom = 1 << 4,
+    RenamedTo = 1 << 5,
+};
+
+constexpr FileAccess operator|(FileAccess a, FileAccess b) {
+    return (FileAccess)((uint32_t)a | (uint32_t)b);
+}
+
+constexpr FileAccess& operator|=(FileAccess& a, FileAccess b) {
+    return a = a | b;
+}
+
+/// Converts an NT object path (`\??\C:\file`, `\??\UNC\server\share\file`) or a path returned by
+///  `GetFinalPathNameByHandleW` (`\\?\C:\file`) to a DOS path. Returns an empty string for other objects
+///  (devices, pipes, the console), which are not traced.
+inline std::wstring to_dos_path(std::wstring_view path) {
+    auto is_drive = [](std::wstring_view p) {
+        return p.size() >= 2 && p[1] == L':' && ((p[0] >= L'A' && p[0] <= L'Z') || (p[0] >= L'a' && p[0] <= L'z'))
+               && (p.size() == 2 || p[2] == L'\\');
+    };
+    if (path.starts_with(LR"(\??\)") || path.starts_with(LR"(\\?\)")) {
+        path.remove_prefix(4);
+        if (path.size() > 4 && (path[0] == L'U' || path[0] == L'u') && (path[1] == L'N' || path[1] == L'n')
+            && (path[2] == L'C' || path[2] == L'c') && path[3] == L'\\') {
+            return LR"(\\)" + std::wstring(path.substr(4));
+        }
+        return is_drive(path) ? std::wstring(path) : std::wstring{};
+    }
+    if (is_drive(path) || (path.starts_with(LR"(\\)") && path.size() > 2 && path[2] != L'?' && path[2] != L'.')) {
+        return std::wstring(path);
+    }
+    return {};
+}
+
+/// Files accessed by a single process, with the number of opens of each file, so that each path is reported once
+///  instead of a message per open (compilers reopen the same headers many times). Paths are compared ignoring
+///  ASCII case, like Windows does; the spelling of the first access is kept.
+///
+/// Open addressing with linear probing over indices into a dense array of entries, which keeps the entries in
+///  the order of the first access and makes iteration cheap. The paths are stored in a single string.
+template<typename CharT>
+class FileAccessTable {
+    struct Entry {
+        uint64_t hash;
+        uint32_t path_offset;
+        uint32_t path_length;
+        FileAccess access;
+        uint32_t opens;
+        uint32_t failed_opens;
+    };
+
+    /// Index of the entry + 1, 0 for empty slots. The size is a power of 2, at most half of the slots are used.
+    std::vector<uint32_t> m_slots = std::vector<uint32_t>(INITIAL_SLOTS);
+    std::vector<Entry> m_entries{};
+    std::basic_string<CharT> m_paths{};
+
+public:
+    /// Number of distinct paths after which the hook reports the table and starts over, to bound its memory usage.
+    static constexpr size_t MAX_ENTRIES = 16384;
+
+    [[nodiscard]] size_t size() const {
+        return m_entries.size();
+    }
+
+    [[nodiscard]] bool empty() const {
+        return m_entries.empty();
+    }
+
+    /// Records an open of `path`. Failed opens (usually a missing file, e.g., when searching the include
+    ///  directories) are only counted, `access` is recorded for the successful ones.
+    void record_open(std::basic_string_view<CharT> path, FileAccess access, bool succeeded) {
+        auto& entry = find_or_add(path);
+        if (succeeded) {
+            entry.access |= access;
+            entry.opens++;
+        } else {
+            entry.failed_opens++;
+        }
+    }
+
+    /// Records an access that is not an open (deleting or renaming an open file).
+    void record(std::basic_string_view<CharT> path, FileAccess access) {
+        find_or_add(path).access |= access;
+    }
+
+    /// Calls `fn(path, access, opens, failed_opens)` for each recorded file, in the order of the first access.
+    void for_each(auto fn) const {
+        for (auto& entry : m_entries) {
+            fn(path(entry), entry.access, entry.opens, entry.failed_opens);
+        }
+    }
+
+private:
+    static constexpr size_t INITIAL_SLOTS = 256;
+
+    [[nodiscard]] std::basic_string_view<CharT> path(const Entry& entry) const {
+        return std::basic_string_view<CharT>(m_paths).substr(entry.path_offset, entry.path_length);
+    }
+
+    Entry& find_or_add(std::basic_string_view<CharT> path) {
+        auto hash = hash_path(path);
+        auto mask = m_slots.size() - 1;
+        auto i = (size_t)hash & mask;
+        for (; m_slots[i] != 0; i = (i + 1) & mask) {
+            auto& entry = m_entries[m_slots[i] - 1];
+            if (entry.hash == hash && equal_paths(this->path(entry), path)) {
+                return entry;
+            }
+        }
+
+        m_slots[i] = (uint32_t)m_entries.size() + 1;
+        m_entries.push_back(Entry{hash, (uint32_t)m_paths.size(), (uint32_t)path.size(), FileAccess::None, 0, 0});
+        m_paths += path;
+        if (m_entries.size() * 2 > m_slots.size()) {
+            grow();
+        }
+        return m_entries.back();
+    }
+
+    void grow() {
+        m_slots.assign(m_slots.size() * 2, 0);
+        auto mask = m_slots.size() - 1;
+        for (uint32_t e = 0; e < m_entries.size(); e++) {
+            auto i = (size_t)m_entries[e].hash & mask;
+            while (m_slots[i] != 0) i = (i + 1) & mask;
+            m_slots[i] = e + 1;
+        }
+    }
+
+    static CharT to_lower(CharT c) {
+        return c >= 'A' && c <= 'Z' ? (CharT)(c - 'A' + 'a') : c;
+    }
+
+    /// FNV-1a of the lowercased characters; the upper bits are mixed into the lower ones, which select the slot.
+    static uint64_t hash_path(std::basic_string_view<CharT> path) {
+        uint64_t hash = 0xcbf29ce484222325;
+        for (auto c : path) {
+            hash ^= (uint64_t)to_lower(c);
+            hash *= 0x100000001b3;
+        }
+        return hash ^ hash >> 32;
+    }
+
+    static bool equal_paths(std::basic_string_view<CharT> a, std::basic_string_view<CharT> b) {
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); i++) {
+            if (a[i] != b[i] && to_lower(a[i]) != to_lower(b[i])) return false;
+        }
+        return true;
+    }
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+
+#include "AsyncSink.hpp"
+#include "ProcessFilter.hpp"
+
+/// How the hook sends messages to the server.
+enum class Transport : uint32_t {
+    /// A named pipe connection per process.
+    Pipe,
+    /// A ring buffer in shared memory provided by the server; falls back to the pipe if the server does not provide it.
+    SharedMemory,
+};
+
+/// Configuration of the hook, set by `SpawnCamper.Tracer` and inherited by all traced child processes.
+struct HookConfig {
+    Transport transport = Transport::Pipe;
+    /// Queue messages and write them on a background thread, instead of blocking the traced process.
+    bool async = false;
+    OverflowPolicy overflow_policy = OverflowPolicy::Block;
+    uint32_t queue_capacity = 1024;
+    /// PID of the tracer recording into a trace file (see `TraceFileWriter`), 0 when messages are sent to the server.
+    uint32_t recorder_pid = 0;
+    /// Highest wire protocol version supported by the server, negotiated by the tracer (see `Protocol.hpp`).
+    uint32_t protocol_version = 1;
+    /// How processes matched by the `ProcessFilter` rules (passed in a separate payload) or by `max_depth` are traced.
+    FilterAction filter_action = FilterAction::Minimal;
+    /// Processes nested deeper below the traced command are filtered.
+    uint32_t max_depth = UINT32_MAX;
+    /// Depth of the process receiving the configuration, 0 for the traced command; incremented for each child.
+    uint32_t depth = 0;
+    /// If the parent was skipped (`FilterAction::Skip`), PID of the nearest ancestor that was reported, which
+    ///  the process reports as its parent instead; 0 if the parent was reported.
+    uint32_t reported_ancestor_pid = 0;
+    /// Detour the file functions and report the files accessed by each fully traced process (see `FileAccessTable`).
+    ///  Requires protocol version 2.
+    bool trace_files = false;
+    /// `Utils::performance_counter()` when the parent started creating this process, 0 if unknown. The hook reports
+    ///  the time until it was loaded into the process as the spawn latency (see `Protocol::Messages::HookTimings`).
+    uint64_t spawn_counter = 0;
+    /// The parent watches this process and reports its exit (see `Protocol::StartFlags::ExitWatched`). Not inherited,
+    ///  set by the parent for each child it watches.
+    bool exit_watched = false;
+
+    /// Returns how the process receiving the configuration is reported, `std::nullopt` if it is traced in full.
+    ///  `filter` are the serialized `ProcessFilter` rules, empty if there are none.
+    [[nodiscard]] std::optional<FilterAction> match(std::span<const std::byte> filter, std::wstring_view exe_path,
+                                                    std::wstring_view command_line) const {
+        if (depth > max_depth) {
+            return filter_action;
+        }
+        if (filter.empty() || !ProcessFilter::deserialize(filter).matches(exe_path, command_line)) {
+            return std::nullopt;
+        }
+        return filter_action;
+    }
+
+    /// Returns the configuration passed to a child of the process receiving this one, which is reported as `action`
+    ///  (see `match`). `parent_pid` is the parent of this process, only used if this process is skipped.
+    [[nodiscard]] HookConfig for_child(std::optional<FilterAction> action, uint32_t parent_pid) const {
+        auto child = *this;
+        child.depth++;
+        child.reported_ancestor_pid = 0;
+        child.exit_watched = false;
+        if (action == FilterAction::Skip) {
+            // the server does not know about this process, attach the child to the nearest ancestor it knows
+            child.reported_ancestor_pid = reported_ancestor_pid ? reported_ancestor_pid : parent_pid;
+        }
+        return child;
+    }
+};
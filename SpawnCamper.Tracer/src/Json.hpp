@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdio>
+#include <ostream>
+#include <string_view>
+
+/// Minimal helpers for the JSON output of the offline tools.
+namespace Json {
+    /// Writes `str` (UTF-8) as a quoted JSON string.
+    inline void write_string(std::ostream& out, std::string_view str) {
+        out << '"';
+        for (auto c : str) {
+            switch (c) {
+                case '"': out << R"(\")"; break;
+                case '\\': out << R"(\\)"; break;
+                case '\n': out << R"(\n)"; break;
+                case '\r': out << R"(\r)"; break;
+                case '\t': out << R"(\t)"; break;
+                default:
+                    if ((unsigned char)c < 0x20) {
+                        char escaped[8];
+                        snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)c);
+                        out << escaped;
+                    } else {
+                        out << c;
+                    }
+            }
+        }
+        out << '"';
+    }
+}
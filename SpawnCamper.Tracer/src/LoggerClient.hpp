@@ -1,95 +1,229 @@
 #pragma once
 
-#include <filesystem>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <span>
-#include <Windows.h>
-
-#include "NamedPipeWriter.hpp"
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "Environment.hpp"
+#include "FileAccessTable.hpp"
+#include "MessageBuffer.hpp"
+#include "MessageSink.hpp"
+#include "Protocol.hpp"
+#include "Utils.hpp"
 
 class LoggerClient {
-    NamedPipeWriter m_writer;
-    std::mutex m_pipe_mutex;
+    std::unique_ptr<MessageSink> m_sink;
+    /// Version of the wire format, chosen by the sink when it connected.
+    uint32_t m_version;
+    /// Serialization buffer, reused for all messages; protected by `m_mutex`.
+    MessageBuffer m_buffer;
+    std::mutex m_mutex;
+    /// Time spent in `MessageSink::write` (100ns units) and the number of written messages; protected by `m_mutex`.
+    uint64_t m_write_time = 0;
+    uint64_t m_writes = 0;
+    /// Sends the full environment of the process, kept until the server replies to the environment delta sent
+    ///  instead; protected by `m_mutex`.
+    std::function<void()> m_send_full_env;
+    uint64_t m_pending_env_hash = 0;
 
 public:
-    explicit LoggerClient(const std::filesystem::path& pipe_name) : m_writer(pipe_name) {}
+    /// Time the hook spent in the process outside of the client, in 100ns units, see `log_hook_timings`.
+    struct HookTimings {
+        uint64_t attach = 0;
+        uint64_t connect = 0;
+        uint64_t log_attach = 0;
+        uint64_t spawn_latency = 0;
+    };
 
-    // TODO: buffer the output?
+    /// A `CreateProcess` call: child PID, duration of the call creating the process and of the whole detour.
+    using Spawn = std::tuple<uint32_t, uint64_t, uint64_t>;
 
-    void log_ExitProcess(DWORD exit_code) {
-        std::unique_lock lock(m_pipe_mutex);
+    explicit LoggerClient(std::unique_ptr<MessageSink> sink)
+        : m_sink(std::move(sink)), m_version(std::min(m_sink->protocol_version(), Protocol::MAX_VERSION)) {}
 
-        write_message_header(MessageType::ExitProcess);
-        write<uint32_t>(exit_code);
-        write<uint32_t>(TERMINATOR_MAGIC);
+    bool connected() {
+        return m_sink->connected();
     }
 
-    void log_new_process(DWORD parentPid, LPCWSTR exe_path, LPCWSTR cmd_line, LPCWSTR working_dir, LPCWSTR env) {
-        std::unique_lock lock(m_pipe_mutex);
+    /// The negotiated protocol version; messages and fields of newer versions are not sent.
+    uint32_t protocol_version() const {
+        return m_version;
+    }
 
-        write_message_header(MessageType::ProcessStart);
-        write<uint32_t>(parentPid);
-        write_string(exe_path);
-        write_string(cmd_line);
-        write_string(working_dir);
-        write_env_block(env);
-        write<uint32_t>(TERMINATOR_MAGIC);
+    /// Runs `fn` while no message is being written, e.g., to hand the connection over to a new program image.
+    auto with_lock(auto fn) {
+        std::unique_lock lock(m_mutex);
+        return fn();
     }
 
-private:
-    static constexpr uint32_t TERMINATOR_MAGIC = 0x012345678;
-    enum class MessageType : uint16_t {
-        ExitProcess,
-        ProcessStart,
-    };
+    /// `resources` is only sent in protocol version 2, older servers ignore it.
+    void log_ExitProcess(uint32_t exit_code, const std::optional<Protocol::ResourceUsage>& resources = std::nullopt) {
+        // pass on all queued messages first, the exit record must not be dropped
+        m_sink->drain(EXIT_DRAIN_TIMEOUT);
 
-    void write(const void* buffer, size_t size) {
-        m_writer.write(std::span{(const std::byte*)buffer, size});
-    }
+        std::unique_lock lock(m_mutex);
 
-    // force the caller to explicitly specify the type
-    template<typename T>
-    void write(std::type_identity_t<T> value) requires std::is_scalar_v<T> {
-        write(&value, sizeof(value));
+        if (auto dropped = m_sink->dropped_messages(); dropped > 0) {
+            write_message<Protocol::Messages::DroppedMessages>(dropped);
+        }
+        write_message<Protocol::Messages::ExitProcess>(exit_code, resources);
     }
 
-    void write_timestamp() {
-        FILETIME ft;
-        ::GetSystemTimePreciseAsFileTime(&ft);
-        write<uint64_t>((uint64_t)ft.dwHighDateTime << 32 | (uint64_t)ft.dwLowDateTime);
+    /// Strings may be either UTF-16 (`wchar_t` on Windows) or UTF-8 (`char` on Linux); `env` is an environment block.
+    /// `timestamp` is when the process started, if the message is sent later. `flags` are only sent in version 2.
+    template<typename CharT>
+    void log_new_process(uint32_t parentPid, const CharT* exe_path, const CharT* cmd_line, const CharT* working_dir,
+                         const CharT* env, uint64_t timestamp = Utils::current_filetime(),
+                         Protocol::StartFlags flags = Protocol::StartFlags::None) {
+        std::unique_lock lock(m_mutex);
+        write_message_at<Protocol::Messages::ProcessStart>(
+            timestamp, parentPid, exe_path, cmd_line, working_dir, env_block(env), start_flags(flags));
     }
 
-    void write_message_header(MessageType msg_type) {
-        write_timestamp();
-        write<MessageType>(msg_type);
+    /// Like `log_new_process`, but the environment is sent as a delta against the environment of the parent process,
+    ///  which the parent previously reported to the server under `base_hash`. `env_hash` is the hash of the full
+    ///  environment `env` of this process, which the server uses to store the reconstructed environment. If the server
+    ///  replies that it does not know the base, `env` is sent in full with the next message.
+    template<typename CharT>
+    void log_new_process(uint32_t parentPid, const CharT* exe_path, const CharT* cmd_line, const CharT* working_dir,
+                         const CharT* env, uint64_t env_hash, uint64_t base_hash,
+                         const Environment::Delta<CharT>& env_delta, uint64_t timestamp = Utils::current_filetime(),
+                         Protocol::StartFlags flags = Protocol::StartFlags::None) {
+        std::unique_lock lock(m_mutex);
+        write_message_at<Protocol::Messages::ProcessStartEnvDelta>(
+            timestamp, parentPid, exe_path, cmd_line, working_dir, env_hash, base_hash, env_delta.removed,
+            env_delta.changed, start_flags(flags));
+        if (m_sink->receives_replies()) {
+            m_send_full_env = [this, block = std::basic_string<CharT>{env_block(env)}] {
+                write_message<Protocol::Messages::EnvironmentSnapshot>(std::basic_string_view<CharT>{block});
+            };
+            m_pending_env_hash = env_hash;
+        }
     }
 
+    /// Reports the start of a process matched by the filter rules, without its command line and environment.
     template<typename CharT>
-    void write_string(const CharT* str) {
-        if (str == nullptr) {
-            // 0xff..ff = nullptr
-            write<uint64_t>((size_t)-1);
-            return;
+    void log_new_process_minimal(uint32_t parentPid, const CharT* exe_path,
+                                 uint64_t timestamp = Utils::current_filetime(),
+                                 Protocol::StartFlags flags = Protocol::StartFlags::None) {
+        std::unique_lock lock(m_mutex);
+        if (m_version == 1) {
+            auto empty = std::basic_string_view<CharT>{};
+            write_message_at<Protocol::Messages::ProcessStart>(
+                timestamp, parentPid, exe_path, empty, empty, empty, std::nullopt);
+        } else {
+            write_message_at<Protocol::Messages::ProcessStartMinimal>(
+                timestamp, parentPid, exe_path, start_flags(flags));
         }
-        auto len = std::char_traits<CharT>::length(str) * sizeof(CharT);
-        write<uint64_t>(len);
-        write(str, len);
     }
 
-    void write_env_block(const wchar_t* env_block) {
-        auto env_size = peb_size(env_block);
-        write<uint64_t>(env_size);
-        write(env_block, env_size);
+    /// Reports the current environment of the process, so that child processes can send a delta against it.
+    template<typename CharT>
+    void log_environment(const CharT* env) {
+        std::unique_lock lock(m_mutex);
+        write_message<Protocol::Messages::EnvironmentSnapshot>(env_block(env));
     }
 
-    /// Returns the size in bytes of a process environment block, excluding the final null terminator.
-    size_t peb_size(const auto* peb) {
-        auto orig = peb;
-        while (*peb) {
-            // skip next string
-            while (*peb != 0) ++peb;
-            ++peb;
+    /// Reports the files recorded in `table`, split into messages of at most `FILE_ACCESS_BATCH` files. Only sent in
+    ///  protocol version 2, older servers do not know the message.
+    template<typename CharT>
+    void log_file_accesses(const FileAccessTable<CharT>& table) {
+        if (m_version == 1) return;
+        auto batch = std::vector<std::tuple<std::basic_string_view<CharT>, uint32_t, uint32_t, uint32_t>>{};
+        auto flush = [&] {
+            std::unique_lock lock(m_mutex);
+            write_message<Protocol::Messages::FileAccesses>(batch);
+            batch.clear();
+        };
+        table.for_each([&](auto path, FileAccess access, uint32_t opens, uint32_t failed_opens) {
+            batch.emplace_back(path, (uint32_t)access, opens, failed_opens);
+            if (batch.size() == FILE_ACCESS_BATCH) flush();
+        });
+        if (!batch.empty()) flush();
+    }
+
+    /// Reports the overhead of the hook, together with the time spent writing messages and `spawns` since the previous
+    ///  call. Only sent in protocol version 2, older servers do not know the message.
+    void log_hook_timings(const HookTimings& timings, std::span<const Spawn> spawns) {
+        if (m_version == 1) return;
+        std::unique_lock lock(m_mutex);
+        write_message<Protocol::Messages::HookTimings>(
+            timings.attach, timings.connect, m_sink->busy_waits(), timings.log_attach, m_write_time, m_writes,
+            timings.spawn_latency, spawns);
+    }
+
+    /// Reports that the child `child_pid` exited at `exit_time` (a FILETIME). Only sent in protocol version 2, older
+    ///  servers do not know the message.
+    void log_child_exit(uint32_t child_pid, uint32_t exit_code, uint64_t exit_time) {
+        if (m_version == 1) return;
+        std::unique_lock lock(m_mutex);
+        write_message_at<Protocol::Messages::ChildExit>(exit_time, child_pid, exit_code);
+    }
+
+private:
+    /// How long to wait for queued messages to be written when the process is exiting.
+    static constexpr auto EXIT_DRAIN_TIMEOUT = std::chrono::milliseconds(1000);
+    /// Bounds the size of a message to roughly that of a large environment block.
+    static constexpr size_t FILE_ACCESS_BATCH = 256;
+
+    /// Serializes the message and passes it to the sink in a single call. Must be called with `m_mutex` held.
+    template<typename Msg, typename... Args>
+    void write_message(const Args&... args) {
+        write_message_at<Msg>(Utils::current_filetime(), args...);
+    }
+
+    static std::optional<std::tuple<uint32_t>> start_flags(Protocol::StartFlags flags) {
+        if (flags == Protocol::StartFlags::None) return std::nullopt;
+        return std::tuple{static_cast<uint32_t>(flags)};
+    }
+
+    template<typename Msg, typename... Args>
+    void write_message_at(uint64_t timestamp, const Args&... args) {
+        poll_environment_reply();
+        Protocol::encode<Msg>(m_buffer, m_version, timestamp, args...);
+        auto start = Utils::performance_counter();
+        m_sink->write(m_buffer.chunks());
+        m_write_time += Utils::performance_counter() - start;
+        m_writes++;
+        m_buffer.clear();
+    }
+
+    /// Handles the reply of the server to the environment delta, if it arrived; the server defers the messages of
+    ///  the process until it gets the full environment it asked for. Must be called with `m_mutex` held.
+    void poll_environment_reply() {
+        if (!m_send_full_env) {
+            return;
         }
-        return (peb - orig) * sizeof(*peb);
+        auto reply = std::array<std::byte, Protocol::ENVIRONMENT_REPLY_SIZE>{};
+        if (!m_sink->read_reply(reply)) {
+            return;
+        }
+        uint64_t env_hash;
+        memcpy(&env_hash, reply.data() + 1, sizeof(env_hash));
+        if (env_hash != m_pending_env_hash) {
+            return; // not a reply to our delta, keep waiting
+        }
+
+        auto send_full_env = std::exchange(m_send_full_env, nullptr);
+        if ((Protocol::EnvironmentReply)reply[0] == Protocol::EnvironmentReply::SendFull) {
+            send_full_env();
+        }
+    }
+
+    template<typename CharT>
+    static std::basic_string_view<CharT> env_block(const CharT* env) {
+        return {env, Environment::peb_size(env) / sizeof(CharT)};
     }
 };
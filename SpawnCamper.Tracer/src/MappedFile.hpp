@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <span>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include "Win32.hpp"
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Posix.hpp"
+#endif
+
+/// Read-only mapping of a whole file, used by the offline tools to work with trace files and indices in place.
+class MappedFile {
+    const std::byte* m_data = nullptr;
+    size_t m_size = 0;
+#ifdef _WIN32
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = nullptr;
+#endif
+
+public:
+    explicit MappedFile(const std::filesystem::path& path) {
+#ifdef _WIN32
+        m_file = ::CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                               nullptr, OPEN_EXISTING, 0, nullptr);
+        if (m_file == INVALID_HANDLE_VALUE) {
+            throw Win32::Win32Error{"CreateFileW"};
+        }
+        LARGE_INTEGER size;
+        if (!::GetFileSizeEx(m_file, &size)) {
+            throw Win32::Win32Error{"GetFileSizeEx"};
+        }
+        m_size = (size_t)size.QuadPart;
+        if (m_size == 0) {
+            return; // empty files cannot be mapped
+        }
+        m_mapping = ::CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!m_mapping) {
+            throw Win32::Win32Error{"CreateFileMappingW"};
+        }
+        m_data = (const std::byte*)::MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!m_data) {
+            throw Win32::Win32Error{"MapViewOfFile"};
+        }
+#else
+        auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw Posix::PosixError{"open"};
+        }
+        struct stat info{};
+        if (::fstat(fd, &info) != 0) {
+            auto error = errno;
+            ::close(fd);
+            throw Posix::PosixError{error, "fstat"};
+        }
+        m_size = (size_t)info.st_size;
+        if (m_size > 0) {
+            auto data = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED) {
+                auto error = errno;
+                ::close(fd);
+                throw Posix::PosixError{error, "mmap"};
+            }
+            m_data = (const std::byte*)data;
+        }
+        // the mapping stays valid after the file is closed
+        ::close(fd);
+#endif
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (m_data) ::UnmapViewOfFile(m_data);
+        if (m_mapping) ::CloseHandle(m_mapping);
+        if (m_file != INVALID_HANDLE_VALUE) ::CloseHandle(m_file);
+#else
+        if (m_data) ::munmap((void*)m_data, m_size);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    [[nodiscard]] std::span<const std::byte> data() const {
+        return {m_data, m_size};
+    }
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <span>
+#include <vector>
+
+/// Reusable buffer for serializing a single message before it is passed to a `MessageSink`.
+///
+/// The backing storage is kept between messages, so once the buffer grows to the size of the largest message,
+///  serialization does not allocate anymore. Large payloads (typically the environment block) are not copied,
+///  but referenced as a separate chunk, so that the sink can write them out directly.
+class MessageBuffer {
+    /// Payloads at least this large are referenced instead of being copied into the buffer.
+    static constexpr size_t INLINE_LIMIT = 64 * 1024;
+
+    struct ExternalChunk {
+        /// Offset in `m_data` where the chunk should be inserted.
+        size_t offset;
+        std::span<const std::byte> data;
+    };
+
+    std::vector<std::byte> m_data;
+    std::vector<ExternalChunk> m_external;
+    std::vector<std::span<const std::byte>> m_chunks;
+    /// Offset in `m_data` where the message starts, see `reserve_header`.
+    size_t m_begin = 0;
+    size_t m_header_space = 0;
+
+public:
+    void clear() {
+        m_data.clear();
+        m_external.clear();
+        m_begin = 0;
+        m_header_space = 0;
+    }
+
+    /// Size of the message, excluding the space reserved for the header that was not filled in yet.
+    [[nodiscard]] size_t size() const {
+        auto size = m_data.size() - m_begin;
+        for (auto& e : m_external) size += e.data.size();
+        return size;
+    }
+
+    /// Reserves up to `max_size` bytes at the start of an empty buffer for a header that depends on the rest
+    ///  of the message (e.g., its length), to be filled in by `set_header` once the message is serialized.
+    void reserve_header(size_t max_size) {
+        m_data.resize(max_size);
+        m_begin = max_size;
+        m_header_space = max_size;
+    }
+
+    void set_header(std::span<const std::byte> header) {
+        // the header is placed right before the message, the unused part of the reserved space is skipped
+        m_begin = m_header_space - header.size();
+        memcpy(m_data.data() + m_begin, header.data(), header.size());
+    }
+
+    void append(const void* buffer, size_t size) {
+        auto bytes = (const std::byte*)buffer;
+        m_data.insert(m_data.end(), bytes, bytes + size);
+    }
+
+    /// Appends `size` bytes for the caller to fill in and returns a pointer to them. Invalidated by any subsequent
+    ///  modification.
+    std::byte* grow(size_t size) {
+        m_data.resize(m_data.size() + size);
+        return m_data.data() + m_data.size() - size;
+    }
+
+    /// Appends a payload that is potentially large. The buffer must remain valid until the message is written.
+    void append_large(const void* buffer, size_t size) {
+        if (size < INLINE_LIMIT) {
+            append(buffer, size);
+        } else {
+            m_external.push_back({m_data.size(), {(const std::byte*)buffer, size}});
+        }
+    }
+
+    /// Returns the serialized message as a list of chunks. Invalidated by any subsequent modification.
+    std::span<const std::span<const std::byte>> chunks() {
+        m_chunks.clear();
+        auto data = std::span<const std::byte>{m_data};
+        size_t last_offset = m_begin;
+        for (auto& e : m_external) {
+            if (e.offset > last_offset) {
+                m_chunks.push_back(data.subspan(last_offset, e.offset - last_offset));
+            }
+            m_chunks.push_back(e.data);
+            last_offset = e.offset;
+        }
+        if (data.size() > last_offset) {
+            m_chunks.push_back(data.subspan(last_offset));
+        }
+        return m_chunks;
+    }
+};
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+/// Transport for serialized messages. Each `write` call receives exactly one complete message, split into
+///  one or more chunks, which must be written out in order without interleaving them with other messages.
+class MessageSink {
+public:
+    virtual ~MessageSink() = default;
+
+    virtual void write(std::span<const std::span<const std::byte>> chunks) = 0;
+
+    /// Returns `false` if it is known that nothing written to the sink will be received (e.g., there is no server).
+    virtual bool connected() {
+        return true;
+    }
+
+    /// Called before the process exits. Waits at most `timeout` until all previously written messages are passed on
+    ///  and makes all subsequent writes synchronous. Returns `false` if the timeout expired.
+    virtual bool drain(std::chrono::milliseconds /*timeout*/) {
+        return true;
+    }
+
+    /// Number of messages that were discarded instead of being written.
+    virtual uint64_t dropped_messages() {
+        return 0;
+    }
+
+    /// Number of times the sink had to wait for the server while connecting, because it was busy.
+    virtual uint32_t busy_waits() {
+        return 0;
+    }
+
+    /// Version of the wire protocol understood by the receiving end, see `Protocol.hpp`.
+    virtual uint32_t protocol_version() {
+        return 1;
+    }
+
+    /// Returns `true` if the receiving end sends replies, see `read_reply`.
+    virtual bool receives_replies() {
+        return false;
+    }
+
+    /// Fills `reply` if the receiving end sent that many bytes back, without blocking. Returns `false` if they did not
+    ///  arrive yet.
+    virtual bool read_reply(std::span<std::byte> /*reply*/) {
+        return false;
+    }
+};
+
+/// Sink that collects all messages in memory. Used to exercise the serializer without a server.
+class MemorySink final : public MessageSink {
+    std::vector<std::byte> m_data;
+    uint32_t m_protocol_version;
+
+public:
+    explicit MemorySink(uint32_t protocol_version = 1) : m_protocol_version(protocol_version) {}
+
+    uint32_t protocol_version() override {
+        return m_protocol_version;
+    }
+
+    void write(std::span<const std::span<const std::byte>> chunks) override {
+        for (auto chunk : chunks) {
+            m_data.insert(m_data.end(), chunk.begin(), chunk.end());
+        }
+    }
+
+    [[nodiscard]] std::span<const std::byte> data() const {
+        return m_data;
+    }
+
+    void clear() {
+        m_data.clear();
+    }
+};
@@ -1,12 +1,91 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <optional>
+#include <thread>
+
+#include "MessageSink.hpp"
+#include "Protocol.hpp"
 #include "Win32.hpp"
 
-class NamedPipeWriter {
+class NamedPipeWriter final : public MessageSink {
+    /// How long `probe_protocol_version` waits for the server to send its version.
+    static constexpr auto PROBE_TIMEOUT = std::chrono::seconds(1);
+    /// How long each connection waits for the version the server sends before the replies. The server sends it right
+    ///  after accepting the connection, so it is normally already there.
+    static constexpr auto NEGOTIATION_TIMEOUT = std::chrono::milliseconds(100);
+
+    /// Declared before `m_output_handle`, which is initialized by connecting to the server.
+    uint32_t m_busy_waits = 0;
     HANDLE m_output_handle;
+    uint32_t m_protocol_version;
+    /// The version sent by the server was consumed, so that the following bytes are the replies.
+    bool m_receives_replies = false;
 
 public:
-    explicit NamedPipeWriter(const std::filesystem::path& pipe_name) : m_output_handle(connect_to_server(pipe_name)) {}
+    /// `protocol_version` must be supported by the server, see `probe_protocol_version`. Servers that support version 2
+    ///  send replies, so the connection is opened for reading as well.
+    explicit NamedPipeWriter(const std::filesystem::path& pipe_name, uint32_t protocol_version = 1)
+        : m_output_handle(connect_to_server(
+              pipe_name, protocol_version >= 2 ? GENERIC_READ | GENERIC_WRITE : GENERIC_WRITE, &m_busy_waits)),
+          m_protocol_version(protocol_version) {
+        if (connected() && m_protocol_version >= 2) {
+            // the replies follow the version the server offers on every connection; if it does not arrive, the
+            //  replies cannot be told apart from it, so they are ignored and the server falls back to its timeout
+            m_receives_replies = receive_protocol_version(m_output_handle, NEGOTIATION_TIMEOUT).has_value();
+            auto preamble = Protocol::stream_preamble(m_protocol_version);
+            auto chunk = std::span<const std::byte>{preamble};
+            write({&chunk, 1});
+        }
+    }
+
+    /// Asks the server for the highest protocol version it supports. The tracer does this once and passes the result
+    ///  to the hooks, so that traced processes do not wait for the server. Servers that predate the negotiation
+    ///  only support version 1 and only accept write-only connections.
+    static uint32_t probe_protocol_version(const std::filesystem::path& pipe_name) {
+        auto handle = HANDLE{};
+        try {
+            handle = connect_to_server(pipe_name, GENERIC_READ | GENERIC_WRITE);
+        } catch (const Win32::Win32Error& e) {
+            if (e.code().value() == ERROR_ACCESS_DENIED) {
+                return 1;
+            }
+            throw;
+        }
+        if (handle == INVALID_HANDLE_VALUE) {
+            return 1;
+        }
+        auto version = receive_protocol_version(handle, PROBE_TIMEOUT);
+        Win32::CloseHandle(handle);
+        return version.value_or(1);
+    }
+
+    uint32_t protocol_version() override {
+        return m_protocol_version;
+    }
+
+    uint32_t busy_waits() override {
+        return m_busy_waits;
+    }
+
+    bool receives_replies() override {
+        return connected() && m_receives_replies;
+    }
+
+    bool read_reply(std::span<std::byte> reply) override {
+        if (!receives_replies()) {
+            return false;
+        }
+        // only read once the whole reply arrived, so that `ReadFile` does not block
+        DWORD available = 0;
+        if (!::PeekNamedPipe(m_output_handle, nullptr, 0, nullptr, &available, nullptr) || available < reply.size()) {
+            return false;
+        }
+        DWORD bytes_read = 0;
+        return ::ReadFile(m_output_handle, reply.data(), (DWORD)reply.size(), &bytes_read, nullptr)
+               && bytes_read == reply.size();
+    }
 
     ~NamedPipeWriter() {
         if (connected()) {
@@ -14,7 +93,7 @@ public:
         }
     }
 
-    bool connected() {
+    bool connected() override {
         return m_output_handle != INVALID_HANDLE_VALUE;
     }
 
@@ -25,13 +104,17 @@ public:
         }
     }
 
-    void write(std::span<const std::byte> buffer) {
+    void write(std::span<const std::span<const std::byte>> chunks) override {
         if (!connected()) {
             return; // the reader was stopped, skip writes and silently continue
         }
 
         try {
-            write_inner(buffer);
+            // WriteFileGather only works for unbuffered files, so write out the chunks one by one; for most messages,
+            //  there is only a single chunk
+            for (auto chunk : chunks) {
+                write_inner(chunk);
+            }
         } catch (const Win32::Win32Error& e) {
             auto err = e.code().value();
             if (err == ERROR_BROKEN_PIPE || err == ERROR_NO_DATA) {
@@ -43,6 +126,24 @@ public:
     }
 
 private:
+    /// Reads the version the server sends right after accepting the connection, `std::nullopt` if it did not arrive
+    ///  within `timeout`.
+    static std::optional<uint32_t> receive_protocol_version(HANDLE handle, std::chrono::milliseconds timeout) {
+        uint32_t version = 0;
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        DWORD available = 0;
+        while (::PeekNamedPipe(handle, nullptr, 0, nullptr, &available, nullptr) && available < sizeof(version)
+               && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        DWORD bytes_read = 0;
+        if (available < sizeof(version) || !::ReadFile(handle, &version, sizeof(version), &bytes_read, nullptr)
+            || bytes_read != sizeof(version)) {
+            return std::nullopt;
+        }
+        return std::clamp(version, 1u, Protocol::MAX_VERSION);
+    }
+
     // ReSharper disable once CppMemberFunctionMayBeConst
     void write_inner(std::span<const std::byte> buffer) {
         do {
@@ -51,9 +152,11 @@ private:
         } while (!buffer.empty());
     }
 
-    static HANDLE connect_to_server(const std::filesystem::path& pipe_name) {
+    /// Increments `busy_waits` each time all instances of the pipe are busy.
+    static HANDLE connect_to_server(const std::filesystem::path& pipe_name, DWORD access,
+                                    uint32_t* busy_waits = nullptr) {
         while (true) {
-            auto handle = connect_raw(pipe_name);
+            auto handle = connect_raw(pipe_name, access);
             if (handle != INVALID_HANDLE_VALUE) {
                 return handle;
             }
@@ -69,6 +172,9 @@ private:
 
             // the pipe exists, but all instances are busy; this can intermittently happen just after another client
             //  connects to the server, before it services the connection and reopens another instance of the pipe server
+            if (busy_waits) {
+                (*busy_waits)++;
+            }
             if (!WaitNamedPipeW(pipe_name.c_str(), NMPWAIT_WAIT_FOREVER)) {
                 error = ::GetLastError();
                 if (error == ERROR_FILE_NOT_FOUND) {
@@ -80,7 +186,7 @@ private:
         }
     }
 
-    static HANDLE connect_raw(const std::filesystem::path& pipe_name) {
-        return ::CreateFileW(pipe_name.c_str(), GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+    static HANDLE connect_raw(const std::filesystem::path& pipe_name, DWORD access) {
+        return ::CreateFileW(pipe_name.c_str(), access, 0, nullptr, OPEN_EXISTING, 0, nullptr);
     }
 };
@@ -7,6 +7,9 @@
 namespace NtDll {
     namespace _ {
         inline decltype(&NtQueryInformationProcess) NtQueryInformationProcess;
+        /// Not declared in the SDK headers, available since Windows Vista.
+        inline NTSTATUS (NTAPI *NtGetNextThread)(HANDLE process, HANDLE thread, ACCESS_MASK access, ULONG attributes,
+                                                 ULONG flags, PHANDLE next_thread);
 
         template<typename FnT>
         static void ensure_fn_loaded(FnT& fn_ptr, const char* fn_name) {
@@ -18,6 +21,44 @@ namespace NtDll {
         }
     }
 
+    /// Returns the address of an `ntdll.dll` export, e.g., for detouring it.
+    template<typename FnT>
+    FnT get_proc(const char* fn_name) {
+        auto fn = FnT{};
+        _::ensure_fn_loaded(fn, fn_name);
+        return fn;
+    }
+
+    // file functions detoured when tracing file accesses; the SDK headers only declare some of them
+
+    using NtCreateFileFn = NTSTATUS (NTAPI *)(PHANDLE file, ACCESS_MASK access, POBJECT_ATTRIBUTES attributes,
+                                              PIO_STATUS_BLOCK io_status, PLARGE_INTEGER allocation_size,
+                                              ULONG file_attributes, ULONG share_access, ULONG disposition,
+                                              ULONG options, PVOID ea_buffer, ULONG ea_length);
+    using NtOpenFileFn = NTSTATUS (NTAPI *)(PHANDLE file, ACCESS_MASK access, POBJECT_ATTRIBUTES attributes,
+                                            PIO_STATUS_BLOCK io_status, ULONG share_access, ULONG options);
+    using NtDeleteFileFn = NTSTATUS (NTAPI *)(POBJECT_ATTRIBUTES attributes);
+    /// `info_class` is a `FILE_INFORMATION_CLASS`, whose SDK declaration lacks most values.
+    using NtSetInformationFileFn = NTSTATUS (NTAPI *)(HANDLE file, PIO_STATUS_BLOCK io_status, PVOID info,
+                                                      ULONG length, ULONG info_class);
+
+    // `FILE_INFORMATION_CLASS` values
+    inline constexpr ULONG FileRenameInformation = 10;
+    inline constexpr ULONG FileDispositionInformation = 13;
+    inline constexpr ULONG FileDispositionInformationEx = 64;
+    inline constexpr ULONG FileRenameInformationEx = 65;
+
+    /// `FILE_RENAME_INFORMATION`, also used for `FileRenameInformationEx`, where the first field is `ULONG Flags`.
+    struct RenameInformation {
+        union {
+            BOOLEAN ReplaceIfExists;
+            ULONG Flags;
+        };
+        HANDLE RootDirectory;
+        ULONG FileNameLength;
+        WCHAR FileName[1];
+    };
+
     inline DWORD GetParentProcessId() {
         _::ensure_fn_loaded(_::NtQueryInformationProcess, "NtQueryInformationProcess");
 
@@ -34,4 +75,22 @@ namespace NtDll {
         // `Reserved3` is the parent process ID
         return (DWORD)(ULONG_PTR)pbi.Reserved3;
     }
+
+    /// Returns the number of threads in the current process, without taking a snapshot of all threads in the system
+    ///  like `CreateToolhelp32Snapshot` does.
+    inline DWORD GetThreadCount() {
+        _::ensure_fn_loaded(_::NtGetNextThread, "NtGetNextThread");
+
+        DWORD count = 0;
+        HANDLE thread = nullptr;
+        HANDLE next_thread;
+        while (NT_SUCCESS(_::NtGetNextThread(GetCurrentProcess(), thread, THREAD_QUERY_LIMITED_INFORMATION, 0, 0,
+                                             &next_thread))) {
+            if (thread) CloseHandle(thread);
+            thread = next_thread;
+            count++;
+        }
+        if (thread) CloseHandle(thread);
+        return count;
+    }
 }
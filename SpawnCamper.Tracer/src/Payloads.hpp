@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <type_traits>
+#include <Windows.h>
+#include <detours.h>
+
+/// Detours payloads, which pass data from a parent process to the hook in its child processes.
+/// The payload is copied into the child while it is suspended, before the hook runs.
+namespace Payloads {
+    /// `HookConfig` of the parent.
+    // {2F1C7E0A-5B7D-4E1B-A3C4-8D6E2B9F0A11}
+    inline constexpr GUID CONFIG_GUID = {0x2f1c7e0a, 0x5b7d, 0x4e1b, {0xa3, 0xc4, 0x8d, 0x6e, 0x2b, 0x9f, 0x0a, 0x11}};
+
+    /// Serialized `ProcessFilter` rules, present only if there are any.
+    // {C4E2A1F3-7B9D-4A26-8E51-0D3F6B2A9C48}
+    inline constexpr GUID FILTER_GUID = {0xc4e2a1f3, 0x7b9d, 0x4a26, {0x8e, 0x51, 0x0d, 0x3f, 0x6b, 0x2a, 0x9c, 0x48}};
+
+    /// Environment block of the parent at the time the child was created, which allows the child to only send
+    ///  a delta against it to the server. Starts with `EnvHeader`.
+    // {6A3B9A41-1E55-4C87-9C2E-3F0B5E2D8C17}
+    inline constexpr GUID ENV_GUID = {0x6a3b9a41, 0x1e55, 0x4c87, {0x9c, 0x2e, 0x3f, 0x0b, 0x5e, 0x2d, 0x8c, 0x17}};
+
+    struct EnvHeader {
+        uint64_t env_hash;
+        /// Size of the environment block in bytes, excluding the final null terminator.
+        uint64_t env_size;
+        // followed by the environment block, including the final null terminator
+    };
+
+    /// Returns the payload with the given GUID passed to this process, or an empty span if there is none.
+    inline std::span<const std::byte> find(const GUID& guid) {
+        DWORD size = 0;
+        auto payload = DetourFindPayloadEx(guid, &size);
+        return payload ? std::span{(const std::byte*)payload, size} : std::span<const std::byte>{};
+    }
+
+    /// Returns the payload with the given GUID interpreted as `T`, or `nullptr` if there is none.
+    template<typename T>
+    const T* find(const GUID& guid) {
+        auto payload = find(guid);
+        return payload.size() >= sizeof(T) ? (const T*)payload.data() : nullptr;
+    }
+
+    inline bool copy(HANDLE process, const GUID& guid, std::span<const std::byte> data) {
+        return DetourCopyPayloadToProcess(process, guid, data.data(), (DWORD)data.size());
+    }
+
+    template<typename T>
+    bool copy_value(HANDLE process, const GUID& guid, const T& value) requires std::is_trivially_copyable_v<T> {
+        return copy(process, guid, std::span{(const std::byte*)&value, sizeof(value)});
+    }
+}
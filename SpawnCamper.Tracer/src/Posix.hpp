@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cerrno>
+#include <string>
+#include <system_error>
+#include <fcntl.h>
+#include <unistd.h>
+
+/// Linux counterpart of `Win32.hpp`, thin wrappers that throw on failure.
+namespace Posix {
+    struct PosixError final : std::system_error {
+        explicit PosixError(const char* message) : PosixError(errno, message) {}
+
+        PosixError(int error_code, const char* message)
+            : std::system_error(error_code, std::generic_category(), message) {}
+    };
+
+    inline std::string readlink(const char* path) {
+        auto result = std::string{};
+        result.resize(256);
+
+        while (true) {
+            auto actual_length = ::readlink(path, result.data(), result.size());
+
+            if (actual_length < 0) {
+                throw PosixError{"readlink"};
+            }
+
+            if ((size_t)actual_length < result.size()) {
+                // success, buffer is large enough (readlink truncates silently otherwise)
+                result.resize(actual_length);
+                return result;
+            }
+
+            // buffer too small, double the size and retry
+            result.resize(result.size() * 2);
+        }
+    }
+
+    inline std::string getcwd() {
+        auto result = std::string{};
+        result.resize(256);
+
+        while (::getcwd(result.data(), result.size()) == nullptr) {
+            if (errno != ERANGE) {
+                throw PosixError{"getcwd"};
+            }
+            result.resize(result.size() * 2);
+        }
+        result.resize(result.find('\0'));
+        return result;
+    }
+
+    /// Reads the whole file; works for `/proc` files, which report a zero size.
+    inline std::string read_file(const char* path) {
+        auto fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw PosixError{"open"};
+        }
+
+        auto result = std::string{};
+        char buffer[4096];
+        while (true) {
+            auto bytes_read = ::read(fd, buffer, sizeof(buffer));
+            if (bytes_read < 0) {
+                if (errno == EINTR) continue;
+                auto error = errno;
+                ::close(fd);
+                throw PosixError{error, "read"};
+            }
+            if (bytes_read == 0) {
+                break;
+            }
+            result.append(buffer, bytes_read);
+        }
+        ::close(fd);
+        return result;
+    }
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// What the hook reports about a process matched by the filter rules (see `ProcessFilter`).
+enum class FilterAction : uint32_t {
+    /// Only the PID, parent PID, executable path and exit code; the command line and environment are not read.
+    Minimal,
+    /// Nothing, the hook in the process only injects itself into the child processes.
+    Skip,
+};
+
+/// Rules selecting processes that are not worth tracing in full (e.g., `conhost.exe` or `git.exe` helpers),
+///  set by `SpawnCamper.Tracer` and passed to the hooks in a payload. The rules are normalized when added, so
+///  that matching a process only needs a single pass over its exe path and command line.
+///
+/// All comparisons are case-insensitive for ASCII letters, which covers the usual Windows paths. Only uses `wchar_t`,
+///  so it builds on all platforms.
+class ProcessFilter {
+    /// Normalized exe path glob; `*` matches any sequence of characters, `?` a single character.
+    struct Glob {
+        std::wstring pattern;
+        /// Globs without a path separator are matched against the file name, other globs against the full path.
+        bool file_name_only;
+        /// No wildcards, compared as a whole.
+        bool literal;
+    };
+
+    std::vector<Glob> m_exe_globs{};
+    /// Normalized command line substrings.
+    std::vector<std::wstring> m_command_lines{};
+
+public:
+    /// Parses the rules serialized by `serialize`. Invalid data results in a partial (possibly empty) filter.
+    static ProcessFilter deserialize(std::span<const std::byte> data) {
+        auto filter = ProcessFilter{};
+        auto str = std::wstring_view((const wchar_t*)data.data(), data.size() / sizeof(wchar_t));
+        while (!str.empty()) {
+            auto end = str.find(L'\0');
+            if (end == str.npos || end == 0) break;
+            auto rule = str.substr(1, end - 1);
+            if (str[0] == EXE_GLOB) filter.add_exe_glob(rule);
+            else if (str[0] == COMMAND_LINE) filter.add_command_line(rule);
+            str = str.substr(end + 1);
+        }
+        return filter;
+    }
+
+    /// Returns the payload passed to the hooks: a list of null-terminated rules, each prefixed by its kind,
+    ///  terminated by an empty string.
+    [[nodiscard]] std::vector<std::byte> serialize() const {
+        auto str = std::wstring{};
+        for (auto& glob : m_exe_globs) {
+            (str += EXE_GLOB) += glob.pattern;
+            str += L'\0';
+        }
+        for (auto& substring : m_command_lines) {
+            (str += COMMAND_LINE) += substring;
+            str += L'\0';
+        }
+        str += L'\0';
+        auto data = std::vector<std::byte>(str.size() * sizeof(wchar_t));
+        memcpy(data.data(), str.data(), data.size());
+        return data;
+    }
+
+    [[nodiscard]] bool empty() const {
+        return m_exe_globs.empty() && m_command_lines.empty();
+    }
+
+    void add_exe_glob(std::wstring_view glob) {
+        auto pattern = normalize(glob, true);
+        auto file_name_only = pattern.find(L'\\') == pattern.npos;
+        auto literal = pattern.find_first_of(L"*?") == pattern.npos;
+        m_exe_globs.push_back({std::move(pattern), file_name_only, literal});
+    }
+
+    void add_command_line(std::wstring_view substring) {
+        m_command_lines.push_back(normalize(substring, false));
+    }
+
+    /// Returns true if the process matches any of the rules.
+    [[nodiscard]] bool matches(std::wstring_view exe_path, std::wstring_view command_line) const {
+        if (!m_exe_globs.empty()) {
+            auto path = normalize(exe_path, true);
+            auto name = std::wstring_view(path).substr(path.find_last_of(L'\\') + 1);
+            for (auto& glob : m_exe_globs) {
+                auto str = glob.file_name_only ? name : std::wstring_view(path);
+                if (glob.literal ? str == glob.pattern : glob_match(glob.pattern, str)) return true;
+            }
+        }
+        if (!m_command_lines.empty()) {
+            auto normalized = normalize(command_line, false);
+            for (auto& substring : m_command_lines) {
+                if (normalized.find(substring) != normalized.npos) return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    static constexpr wchar_t EXE_GLOB = L'e';
+    static constexpr wchar_t COMMAND_LINE = L'c';
+
+    /// Lowercases ASCII letters, and in paths, unifies the separators.
+    static std::wstring normalize(std::wstring_view str, bool is_path) {
+        auto result = std::wstring(str);
+        for (auto& c : result) {
+            if (c >= L'A' && c <= L'Z') c = (wchar_t)(c - L'A' + L'a');
+            else if (is_path && c == L'/') c = L'\\';
+        }
+        return result;
+    }
+
+    /// Wildcard matching with backtracking to the last `*` only, which is linear for the usual patterns.
+    static bool glob_match(std::wstring_view pattern, std::wstring_view str) {
+        size_t p = 0, s = 0;
+        auto star = pattern.npos;
+        size_t star_s = 0;
+        while (s < str.size()) {
+            if (p < pattern.size() && (pattern[p] == L'?' || pattern[p] == str[s])) {
+                p++;
+                s++;
+            } else if (p < pattern.size() && pattern[p] == L'*') {
+                star = p++;
+                star_s = s;
+            } else if (star != pattern.npos) {
+                // let the last `*` match one more character
+                p = star + 1;
+                s = ++star_s;
+            } else {
+                return false;
+            }
+        }
+        while (p < pattern.size() && pattern[p] == L'*') p++;
+        return p == pattern.size();
+    }
+};
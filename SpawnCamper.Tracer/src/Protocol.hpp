@@ -0,0 +1,681 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include "MessageBuffer.hpp"
+#include "Scan.hpp"
+#include "Utils.hpp"
+
+/// Wire format of the messages sent by the hook to the server. The message schemas in `Protocol::Messages` drive
+///  both the encoder used by `LoggerClient` and the reference decoder (`Protocol::Decoder`), so the two cannot
+///  drift apart. The server side is implemented in `MessageParser.cs`, keep it in sync.
+///
+/// Version 1: `u64 timestamp, u16 type`, the fields, `u32 TERMINATOR_MAGIC`. Integers are fixed-size, strings are
+///  a `u64` byte length (0xff..ff for null), followed by UTF-16 data.
+///
+/// Version 2: `varint length` of the rest of the message, `u8 type, u64 timestamp`, the fields. Integers are varints
+///  (LEB128), strings are a `varint (byte length << 2 | StringEncoding)` tag followed by the data. Thanks to the
+///  length prefix, readers skip unknown message types and trailing fields they do not know, so messages can be
+///  extended without breaking older servers.
+///
+/// Negotiation: when a client connects to the pipe, the server writes the highest version it supports as `u32`;
+///  old servers only support version 1 and do not write anything. A version 2 connection starts with
+///  `stream_preamble`. The shared memory ring and trace files instead store the version in their header.
+///
+/// Replies: on version 2 pipe connections, the server answers each `ProcessStartEnvDelta` message with
+///  `u8 EnvironmentReply, u64 env_hash`. Other transports have no way back to the hook.
+namespace Protocol {
+    inline constexpr uint32_t MAX_VERSION = 2;
+    inline constexpr uint32_t TERMINATOR_MAGIC = 0x012345678;
+    inline constexpr uint32_t PREAMBLE_MAGIC = 0x32504353; // "SCP2"
+
+    enum class MessageType : uint16_t {
+        ExitProcess,
+        ProcessStart,
+        ProcessStartEnvDelta,
+        EnvironmentSnapshot,
+        DroppedMessages,
+        /// Added in version 2.
+        ProcessStartMinimal,
+        /// Added in version 2.
+        FileAccesses,
+        /// Added in version 2.
+        HookTimings,
+        /// Added in version 2.
+        ChildExit,
+    };
+
+    enum class StringEncoding : uint8_t {
+        /// One byte per character, used whenever all characters fit, which is the common case for paths,
+        ///  command lines and environment variables.
+        Latin1 = 0,
+        Utf8 = 1,
+        /// Fallback for Windows strings with unpaired surrogates, which cannot be represented in UTF-8.
+        Utf16 = 2,
+        /// Null string, the length is always 0.
+        Null = 3,
+    };
+
+    enum class EnvironmentReply : uint8_t {
+        /// The server reconstructed the environment from its base.
+        Resolved = 0,
+        /// The server does not know the base environment, the hook should send its full environment
+        ///  in an `EnvironmentSnapshot` message.
+        SendFull = 1,
+    };
+
+    inline constexpr size_t ENVIRONMENT_REPLY_SIZE = 1 + sizeof(uint64_t);
+
+    /// Flags of a process start, see `Messages::StartFlagsField`.
+    enum class StartFlags : uint32_t {
+        None = 0,
+        /// The parent watches the process and reports its exit with `Messages::ChildExit`, even if the process is
+        ///  killed before reporting it itself; the server waits for that report when the process disconnects without
+        ///  an exit code (see `HookConfig::exit_watched`).
+        ExitWatched = 1,
+    };
+
+    struct DecodeError final : std::runtime_error {
+        using std::runtime_error::runtime_error;
+    };
+
+    /// Starts a version 2 stream. The first 8 bytes of a version 1 stream are a FILETIME timestamp, whose upper half
+    ///  is never a small number, so the two cannot be confused.
+    inline std::array<std::byte, 8> stream_preamble(uint32_t version) {
+        auto preamble = std::array<std::byte, 8>{};
+        memcpy(preamble.data(), &PREAMBLE_MAGIC, 4);
+        memcpy(preamble.data() + 4, &version, 4);
+        return preamble;
+    }
+
+    /// Returns the version of a stream starting with `data` (at least 8 bytes).
+    inline uint32_t parse_preamble(std::span<const std::byte, 8> data) {
+        uint32_t magic, version;
+        memcpy(&magic, data.data(), 4);
+        memcpy(&version, data.data() + 4, 4);
+        return magic == PREAMBLE_MAGIC ? version : 1;
+    }
+
+    inline size_t encode_varint(uint64_t value, std::byte* out) {
+        size_t size = 0;
+        while (value >= 0x80) {
+            out[size++] = (std::byte)(value | 0x80);
+            value >>= 7;
+        }
+        out[size++] = (std::byte)value;
+        return size;
+    }
+
+    inline constexpr size_t MAX_VARINT_SIZE = 10;
+
+    class Writer {
+        MessageBuffer& m_buffer;
+
+    public:
+        const uint32_t version;
+
+        Writer(MessageBuffer& buffer, uint32_t version) : m_buffer(buffer), version(version) {}
+
+        void bytes(const void* data, size_t size) {
+            m_buffer.append(data, size);
+        }
+
+        /// Like `bytes`, but the data is referenced if it's large; it must remain valid until the message is written.
+        void large_bytes(const void* data, size_t size) {
+            m_buffer.append_large(data, size);
+        }
+
+        std::byte* grow(size_t size) {
+            return m_buffer.grow(size);
+        }
+
+        // force the caller to explicitly specify the type
+        template<typename T>
+        void fixed(std::type_identity_t<T> value) requires std::is_scalar_v<T> {
+            bytes(&value, sizeof(value));
+        }
+
+        void varint(uint64_t value) {
+            std::byte buffer[MAX_VARINT_SIZE];
+            bytes(buffer, encode_varint(value, buffer));
+        }
+    };
+
+    class Reader {
+        std::span<const std::byte> m_data;
+        size_t m_position = 0;
+
+    public:
+        const uint32_t version;
+        /// End of the current message, set by `Decoder`; only known in version 2, where messages can be extended.
+        size_t message_end = 0;
+
+        Reader(std::span<const std::byte> data, uint32_t version) : m_data(data), version(version) {}
+
+        [[nodiscard]] size_t position() const {
+            return m_position;
+        }
+
+        [[nodiscard]] bool at_end() const {
+            return m_position == m_data.size();
+        }
+
+        /// Returns `true` if all fields of the current message were read. Always `true` in version 1.
+        [[nodiscard]] bool at_message_end() const {
+            return m_position >= message_end;
+        }
+
+        void seek(size_t position) {
+            if (position > m_data.size()) {
+                throw DecodeError("message extends past the end of the data");
+            }
+            m_position = position;
+        }
+
+        std::span<const std::byte> bytes(size_t size) {
+            if (size > m_data.size() - m_position) {
+                throw DecodeError("message extends past the end of the data");
+            }
+            auto result = m_data.subspan(m_position, size);
+            m_position += size;
+            return result;
+        }
+
+        template<typename T>
+        T fixed() requires std::is_scalar_v<T> {
+            T value;
+            memcpy(&value, bytes(sizeof(T)).data(), sizeof(T));
+            return value;
+        }
+
+        uint64_t varint() {
+            uint64_t value = 0;
+            for (int shift = 0; shift < 64; shift += 7) {
+                auto byte = fixed<uint8_t>();
+                value |= (uint64_t)(byte & 0x7f) << shift;
+                if (!(byte & 0x80)) {
+                    return value;
+                }
+            }
+            throw DecodeError("varint is too long");
+        }
+    };
+
+    /// Decoded string, referencing the message data.
+    struct StringValue {
+        StringEncoding encoding = StringEncoding::Null;
+        std::span<const std::byte> data{};
+
+        [[nodiscard]] bool is_null() const {
+            return encoding == StringEncoding::Null;
+        }
+
+        [[nodiscard]] std::string to_utf8() const {
+            switch (encoding) {
+                case StringEncoding::Latin1: {
+                    auto result = std::string{};
+                    result.reserve(data.size());
+                    for (auto b : data) {
+                        auto c = (unsigned char)b;
+                        if (c < 0x80) {
+                            result += (char)c;
+                        } else {
+                            result += (char)(0xc0 | c >> 6);
+                            result += (char)(0x80 | (c & 0x3f));
+                        }
+                    }
+                    return result;
+                }
+                case StringEncoding::Utf8:
+                    return {(const char*)data.data(), data.size()};
+                case StringEncoding::Utf16: {
+                    auto units = std::u16string(data.size() / 2, u'\0');
+                    memcpy(units.data(), data.data(), units.size() * 2);
+                    // at most 3 bytes per UTF-16 code unit
+                    auto result = std::string(units.size() * 3, '\0');
+                    auto end = Utils::utf16_to_utf8(std::u16string_view(units), result.data());
+                    result.resize(end - result.data());
+                    return result;
+                }
+                default:
+                    return {};
+            }
+        }
+
+        /// Returns the string as UTF-16, exactly as the hook saw it on Windows (including unpaired surrogates).
+        [[nodiscard]] std::u16string to_utf16() const {
+            switch (encoding) {
+                case StringEncoding::Latin1: {
+                    auto result = std::u16string(data.size(), u'\0');
+                    for (size_t i = 0; i < data.size(); i++) result[i] = (char16_t)data[i];
+                    return result;
+                }
+                case StringEncoding::Utf8:
+                    return Utils::utf8_to_utf16({(const char*)data.data(), data.size()});
+                case StringEncoding::Utf16: {
+                    auto result = std::u16string(data.size() / 2, u'\0');
+                    memcpy(result.data(), data.data(), result.size() * 2);
+                    return result;
+                }
+                default:
+                    return {};
+            }
+        }
+    };
+
+    // field types of the message schemas, each one knows how to encode and decode itself in all versions
+
+    /// Unsigned integer, fixed-size in version 1, varint in version 2.
+    template<typename T>
+    struct UInt {
+        using value_type = T;
+
+        static void encode(Writer& w, std::type_identity_t<T> value) {
+            if (w.version == 1) w.fixed<T>(value);
+            else w.varint(value);
+        }
+
+        static T decode(Reader& r) {
+            if (r.version == 1) return r.fixed<T>();
+            auto value = r.varint();
+            if (value > std::numeric_limits<T>::max()) {
+                throw DecodeError("integer field out of range");
+            }
+            return (T)value;
+        }
+    };
+
+    /// Fixed-size 64-bit value in all versions, for hashes that would not benefit from varints.
+    struct Fixed64 {
+        using value_type = uint64_t;
+
+        static void encode(Writer& w, uint64_t value) {
+            w.fixed<uint64_t>(value);
+        }
+
+        static uint64_t decode(Reader& r) {
+            return r.fixed<uint64_t>();
+        }
+    };
+
+    /// Nullable string; environment blocks and name lists are strings with embedded null characters. Accepts
+    ///  UTF-16 strings (`wchar_t` on Windows, `char16_t`) and UTF-8 strings (`char`).
+    struct String {
+        using value_type = StringValue;
+
+        static void encode(Writer& w, std::nullptr_t) {
+            if (w.version == 1) w.fixed<uint64_t>((uint64_t)-1);
+            else w.varint((uint64_t)StringEncoding::Null);
+        }
+
+        template<typename CharT>
+        static void encode(Writer& w, const CharT* str) {
+            if (str == nullptr) encode(w, nullptr);
+            else encode(w, std::basic_string_view<CharT>(str, Scan::length(str)));
+        }
+
+        template<typename CharT>
+        static void encode(Writer& w, const std::basic_string<CharT>& str) {
+            encode(w, std::basic_string_view<CharT>(str));
+        }
+
+        template<typename CharT>
+        static void encode(Writer& w, std::basic_string_view<CharT> str) {
+            static_assert(sizeof(CharT) == 1 || sizeof(CharT) == 2, "strings must be either UTF-8 or UTF-16");
+            if (w.version == 1) {
+                encode_v1(w, str);
+            } else if constexpr (sizeof(CharT) == 1) {
+                encode_v2_utf8(w, str);
+            } else {
+                encode_v2_utf16(w, str);
+            }
+        }
+
+        static StringValue decode(Reader& r) {
+            if (r.version == 1) {
+                auto size = r.fixed<uint64_t>();
+                if (size == (uint64_t)-1) return {};
+                return {StringEncoding::Utf16, r.bytes(size)};
+            }
+            auto tag = r.varint();
+            auto encoding = (StringEncoding)(tag & 3);
+            if (encoding == StringEncoding::Null) return {};
+            return {encoding, r.bytes(tag >> 2)};
+        }
+
+    private:
+        template<typename CharT>
+        static void encode_v1(Writer& w, std::basic_string_view<CharT> str) {
+            if constexpr (sizeof(CharT) == 1) {
+                auto utf16 = Utils::utf8_to_utf16(str);
+                w.fixed<uint64_t>(utf16.size() * 2);
+                w.bytes(utf16.data(), utf16.size() * 2);
+            } else {
+                w.fixed<uint64_t>(str.size() * 2);
+                // the environment block is by far the largest part of the message, avoid copying it if it's large
+                w.large_bytes(str.data(), str.size() * 2);
+            }
+        }
+
+        static void write_tag(Writer& w, size_t size, StringEncoding encoding) {
+            w.varint((uint64_t)size << 2 | (uint64_t)encoding);
+        }
+
+        template<typename CharT>
+        static void encode_v2_utf8(Writer& w, std::basic_string_view<CharT> str) {
+            auto data = (const uint8_t*)str.data();
+            uint8_t all_bits = 0;
+            for (size_t i = 0; i < str.size(); i++) all_bits |= data[i];
+            auto ascii = all_bits < 0x80;
+            // ASCII is a subset of both, Latin-1 is cheaper to decode
+            write_tag(w, str.size(), ascii ? StringEncoding::Latin1 : StringEncoding::Utf8);
+            w.large_bytes(str.data(), str.size());
+        }
+
+        template<typename CharT>
+        static void encode_v2_utf16(Writer& w, std::basic_string_view<CharT> str) {
+            // plain pointer loops, so that the compiler can vectorize them (`std::byte*` may alias `str`)
+            auto data = (const char16_t*)str.data();
+            auto size = str.size();
+            char16_t all_bits = 0;
+            for (size_t i = 0; i < size; i++) all_bits |= data[i];
+            if (all_bits <= 0xff) {
+                write_tag(w, size, StringEncoding::Latin1);
+                auto out = (uint8_t*)w.grow(size);
+                for (size_t i = 0; i < size; i++) out[i] = (uint8_t)data[i];
+                return;
+            }
+
+            if (auto utf8_size = Utils::utf8_length(str)) {
+                write_tag(w, *utf8_size, StringEncoding::Utf8);
+                Utils::utf16_to_utf8(str, (char*)w.grow(*utf8_size));
+            } else {
+                write_tag(w, str.size() * 2, StringEncoding::Utf16);
+                w.large_bytes(str.data(), str.size() * 2);
+            }
+        }
+    };
+
+    /// Group of fields appended to a message in version 2, which the sender may omit (`std::nullopt`). Since only
+    ///  the message length tells whether the group is present, it must be the last field of the message.
+    template<typename... Fields>
+    struct Extension {
+        using value_type = std::optional<std::tuple<typename Fields::value_type...>>;
+
+        static void encode(Writer& w, const value_type& value) {
+            if (w.version == 1 || !value) return;
+            std::apply([&](const auto&... values) {
+                (Fields::encode(w, values), ...);
+            }, *value);
+        }
+
+        static value_type decode(Reader& r) {
+            if (r.at_message_end()) return std::nullopt;
+            return std::tuple<typename Fields::value_type...>{Fields::decode(r)...};
+        }
+    };
+
+    /// Sequence of records, each consisting of `Fields`; prefixed by the record count (`u64` in version 1, varint in
+    ///  version 2). Encodes any sized range of tuples of values accepted by the fields.
+    template<typename... Fields>
+    struct List {
+        using record_type = std::tuple<typename Fields::value_type...>;
+        using value_type = std::vector<record_type>;
+
+        template<typename Range>
+        static void encode(Writer& w, const Range& records) {
+            auto count = (uint64_t)std::ranges::size(records);
+            if (w.version == 1) w.fixed<uint64_t>(count);
+            else w.varint(count);
+            for (auto& record : records) {
+                std::apply([&](const auto&... values) {
+                    (Fields::encode(w, values), ...);
+                }, record);
+            }
+        }
+
+        static value_type decode(Reader& r) {
+            auto count = r.version == 1 ? r.fixed<uint64_t>() : r.varint();
+            auto records = value_type{};
+            // do not reserve `count`, it is not validated until the records are read
+            for (uint64_t i = 0; i < count; i++) {
+                records.push_back(record_type{Fields::decode(r)...});
+            }
+            return records;
+        }
+    };
+
+    template<MessageType Type, typename... Fields>
+    struct Message {
+        static constexpr MessageType type = Type;
+        using fields = std::tuple<Fields...>;
+        using values = std::tuple<typename Fields::value_type...>;
+
+        template<typename... Args>
+        static void encode_fields(Writer& w, const Args&... args) {
+            static_assert(sizeof...(Args) == sizeof...(Fields), "incorrect number of message fields");
+            (Fields::encode(w, args), ...);
+        }
+
+        static values decode_fields(Reader& r) {
+            // braced initialization guarantees left-to-right evaluation
+            return values{Fields::decode(r)...};
+        }
+    };
+
+    /// Message schemas. New fields may only be appended in version 2, since older readers skip the fields they don't
+    ///  know, but not the other way around.
+    namespace Messages {
+        /// Resource usage of the process over its lifetime, see `ResourceUsage`.
+        using ResourceUsageFields = Extension<
+            UInt<uint64_t> /* user CPU time (100ns units) */,
+            UInt<uint64_t> /* kernel CPU time (100ns units) */,
+            UInt<uint64_t> /* peak working set (bytes) */,
+            UInt<uint64_t> /* peak committed memory (bytes) */,
+            UInt<uint64_t> /* bytes read */,
+            UInt<uint64_t> /* bytes written */,
+            UInt<uint64_t> /* read operations */,
+            UInt<uint64_t> /* write operations */,
+            UInt<uint32_t> /* open handles at exit */,
+            UInt<uint32_t> /* threads at exit */>;
+
+        using ExitProcess = Message<MessageType::ExitProcess,
+            UInt<uint32_t> /* exit code */,
+            ResourceUsageFields /* added in version 2, optional */>;
+
+        /// `StartFlags` of the process starts, omitted if there are none.
+        using StartFlagsField = Extension<UInt<uint32_t> /* `StartFlags` */>;
+
+        using ProcessStart = Message<MessageType::ProcessStart,
+            UInt<uint32_t> /* parent PID */,
+            String /* executable path */,
+            String /* command line */,
+            String /* working directory */,
+            String /* environment block */,
+            StartFlagsField /* added in version 2, optional */>;
+
+        /// Like `ProcessStart`, but the environment is a delta against the parent environment, see `Environment::Delta`.
+        using ProcessStartEnvDelta = Message<MessageType::ProcessStartEnvDelta,
+            UInt<uint32_t> /* parent PID */,
+            String /* executable path */,
+            String /* command line */,
+            String /* working directory */,
+            Fixed64 /* environment hash */,
+            Fixed64 /* base environment hash */,
+            String /* removed variable names */,
+            String /* added or changed variables */,
+            StartFlagsField /* added in version 2, optional */>;
+
+        using EnvironmentSnapshot = Message<MessageType::EnvironmentSnapshot,
+            String /* environment block */>;
+
+        using DroppedMessages = Message<MessageType::DroppedMessages,
+            UInt<uint64_t> /* dropped message count */>;
+
+        /// Start of a process matched by the hook filter rules, whose command line and environment were not captured.
+        ///  Version 1 readers do not know it, `ProcessStart` with empty fields is sent instead.
+        using ProcessStartMinimal = Message<MessageType::ProcessStartMinimal,
+            UInt<uint32_t> /* parent PID */,
+            String /* executable path */,
+            StartFlagsField /* optional */>;
+
+        /// Files accessed by the process since the previous `FileAccesses` message, each reported once with its
+        ///  access counts (see `FileAccessTable`). Only sent in version 2, version 1 readers do not know it.
+        using FileAccesses = Message<MessageType::FileAccesses,
+            List<String /* DOS path */,
+                 UInt<uint32_t> /* `FileAccess` flags */,
+                 UInt<uint32_t> /* successful opens */,
+                 UInt<uint32_t> /* failed opens */>>;
+
+        /// Time the hook spent in the process, and the `CreateProcess` calls of the process since the previous
+        ///  `HookTimings` message, so that the overhead of the tracing can be measured. Durations are in 100ns units,
+        ///  measured with `Utils::performance_counter`; the totals are cumulative, so that only the last message
+        ///  of a process matters. Sent once the start is reported (so that killed processes report their overhead
+        ///  too), before `ExitProcess` or executing another image, when the hook is unloaded, and whenever the process
+        ///  started many children. Only sent in version 2, version 1 readers do not know it.
+        using HookTimings = Message<MessageType::HookTimings,
+            UInt<uint64_t> /* loading the hook (`DllMain`) */,
+            UInt<uint64_t> /* connecting to the server */,
+            UInt<uint32_t> /* times the server was busy while connecting */,
+            UInt<uint64_t> /* reporting the process start */,
+            UInt<uint64_t> /* writing messages, including waits for the server or a full queue */,
+            UInt<uint64_t> /* messages written */,
+            UInt<uint64_t> /* spawn latency, from the parent calling `CreateProcess` to `DllMain`; 0 if unknown */,
+            List<UInt<uint32_t> /* child PID */,
+                 UInt<uint64_t> /* `DetourCreateProcessWithDllEx*` call */,
+                 UInt<uint64_t> /* whole `CreateProcess` detour, including copying the payloads */>>;
+
+        /// Exit of a child process observed by its parent, including children that were killed or crashed without
+        ///  sending `ExitProcess` themselves. The timestamp is the exit time of the child reported by the OS, not
+        ///  the time the message was sent. Only sent in version 2, version 1 readers do not know it.
+        using ChildExit = Message<MessageType::ChildExit,
+            UInt<uint32_t> /* child PID */,
+            UInt<uint32_t> /* exit code */>;
+    }
+
+    /// Values of `Messages::ResourceUsageFields`, in the order of the fields.
+    using ResourceUsage = Messages::ResourceUsageFields::value_type::value_type;
+
+    /// Serializes a single message into an empty `buffer`.
+    template<typename Msg, typename... Args>
+    void encode(MessageBuffer& buffer, uint32_t version, uint64_t timestamp, const Args&... args) {
+        auto w = Writer{buffer, version};
+        if (version == 1) {
+            w.fixed<uint64_t>(timestamp);
+            w.fixed<MessageType>(Msg::type);
+            Msg::encode_fields(w, args...);
+            w.fixed<uint32_t>(TERMINATOR_MAGIC);
+            return;
+        }
+
+        // the length is only known once the message is serialized
+        buffer.reserve_header(MAX_VARINT_SIZE);
+        w.fixed<uint8_t>((uint8_t)Msg::type);
+        w.fixed<uint64_t>(timestamp);
+        Msg::encode_fields(w, args...);
+
+        std::byte length[MAX_VARINT_SIZE];
+        buffer.set_header({length, encode_varint(buffer.size(), length)});
+    }
+
+    struct MessageHeader {
+        MessageType type;
+        uint64_t timestamp;
+    };
+
+    /// Reference decoder for a sequence of messages (e.g., the contents of a pipe connection after the preamble,
+    ///  or a single ring buffer record).
+    class Decoder {
+        Reader m_reader;
+        std::optional<MessageHeader> m_header{};
+
+    public:
+        Decoder(std::span<const std::byte> data, uint32_t version) : m_reader(data, version) {
+            if (version < 1 || version > MAX_VERSION) {
+                throw DecodeError("unsupported protocol version");
+            }
+        }
+
+        /// Reads the header of the next message, returns `std::nullopt` at the end of the data. The previous message
+        ///  must have been consumed by `decode` or `skip`.
+        std::optional<MessageHeader> next() {
+            if (m_header) {
+                throw DecodeError("previous message was not consumed");
+            }
+            if (m_reader.at_end()) {
+                return std::nullopt;
+            }
+
+            if (m_reader.version == 1) {
+                auto timestamp = m_reader.fixed<uint64_t>();
+                m_header = MessageHeader{m_reader.fixed<MessageType>(), timestamp};
+            } else {
+                auto length = m_reader.varint();
+                m_reader.message_end = m_reader.position() + length;
+                auto type = (MessageType)m_reader.fixed<uint8_t>();
+                m_header = MessageHeader{type, m_reader.fixed<uint64_t>()};
+            }
+            return m_header;
+        }
+
+        /// Decodes the fields of the current message, which must be of type `Msg`.
+        template<typename Msg>
+        typename Msg::values decode() {
+            if (!m_header || m_header->type != Msg::type) {
+                throw DecodeError("unexpected message type");
+            }
+            auto values = Msg::decode_fields(m_reader);
+            finish();
+            return values;
+        }
+
+        /// Skips the current message.
+        void skip() {
+            if (!m_header) {
+                throw DecodeError("no current message");
+            }
+            if (m_reader.version > 1) {
+                finish();
+                return;
+            }
+            // version 1 messages have no length, they can only be skipped by decoding them
+            switch (m_header->type) {
+                case MessageType::ExitProcess: decode<Messages::ExitProcess>(); break;
+                case MessageType::ProcessStart: decode<Messages::ProcessStart>(); break;
+                case MessageType::ProcessStartEnvDelta: decode<Messages::ProcessStartEnvDelta>(); break;
+                case MessageType::EnvironmentSnapshot: decode<Messages::EnvironmentSnapshot>(); break;
+                case MessageType::DroppedMessages: decode<Messages::DroppedMessages>(); break;
+                default: throw DecodeError("unknown message type");
+            }
+        }
+
+    private:
+        void finish() {
+            if (m_reader.version == 1) {
+                if (m_reader.fixed<uint32_t>() != TERMINATOR_MAGIC) {
+                    throw DecodeError("incorrect message terminator");
+                }
+            } else {
+                if (m_reader.position() > m_reader.message_end) {
+                    throw DecodeError("message is longer than its length prefix");
+                }
+                // skip fields added in newer versions
+                m_reader.seek(m_reader.message_end);
+            }
+            m_header = std::nullopt;
+        }
+    };
+}
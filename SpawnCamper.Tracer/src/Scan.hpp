@@ -0,0 +1,254 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) \
+    || (defined(__i386__) && defined(__SSE2__))
+#define SCAN_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define SCAN_X86 0
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+// MSVC allows AVX2 intrinsics in any function
+#define SCAN_TARGET_AVX2
+#define SCAN_NO_SANITIZE __declspec(no_sanitize_address)
+#else
+#define SCAN_TARGET_AVX2 __attribute__((target("avx2")))
+#define SCAN_NO_SANITIZE __attribute__((no_sanitize_address))
+#endif
+
+/// Vectorized scanning of null-terminated strings, environment blocks and command lines, which the hooks do for each
+///  traced process and the offline tools for each recorded one. The best implementation supported by the CPU is
+///  selected at runtime; `Scalar`, `Sse2` and `Avx2` can also be called directly (e.g., by the benchmarks).
+///
+/// The unbounded scans read whole aligned vectors, which may extend past the terminator, but never into the next page.
+///  Characters are either 1 or 2 bytes (UTF-8 or UTF-16); wider characters (`wchar_t` on Linux) use the scalar code.
+namespace Scan {
+    enum class Level {
+        Scalar,
+        Sse2,
+        Avx2,
+    };
+
+    namespace Scalar {
+        /// Returns a pointer to the first character of `str` that is one of `Chars`, or the null terminator.
+        template<auto... Chars, typename CharT>
+        const CharT* find_first_of(const CharT* str) {
+            while (*str != 0 && ((*str != CharT(Chars)) && ...)) str++;
+            return str;
+        }
+
+        /// Returns a pointer to the first `c` in `[begin, end)`, or `end`.
+        template<typename CharT>
+        const CharT* find(const CharT* begin, const CharT* end, CharT c) {
+            while (begin != end && *begin != c) begin++;
+            return begin;
+        }
+
+        /// Returns the number of characters in an environment block, excluding the final terminator.
+        template<typename CharT>
+        size_t env_block_length(const CharT* block) {
+            auto it = block;
+            while (*it != 0) {
+                while (*it != 0) it++;
+                it++;
+            }
+            return it - block;
+        }
+    }
+
+#if SCAN_X86
+    namespace Sse2 {
+        constexpr size_t WIDTH = 16;
+
+        /// Bit per byte of `v`, set for the first byte of each character equal to `c`.
+        template<typename CharT>
+        uint32_t match(__m128i v, CharT c) {
+            if constexpr (sizeof(CharT) == 1) {
+                return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8((char)c)));
+            } else {
+                return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi16(v, _mm_set1_epi16((short)c))) & 0x5555;
+            }
+        }
+
+        template<auto... Chars, typename CharT>
+        SCAN_NO_SANITIZE const CharT* find_first_of(const CharT* str) {
+            static_assert(sizeof(CharT) <= 2);
+            auto offset = (uintptr_t)str % WIDTH;
+            auto chunk = (const char*)str - offset;
+            auto v = _mm_load_si128((const __m128i*)chunk);
+            auto mask = (match(v, CharT(0)) | ... | match(v, CharT(Chars))) >> offset << offset;
+            while (mask == 0) {
+                chunk += WIDTH;
+                v = _mm_load_si128((const __m128i*)chunk);
+                mask = (match(v, CharT(0)) | ... | match(v, CharT(Chars)));
+            }
+            return (const CharT*)(chunk + std::countr_zero(mask));
+        }
+
+        template<typename CharT>
+        const CharT* find(const CharT* begin, const CharT* end, CharT c) {
+            static_assert(sizeof(CharT) <= 2);
+            auto it = begin;
+            for (; (size_t)(end - it) * sizeof(CharT) >= WIDTH; it += WIDTH / sizeof(CharT)) {
+                if (auto mask = match(_mm_loadu_si128((const __m128i*)it), c)) {
+                    return (const CharT*)((const char*)it + std::countr_zero(mask));
+                }
+            }
+            return Scalar::find(it, end, c);
+        }
+
+        template<typename CharT>
+        SCAN_NO_SANITIZE size_t env_block_length(const CharT* block) {
+            static_assert(sizeof(CharT) <= 2);
+            constexpr auto SHIFT = sizeof(CharT);
+            auto offset = (uintptr_t)block % WIDTH;
+            auto chunk = (const char*)block - offset;
+            // bit set where the previous character is null; the block behaves as if a null preceded it, so that
+            //  an empty block (a single null) has zero length
+            uint32_t previous = 1u << offset;
+            auto zeros = match(_mm_load_si128((const __m128i*)chunk), CharT(0)) >> offset << offset;
+            // the second null of a pair terminates the block
+            while (!(zeros & (zeros << SHIFT | previous))) {
+                previous = zeros >> (WIDTH - SHIFT);
+                chunk += WIDTH;
+                zeros = match(_mm_load_si128((const __m128i*)chunk), CharT(0));
+            }
+            auto end = chunk + std::countr_zero(zeros & (zeros << SHIFT | previous));
+            return (end - (const char*)block) / sizeof(CharT);
+        }
+    }
+
+    namespace Avx2 {
+        constexpr size_t WIDTH = 32;
+
+        template<typename CharT>
+        SCAN_TARGET_AVX2 uint32_t match(__m256i v, CharT c) {
+            if constexpr (sizeof(CharT) == 1) {
+                return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)c)));
+            } else {
+                return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi16(v, _mm256_set1_epi16((short)c)))
+                       & 0x55555555;
+            }
+        }
+
+        template<auto... Chars, typename CharT>
+        SCAN_TARGET_AVX2 SCAN_NO_SANITIZE const CharT* find_first_of(const CharT* str) {
+            static_assert(sizeof(CharT) <= 2);
+            auto offset = (uintptr_t)str % WIDTH;
+            auto chunk = (const char*)str - offset;
+            auto v = _mm256_load_si256((const __m256i*)chunk);
+            auto mask = (match(v, CharT(0)) | ... | match(v, CharT(Chars))) >> offset << offset;
+            while (mask == 0) {
+                chunk += WIDTH;
+                v = _mm256_load_si256((const __m256i*)chunk);
+                mask = (match(v, CharT(0)) | ... | match(v, CharT(Chars)));
+            }
+            return (const CharT*)(chunk + std::countr_zero(mask));
+        }
+
+        template<typename CharT>
+        SCAN_TARGET_AVX2 const CharT* find(const CharT* begin, const CharT* end, CharT c) {
+            static_assert(sizeof(CharT) <= 2);
+            auto it = begin;
+            for (; (size_t)(end - it) * sizeof(CharT) >= WIDTH; it += WIDTH / sizeof(CharT)) {
+                if (auto mask = match(_mm256_loadu_si256((const __m256i*)it), c)) {
+                    return (const CharT*)((const char*)it + std::countr_zero(mask));
+                }
+            }
+            return Sse2::find(it, end, c);
+        }
+
+        /// See `Sse2::env_block_length`.
+        template<typename CharT>
+        SCAN_TARGET_AVX2 SCAN_NO_SANITIZE size_t env_block_length(const CharT* block) {
+            static_assert(sizeof(CharT) <= 2);
+            constexpr auto SHIFT = sizeof(CharT);
+            auto offset = (uintptr_t)block % WIDTH;
+            auto chunk = (const char*)block - offset;
+            uint32_t previous = 1u << offset;
+            auto zeros = match(_mm256_load_si256((const __m256i*)chunk), CharT(0)) >> offset << offset;
+            while (!(zeros & (zeros << SHIFT | previous))) {
+                previous = zeros >> (WIDTH - SHIFT);
+                chunk += WIDTH;
+                zeros = match(_mm256_load_si256((const __m256i*)chunk), CharT(0));
+            }
+            auto end = chunk + std::countr_zero(zeros & (zeros << SHIFT | previous));
+            return (end - (const char*)block) / sizeof(CharT);
+        }
+    }
+#endif
+
+    inline Level detect_level() {
+#if !SCAN_X86
+        return Level::Scalar;
+#elif defined(_MSC_VER) && !defined(__clang__)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) return Level::Sse2;
+        __cpuid(info, 1);
+        // the OS must save the AVX registers on context switches
+        auto osxsave = (info[2] & (1 << 27)) != 0;
+        auto avx = (info[2] & (1 << 28)) != 0;
+        if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) return Level::Sse2;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) ? Level::Avx2 : Level::Sse2;
+#else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") ? Level::Avx2 : Level::Sse2;
+#endif
+    }
+
+    /// Implementation used by the functions below, detected when the module is loaded.
+    inline const Level LEVEL = detect_level();
+
+    /// Returns a pointer to the first character of `str` that is one of `Chars`, or the null terminator.
+    template<auto... Chars, typename CharT>
+    const CharT* find_first_of(const CharT* str) {
+#if SCAN_X86
+        if constexpr (sizeof(CharT) <= 2) {
+            if (LEVEL == Level::Avx2) return Avx2::find_first_of<Chars...>(str);
+            return Sse2::find_first_of<Chars...>(str);
+        }
+#endif
+        return Scalar::find_first_of<Chars...>(str);
+    }
+
+    /// Returns the number of characters in a null-terminated string, `std::char_traits::length`.
+    template<typename CharT>
+    size_t length(const CharT* str) {
+        return find_first_of<>(str) - str;
+    }
+
+    /// Returns a pointer to the first `c` in `[begin, end)`, or `end`.
+    template<typename CharT>
+    const CharT* find(const CharT* begin, const CharT* end, CharT c) {
+#if SCAN_X86
+        if constexpr (sizeof(CharT) <= 2) {
+            if (LEVEL == Level::Avx2) return Avx2::find(begin, end, c);
+            return Sse2::find(begin, end, c);
+        }
+#endif
+        return Scalar::find(begin, end, c);
+    }
+
+    /// Returns the number of characters in an environment block (null-terminated list of null-terminated strings),
+    ///  excluding the final terminator.
+    template<typename CharT>
+    size_t env_block_length(const CharT* block) {
+#if SCAN_X86
+        if constexpr (sizeof(CharT) <= 2) {
+            if (LEVEL == Level::Avx2) return Avx2::env_block_length(block);
+            return Sse2::env_block_length(block);
+        }
+#endif
+        return Scalar::env_block_length(block);
+    }
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include <thread>
+#include <Windows.h>
+
+#include "MessageSink.hpp"
+#include "SharedRing.hpp"
+
+/// Sink that appends messages to the shared memory ring buffer created by the server. Unlike `NamedPipeWriter`,
+///  there is no per-process connection and writing a message does not enter the kernel, unless the server is idle
+///  and must be woken up.
+class SharedMemoryWriter final : public MessageSink {
+    /// How long to wait for free space in the ring before dropping the message (e.g., when the server hangs).
+    static constexpr auto FULL_TIMEOUT = std::chrono::seconds(5);
+
+    HANDLE m_mapping = nullptr;
+    void* m_view = nullptr;
+    HANDLE m_event = nullptr;
+    std::optional<SharedRing> m_ring{};
+    uint32_t m_process_id = ::GetCurrentProcessId();
+    std::atomic<uint64_t> m_dropped{0};
+
+public:
+    /// If the server does not provide the ring buffer, the writer is not connected and silently drops all messages.
+    SharedMemoryWriter(const wchar_t* ring_name, const wchar_t* event_name) {
+        m_mapping = ::OpenFileMappingW(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, ring_name);
+        if (!m_mapping) {
+            return;
+        }
+        m_view = ::MapViewOfFile(m_mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, 0);
+        m_event = ::OpenEventW(EVENT_MODIFY_STATE, FALSE, event_name);
+        if (!m_view || !m_event) {
+            return;
+        }
+
+        MEMORY_BASIC_INFORMATION info{};
+        ::VirtualQuery(m_view, &info, sizeof(info));
+        if (SharedRing::is_valid(m_view, info.RegionSize)) {
+            m_ring.emplace(m_view);
+        }
+    }
+
+    ~SharedMemoryWriter() override {
+        if (m_view) ::UnmapViewOfFile(m_view);
+        if (m_event) ::CloseHandle(m_event);
+        if (m_mapping) ::CloseHandle(m_mapping);
+    }
+
+    SharedMemoryWriter(const SharedMemoryWriter&) = delete;
+    SharedMemoryWriter& operator=(const SharedMemoryWriter&) = delete;
+
+    bool connected() override {
+        return m_ring.has_value();
+    }
+
+    void write(std::span<const std::span<const std::byte>> chunks) override {
+        if (!m_ring) {
+            return;
+        }
+
+        size_t size = 0;
+        for (auto chunk : chunks) size += chunk.size();
+        if (size > m_ring->max_payload_size()) {
+            m_dropped.fetch_add(1);
+            return;
+        }
+
+        auto deadline = std::chrono::steady_clock::time_point{};
+        for (uint32_t attempt = 0; !m_ring->try_write(m_process_id, chunks); attempt++) {
+            // the ring is full, back off until the server catches up
+            if (attempt == 0) {
+                deadline = std::chrono::steady_clock::now() + FULL_TIMEOUT;
+            } else if (std::chrono::steady_clock::now() > deadline) {
+                m_dropped.fetch_add(1);
+                return;
+            }
+            if (attempt < 64) {
+                std::this_thread::yield();
+            } else {
+                ::Sleep(1);
+            }
+        }
+
+        if (m_ring->consumer_waiting()) {
+            ::SetEvent(m_event);
+        }
+    }
+
+    uint64_t dropped_messages() override {
+        return m_dropped.load();
+    }
+
+    uint32_t protocol_version() override {
+        return m_ring ? m_ring->protocol_version() : 1;
+    }
+};
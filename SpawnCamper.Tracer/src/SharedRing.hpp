@@ -0,0 +1,240 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+/// Multi-producer single-consumer ring buffer of framed records, living in memory shared between processes.
+///
+/// Producers reserve space by advancing `head` with a CAS, fill in the record and then mark it committed; the consumer
+///  processes records in order, clears the consumed memory and advances `tail`. A record never wraps around the end
+///  of the buffer, the leftover space is filled with a padding record instead. Nothing here makes a syscall, waking up
+///  a sleeping consumer is left to the caller (see `consumer_waiting`).
+///
+/// The layout is shared with `SharedRingReader` in the server, keep them in sync.
+class SharedRing {
+public:
+    static constexpr uint32_t MAGIC = 0x42524353; // "SCRB"
+    static constexpr uint32_t VERSION = 2;
+
+    struct Header {
+        /// Written last by the consumer when it initializes the ring.
+        std::atomic<uint32_t> magic;
+        uint32_t version;
+        /// Size of the data area in bytes, must be a power of two.
+        uint64_t capacity;
+        /// Highest wire protocol version supported by the consumer (added in version 2, zero in version 1 rings).
+        uint32_t protocol_version;
+        /// Number of bytes reserved by producers since the ring was created.
+        alignas(64) std::atomic<uint64_t> head;
+        /// Number of bytes consumed since the ring was created.
+        alignas(64) std::atomic<uint64_t> tail;
+        /// Set by the consumer before it goes to sleep when the ring is empty.
+        alignas(64) std::atomic<uint32_t> consumer_waiting;
+    };
+
+    static_assert(sizeof(Header) == 256);
+
+    enum class RecordState : uint32_t {
+        Writing = 0,
+        Committed = 1,
+        Padding = 2,
+    };
+
+    struct RecordHeader {
+        /// Size of the whole record including this header, written right after the space is reserved, after
+        ///  `process_id`.
+        std::atomic<uint32_t> size;
+        std::atomic<RecordState> state;
+        uint32_t process_id;
+        uint32_t payload_size;
+    };
+
+    static_assert(sizeof(RecordHeader) == 16);
+
+    /// Records are aligned to the header size, so that there is always space for a padding record at the end.
+    static constexpr size_t RECORD_ALIGNMENT = sizeof(RecordHeader);
+
+private:
+    Header* m_header;
+    std::byte* m_data;
+    uint64_t m_mask;
+
+public:
+    /// `memory` must point to a region of at least `sizeof(Header) + capacity` bytes.
+    explicit SharedRing(void* memory)
+        : m_header((Header*)memory), m_data((std::byte*)memory + sizeof(Header)), m_mask(m_header->capacity - 1) {}
+
+    /// Initializes a zeroed region as an empty ring. Only called by the consumer.
+    static SharedRing initialize(void* memory, uint64_t capacity, uint32_t protocol_version) {
+        auto header = (Header*)memory;
+        header->version = VERSION;
+        header->capacity = capacity;
+        header->protocol_version = protocol_version;
+        header->magic.store(MAGIC, std::memory_order_release);
+        return SharedRing(memory);
+    }
+
+    /// Checks that the region contains an initialized ring with a layout we understand.
+    static bool is_valid(const void* memory, size_t size) {
+        auto header = (const Header*)memory;
+        return size >= sizeof(Header)
+               && header->magic.load(std::memory_order_acquire) == MAGIC
+               // version 2 only added a field to the header, so version 1 rings are accepted as well
+               && header->version >= 1 && header->version <= VERSION
+               && header->capacity != 0 && (header->capacity & (header->capacity - 1)) == 0
+               && size - sizeof(Header) >= header->capacity;
+    }
+
+    /// Wire protocol version of the record payloads.
+    [[nodiscard]] uint32_t protocol_version() const {
+        return m_header->version >= 2 ? m_header->protocol_version : 1;
+    }
+
+    /// Largest payload that fits into the ring.
+    [[nodiscard]] size_t max_payload_size() const {
+        return m_header->capacity / 4 - sizeof(RecordHeader);
+    }
+
+    /// Appends a record containing the concatenated chunks. Returns `false` if there's not enough free space.
+    bool try_write(uint32_t process_id, std::span<const std::span<const std::byte>> chunks) {
+        size_t payload_size = 0;
+        for (auto chunk : chunks) payload_size += chunk.size();
+
+        auto record_size = align(sizeof(RecordHeader) + payload_size);
+        auto capacity = m_header->capacity;
+
+        uint64_t head = m_header->head.load(std::memory_order_relaxed);
+        uint64_t padding;
+        while (true) {
+            auto contiguous = capacity - (head & m_mask);
+            padding = record_size > contiguous ? contiguous : 0;
+            if (head + padding + record_size - m_header->tail.load(std::memory_order_acquire) > capacity) {
+                return false;
+            }
+            if (m_header->head.compare_exchange_weak(head, head + padding + record_size, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+
+        if (padding) {
+            auto pad = record_at(head);
+            // the PID lets the consumer check whether we are still alive if we stall before committing the padding
+            pad->process_id = process_id;
+            pad->size.store((uint32_t)padding, std::memory_order_release);
+            pad->state.store(RecordState::Padding, std::memory_order_release);
+            head += padding;
+        }
+
+        auto record = record_at(head);
+        record->process_id = process_id;
+        record->payload_size = (uint32_t)payload_size;
+        // the PID is visible to the consumer once the size is
+        record->size.store((uint32_t)record_size, std::memory_order_release);
+        auto out = (std::byte*)(record + 1);
+        for (auto chunk : chunks) {
+            memcpy(out, chunk.data(), chunk.size());
+            out += chunk.size();
+        }
+        record->state.store(RecordState::Committed, std::memory_order_release);
+        return true;
+    }
+
+    /// Returns `true` if the consumer is sleeping and should be woken up after writing a record.
+    [[nodiscard]] bool consumer_waiting() const {
+        // pairs with the consumer setting the flag and then re-checking `head`
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return m_header->consumer_waiting.load(std::memory_order_seq_cst) != 0;
+    }
+
+    /// Result of `try_read`.
+    enum class ReadResult {
+        /// A record was passed to the callback (or a padding record was skipped).
+        Read,
+        /// There are no records.
+        Empty,
+        /// The next record is reserved, but not committed yet.
+        Pending,
+    };
+
+    /// Passes the next record to `record_cb(process_id, payload)` and frees its space. Only called by the consumer.
+    ///  Records that are not committed yet are never discarded, see the overload below.
+    ReadResult try_read(auto&& record_cb) {
+        return try_read(record_cb, 0, [](uint32_t) { return true; });
+    }
+
+    /// Same as above, but also discards the records abandoned by producers that were killed while writing them. After
+    ///  a timeout, the consumer passes `head()` as seen when it started waiting for a pending record as
+    ///  `abandoned_before`; records reserved before it are discarded if they are still not committed and
+    ///  `process_alive(process_id)` returns `false` for their producer. If the producer was killed before it wrote
+    ///  the size of its record, the end of the record is unknown, so everything up to `abandoned_before` is discarded.
+    ReadResult try_read(auto&& record_cb, uint64_t abandoned_before, auto&& process_alive) {
+        auto tail = m_header->tail.load(std::memory_order_relaxed);
+        if (tail == m_header->head.load(std::memory_order_acquire)) {
+            return ReadResult::Empty;
+        }
+
+        auto record = record_at(tail);
+        auto size = record->size.load(std::memory_order_acquire);
+        auto abandoned = tail < abandoned_before;
+        if (size == 0 && abandoned) {
+            // `abandoned_before` is the only later position known to start a record: the words in between may be
+            //  the payloads of other records, which must not be mistaken for a record header
+            if (record->size.load(std::memory_order_acquire) != 0) {
+                return ReadResult::Pending; // the producer was only stalled
+            }
+            clear(tail, abandoned_before);
+            m_header->tail.store(abandoned_before, std::memory_order_release);
+            return ReadResult::Read;
+        }
+        if (size == 0) {
+            return ReadResult::Pending;
+        }
+        auto state = record->state.load(std::memory_order_acquire);
+        if (state == RecordState::Writing && (!abandoned || process_alive(record->process_id))) {
+            // a live producer still writes into the record, freeing it would corrupt the next records
+            return ReadResult::Pending;
+        }
+
+        if (state == RecordState::Committed) {
+            record_cb(record->process_id, std::span{(const std::byte*)(record + 1), record->payload_size});
+        }
+
+        // producers rely on the memory being zeroed when they reserve it
+        memset((void*)record, 0, size);
+        m_header->tail.store(tail + size, std::memory_order_release);
+        return ReadResult::Read;
+    }
+
+    /// Number of bytes reserved by producers so far, see `try_read`.
+    [[nodiscard]] uint64_t head() const {
+        return m_header->head.load(std::memory_order_acquire);
+    }
+
+    /// Marks the consumer as sleeping. The consumer must check for records once more after calling this,
+    ///  before actually going to sleep, otherwise it could miss a wakeup.
+    void set_consumer_waiting(bool waiting) {
+        m_header->consumer_waiting.store(waiting ? 1 : 0, std::memory_order_seq_cst);
+    }
+
+private:
+    /// Zeroes the data between the positions `begin` and `end`, which may wrap around the end of the buffer.
+    void clear(uint64_t begin, uint64_t end) {
+        while (begin < end) {
+            auto contiguous = std::min(end - begin, m_header->capacity - (begin & m_mask));
+            memset(m_data + (begin & m_mask), 0, contiguous);
+            begin += contiguous;
+        }
+    }
+
+    static size_t align(size_t size) {
+        return (size + RECORD_ALIGNMENT - 1) & ~(RECORD_ALIGNMENT - 1);
+    }
+
+    RecordHeader* record_at(uint64_t position) {
+        return (RecordHeader*)(m_data + (position & m_mask));
+    }
+};
@@ -0,0 +1,411 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <queue>
+#include <ranges>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "Json.hpp"
+#include "TraceIndex.hpp"
+
+/// Parallelism analysis of a recorded process tree (see `TraceIndex`), used by `SpawnCamper.Analyzer` to find what
+///  serializes a build: the critical path, per-subtree wall vs. summed time, the concurrency over time, and periods
+///  where a parent waits for a single child.
+///
+/// All times are FILETIME ticks. Processes whose end was not recorded are assumed to end with the last of their
+///  descendants, but not before their parent (or the end of the trace, for roots without a parent).
+namespace TraceAnalysis {
+    /// Effective time span of each row, and the traversal order of the process tree.
+    class Timeline {
+        const TraceIndex::View& m_index;
+        std::vector<uint64_t> m_end;
+        std::vector<uint64_t> m_subtree_end;
+        std::vector<uint32_t> m_roots{};
+        /// Parents come before their children.
+        std::vector<uint32_t> m_preorder{};
+        uint64_t m_trace_start;
+        uint64_t m_trace_end;
+
+    public:
+        explicit Timeline(const TraceIndex::View& index)
+            : m_index(index), m_end(index.row_count()), m_subtree_end(index.row_count()), m_trace_start(index.header().start_time),
+              m_trace_end(index.header().start_time) {
+            auto row_count = index.row_count();
+            m_preorder.reserve(row_count);
+            for (uint32_t row = 0; row < row_count; row++) {
+                if (index.parent_row(row) == TraceIndex::NO_ROW) m_roots.push_back(row);
+            }
+            // explicit stack, process trees of builds may be deep
+            auto stack = std::vector<uint32_t>(m_roots.rbegin(), m_roots.rend());
+            while (!stack.empty()) {
+                auto row = stack.back();
+                stack.pop_back();
+                m_preorder.push_back(row);
+                auto children = index.children(row);
+                stack.insert(stack.end(), children.rbegin(), children.rend());
+            }
+
+            // the latest recorded time in each subtree
+            for (auto row : m_preorder | std::views::reverse) {
+                auto end = index.end_time(row);
+                m_end[row] = std::max(m_end[row], end == TraceIndex::NO_TIME ? index.start_time(row) : end);
+                m_trace_end = std::max(m_trace_end, m_end[row]);
+                if (auto parent = index.parent_row(row); parent != TraceIndex::NO_ROW) {
+                    m_end[parent] = std::max(m_end[parent], m_end[row]);
+                }
+            }
+            for (auto row : m_preorder) {
+                if (index.end_time(row) != TraceIndex::NO_TIME) {
+                    m_end[row] = index.end_time(row);
+                } else {
+                    auto parent = index.parent_row(row);
+                    m_end[row] = std::max(m_end[row], parent == TraceIndex::NO_ROW ? m_trace_end : m_end[parent]);
+                }
+            }
+            for (auto row : m_preorder | std::views::reverse) {
+                m_subtree_end[row] = std::max(m_subtree_end[row], m_end[row]);
+                if (auto parent = index.parent_row(row); parent != TraceIndex::NO_ROW) {
+                    m_subtree_end[parent] = std::max(m_subtree_end[parent], m_subtree_end[row]);
+                }
+            }
+        }
+
+        [[nodiscard]] const TraceIndex::View& index() const {
+            return m_index;
+        }
+
+        [[nodiscard]] uint32_t row_count() const {
+            return m_index.row_count();
+        }
+
+        [[nodiscard]] uint64_t start(uint32_t row) const {
+            return m_index.start_time(row);
+        }
+
+        [[nodiscard]] uint64_t end(uint32_t row) const {
+            return m_end[row];
+        }
+
+        [[nodiscard]] uint64_t duration(uint32_t row) const {
+            return end(row) - start(row);
+        }
+
+        /// End of the last process in the subtree of `row`, children may outlive their parents.
+        [[nodiscard]] uint64_t subtree_end(uint32_t row) const {
+            return m_subtree_end[row];
+        }
+
+        /// Rows without a traced parent.
+        [[nodiscard]] const std::vector<uint32_t>& roots() const {
+            return m_roots;
+        }
+
+        [[nodiscard]] const std::vector<uint32_t>& preorder() const {
+            return m_preorder;
+        }
+
+        [[nodiscard]] uint64_t trace_start() const {
+            return m_trace_start;
+        }
+
+        /// The latest recorded time of any process.
+        [[nodiscard]] uint64_t trace_end() const {
+            return m_trace_end;
+        }
+    };
+
+    /// Part of the critical path, spent in `row` itself (not waiting for a child that is also on the path).
+    ///  `row` is `TraceIndex::NO_ROW` for gaps where no traced process was running.
+    struct Segment {
+        uint32_t row;
+        uint64_t begin;
+        uint64_t end;
+    };
+
+    /// Computes the critical path from the start to the end of the trace, the chain of processes that determined
+    ///  when the trace ended. Walking back from the end of a subtree, the path continues into the child subtree that
+    ///  ended last before the current point (the child the process was waiting for), and after reaching the start of
+    ///  that child, back in the parent. Segments are sorted by time, consecutive segments of the same row are merged.
+    inline std::vector<Segment> critical_path(const Timeline& timeline) {
+        auto& index = timeline.index();
+        struct Frame {
+            uint32_t row;
+            uint64_t begin;
+            /// The path is known from this point to the end.
+            uint64_t time;
+            /// Sorted by subtree end, latest first.
+            std::vector<uint32_t> children;
+            size_t next_child = 0;
+        };
+        auto make_frame = [&](uint32_t row, uint64_t begin, uint64_t time, std::span<const uint32_t> children) {
+            auto frame = Frame{row, begin, time, {children.begin(), children.end()}};
+            std::ranges::stable_sort(frame.children, std::greater{}, [&](uint32_t c) { return timeline.subtree_end(c); });
+            return frame;
+        };
+
+        auto segments = std::vector<Segment>{};
+        auto emit = [&](uint32_t row, uint64_t begin, uint64_t end) {
+            if (begin == end) return;
+            if (!segments.empty() && segments.back().row == row && segments.back().begin == end) {
+                segments.back().begin = begin;
+            } else {
+                segments.push_back({row, begin, end});
+            }
+        };
+        // time spent in a subtree after the end of its root, waiting for descendants that outlived it, is a gap
+        auto emit_self = [&](uint32_t row, uint64_t begin, uint64_t end) {
+            auto row_end = row == TraceIndex::NO_ROW ? timeline.trace_end() : timeline.end(row);
+            if (end > row_end) emit(TraceIndex::NO_ROW, std::max(begin, row_end), end);
+            if (begin < row_end) emit(row, begin, std::min(end, row_end));
+        };
+
+        // the trace itself acts as a parent of the root processes
+        auto stack = std::vector<Frame>{};
+        stack.push_back(make_frame(TraceIndex::NO_ROW, timeline.trace_start(), timeline.trace_end(),
+                                   timeline.roots()));
+        while (!stack.empty()) {
+            auto& frame = stack.back();
+            auto child = TraceIndex::NO_ROW;
+            while (frame.next_child < frame.children.size()) {
+                auto candidate = frame.children[frame.next_child++];
+                // children outside the remaining part of the parent cannot be on the path
+                if (timeline.start(candidate) < frame.time && timeline.subtree_end(candidate) > frame.begin) {
+                    child = candidate;
+                    break;
+                }
+            }
+            if (child == TraceIndex::NO_ROW) {
+                emit_self(frame.row, frame.begin, frame.time);
+                stack.pop_back();
+                continue;
+            }
+
+            auto child_end = std::min(timeline.subtree_end(child), frame.time);
+            emit_self(frame.row, child_end, frame.time);
+            frame.time = std::max(timeline.start(child), frame.begin);
+            // `frame` is invalidated by the push
+            stack.push_back(make_frame(child, timeline.start(child), child_end, index.children(child)));
+        }
+
+        std::ranges::reverse(segments);
+        return segments;
+    }
+
+    struct SubtreeTimes {
+        /// From the start of the root of the subtree to the end of its last process.
+        uint64_t wall = 0;
+        /// Sum of the durations of all processes in the subtree.
+        uint64_t summed = 0;
+        uint32_t processes = 0;
+    };
+
+    /// Computes the wall and summed time of the subtree of each row.
+    inline std::vector<SubtreeTimes> subtree_times(const Timeline& timeline) {
+        auto& index = timeline.index();
+        auto times = std::vector<SubtreeTimes>(timeline.row_count());
+        for (auto row : timeline.preorder() | std::views::reverse) {
+            auto& t = times[row];
+            t.wall = timeline.subtree_end(row) - timeline.start(row);
+            t.summed += timeline.duration(row);
+            t.processes++;
+            if (auto parent = index.parent_row(row); parent != TraceIndex::NO_ROW) {
+                auto& p = times[parent];
+                p.summed += t.summed;
+                p.processes += t.processes;
+            }
+        }
+        return times;
+    }
+
+    /// Process counts from `time` until the next sample.
+    struct ConcurrencySample {
+        uint64_t time;
+        /// Running processes.
+        uint32_t running;
+        /// Running processes without a running child, i.e., the ones not just waiting for their children.
+        uint32_t busy;
+    };
+
+    /// Computes the number of running and busy processes over time. Consecutive samples always differ, the last
+    ///  sample is at the end of the trace with no running processes.
+    inline std::vector<ConcurrencySample> concurrency(const Timeline& timeline) {
+        auto& index = timeline.index();
+        auto row_count = timeline.row_count();
+
+        // at the same time, ends come before starts, parents start before and end after their children
+        auto position = std::vector<uint32_t>(row_count);
+        for (uint32_t i = 0; i < row_count; i++) position[timeline.preorder()[i]] = i;
+        struct Event {
+            uint64_t time;
+            bool is_start;
+            uint32_t order;
+            uint32_t row;
+            auto operator<=>(const Event&) const = default;
+        };
+        auto events = std::vector<Event>{};
+        events.reserve(2 * (size_t)row_count);
+        for (uint32_t row = 0; row < row_count; row++) {
+            if (timeline.duration(row) == 0) continue;
+            events.push_back({timeline.start(row), true, position[row], row});
+            events.push_back({timeline.end(row), false, ~position[row], row});
+        }
+        std::ranges::sort(events);
+
+        auto running_children = std::vector<uint32_t>(row_count);
+        auto is_running = std::vector<bool>(row_count);
+        auto samples = std::vector<ConcurrencySample>{};
+        uint32_t running = 0, busy = 0;
+        for (size_t i = 0; i < events.size(); i++) {
+            auto& e = events[i];
+            auto parent = index.parent_row(e.row);
+            auto parent_running = parent != TraceIndex::NO_ROW && is_running[parent];
+            if (e.is_start) {
+                is_running[e.row] = true;
+                running++;
+                busy++;
+                if (parent_running && running_children[parent]++ == 0) busy--;
+            } else {
+                is_running[e.row] = false;
+                running--;
+                if (running_children[e.row] == 0) busy--;
+                if (parent_running && --running_children[parent] == 0) busy++;
+            }
+
+            if (i + 1 < events.size() && events[i + 1].time == e.time) continue;
+            if (samples.empty() || samples.back().running != running || samples.back().busy != busy) {
+                samples.push_back({e.time, running, busy});
+            }
+        }
+        return samples;
+    }
+
+    /// Period when `parent` was running with `child` as its only running child.
+    struct SingleChildWait {
+        uint32_t parent;
+        uint32_t child;
+        uint64_t begin;
+        uint64_t end;
+    };
+
+    /// Finds the periods, at least `min_duration` long, when a process was running with exactly one running child,
+    ///  sorted by duration, longest first. These are the places where a build is serialized: the parent could only
+    ///  make progress once the child finished, and no other work was started meanwhile.
+    inline std::vector<SingleChildWait> single_child_waits(const Timeline& timeline, uint64_t min_duration) {
+        auto& index = timeline.index();
+        auto waits = std::vector<SingleChildWait>{};
+        auto events = std::vector<std::pair<uint64_t, int64_t>>{};
+        for (uint32_t parent = 0; parent < timeline.row_count(); parent++) {
+            auto children = index.children(parent);
+            if (children.empty()) continue;
+
+            // children clipped to the lifetime of the parent; an event adds/removes the child row (+ 1, so that
+            //  row 0 is distinguishable), when exactly one child is running, the sum of the events is its row
+            auto from = timeline.start(parent), to = timeline.end(parent);
+            events.clear();
+            for (auto child : children) {
+                auto begin = std::max(timeline.start(child), from), end = std::min(timeline.end(child), to);
+                if (begin >= end) continue;
+                events.emplace_back(begin, (int64_t)child + 1);
+                events.emplace_back(end, -((int64_t)child + 1));
+            }
+            std::ranges::sort(events);
+
+            int64_t count = 0, sum = 0;
+            // `row + 1` of the single running child, 0 if there is none; only updated once all events at the same
+            //  time are applied, so that a child starting right when another one ends is seen as a switch
+            int64_t single = 0;
+            uint64_t wait_begin = 0;
+            for (size_t i = 0; i < events.size(); i++) {
+                auto [time, delta] = events[i];
+                count += delta > 0 ? 1 : -1;
+                sum += delta;
+                if (i + 1 < events.size() && events[i + 1].first == time) continue;
+
+                auto new_single = count == 1 ? sum : 0;
+                if (new_single == single) continue;
+                if (single != 0 && time - wait_begin >= min_duration) {
+                    waits.push_back({parent, (uint32_t)(single - 1), wait_begin, time});
+                }
+                single = new_single;
+                wait_begin = time;
+            }
+        }
+        std::ranges::sort(waits, std::greater{}, [](const SingleChildWait& w) { return w.end - w.begin; });
+        return waits;
+    }
+
+    /// File name of the executable of `row`, for display.
+    inline std::string_view exe_name(const TraceIndex::View& index, uint32_t row) {
+        auto path = index.exe_path(row);
+        auto separator = path.find_last_of("\\/");
+        return separator == std::string_view::npos ? path : path.substr(separator + 1);
+    }
+
+    /// Writes a trace in the Chrome trace event format (https://ui.perfetto.dev, `chrome://tracing`). Processes are
+    ///  shown as slices packed into as few lanes as possible, with a counter track of the concurrency, and the
+    ///  critical path is shown as a separate track.
+    inline void write_chrome_trace(std::ostream& out, const Timeline& timeline, const std::vector<Segment>& path,
+                                   const std::vector<ConcurrencySample>& samples) {
+        auto& index = timeline.index();
+        // FILETIME ticks are 100 ns, the format uses microseconds
+        auto write_us = [&](uint64_t ticks) {
+            out << ticks / 10 << '.' << ticks % 10;
+        };
+        auto write_slice = [&](uint32_t pid, uint32_t tid, uint32_t row, uint64_t begin, uint64_t end) {
+            out << R"({"ph":"X","pid":)" << pid << R"(,"tid":)" << tid << R"(,"ts":)";
+            write_us(begin - timeline.trace_start());
+            out << R"(,"dur":)";
+            write_us(end - begin);
+            out << R"(,"name":)";
+            Json::write_string(out, row == TraceIndex::NO_ROW ? "(no process)" : exe_name(index, row));
+            if (row != TraceIndex::NO_ROW) {
+                out << R"(,"args":{"row":)" << row << R"(,"pid":)" << index.pid(row) << R"(,"commandLine":)";
+                Json::write_string(out, index.command_line(row));
+                out << R"(,"exitCode":)";
+                if (auto code = index.exit_code(row)) out << *code;
+                else out << "null";
+                out << '}';
+            }
+            out << "},\n";
+        };
+
+        out << "{\"traceEvents\":[\n";
+        out << R"({"ph":"M","pid":1,"name":"process_name","args":{"name":"Processes"}},)" << '\n';
+        out << R"({"ph":"M","pid":2,"name":"process_name","args":{"name":"Critical path"}},)" << '\n';
+
+        // rows are sorted by start time; reuse the lane that became free first
+        using Lane = std::pair<uint64_t, uint32_t>; // end time, lane
+        auto free_lanes = std::priority_queue<Lane, std::vector<Lane>, std::greater<>>{};
+        uint32_t lane_count = 0;
+        for (uint32_t row = 0; row < timeline.row_count(); row++) {
+            uint32_t lane;
+            if (!free_lanes.empty() && free_lanes.top().first <= timeline.start(row)) {
+                lane = free_lanes.top().second;
+                free_lanes.pop();
+            } else {
+                lane = lane_count++;
+            }
+            free_lanes.emplace(timeline.end(row), lane);
+            write_slice(1, lane, row, timeline.start(row), timeline.end(row));
+        }
+
+        for (auto& s : samples) {
+            out << R"({"ph":"C","pid":1,"name":"Concurrency","ts":)";
+            write_us(s.time - timeline.trace_start());
+            out << R"(,"args":{"running":)" << s.running << R"(,"busy":)" << s.busy << "}},\n";
+        }
+        for (auto& s : path) {
+            write_slice(2, 0, s.row, s.begin, s.end);
+        }
+
+        // the format allows a trailing comma, but not all viewers do
+        out << R"({"ph":"M","pid":1,"name":"process_sort_index","args":{"sort_index":1}})" << "\n";
+        out << "],\"displayTimeUnit\":\"ms\"}\n";
+    }
+}
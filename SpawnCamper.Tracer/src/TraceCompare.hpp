@@ -0,0 +1,289 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Environment.hpp"
+#include "TraceAnalysis.hpp"
+#include "TraceIndex.hpp"
+
+/// Alignment of two recorded runs of the same build (see `TraceIndex`), used by `SpawnCamper.Compare` to find what
+///  changed between them: which invocations were added or removed, which got slower, whose exit code or environment
+///  changed, and how much each of them contributed to the change of the total wall time.
+///
+/// Processes are matched by signatures, hashes of the exe path and the normalized command line, so that aligning
+///  two traces is linear in the number of processes instead of comparing every pair. Matching proceeds in passes,
+///  each only considering the processes left unmatched by the previous ones:
+///   1. In preorder, a process is matched to a child of the process its parent was matched to (or to a root, for
+///      roots) with the same signature.
+///   2. Processes with the same signature anywhere in the tree, for invocations that moved to another parent.
+///   3. Same as 1, for the processes whose parent was only matched by pass 2; if there is no child with the same
+///      signature, a child with the same exe file name is taken instead, for invocations whose arguments or
+///      toolchain path changed.
+///  Within each group of candidates, the k-th process of one trace (by start time) is matched to the k-th one of the
+///  other, so that repeated identical invocations are paired in the order they ran.
+namespace TraceCompare {
+    /// Normalizes a command line, so that invocations that only differ by values generated at runtime (PIDs,
+    ///  timestamps, temporary file names, GUIDs) match. ASCII letters are lowercased, `/` is replaced by `\`, runs of
+    ///  whitespace are collapsed, and runs of 4 or more decimal digits and alphanumeric runs of 8 or more hexadecimal
+    ///  digits containing a digit are replaced by `#`.
+    inline void normalize_command_line(std::string_view command_line, std::string& out) {
+        auto is_digit = [](char c) { return c >= '0' && c <= '9'; };
+        auto is_hex = [&](char c) { return is_digit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'); };
+        auto is_alnum = [&](char c) { return is_hex(c) || (c >= 'g' && c <= 'z') || (c >= 'G' && c <= 'Z'); };
+        auto to_lower = [](char c) { return c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c; };
+
+        out.clear();
+        size_t i = 0;
+        while (i < command_line.size()) {
+            auto c = command_line[i];
+            if (c == ' ' || c == '\t') {
+                while (i < command_line.size() && (command_line[i] == ' ' || command_line[i] == '\t')) i++;
+                if (!out.empty() && i < command_line.size()) out += ' ';
+                continue;
+            }
+            if (!is_alnum(c)) {
+                out += c == '/' ? '\\' : c;
+                i++;
+                continue;
+            }
+
+            auto end = i;
+            while (end < command_line.size() && is_alnum(command_line[end])) end++;
+            auto run = command_line.substr(i, end - i);
+            if (run.size() >= 8 && std::ranges::all_of(run, is_hex) && std::ranges::any_of(run, is_digit)) {
+                out += '#';
+                i = end;
+                continue;
+            }
+            while (i < end) {
+                auto digits_end = i;
+                while (digits_end < end && is_digit(command_line[digits_end])) digits_end++;
+                if (digits_end - i >= 4) {
+                    out += '#';
+                    i = digits_end;
+                } else if (digits_end > i) {
+                    out.append(command_line.substr(i, digits_end - i));
+                    i = digits_end;
+                } else {
+                    out += to_lower(command_line[i++]);
+                }
+            }
+        }
+    }
+
+    /// File name of an exe path, lowercased, to match invocations of the same tool installed in another directory.
+    inline std::string exe_file_name(std::string_view path) {
+        auto separator = path.find_last_of("\\/");
+        auto name = std::string(separator == std::string_view::npos ? path : path.substr(separator + 1));
+        for (auto& c : name) {
+            if (c >= 'A' && c <= 'Z') c = (char)(c - 'A' + 'a');
+        }
+        return name;
+    }
+
+    /// Per-row hashes used to match processes.
+    struct Signatures {
+        /// Exe path and normalized command line.
+        std::vector<uint64_t> invocation;
+        /// Exe file name.
+        std::vector<uint64_t> exe;
+
+        explicit Signatures(const TraceIndex::View& index)
+            : invocation(index.row_count()), exe(index.row_count()) {
+            auto exe_hashes = std::vector<uint64_t>(index.exe_count());
+            auto exe_name_hashes = std::vector<uint64_t>(index.exe_count());
+            for (uint32_t exe = 0; exe < index.exe_count(); exe++) {
+                auto path = index.exe_name(exe);
+                auto name = exe_file_name(path);
+                exe_hashes[exe] = Environment::hash(path.data(), path.size());
+                exe_name_hashes[exe] = Environment::hash(name.data(), name.size());
+            }
+            auto normalized = std::string{};
+            for (uint32_t row = 0; row < index.row_count(); row++) {
+                normalize_command_line(index.command_line(row), normalized);
+                invocation[row] = combine(exe_hashes[index.exe(row)],
+                                          Environment::hash(normalized.data(), normalized.size()));
+                exe[row] = exe_name_hashes[index.exe(row)];
+            }
+        }
+
+        static uint64_t combine(uint64_t a, uint64_t b) {
+            // the 64-bit finalizer of MurmurHash3, so that swapped or equal parts do not cancel out
+            auto h = a ^ (b + 0x9e3779b97f4a7c15 + (a << 6) + (a >> 2));
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccd;
+            h ^= h >> 33;
+            h *= 0xc4ceb9fe1a85ec53;
+            h ^= h >> 33;
+            return h;
+        }
+    };
+
+    /// Rows of one trace matched to the rows of the other one, `TraceIndex::NO_ROW` if unmatched.
+    struct Matching {
+        std::vector<uint32_t> before_to_after;
+        std::vector<uint32_t> after_to_before;
+    };
+
+    inline Matching match(const TraceAnalysis::Timeline& before, const TraceAnalysis::Timeline& after) {
+        auto before_signatures = Signatures(before.index());
+        auto after_signatures = Signatures(after.index());
+        auto result = Matching{std::vector(before.row_count(), TraceIndex::NO_ROW),
+                               std::vector(after.row_count(), TraceIndex::NO_ROW)};
+
+        /// Candidate rows of `after` in start order, consumed from `next`; matched rows are skipped lazily.
+        struct Candidates {
+            std::vector<uint32_t> rows{};
+            size_t next = 0;
+        };
+        using Buckets = std::unordered_map<uint64_t, Candidates>;
+        auto take = [&](Buckets& buckets, uint64_t key) {
+            auto it = buckets.find(key);
+            if (it == buckets.end()) return TraceIndex::NO_ROW;
+            auto& c = it->second;
+            while (c.next < c.rows.size() && result.after_to_before[c.rows[c.next]] != TraceIndex::NO_ROW) c.next++;
+            return c.next < c.rows.size() ? c.rows[c.next++] : TraceIndex::NO_ROW;
+        };
+        auto pair = [&](uint32_t before_row, uint32_t after_row) {
+            result.before_to_after[before_row] = after_row;
+            result.after_to_before[after_row] = before_row;
+        };
+        // the parent of roots is the trace itself, which always matches
+        auto positional_key = [](uint32_t after_parent, uint64_t signature) {
+            return Signatures::combine(after_parent, signature);
+        };
+
+        auto& after_index = after.index();
+        auto by_position = Buckets{}, by_exe = Buckets{}, by_signature = Buckets{};
+        by_position.reserve(after.row_count());
+        by_signature.reserve(after.row_count());
+        // rows are sorted by start time
+        for (uint32_t row = 0; row < after.row_count(); row++) {
+            auto parent = after_index.parent_row(row);
+            by_position[positional_key(parent, after_signatures.invocation[row])].rows.push_back(row);
+            by_exe[positional_key(parent, after_signatures.exe[row])].rows.push_back(row);
+            by_signature[after_signatures.invocation[row]].rows.push_back(row);
+        }
+
+        auto& before_index = before.index();
+        auto match_positional = [&](bool fall_back_to_exe) {
+            for (auto row : before.preorder()) {
+                if (result.before_to_after[row] != TraceIndex::NO_ROW) continue;
+                auto parent = before_index.parent_row(row);
+                auto after_parent = parent == TraceIndex::NO_ROW ? TraceIndex::NO_ROW : result.before_to_after[parent];
+                if (parent != TraceIndex::NO_ROW && after_parent == TraceIndex::NO_ROW) continue;
+
+                auto candidate = take(by_position, positional_key(after_parent, before_signatures.invocation[row]));
+                if (candidate == TraceIndex::NO_ROW && fall_back_to_exe) {
+                    candidate = take(by_exe, positional_key(after_parent, before_signatures.exe[row]));
+                }
+                if (candidate != TraceIndex::NO_ROW) pair(row, candidate);
+            }
+        };
+
+        match_positional(false);
+        // rows are sorted by start time, so are the candidates
+        for (uint32_t row = 0; row < before.row_count(); row++) {
+            if (result.before_to_after[row] != TraceIndex::NO_ROW) continue;
+            auto candidate = take(by_signature, before_signatures.invocation[row]);
+            if (candidate != TraceIndex::NO_ROW) pair(row, candidate);
+        }
+        match_positional(true);
+        return result;
+    }
+
+    /// Time each row spent on the critical path (see `TraceAnalysis::critical_path`), which sums up to the wall time
+    ///  of the trace minus the gaps when no process was running. A change of this time is the impact of the row on
+    ///  the wall time of the whole trace.
+    inline std::vector<uint64_t> critical_times(const TraceAnalysis::Timeline& timeline) {
+        auto times = std::vector<uint64_t>(timeline.row_count());
+        for (auto& s : TraceAnalysis::critical_path(timeline)) {
+            if (s.row != TraceIndex::NO_ROW) times[s.row] += s.end - s.begin;
+        }
+        return times;
+    }
+
+    /// A variable that differs between the environments of matched processes.
+    struct VariableChange {
+        std::string_view name;
+        /// Example values from the first pair of processes with the change, `nullopt` if the variable is not set.
+        std::optional<std::string_view> before;
+        std::optional<std::string_view> after;
+        /// Matched pairs of processes with the change.
+        uint32_t processes = 0;
+    };
+
+    /// Compares the environments of all matched pairs of processes, sorted by the number of affected processes.
+    ///  Environments are deduplicated in the index and most processes of a build share a few of them, so each
+    ///  distinct pair of environments is only compared once.
+    inline std::vector<VariableChange> environment_changes(const TraceIndex::View& before,
+                                                           const TraceIndex::View& after, const Matching& matching) {
+        auto parse = [](std::string_view block) {
+            auto vars = std::unordered_map<std::string_view, std::string_view>{};
+            for (size_t i = 0; i < block.size();) {
+                auto end = block.find('\0', i);
+                if (end == std::string_view::npos) end = block.size();
+                auto var = block.substr(i, end - i);
+                i = end + 1;
+                // skip the `=C:=C:\...` entries of cmd.exe, like the server does
+                auto separator = var.find('=', 1);
+                if (separator == std::string_view::npos) continue;
+                vars.emplace(var.substr(0, separator), var.substr(separator + 1));
+            }
+            return vars;
+        };
+
+        // pairs of environments are identified by the addresses of their blocks in the mapped indices
+        struct EnvironmentPair {
+            uint32_t before_row;
+            uint32_t after_row;
+            uint32_t processes;
+        };
+        auto pairs = std::vector<EnvironmentPair>{};
+        auto pair_index = std::unordered_map<uint64_t, size_t>{};
+        for (uint32_t row = 0; row < before.row_count(); row++) {
+            auto other = matching.before_to_after[row];
+            if (other == TraceIndex::NO_ROW) continue;
+            // a partial environment would show every variable it lacks as removed or added
+            if ((before.flags(row) | after.flags(other)) & TraceIndex::RowFlags::EnvironmentIncomplete) continue;
+            auto a = before.environment(row), b = after.environment(other);
+            if (a == b) continue;
+            auto key = Signatures::combine((uint64_t)(uintptr_t)a.data(), (uint64_t)(uintptr_t)b.data());
+            auto [it, inserted] = pair_index.try_emplace(key, pairs.size());
+            if (inserted) pairs.push_back({row, other, 0});
+            pairs[it->second].processes++;
+        }
+
+        auto changes = std::vector<VariableChange>{};
+        auto change_index = std::unordered_map<std::string_view, size_t>{};
+        auto record = [&](std::string_view name, std::optional<std::string_view> old_value,
+                          std::optional<std::string_view> new_value, uint32_t count) {
+            auto [it, inserted] = change_index.try_emplace(name, changes.size());
+            if (inserted) changes.push_back({name, old_value, new_value});
+            changes[it->second].processes += count;
+        };
+        for (auto& p : pairs) {
+            auto old_vars = parse(before.environment(p.before_row));
+            auto new_vars = parse(after.environment(p.after_row));
+            for (auto& [name, old_value] : old_vars) {
+                auto it = new_vars.find(name);
+                if (it == new_vars.end()) record(name, old_value, std::nullopt, p.processes);
+                else if (it->second != old_value) record(name, old_value, it->second, p.processes);
+            }
+            for (auto& [name, new_value] : new_vars) {
+                if (!old_vars.contains(name)) record(name, std::nullopt, new_value, p.processes);
+            }
+        }
+        std::ranges::sort(changes, [](const VariableChange& a, const VariableChange& b) {
+            return a.processes != b.processes ? a.processes > b.processes : a.name < b.name;
+        });
+        return changes;
+    }
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+
+#include "SharedRing.hpp"
+
+/// Trace file written by `SpawnCamper.Tracer --record`, which can be replayed into the server later.
+///
+/// The file starts with `Header`, followed by a data area of `Header::capacity` bytes. Hooks append records by
+///  atomically advancing `Header::end`; the records use the same framing as `SharedRing`, and their
+///  payloads are the same messages that would otherwise be sent to the server. The layout is shared with
+///  `TraceFileReader` in the server, keep them in sync.
+namespace TraceFile {
+    inline constexpr char MAGIC[8] = "SCTRACE";
+    inline constexpr uint32_t VERSION = 1;
+    /// Offset of the data area, one page, so that the header can be mapped separately.
+    inline constexpr size_t DATA_OFFSET = 4096;
+
+    using RecordHeader = SharedRing::RecordHeader;
+    using RecordState = SharedRing::RecordState;
+
+    struct Header {
+        char magic[8];
+        /// Version of the file layout.
+        uint32_t version;
+        /// Version of the wire protocol used for the record payloads.
+        uint32_t protocol_version;
+        /// Clock base of the recording, FILETIME when the recording started. Message timestamps are absolute FILETIMEs.
+        uint64_t start_time;
+        /// Size of the data area in bytes.
+        uint64_t capacity;
+        /// Number of bytes reserved in the data area.
+        alignas(64) std::atomic<uint64_t> end;
+        /// Number of messages that did not fit into the file.
+        alignas(64) std::atomic<uint64_t> dropped;
+    };
+
+    static_assert(sizeof(Header) <= DATA_OFFSET);
+
+    /// Initializes a zeroed region of `DATA_OFFSET + capacity` bytes as an empty trace file.
+    inline void initialize(void* memory, uint64_t capacity, uint32_t protocol_version, uint64_t start_time) {
+        auto header = (Header*)memory;
+        header->version = VERSION;
+        header->protocol_version = protocol_version;
+        header->start_time = start_time;
+        header->capacity = capacity;
+        memcpy(header->magic, MAGIC, sizeof(MAGIC));
+    }
+
+    /// Checks the header alone, for writers that map the data area separately.
+    inline bool is_valid_header(const void* memory, size_t size) {
+        auto header = (const Header*)memory;
+        return size >= sizeof(Header)
+               && memcmp(header->magic, MAGIC, sizeof(MAGIC)) == 0
+               && header->version == VERSION;
+    }
+
+    inline bool is_valid(const void* memory, size_t size) {
+        return size >= DATA_OFFSET && is_valid_header(memory, size)
+               && size - DATA_OFFSET >= ((const Header*)memory)->capacity;
+    }
+
+    /// Size of a record with a payload of `payload_size` bytes, including its header and alignment.
+    inline size_t record_size(size_t payload_size) {
+        return (sizeof(RecordHeader) + payload_size + SharedRing::RECORD_ALIGNMENT - 1)
+               & ~(SharedRing::RECORD_ALIGNMENT - 1);
+    }
+
+    /// Reserves `record_size` bytes in the data area and returns their offset in the data area, or `std::nullopt`
+    ///  if the file is full.
+    inline std::optional<uint64_t> reserve(Header* header, size_t record_size) {
+        auto offset = header->end.fetch_add(record_size, std::memory_order_relaxed);
+        if (offset + record_size > header->capacity) {
+            // the file is full; `end` stays past the capacity, so all subsequent appends fail as well
+            header->dropped.fetch_add(1, std::memory_order_relaxed);
+            return std::nullopt;
+        }
+        return offset;
+    }
+
+    /// Writes a record containing the concatenated chunks into the space reserved for it at `memory`.
+    inline void write_record(void* memory, uint32_t process_id, std::span<const std::span<const std::byte>> chunks) {
+        size_t payload_size = 0;
+        for (auto chunk : chunks) payload_size += chunk.size();
+
+        auto record = (RecordHeader*)memory;
+        record->size.store((uint32_t)record_size(payload_size), std::memory_order_relaxed);
+        record->process_id = process_id;
+        record->payload_size = (uint32_t)payload_size;
+        auto out = (std::byte*)(record + 1);
+        for (auto chunk : chunks) {
+            memcpy(out, chunk.data(), chunk.size());
+            out += chunk.size();
+        }
+        record->state.store(RecordState::Committed, std::memory_order_release);
+    }
+
+    /// Appends a record containing the concatenated chunks to a file mapped as a whole at `memory`. Returns `false`
+    ///  if the file is full.
+    inline bool append(void* memory, uint32_t process_id, std::span<const std::span<const std::byte>> chunks) {
+        size_t payload_size = 0;
+        for (auto chunk : chunks) payload_size += chunk.size();
+        auto offset = reserve((Header*)memory, record_size(payload_size));
+        if (!offset) {
+            return false;
+        }
+        write_record((std::byte*)memory + DATA_OFFSET + *offset, process_id, chunks);
+        return true;
+    }
+
+    /// Calls `record_cb(process_id, payload)` for each committed record in the file, in the order they were reserved.
+    /// Records whose writer was killed (or failed to map the file) before committing them are skipped.
+    inline void for_each_record(const void* memory, size_t size, auto&& record_cb) {
+        auto header = (const Header*)memory;
+        auto end = std::min<uint64_t>(header->end.load(std::memory_order_acquire), header->capacity);
+        end = std::min<uint64_t>(end, size - DATA_OFFSET);
+
+        uint64_t offset = 0;
+        while (offset + sizeof(RecordHeader) <= end) {
+            auto record = (const RecordHeader*)((const std::byte*)memory + DATA_OFFSET + offset);
+            auto record_size = record->size.load(std::memory_order_acquire);
+            if (record_size == 0) {
+                // the size was never written, but the reserved space is still zeroed, so the next record starts
+                //  at the first non-zero record header
+                offset += SharedRing::RECORD_ALIGNMENT;
+                continue;
+            }
+            if (offset + record_size > end) {
+                break;
+            }
+            if (record->state.load(std::memory_order_acquire) == RecordState::Committed) {
+                record_cb(record->process_id, std::span{(const std::byte*)(record + 1), record->payload_size});
+            }
+            offset += record_size;
+        }
+    }
+}
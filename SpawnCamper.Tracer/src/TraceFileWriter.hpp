@@ -0,0 +1,193 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <Windows.h>
+#include <winioctl.h>
+
+#include "MessageSink.hpp"
+#include "TraceFile.hpp"
+#include "Utils.hpp"
+#include "Win32.hpp"
+
+namespace TraceFile {
+    /// Name of the file mapping through which the hooks append to the trace file recorded by the tracer `recorder_pid`.
+    inline std::wstring mapping_name(uint32_t recorder_pid) {
+        return LR"(Local\SpawnCamper.Record.)" + std::to_wstring(recorder_pid);
+    }
+}
+
+/// Sink that appends messages to the trace file recorded by the tracer, without any server. Like `SharedMemoryWriter`,
+///  writing a message usually does not enter the kernel; when the file is full, messages are dropped.
+///
+/// Only the header and a window of the data area around the last record are mapped: mapping the whole file would
+///  reserve its full capacity (1 GiB by default) in each traced process, which often does not fit into the address
+///  space of 32-bit processes. Messages that cannot be written because the window cannot be mapped are counted
+///  as dropped as well.
+class TraceFileWriter final : public MessageSink {
+    /// Size of the mapped window of the data area; a larger record is mapped on its own.
+    static constexpr uint64_t WINDOW_SIZE = 4 * 1024 * 1024;
+
+    HANDLE m_mapping = nullptr;
+    TraceFile::Header* m_header = nullptr;
+    /// Window of the file at offsets `[m_window_start, m_window_end)`; protected by `m_mutex`.
+    std::byte* m_window = nullptr;
+    uint64_t m_window_start = 0;
+    uint64_t m_window_end = 0;
+    std::mutex m_mutex;
+    uint32_t m_process_id = ::GetCurrentProcessId();
+    std::atomic<uint64_t> m_dropped{0};
+
+public:
+    /// If the trace file mapping does not exist (e.g., the tracer exited), the writer is not connected.
+    explicit TraceFileWriter(uint32_t recorder_pid) {
+        m_mapping = ::OpenFileMappingW(FILE_MAP_READ | FILE_MAP_WRITE, FALSE,
+                                       TraceFile::mapping_name(recorder_pid).c_str());
+        if (!m_mapping) {
+            return;
+        }
+        m_header = (TraceFile::Header*)::MapViewOfFile(m_mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0,
+                                                       TraceFile::DATA_OFFSET);
+        if (m_header && !TraceFile::is_valid_header(m_header, TraceFile::DATA_OFFSET)) {
+            ::UnmapViewOfFile(m_header);
+            m_header = nullptr;
+        }
+    }
+
+    ~TraceFileWriter() override {
+        if (m_window) ::UnmapViewOfFile(m_window);
+        if (m_header) ::UnmapViewOfFile(m_header);
+        if (m_mapping) ::CloseHandle(m_mapping);
+    }
+
+    TraceFileWriter(const TraceFileWriter&) = delete;
+    TraceFileWriter& operator=(const TraceFileWriter&) = delete;
+
+    bool connected() override {
+        return m_header != nullptr;
+    }
+
+    void write(std::span<const std::span<const std::byte>> chunks) override {
+        if (!m_header) {
+            return;
+        }
+        size_t payload_size = 0;
+        for (auto chunk : chunks) payload_size += chunk.size();
+        auto record_size = TraceFile::record_size(payload_size);
+        auto offset = TraceFile::reserve(m_header, record_size);
+        if (!offset) {
+            m_dropped.fetch_add(1);
+            return;
+        }
+
+        std::unique_lock lock(m_mutex);
+        auto record = map(TraceFile::DATA_OFFSET + *offset, record_size);
+        if (!record) {
+            // out of address space; readers skip the reserved space, which stays zeroed
+            m_dropped.fetch_add(1);
+            return;
+        }
+        TraceFile::write_record(record, m_process_id, chunks);
+    }
+
+    uint64_t dropped_messages() override {
+        return m_dropped.load();
+    }
+
+    uint32_t protocol_version() override {
+        return m_header ? m_header->protocol_version : 1;
+    }
+
+private:
+    /// Returns a pointer to `size` bytes at the file offset `offset`, moving the window if necessary.
+    std::byte* map(uint64_t offset, uint64_t size) {
+        if (offset < m_window_start || offset + size > m_window_end) {
+            if (m_window) {
+                ::UnmapViewOfFile(m_window);
+                m_window = nullptr;
+            }
+            // views must start at a multiple of the allocation granularity; records are appended, so start
+            //  the window at the record and leave the rest of it for the following records
+            auto start = offset & ~(uint64_t)(allocation_granularity() - 1);
+            auto end = std::min(std::max(start + WINDOW_SIZE, offset + size),
+                                TraceFile::DATA_OFFSET + m_header->capacity);
+            m_window = (std::byte*)::MapViewOfFile(m_mapping, FILE_MAP_READ | FILE_MAP_WRITE, (DWORD)(start >> 32),
+                                                   (DWORD)start, (SIZE_T)(end - start));
+            if (!m_window) {
+                m_window_start = m_window_end = 0;
+                return nullptr;
+            }
+            m_window_start = start;
+            m_window_end = end;
+        }
+        return m_window + (offset - m_window_start);
+    }
+
+    static uint32_t allocation_granularity() {
+        SYSTEM_INFO info;
+        ::GetSystemInfo(&info);
+        return info.dwAllocationGranularity;
+    }
+};
+
+/// Trace file created by the tracer. The data area is reserved upfront as a sparse file, and the file is truncated
+///  to the recorded size in `finish()`.
+class TraceFileRecording {
+    HANDLE m_file;
+    HANDLE m_mapping = nullptr;
+    void* m_view = nullptr;
+
+public:
+    TraceFileRecording(const std::filesystem::path& path, uint64_t capacity, uint32_t protocol_version) {
+        m_file = Win32::CreateFileW(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, CREATE_ALWAYS);
+        // not supported by all filesystems, in which case the whole file is allocated
+        DWORD bytes_returned;
+        ::DeviceIoControl(m_file, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &bytes_returned, nullptr);
+
+        auto size = TraceFile::DATA_OFFSET + capacity;
+        m_mapping = ::CreateFileMappingW(m_file, nullptr, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)size,
+                                         TraceFile::mapping_name(::GetCurrentProcessId()).c_str());
+        if (!m_mapping) {
+            throw Win32::Win32Error{"CreateFileMappingW"};
+        }
+        // the tracer only needs the header
+        m_view = ::MapViewOfFile(m_mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, TraceFile::DATA_OFFSET);
+        if (!m_view) {
+            throw Win32::Win32Error{"MapViewOfFile"};
+        }
+        TraceFile::initialize(m_view, capacity, protocol_version, Utils::current_filetime());
+    }
+
+    ~TraceFileRecording() {
+        if (m_view) ::UnmapViewOfFile(m_view);
+        if (m_mapping) ::CloseHandle(m_mapping);
+        ::CloseHandle(m_file);
+    }
+
+    TraceFileRecording(const TraceFileRecording&) = delete;
+    TraceFileRecording& operator=(const TraceFileRecording&) = delete;
+
+    /// Stops the recording; processes that are still running keep appending until they exit. Returns the number
+    ///  of messages that did not fit into the file.
+    uint64_t finish() {
+        auto header = (TraceFile::Header*)m_view;
+        auto dropped = header->dropped.load();
+        auto end = std::min(header->end.load(), header->capacity);
+
+        ::UnmapViewOfFile(m_view);
+        m_view = nullptr;
+        ::CloseHandle(m_mapping);
+        m_mapping = nullptr;
+
+        // fails if a process that outlived the traced command still has the file mapped, in which case the file
+        //  stays at the full (sparse) size; readers only use the part up to `Header::end`
+        auto file_size = LARGE_INTEGER{.QuadPart = (LONGLONG)(TraceFile::DATA_OFFSET + end)};
+        if (::SetFilePointerEx(m_file, file_size, nullptr, FILE_BEGIN)) {
+            ::SetEndOfFile(m_file);
+        }
+        return dropped;
+    }
+};
@@ -0,0 +1,486 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <numeric>
+#include <optional>
+#include <ostream>
+#include <ranges>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "TraceReader.hpp"
+
+/// Columnar index of a recorded trace, built by `SpawnCamper.Indexer` and meant to be memory-mapped and queried
+///  in place, so that tools only page in the processes they actually look at.
+///
+/// Each traced process (each program image on Linux) is a row. Rows are sorted by start time, so time range queries
+///  are binary searches. Fixed-size per-row data is stored in columns, strings and environment blocks in heaps
+///  referenced by offsets (both deduplicated where it pays off). Children of a row and rows of an executable are
+///  stored as adjacency lists (an offset column indexing into a flat array of rows), so both lookups are O(1).
+///
+/// The file starts with `Header`, followed by the sections listed in `Header::sections`, each aligned to 64 bytes.
+///  All values are little-endian.
+namespace TraceIndex {
+    inline constexpr char MAGIC[8] = "SCINDEX";
+    inline constexpr uint32_t VERSION = 1;
+    inline constexpr uint32_t NO_ROW = UINT32_MAX;
+    inline constexpr uint64_t NO_STRING = UINT64_MAX;
+    /// `end_time` of processes whose end was not recorded (e.g., they were killed).
+    inline constexpr uint64_t NO_TIME = 0;
+    inline constexpr size_t SECTION_ALIGNMENT = 64;
+
+    enum class Section : uint32_t {
+        // per-row columns
+        Pid, // uint32_t
+        ParentPid, // uint32_t
+        ParentRow, // uint32_t, `NO_ROW` if the parent was not traced
+        StartTime, // uint64_t FILETIME, ascending
+        EndTime, // uint64_t FILETIME or `NO_TIME`
+        ExitCode, // uint32_t, valid if `RowFlags::Exited` is set
+        Flags, // uint32_t `RowFlags`
+        Exe, // uint32_t exe ID
+        CommandLine, // uint64_t offset in `Strings`
+        WorkingDirectory, // uint64_t offset in `Strings`
+        Environment, // uint64_t offset in `Environments`
+        ChildOffsets, // uint32_t, row count + 1 entries indexing into `Children`
+        Children, // uint32_t rows, ascending for each parent
+        // per-exe columns, exe IDs are assigned in the order of sorted exe paths
+        ExeName, // uint64_t offset in `Strings`
+        ExeRowOffsets, // uint32_t, exe count + 1 entries indexing into `ExeRows`
+        ExeRows, // uint32_t rows, ascending for each exe
+        // heaps, each entry is a `uint32_t` length followed by UTF-8 data
+        Strings,
+        Environments,
+        Count,
+    };
+
+    enum RowFlags : uint32_t {
+        /// The exit code was recorded.
+        Exited = 1,
+        /// The process executed another program image, which is its child row with the same PID (Linux only).
+        Replaced = 2,
+        /// The process ended without recording its exit (e.g., it was killed or crashed), the exit code and time were
+        ///  recorded by its parent (Windows only).
+        Terminated = 4,
+        /// Only the variables the process changed are known, the environment it inherited was not recorded
+        ///  (see `TraceReader::ProcessStart::environment_incomplete`).
+        EnvironmentIncomplete = 8,
+    };
+
+    struct SectionInfo {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t row_count;
+        uint32_t exe_count;
+        uint32_t reserved;
+        /// FILETIME when the recording started.
+        uint64_t start_time;
+        /// Messages that did not fit into the trace file.
+        uint64_t dropped_messages;
+        SectionInfo sections[(size_t)Section::Count];
+    };
+
+    /// Read-only view of an index, typically a mapped file. Throws `std::runtime_error` if `data` is not a valid index.
+    class View {
+        std::span<const std::byte> m_data;
+        const Header* m_header;
+
+    public:
+        explicit View(std::span<const std::byte> data) : m_data(data), m_header((const Header*)data.data()) {
+            if (data.size() < sizeof(Header) || memcmp(m_header->magic, MAGIC, sizeof(MAGIC)) != 0) {
+                throw std::runtime_error("not a SpawnCamper trace index");
+            }
+            if (m_header->version != VERSION) {
+                throw std::runtime_error("unsupported trace index version");
+            }
+            for (auto& section : m_header->sections) {
+                if (section.offset > data.size() || section.size > data.size() - section.offset) {
+                    throw std::runtime_error("truncated trace index");
+                }
+            }
+        }
+
+        [[nodiscard]] const Header& header() const {
+            return *m_header;
+        }
+
+        [[nodiscard]] uint32_t row_count() const {
+            return m_header->row_count;
+        }
+
+        [[nodiscard]] uint32_t exe_count() const {
+            return m_header->exe_count;
+        }
+
+        template<typename T>
+        [[nodiscard]] std::span<const T> column(Section section) const {
+            auto& info = m_header->sections[(size_t)section];
+            return {(const T*)(m_data.data() + info.offset), info.size / sizeof(T)};
+        }
+
+        [[nodiscard]] uint32_t pid(uint32_t row) const {
+            return column<uint32_t>(Section::Pid)[row];
+        }
+
+        [[nodiscard]] uint32_t parent_pid(uint32_t row) const {
+            return column<uint32_t>(Section::ParentPid)[row];
+        }
+
+        [[nodiscard]] uint32_t parent_row(uint32_t row) const {
+            return column<uint32_t>(Section::ParentRow)[row];
+        }
+
+        [[nodiscard]] uint64_t start_time(uint32_t row) const {
+            return column<uint64_t>(Section::StartTime)[row];
+        }
+
+        [[nodiscard]] uint64_t end_time(uint32_t row) const {
+            return column<uint64_t>(Section::EndTime)[row];
+        }
+
+        [[nodiscard]] uint32_t flags(uint32_t row) const {
+            return column<uint32_t>(Section::Flags)[row];
+        }
+
+        [[nodiscard]] uint32_t exe(uint32_t row) const {
+            return column<uint32_t>(Section::Exe)[row];
+        }
+
+        [[nodiscard]] std::optional<uint32_t> exit_code(uint32_t row) const {
+            if (!(flags(row) & RowFlags::Exited)) return std::nullopt;
+            return column<uint32_t>(Section::ExitCode)[row];
+        }
+
+        [[nodiscard]] std::string_view exe_path(uint32_t row) const {
+            return exe_name(exe(row));
+        }
+
+        [[nodiscard]] std::string_view command_line(uint32_t row) const {
+            return heap_entry(Section::Strings, column<uint64_t>(Section::CommandLine)[row]);
+        }
+
+        [[nodiscard]] std::string_view working_directory(uint32_t row) const {
+            return heap_entry(Section::Strings, column<uint64_t>(Section::WorkingDirectory)[row]);
+        }
+
+        /// Environment block (`NAME=value\0` entries), without the final terminator.
+        [[nodiscard]] std::string_view environment(uint32_t row) const {
+            return heap_entry(Section::Environments, column<uint64_t>(Section::Environment)[row]);
+        }
+
+        [[nodiscard]] std::span<const uint32_t> children(uint32_t row) const {
+            return adjacency(Section::ChildOffsets, Section::Children, row);
+        }
+
+        [[nodiscard]] std::string_view exe_name(uint32_t exe) const {
+            return heap_entry(Section::Strings, column<uint64_t>(Section::ExeName)[exe]);
+        }
+
+        /// Exe paths are compared exactly (the hooks report them in a canonical form).
+        [[nodiscard]] std::optional<uint32_t> find_exe(std::string_view path) const {
+            auto ids = std::views::iota(0u, exe_count());
+            auto it = std::ranges::lower_bound(ids, path, {}, [&](uint32_t exe) { return exe_name(exe); });
+            if (it == ids.end() || exe_name(*it) != path) return std::nullopt;
+            return *it;
+        }
+
+        /// Rows of processes running `exe`, sorted by start time.
+        [[nodiscard]] std::span<const uint32_t> rows_of_exe(uint32_t exe) const {
+            return adjacency(Section::ExeRowOffsets, Section::ExeRows, exe);
+        }
+
+        /// Returns the range `[first, last)` of rows that started in `[from, to)`.
+        [[nodiscard]] std::pair<uint32_t, uint32_t> rows_started_between(uint64_t from, uint64_t to) const {
+            auto starts = column<uint64_t>(Section::StartTime);
+            auto first = std::ranges::lower_bound(starts, from) - starts.begin();
+            auto last = std::ranges::lower_bound(starts, std::max(from, to)) - starts.begin();
+            return {(uint32_t)first, (uint32_t)last};
+        }
+
+        /// Rows of processes running `exe` that started in `[from, to)`.
+        [[nodiscard]] std::span<const uint32_t> rows_of_exe_started_between(
+            uint32_t exe, uint64_t from, uint64_t to) const {
+            // rows are sorted by start time, so the rows of an exe are as well
+            auto rows = rows_of_exe(exe);
+            auto start = [&](uint32_t row) { return start_time(row); };
+            auto first = std::ranges::lower_bound(rows, from, {}, start);
+            auto last = std::ranges::lower_bound(first, rows.end(), std::max(from, to), {}, start);
+            return {first, last};
+        }
+
+    private:
+        [[nodiscard]] std::string_view heap_entry(Section heap, uint64_t offset) const {
+            if (offset == NO_STRING) return {};
+            auto data = column<std::byte>(heap);
+            uint32_t size;
+            memcpy(&size, data.data() + offset, sizeof(size));
+            return {(const char*)data.data() + offset + sizeof(size), size};
+        }
+
+        [[nodiscard]] std::span<const uint32_t> adjacency(Section offsets, Section values, uint32_t i) const {
+            auto begin = column<uint32_t>(offsets)[i];
+            auto end = column<uint32_t>(offsets)[i + 1];
+            return column<uint32_t>(values).subspan(begin, end - begin);
+        }
+    };
+
+    /// Builds an index from process events fed in the order they were recorded (see `TraceReader`). Everything is
+    ///  kept in memory until `write`, the heaps are typically by far the largest part.
+    class Builder {
+        struct Row {
+            uint32_t pid;
+            uint32_t parent_pid;
+            /// Index in `m_rows` until the rows are sorted.
+            uint32_t parent_row;
+            uint64_t start_time;
+            uint64_t end_time = NO_TIME;
+            uint32_t exit_code = 0;
+            uint32_t flags = 0;
+            /// Index in `m_exe_names` until the exe IDs are assigned.
+            uint32_t exe;
+            uint64_t command_line;
+            uint64_t working_directory;
+            uint64_t environment;
+        };
+
+        uint64_t m_start_time;
+        uint64_t m_dropped_messages;
+        std::vector<Row> m_rows{};
+        /// Last row started for each PID; PIDs may be reused during a long trace.
+        std::unordered_map<uint32_t, uint32_t> m_pid_rows{};
+        std::vector<std::byte> m_strings{};
+        std::vector<std::byte> m_environments{};
+        /// Deduplicated heap entries; working directories and environments repeat a lot across a build,
+        ///  command lines mostly do not, so they are stored as they are.
+        std::unordered_map<std::string, uint64_t> m_string_offsets{};
+        std::unordered_map<std::string_view, uint64_t> m_environment_offsets{};
+        /// Keys of `m_environment_offsets`, a deque does not move the strings when it grows.
+        std::deque<std::string> m_environment_keys{};
+        std::unordered_map<std::string, uint32_t> m_exe_ids{};
+        std::vector<std::string_view> m_exe_names{};
+
+    public:
+        Builder(uint64_t start_time, uint64_t dropped_messages)
+            : m_start_time(start_time), m_dropped_messages(dropped_messages) {}
+
+        void add_start(uint32_t pid, uint32_t parent_pid, uint64_t timestamp, std::string_view exe_path,
+                       std::string_view command_line, std::string_view working_directory,
+                       std::string_view environment, bool environment_incomplete = false) {
+            auto parent_row = NO_ROW;
+            if (auto it = m_pid_rows.find(parent_pid); it != m_pid_rows.end()) {
+                parent_row = it->second;
+                if (parent_pid == pid) {
+                    // a new program image replaced the parent (see `lib_linux.cpp`), which ends it
+                    auto& parent = m_rows[parent_row];
+                    parent.flags |= RowFlags::Replaced;
+                    if (parent.end_time == NO_TIME) parent.end_time = timestamp;
+                }
+            }
+
+            auto [exe, inserted] = m_exe_ids.try_emplace(std::string(exe_path), (uint32_t)m_exe_names.size());
+            if (inserted) m_exe_names.push_back(exe->first);
+
+            m_pid_rows[pid] = (uint32_t)m_rows.size();
+            m_rows.push_back(Row{
+                .pid = pid,
+                .parent_pid = parent_pid,
+                .parent_row = parent_row,
+                .start_time = timestamp,
+                .flags = environment_incomplete ? (uint32_t)RowFlags::EnvironmentIncomplete : 0u,
+                .exe = exe->second,
+                .command_line = append(m_strings, command_line),
+                .working_directory = add_string(working_directory),
+                .environment = add_environment(environment),
+            });
+        }
+
+        [[nodiscard]] size_t row_count() const {
+            return m_rows.size();
+        }
+
+        /// With `terminated`, the exit was recorded by the parent (`Messages::ChildExit`), and is ignored if
+        ///  the process recorded its own exit.
+        void add_exit(uint32_t pid, uint64_t timestamp, uint32_t exit_code, bool terminated = false) {
+            auto it = m_pid_rows.find(pid);
+            if (it == m_pid_rows.end()) {
+                return; // the start was dropped
+            }
+            auto& row = m_rows[it->second];
+            if (terminated && (row.flags & RowFlags::Exited)) {
+                return;
+            }
+            row.end_time = timestamp;
+            row.exit_code = exit_code;
+            row.flags |= terminated ? RowFlags::Exited | RowFlags::Terminated : RowFlags::Exited;
+        }
+
+        void write(std::ostream& out) {
+            auto row_count = (uint32_t)m_rows.size();
+            auto exe_count = (uint32_t)m_exe_names.size();
+
+            // sort the rows by start time, ties stay in the recorded order
+            auto order = std::vector<uint32_t>(row_count);
+            std::iota(order.begin(), order.end(), 0u);
+            std::ranges::stable_sort(order, {}, [&](uint32_t i) { return m_rows[i].start_time; });
+            auto new_row = std::vector<uint32_t>(row_count);
+            for (uint32_t i = 0; i < row_count; i++) new_row[order[i]] = i;
+
+            // assign exe IDs in the order of sorted paths, so that exes can be found by binary search
+            auto exe_order = std::vector<uint32_t>(exe_count);
+            std::iota(exe_order.begin(), exe_order.end(), 0u);
+            std::ranges::sort(exe_order, {}, [&](uint32_t i) { return m_exe_names[i]; });
+            auto new_exe = std::vector<uint32_t>(exe_count);
+            for (uint32_t i = 0; i < exe_count; i++) new_exe[exe_order[i]] = i;
+
+            auto columns = Columns{};
+            for (auto i : order) {
+                auto& row = m_rows[i];
+                columns.add(Section::Pid, row.pid);
+                columns.add(Section::ParentPid, row.parent_pid);
+                columns.add(Section::ParentRow, row.parent_row == NO_ROW ? NO_ROW : new_row[row.parent_row]);
+                columns.add(Section::StartTime, row.start_time);
+                columns.add(Section::EndTime, row.end_time);
+                columns.add(Section::ExitCode, row.exit_code);
+                columns.add(Section::Flags, row.flags);
+                columns.add(Section::Exe, new_exe[row.exe]);
+                columns.add(Section::CommandLine, row.command_line);
+                columns.add(Section::WorkingDirectory, row.working_directory);
+                columns.add(Section::Environment, row.environment);
+            }
+
+            auto strings = std::move(m_strings);
+            auto exe_rows = std::vector<std::vector<uint32_t>>(exe_count);
+            auto children = std::vector<std::vector<uint32_t>>(row_count);
+            for (uint32_t i = 0; i < row_count; i++) {
+                auto& row = m_rows[order[i]];
+                exe_rows[new_exe[row.exe]].push_back(i);
+                if (row.parent_row != NO_ROW) children[new_row[row.parent_row]].push_back(i);
+            }
+            for (auto i : exe_order) {
+                columns.add(Section::ExeName, append(strings, m_exe_names[i]));
+            }
+            columns.add_adjacency(Section::ChildOffsets, Section::Children, children);
+            columns.add_adjacency(Section::ExeRowOffsets, Section::ExeRows, exe_rows);
+
+            auto header = Header{};
+            memcpy(header.magic, MAGIC, sizeof(MAGIC));
+            header.version = VERSION;
+            header.row_count = row_count;
+            header.exe_count = exe_count;
+            header.start_time = m_start_time;
+            header.dropped_messages = m_dropped_messages;
+
+            columns.data[(size_t)Section::Strings] = std::move(strings);
+            columns.data[(size_t)Section::Environments] = std::move(m_environments);
+
+            auto offset = align(sizeof(Header));
+            for (size_t i = 0; i < (size_t)Section::Count; i++) {
+                header.sections[i] = {offset, columns.data[i].size()};
+                offset = align(offset + columns.data[i].size());
+            }
+
+            write_padded(out, {(const std::byte*)&header, sizeof(header)});
+            for (auto& section : columns.data) {
+                write_padded(out, section);
+            }
+        }
+
+    private:
+        struct Columns {
+            std::array<std::vector<std::byte>, (size_t)Section::Count> data{};
+
+            template<typename T>
+            void add(Section section, T value) {
+                auto& column = data[(size_t)section];
+                column.insert(column.end(), (const std::byte*)&value, (const std::byte*)&value + sizeof(value));
+            }
+
+            void add_adjacency(Section offsets, Section values, const std::vector<std::vector<uint32_t>>& lists) {
+                uint32_t offset = 0;
+                for (auto& list : lists) {
+                    add(offsets, offset);
+                    for (auto value : list) add(values, value);
+                    offset += (uint32_t)list.size();
+                }
+                add(offsets, offset);
+            }
+        };
+
+        static uint64_t append(std::vector<std::byte>& heap, std::string_view str) {
+            auto offset = (uint64_t)heap.size();
+            auto size = (uint32_t)str.size();
+            heap.insert(heap.end(), (const std::byte*)&size, (const std::byte*)&size + sizeof(size));
+            heap.insert(heap.end(), (const std::byte*)str.data(), (const std::byte*)str.data() + str.size());
+            return offset;
+        }
+
+        uint64_t add_string(std::string_view str) {
+            auto [it, inserted] = m_string_offsets.try_emplace(std::string(str), 0);
+            if (inserted) it->second = append(m_strings, str);
+            return it->second;
+        }
+
+        uint64_t add_environment(std::string_view env) {
+            if (auto it = m_environment_offsets.find(env); it != m_environment_offsets.end()) {
+                return it->second;
+            }
+            auto offset = append(m_environments, env);
+            auto& key = m_environment_keys.emplace_back(env);
+            m_environment_offsets.emplace(key, offset);
+            return offset;
+        }
+
+        static uint64_t align(uint64_t offset) {
+            return (offset + SECTION_ALIGNMENT - 1) & ~(SECTION_ALIGNMENT - 1);
+        }
+
+        static void write_padded(std::ostream& out, std::span<const std::byte> data) {
+            static constexpr char zeros[SECTION_ALIGNMENT]{};
+            out.write((const char*)data.data(), (std::streamsize)data.size());
+            out.write(zeros, (std::streamsize)(align(data.size()) - data.size()));
+        }
+    };
+
+    /// Adds all processes recorded in a trace file to `builder`. Returns the number of records that could not be
+    ///  decoded and were skipped.
+    inline size_t add_trace(Builder& builder, TraceReader& reader) {
+        return reader.read([&](const TraceReader::ProcessStart& e) {
+            builder.add_start(e.pid, e.parent_pid, e.timestamp, e.exe_path, e.command_line, e.working_directory,
+                              e.environment, e.environment_incomplete);
+        }, [&](const TraceReader::ProcessExit& e) {
+            builder.add_exit(e.pid, e.timestamp, e.exit_code, e.reported_by_parent);
+        });
+    }
+
+    /// Returns true if `data` starts with the index header, as opposed to a raw trace file.
+    inline bool is_index(std::span<const std::byte> data) {
+        return data.size() >= sizeof(MAGIC) && memcmp(data.data(), MAGIC, sizeof(MAGIC)) == 0;
+    }
+
+    /// Indexes a whole trace file in memory, for the tools that accept raw traces in place of indices. Returns the
+    ///  serialized index; `malformed` is set to the number of records that could not be decoded.
+    inline std::string build_in_memory(std::span<const std::byte> trace, size_t& malformed) {
+        auto reader = TraceReader(trace);
+        auto builder = Builder(reader.start_time(), reader.dropped_messages());
+        malformed = add_trace(builder, reader);
+        auto stream = std::ostringstream(std::ios::binary);
+        builder.write(stream);
+        return std::move(stream).str();
+    }
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "Environment.hpp"
+#include "Protocol.hpp"
+#include "TraceFile.hpp"
+
+/// Decodes the messages recorded in a trace file (see `TraceFile.hpp`), the C++ counterpart of `TraceFileReader`
+///  in the server, used by the offline tools. Strings are converted to UTF-8 and environment deltas are resolved
+///  against the previously recorded environments, like `EnvironmentCache` does in the server.
+class TraceReader {
+public:
+    struct ProcessStart {
+        uint32_t pid;
+        uint32_t parent_pid;
+        /// FILETIME
+        uint64_t timestamp;
+        std::string exe_path;
+        /// Empty for processes matched by the hook filter rules, see `Messages::ProcessStartMinimal`.
+        std::string command_line;
+        std::string working_directory;
+        /// Environment block (`NAME=value\0` entries), without the final terminator; only valid during the callback.
+        std::string_view environment;
+        /// The environment was recorded as a delta against an environment missing from the trace (e.g., its message
+        ///  was dropped), `environment` only contains the variables changed by the delta.
+        bool environment_incomplete = false;
+    };
+
+    struct ProcessExit {
+        uint32_t pid;
+        uint64_t timestamp;
+        uint32_t exit_code;
+        /// Only recorded by hooks that support it.
+        std::optional<Protocol::ResourceUsage> resources;
+        /// The process did not record its exit (e.g., it was killed), its parent did, see `Messages::ChildExit`.
+        ///  The parent also records the exit of children that recorded it themselves, which is reported again.
+        bool reported_by_parent = false;
+    };
+
+private:
+    std::span<const std::byte> m_file;
+    const TraceFile::Header* m_header;
+    /// Environments by the hash the hooks reference them with.
+    std::unordered_map<uint64_t, std::string> m_environments{};
+    /// Hashing dominates the decoding cost and consecutive snapshots are usually identical, remember the last one.
+    std::string m_last_environment{};
+    uint64_t m_last_hash = 0;
+    /// Environment reported for a delta whose base is missing, see `ProcessStart::environment_incomplete`.
+    std::string m_partial_environment{};
+
+public:
+    /// `file` must stay valid while the reader is used. Throws `std::runtime_error` if it is not a trace file.
+    explicit TraceReader(std::span<const std::byte> file)
+        : m_file(file), m_header((const TraceFile::Header*)file.data()) {
+        if (!TraceFile::is_valid(file.data(), file.size())) {
+            throw std::runtime_error("not a SpawnCamper trace file, or an unsupported version");
+        }
+        if (m_header->protocol_version < 1 || m_header->protocol_version > Protocol::MAX_VERSION) {
+            throw std::runtime_error("unsupported trace file protocol version");
+        }
+    }
+
+    /// FILETIME when the recording started.
+    [[nodiscard]] uint64_t start_time() const {
+        return m_header->start_time;
+    }
+
+    /// Number of messages that did not fit into the trace file.
+    [[nodiscard]] uint64_t dropped_messages() const {
+        return m_header->dropped.load();
+    }
+
+    /// Passes all recorded process starts and exits to the callbacks, in the order they were recorded. Records that
+    ///  cannot be decoded are skipped and counted in the return value.
+    size_t read(auto&& start_cb, auto&& exit_cb) {
+        size_t malformed = 0;
+        TraceFile::for_each_record(m_file.data(), m_file.size(),
+                                   [&](uint32_t pid, std::span<const std::byte> payload) {
+                                       try {
+                                           read_record(pid, payload, start_cb, exit_cb);
+                                       } catch (const Protocol::DecodeError&) {
+                                           malformed++;
+                                       }
+                                   });
+        return malformed;
+    }
+
+private:
+    void read_record(uint32_t pid, std::span<const std::byte> payload, auto& start_cb, auto& exit_cb) {
+        using namespace Protocol;
+        auto decoder = Decoder(payload, m_header->protocol_version);
+        while (auto header = decoder.next()) {
+            switch (header->type) {
+                case MessageType::ProcessStart: {
+                    // the start flags only matter to the live process tree of the server
+                    auto [parent_pid, exe_path, cmd_line, working_dir, env, flags]
+                        = decoder.decode<Messages::ProcessStart>();
+                    auto& env_utf8 = add_environment(env);
+                    start_cb(ProcessStart{pid, parent_pid, header->timestamp, exe_path.to_utf8(), cmd_line.to_utf8(),
+                                          working_dir.to_utf8(), env_utf8});
+                    break;
+                }
+                case MessageType::ProcessStartEnvDelta: {
+                    auto [parent_pid, exe_path, cmd_line, working_dir, env_hash, base_hash, removed, changed, flags]
+                        = decoder.decode<Messages::ProcessStartEnvDelta>();
+                    auto base = m_environments.find(base_hash);
+                    if (base == m_environments.end()) {
+                        // report the part of the environment we know about, but do not store it under `env_hash`,
+                        //  other deltas against it would silently miss the unknown variables
+                        m_partial_environment = changed.to_utf8();
+                        start_cb(ProcessStart{pid, parent_pid, header->timestamp, exe_path.to_utf8(),
+                                              cmd_line.to_utf8(), working_dir.to_utf8(), m_partial_environment, true});
+                        break;
+                    }
+                    auto env = Environment::apply_delta<char>(base->second, removed.to_utf8(), changed.to_utf8());
+                    auto& stored = m_environments.insert_or_assign(env_hash, std::move(env)).first->second;
+                    start_cb(ProcessStart{pid, parent_pid, header->timestamp, exe_path.to_utf8(), cmd_line.to_utf8(),
+                                          working_dir.to_utf8(), stored});
+                    break;
+                }
+                case MessageType::ProcessStartMinimal: {
+                    auto [parent_pid, exe_path, flags] = decoder.decode<Messages::ProcessStartMinimal>();
+                    start_cb(ProcessStart{pid, parent_pid, header->timestamp, exe_path.to_utf8(), {}, {}, {}});
+                    break;
+                }
+                case MessageType::EnvironmentSnapshot: {
+                    auto [env] = decoder.decode<Messages::EnvironmentSnapshot>();
+                    add_environment(env);
+                    break;
+                }
+                case MessageType::ExitProcess: {
+                    auto [exit_code, resources] = decoder.decode<Messages::ExitProcess>();
+                    exit_cb(ProcessExit{pid, header->timestamp, exit_code, resources});
+                    break;
+                }
+                case MessageType::ChildExit: {
+                    auto [child_pid, exit_code] = decoder.decode<Messages::ChildExit>();
+                    exit_cb(ProcessExit{child_pid, header->timestamp, exit_code, std::nullopt, true});
+                    break;
+                }
+                default:
+                    decoder.skip();
+                    break;
+            }
+        }
+    }
+
+    /// The hooks hash the raw UTF-16 environment block, see `Environment::hash`.
+    const std::string& add_environment(const Protocol::StringValue& env) {
+        auto env_utf8 = env.to_utf8();
+        if (env_utf8 != m_last_environment || m_environments.empty()) {
+            auto env_utf16 = env.to_utf16();
+            m_last_hash = Environment::hash(env_utf16.data(), env_utf16.size() * sizeof(char16_t));
+            m_last_environment = env_utf8;
+        }
+        return m_environments.insert_or_assign(m_last_hash, std::move(env_utf8)).first->second;
+    }
+};
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "MessageSink.hpp"
+#include "Posix.hpp"
+#include "Protocol.hpp"
+
+/// Linux counterpart of `NamedPipeWriter`. On Unix, .NET implements named pipes as Unix domain sockets, so the server
+///  listens with the same `NamedPipeServerStream` as on Windows.
+class UnixSocketWriter final : public MessageSink {
+    /// How long to wait for the server to send its protocol version after connecting. Short, since every process
+    ///  waits for it; if it expires, the writer falls back to version 1, which the server detects as well.
+    static constexpr auto NEGOTIATION_TIMEOUT = std::chrono::milliseconds(100);
+
+    int m_fd;
+    uint32_t m_protocol_version = 1;
+
+public:
+    /// Connects to the server socket at `path`; if the server is not running, the writer is not connected.
+    explicit UnixSocketWriter(const std::string& path) : m_fd(connect_to_server(path)) {
+        if (m_fd < 0) {
+            return;
+        }
+        m_protocol_version = receive_protocol_version(m_fd);
+        if (m_protocol_version >= 2) {
+            auto preamble = Protocol::stream_preamble(m_protocol_version);
+            auto chunk = std::span<const std::byte>{preamble};
+            write({&chunk, 1});
+        }
+    }
+
+    /// Takes over an already connected socket (e.g., one inherited across `execve`), which previously negotiated
+    ///  `protocol_version`.
+    UnixSocketWriter(int fd, uint32_t protocol_version) : m_fd(fd), m_protocol_version(protocol_version) {}
+
+    ~UnixSocketWriter() override {
+        close();
+    }
+
+    UnixSocketWriter(const UnixSocketWriter&) = delete;
+    UnixSocketWriter& operator=(const UnixSocketWriter&) = delete;
+
+    /// Path of the socket that .NET creates for the named pipe `pipe_name`, see `Path.GetTempPath()`.
+    static std::string server_path(std::string_view pipe_name) {
+        auto tmp_dir = getenv("TMPDIR");
+        auto path = std::string(tmp_dir && *tmp_dir ? tmp_dir : "/tmp");
+        if (path.back() != '/') {
+            path += '/';
+        }
+        return path + "CoreFxPipe_" + std::string(pipe_name);
+    }
+
+    bool connected() override {
+        return m_fd >= 0;
+    }
+
+    uint32_t protocol_version() override {
+        return m_protocol_version;
+    }
+
+    bool receives_replies() override {
+        return connected() && m_protocol_version >= 2;
+    }
+
+    bool read_reply(std::span<std::byte> reply) override {
+        if (!receives_replies()) {
+            return false;
+        }
+        // only consume the reply once all of it arrived
+        auto available = ::recv(m_fd, reply.data(), reply.size(), MSG_PEEK | MSG_DONTWAIT);
+        if (available < (ssize_t)reply.size()) {
+            return false;
+        }
+        return ::recv(m_fd, reply.data(), reply.size(), MSG_DONTWAIT) == (ssize_t)reply.size();
+    }
+
+    [[nodiscard]] int fd() const {
+        return m_fd;
+    }
+
+    void close() {
+        if (m_fd >= 0) {
+            ::close(m_fd);
+            m_fd = -1;
+        }
+    }
+
+    void write(std::span<const std::span<const std::byte>> chunks) override {
+        if (!connected()) {
+            return; // the reader was stopped, skip writes and silently continue
+        }
+
+        for (auto chunk : chunks) {
+            while (!chunk.empty()) {
+                // MSG_NOSIGNAL: we must not kill the traced process with SIGPIPE when the server exits
+                auto bytes_written = ::send(m_fd, chunk.data(), chunk.size(), MSG_NOSIGNAL);
+                if (bytes_written < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    if (errno == EPIPE || errno == ECONNRESET) {
+                        close(); // the reader was stopped, skip writes and silently continue
+                        return;
+                    }
+                    throw Posix::PosixError{"send"};
+                }
+                chunk = chunk.subspan(bytes_written);
+            }
+        }
+    }
+
+private:
+    /// The server sends the highest version it supports right after accepting the connection. Unlike on Windows,
+    ///  each process waits for it, since there is no tracer-provided configuration inherited by all hooks.
+    static uint32_t receive_protocol_version(int fd) {
+        uint32_t version = 0;
+        size_t received = 0;
+        auto deadline = std::chrono::steady_clock::now() + NEGOTIATION_TIMEOUT;
+        while (received < sizeof(version)) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
+            auto pfd = pollfd{fd, POLLIN, 0};
+            auto ready = ::poll(&pfd, 1, (int)std::max(remaining.count(), (decltype(remaining.count()))0));
+            if (ready < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ready <= 0) {
+                return 1; // the server does not support negotiation
+            }
+            auto bytes_read = ::recv(fd, (char*)&version + received, sizeof(version) - received, 0);
+            if (bytes_read < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytes_read <= 0) {
+                return 1; // the connection broke, the writes will fail as well
+            }
+            received += bytes_read;
+        }
+        return std::clamp(version, 1u, Protocol::MAX_VERSION);
+    }
+
+    static int connect_to_server(const std::string& path) {
+        auto address = sockaddr_un{};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            return -1;
+        }
+        memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+        // SOCK_CLOEXEC: the connection is only passed to a new image explicitly, see `lib_linux.cpp`
+        auto fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            throw Posix::PosixError{"socket"};
+        }
+        if (::connect(fd, (const sockaddr*)&address, sizeof(address)) != 0) {
+            // silently continue if the server is not running
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+};
@@ -1,8 +1,18 @@
 #pragma once
 
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <exception>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <ctime>
+#endif
 
 namespace Utils {
     /// Helper function that aborts the process when an exception is thrown from our code.
@@ -19,4 +29,134 @@ namespace Utils {
             std::abort();
         }
     }
+
+    /// Returns the current time as a FILETIME value (100ns intervals since 1601-01-01 UTC), which is the timestamp
+    ///  format expected by the server.
+    inline uint64_t current_filetime() {
+#ifdef _WIN32
+        FILETIME ft;
+        ::GetSystemTimePreciseAsFileTime(&ft);
+        return (uint64_t)ft.dwHighDateTime << 32 | (uint64_t)ft.dwLowDateTime;
+#else
+        // offset between the FILETIME epoch (1601) and the Unix epoch (1970), in 100ns intervals
+        constexpr uint64_t UNIX_EPOCH_FILETIME = 116444736000000000;
+        timespec ts{};
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return UNIX_EPOCH_FILETIME + (uint64_t)ts.tv_sec * 10'000'000 + (uint64_t)ts.tv_nsec / 100;
+#endif
+    }
+
+    /// Returns a monotonic timestamp in 100ns units, from the performance counter on Windows. Unlike
+    ///  `current_filetime`, it is not affected by adjustments of the system clock, and it is the same in all
+    ///  processes, so that a timestamp taken in the parent can be compared with one taken in the child.
+    inline uint64_t performance_counter() {
+#ifdef _WIN32
+        static const auto frequency = [] {
+            LARGE_INTEGER f;
+            ::QueryPerformanceFrequency(&f);
+            return (uint64_t)f.QuadPart;
+        }();
+        LARGE_INTEGER counter;
+        ::QueryPerformanceCounter(&counter);
+        auto ticks = (uint64_t)counter.QuadPart;
+        // split to avoid overflowing the multiplication
+        return ticks / frequency * 10'000'000 + ticks % frequency * 10'000'000 / frequency;
+#else
+        timespec ts{};
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 10'000'000 + (uint64_t)ts.tv_nsec / 100;
+#endif
+    }
+
+    /// Converts UTF-8 to UTF-16, which is the string encoding expected by the server. Invalid sequences are replaced
+    ///  with U+FFFD, since paths and environment variables on Linux are not guaranteed to be valid UTF-8.
+    inline std::u16string utf8_to_utf16(std::string_view str) {
+        auto result = std::u16string{};
+        result.reserve(str.size());
+
+        for (size_t i = 0; i < str.size();) {
+            auto c = (unsigned char)str[i];
+            auto length = c < 0x80 ? 1 : (c & 0xe0) == 0xc0 ? 2 : (c & 0xf0) == 0xe0 ? 3 : (c & 0xf8) == 0xf0 ? 4 : 0;
+            char32_t code_point = length == 1 ? c : length == 2 ? c & 0x1f : length == 3 ? c & 0x0f : c & 0x07;
+
+            auto valid = length != 0 && i + length <= str.size();
+            for (int j = 1; valid && j < length; j++) {
+                auto continuation = (unsigned char)str[i + j];
+                valid = (continuation & 0xc0) == 0x80;
+                code_point = code_point << 6 | (continuation & 0x3f);
+            }
+            // reject overlong encodings, surrogates and out-of-range code points
+            constexpr char32_t MIN_CODE_POINT[] = {0, 0, 0x80, 0x800, 0x10000};
+            valid = valid && code_point >= MIN_CODE_POINT[length] && code_point <= 0x10ffff
+                    && (code_point < 0xd800 || code_point > 0xdfff);
+
+            if (!valid) {
+                result += u'\ufffd';
+                i++;
+            } else if (code_point >= 0x10000) {
+                code_point -= 0x10000;
+                result += (char16_t)(0xd800 + (code_point >> 10));
+                result += (char16_t)(0xdc00 + (code_point & 0x3ff));
+                i += length;
+            } else {
+                result += (char16_t)code_point;
+                i += length;
+            }
+        }
+        return result;
+    }
+
+    /// Decodes the code point starting at `str[i]` from UTF-16 and advances `i` past it. Returns `std::nullopt`
+    ///  for unpaired surrogates, which are valid in Windows strings, but cannot be represented in UTF-8.
+    template<typename CharT>
+    std::optional<char32_t> next_utf16_code_point(std::basic_string_view<CharT> str, size_t& i) {
+        static_assert(sizeof(CharT) == 2);
+        char32_t unit = (char16_t)str[i++];
+        if (unit < 0xd800 || unit > 0xdfff) {
+            return unit;
+        }
+        if (unit > 0xdbff || i == str.size() || (char16_t)str[i] < 0xdc00 || (char16_t)str[i] > 0xdfff) {
+            return std::nullopt;
+        }
+        return 0x10000 + ((unit - 0xd800) << 10 | ((char16_t)str[i++] - 0xdc00));
+    }
+
+    /// Returns the length of UTF-16 `str` encoded as UTF-8, or `std::nullopt` if it contains unpaired surrogates.
+    template<typename CharT>
+    std::optional<size_t> utf8_length(std::basic_string_view<CharT> str) {
+        size_t length = 0;
+        for (size_t i = 0; i < str.size();) {
+            auto code_point = next_utf16_code_point(str, i);
+            if (!code_point) {
+                return std::nullopt;
+            }
+            length += *code_point < 0x80 ? 1 : *code_point < 0x800 ? 2 : *code_point < 0x10000 ? 3 : 4;
+        }
+        return length;
+    }
+
+    /// Encodes UTF-16 `str` as UTF-8 into `out` and returns the end of the output; `out` must have space for
+    ///  `utf8_length(str)` bytes. Unpaired surrogates are replaced with U+FFFD.
+    template<typename CharT>
+    char* utf16_to_utf8(std::basic_string_view<CharT> str, char* out) {
+        for (size_t i = 0; i < str.size();) {
+            auto code_point = next_utf16_code_point(str, i).value_or(0xfffd);
+            if (code_point < 0x80) {
+                *out++ = (char)code_point;
+            } else if (code_point < 0x800) {
+                *out++ = (char)(0xc0 | code_point >> 6);
+                *out++ = (char)(0x80 | (code_point & 0x3f));
+            } else if (code_point < 0x10000) {
+                *out++ = (char)(0xe0 | code_point >> 12);
+                *out++ = (char)(0x80 | (code_point >> 6 & 0x3f));
+                *out++ = (char)(0x80 | (code_point & 0x3f));
+            } else {
+                *out++ = (char)(0xf0 | code_point >> 18);
+                *out++ = (char)(0x80 | (code_point >> 12 & 0x3f));
+                *out++ = (char)(0x80 | (code_point >> 6 & 0x3f));
+                *out++ = (char)(0x80 | (code_point & 0x3f));
+            }
+        }
+        return out;
+    }
 }
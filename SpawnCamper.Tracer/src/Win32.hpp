@@ -140,33 +140,4 @@ namespace Win32 {
         auto deleter = [](wchar_t* p) { FreeEnvironmentStringsW(p); };
         return std::unique_ptr<wchar_t, decltype(deleter)>{env, deleter};
     }
-
-    /// Iterator over an environment block (null-terminated list of null-terminated strings).
-    template<typename CharT>
-    class PebIterator {
-        CharT* m_ptr;
-
-    public:
-        explicit PebIterator(CharT* env) : m_ptr(env) {}
-
-        auto begin() const { return *this; }
-        auto end() const { return PebIterator(nullptr); }
-
-        PebIterator& operator++() {
-            while (*m_ptr != 0) ++m_ptr;
-            ++m_ptr;
-            return *this;
-        }
-
-        bool operator==(const PebIterator& other) const {
-            if (other.m_ptr == nullptr && *m_ptr == 0) return true;
-            return other.m_ptr == m_ptr;
-        }
-
-        bool operator!=(const PebIterator& other) const {
-            return !(*this == other);
-        }
-
-        const CharT* operator*() const { return m_ptr; }
-    };
 }
@@ -0,0 +1,194 @@
+// Reports what limits the parallelism of a recorded build (see `TraceAnalysis.hpp`), and exports the process tree
+//  for timeline viewers.
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "MappedFile.hpp"
+#include "TraceAnalysis.hpp"
+#include "TraceIndex.hpp"
+#include "Utils.hpp"
+
+constexpr auto USAGE = R"(Usage:
+  SpawnCamper.Analyzer <trace or index file> [--chrome=<file>] [--top=<n>] [--min-wait=<seconds>]
+
+Prints the critical path, the subtrees with the largest wall time, the concurrency profile and the longest periods
+when a process waited for a single child. With --chrome, also writes the process tree in the Chrome trace event
+format, which can be opened in https://ui.perfetto.dev or chrome://tracing.
+)";
+
+/// FILETIME ticks per second.
+constexpr double TICKS_PER_SECOND = 10'000'000;
+
+[[noreturn]] static void usage_error(const std::string& message) {
+    std::cerr << "ERROR: " << message << "\n\n" << USAGE;
+    exit(1);
+}
+
+static double parse_number(std::string_view str) {
+    double value;
+    auto [end, error] = std::from_chars(str.data(), str.data() + str.size(), value);
+    if (error != std::errc{} || end != str.data() + str.size() || value < 0) {
+        usage_error("invalid number: " + std::string(str));
+    }
+    return value;
+}
+
+static double seconds(uint64_t ticks) {
+    return (double)ticks / TICKS_PER_SECOND;
+}
+
+static void write_report(std::ostream& out, const TraceAnalysis::Timeline& timeline, size_t top,
+                         uint64_t min_wait) {
+    auto& index = timeline.index();
+    auto path = TraceAnalysis::critical_path(timeline);
+    auto subtrees = TraceAnalysis::subtree_times(timeline);
+    auto samples = TraceAnalysis::concurrency(timeline);
+    auto waits = TraceAnalysis::single_child_waits(timeline, min_wait);
+    auto since_start = [&](uint64_t time) { return seconds(time - timeline.trace_start()); };
+    auto exe = [&](uint32_t row) {
+        return row == TraceIndex::NO_ROW ? std::string_view("(no process)") : TraceAnalysis::exe_name(index, row);
+    };
+
+    uint64_t summed = 0;
+    for (auto root : timeline.roots()) summed += subtrees[root].summed;
+    auto span = timeline.trace_end() - timeline.trace_start();
+    uint32_t peak_running = 0, peak_busy = 0;
+    for (auto& s : samples) {
+        peak_running = std::max(peak_running, s.running);
+        peak_busy = std::max(peak_busy, s.busy);
+    }
+
+    out << std::fixed << std::setprecision(3);
+    out << "Processes: " << timeline.row_count() << " (" << timeline.roots().size() << " roots)\n";
+    out << "Trace span: " << seconds(span) << " s, summed process time: " << seconds(summed) << " s\n";
+    out << "Average parallelism: " << (span ? (double)summed / (double)span : 0.0)
+        << ", peak: " << peak_running << " running, " << peak_busy << " busy\n";
+
+    // time on the path spent in each row itself
+    auto self_times = std::unordered_map<uint32_t, uint64_t>{};
+    for (auto& s : path) self_times[s.row] += s.end - s.begin;
+    auto path_rows = std::vector<std::pair<uint32_t, uint64_t>>(self_times.begin(), self_times.end());
+    std::ranges::sort(path_rows, std::greater{}, [](auto& p) { return p.second; });
+    out << "\nCritical path: " << path_rows.size() << " processes, " << path.size() << " segments\n";
+    out << "  self [s]     start [s]   row      exe\n";
+    for (auto& [row, self] : path_rows | std::views::take(top)) {
+        out << "  " << std::setw(10) << seconds(self) << "  " << std::setw(10);
+        if (row == TraceIndex::NO_ROW) out << "" << "  " << std::setw(7) << "";
+        else out << since_start(timeline.start(row)) << "  " << std::setw(7) << row;
+        out << "  " << exe(row) << "\n";
+    }
+
+    auto largest = std::vector<uint32_t>{};
+    for (uint32_t row = 0; row < timeline.row_count(); row++) {
+        if (subtrees[row].processes > 1) largest.push_back(row);
+    }
+    auto largest_end = largest.begin() + (ptrdiff_t)std::min(top, largest.size());
+    std::ranges::partial_sort(largest, largest_end, std::greater{}, [&](uint32_t row) { return subtrees[row].wall; });
+    out << "\nLargest subtrees by wall time:\n";
+    out << "  wall [s]    summed [s]  parallelism  processes  row      exe\n";
+    for (auto row : std::ranges::subrange(largest.begin(), largest_end)) {
+        auto& t = subtrees[row];
+        out << "  " << std::setw(10) << seconds(t.wall) << "  " << std::setw(10) << seconds(t.summed) << "  "
+            << std::setw(11) << (t.wall ? (double)t.summed / (double)t.wall : 0.0) << "  " << std::setw(9)
+            << t.processes << "  " << std::setw(7) << row << "  " << exe(row) << "\n";
+    }
+
+    // time spent at each concurrency level
+    auto levels = std::map<uint32_t, uint64_t>{};
+    if (!samples.empty()) levels[0] += samples.front().time - timeline.trace_start();
+    for (size_t i = 0; i + 1 < samples.size(); i++) {
+        levels[samples[i].running] += samples[i + 1].time - samples[i].time;
+    }
+    out << "\nConcurrency profile:\n";
+    out << "  running  time [s]    share\n";
+    for (auto& [running, time] : levels) {
+        out << "  " << std::setw(7) << running << "  " << std::setw(10) << seconds(time) << "  " << std::setw(6)
+            << std::setprecision(1) << (span ? 100.0 * (double)time / (double)span : 0.0) << " %\n"
+            << std::setprecision(3);
+    }
+
+    out << "\nLongest waits for a single child:\n";
+    out << "  wait [s]     start [s]   parent   child    exe\n";
+    for (auto& w : waits | std::views::take(top)) {
+        out << "  " << std::setw(10) << seconds(w.end - w.begin) << "  " << std::setw(10) << since_start(w.begin)
+            << "  " << std::setw(7) << w.parent << "  " << std::setw(7) << w.child << "  " << exe(w.parent)
+            << " -> " << exe(w.child) << "\n";
+    }
+}
+
+static int real_main(int argc, char** argv) {
+    std::optional<std::filesystem::path> input{}, chrome_path{};
+    size_t top = 20;
+    uint64_t min_wait = 0;
+    for (auto& arg : std::span(argv + 1, argv + argc)) {
+        auto str = std::string_view(arg);
+        if (str.starts_with("--chrome=")) {
+            chrome_path = str.substr(strlen("--chrome="));
+        } else if (str.starts_with("--top=")) {
+            top = (size_t)parse_number(str.substr(strlen("--top=")));
+        } else if (str.starts_with("--min-wait=")) {
+            min_wait = (uint64_t)(parse_number(str.substr(strlen("--min-wait="))) * TICKS_PER_SECOND);
+        } else if (str.starts_with("--") || input) {
+            usage_error("unknown argument: " + std::string(str));
+        } else {
+            input = str;
+        }
+    }
+    if (!input) {
+        usage_error("missing trace file");
+    }
+
+    auto file = MappedFile(*input);
+    auto data = file.data();
+    // accept both indices and raw traces, which are indexed in memory
+    std::string built_index{};
+    if (!TraceIndex::is_index(data)) {
+        size_t malformed;
+        built_index = TraceIndex::build_in_memory(data, malformed);
+        if (malformed > 0) {
+            std::cerr << "WARNING: skipped " << malformed << " malformed records\n";
+        }
+        data = std::as_bytes(std::span(built_index));
+    }
+    auto index = TraceIndex::View(data);
+    if (index.header().dropped_messages > 0) {
+        std::cerr << "WARNING: the trace is incomplete, " << index.header().dropped_messages
+                  << " messages were dropped during recording\n";
+    }
+
+    auto timeline = TraceAnalysis::Timeline(index);
+    write_report(std::cout, timeline, top, min_wait);
+
+    if (chrome_path) {
+        auto out = std::ofstream(*chrome_path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            throw std::runtime_error("cannot open the output file: " + chrome_path->string());
+        }
+        TraceAnalysis::write_chrome_trace(out, timeline, TraceAnalysis::critical_path(timeline),
+                                          TraceAnalysis::concurrency(timeline));
+        out.close();
+        if (!out) {
+            throw std::runtime_error("cannot write the output file: " + chrome_path->string());
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    return Utils::catch_abort([&] {
+        return real_main(argc, argv);
+    });
+}
@@ -0,0 +1,427 @@
+// Benchmarks of the work the hooks do for each traced process (message serialization, environment block handling,
+//  command line parsing), and on Windows, of the end-to-end cost of spawning a process with the hook injected.
+// Each result is printed as a single JSON object per line, so that runs can be compared to catch regressions.
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "CommandLine.hpp"
+#include "Environment.hpp"
+#include "LoggerClient.hpp"
+#include "MessageBuffer.hpp"
+#include "MessageSink.hpp"
+#include "Protocol.hpp"
+#include "Scan.hpp"
+#include "Utils.hpp"
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <detours.h>
+#include <filesystem>
+#include <optional>
+#include "HookConfig.hpp"
+#include "Payloads.hpp"
+#include "TraceFileWriter.hpp"
+#include "Win32.hpp"
+#endif
+
+constexpr auto USAGE = R"(Usage:
+  SpawnCamper.Benchmark [--filter=<substring>] [--min-time=<ms>]
+  SpawnCamper.Benchmark spawn [--count=<n>] [--parallel=<threads>]
+
+Without a command, runs the serialization benchmarks whose name contains the filter. `spawn` (Windows only) measures
+the latency and throughput of `cmd /c exit` with and without the hook injected.
+)";
+
+using Clock = std::chrono::steady_clock;
+
+[[noreturn]] static void usage_error(const std::string& message) {
+    std::cerr << "ERROR: " << message << "\n\n" << USAGE;
+    exit(1);
+}
+
+static uint32_t parse_uint(std::string_view str) {
+    uint32_t value;
+    auto [end, error] = std::from_chars(str.data(), str.data() + str.size(), value);
+    if (error != std::errc{} || end != str.data() + str.size() || value == 0) {
+        usage_error("expected a positive integer: " + std::string(str));
+    }
+    return value;
+}
+
+/// Results of the benchmarked functions are accumulated here, so that the compiler cannot optimize the calls away.
+static volatile uint64_t g_sink = 0;
+
+static void keep(uint64_t value) {
+    g_sink = g_sink + value;
+}
+
+class Runner {
+    std::string_view m_filter;
+    std::chrono::nanoseconds m_min_time;
+
+public:
+    Runner(std::string_view filter, std::chrono::milliseconds min_time) : m_filter(filter), m_min_time(min_time) {}
+
+    /// Calls `fn` repeatedly until the minimum time elapses. `size` is the benchmark parameter (e.g., the number
+    ///  of characters in the environment block), `bytes` is the amount of data processed by a single call.
+    void run(std::string_view name, size_t size, size_t bytes, auto&& fn) {
+        if (!name.contains(m_filter)) {
+            return;
+        }
+
+        fn(); // warm up the caches and let the buffers grow to their final size
+        uint64_t iterations = 0;
+        uint64_t batch = 1;
+        auto start = Clock::now();
+        auto elapsed = Clock::duration{};
+        while (elapsed < m_min_time) {
+            for (uint64_t i = 0; i < batch; i++) {
+                fn();
+            }
+            iterations += batch;
+            elapsed = Clock::now() - start;
+            batch = std::min<uint64_t>(batch * 2, 1 << 16);
+        }
+
+        auto ns_per_op = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()
+                         / (double)iterations;
+        printf(R"({"name":"%.*s","size":%zu,"iterations":%llu,"nsPerOp":%.1f,"bytesPerSecond":%.0f})" "\n",
+               (int)name.size(), name.data(), size, (unsigned long long)iterations, ns_per_op,
+               (double)bytes / ns_per_op * 1e9);
+        fflush(stdout);
+    }
+};
+
+/// Builds an environment block with roughly `size` characters, resembling a typical developer machine
+///  (a few long `PATH`-like variables and many short ones). The returned string contains the final terminator.
+template<typename CharT>
+static std::basic_string<CharT> make_env(size_t size) {
+    std::basic_string<CharT> env{};
+    auto append = [&](std::string_view str) {
+        env.append(str.begin(), str.end());
+    };
+    for (size_t i = 0; env.size() < size; i++) {
+        append("VARIABLE_" + std::to_string(i) + "=");
+        size_t value_size = i % 8 == 0 ? 400 : 20;
+        for (size_t j = 0; j < value_size && env.size() + 1 < size; j++) {
+            env.push_back(CharT(j % 64 == 63 ? ';' : 'a' + j % 26));
+        }
+        env.push_back(0);
+    }
+    env.push_back(0);
+    return env;
+}
+
+template<typename CharT>
+static std::basic_string<CharT> widen(std::string_view str) {
+    return {str.begin(), str.end()};
+}
+
+constexpr size_t ENV_SIZES[] = {256, 4096, 32768};
+
+/// `CharT` is the character type the hooks use, `wchar_t` (UTF-16) on Windows and `char` (UTF-8) on Linux;
+///  `char16_t` stands in for UTF-16 on Linux.
+template<typename CharT>
+static void run_serialization_benchmarks(Runner& runner, std::string_view encoding) {
+    auto name = [&](std::string_view benchmark, uint32_t version = 0) {
+        auto result = std::string(benchmark) + "/" + std::string(encoding);
+        if (version > 0) result += "/v" + std::to_string(version);
+        return result;
+    };
+
+    auto exe_path = widen<CharT>(R"(C:\Program Files\Microsoft Visual Studio\2022\Community\VC\Tools\MSVC)"
+                                 R"(\14.40.33807\bin\Hostx64\x64\cl.exe)");
+    auto cmd_line = widen<CharT>(R"("cl.exe" /nologo /TP /DWIN32 /D_WINDOWS /EHsc /O2 /Ob2 /DNDEBUG -std:c++latest)"
+                                 R"( /showIncludes /FoCMakeFiles\hook.dir\src\lib.cpp.obj /FdCMakeFiles\hook.dir\)"
+                                 R"( /FS -c C:\dev\SpawnCamper\SpawnCamper.Tracer\src\lib.cpp)");
+    auto working_dir = widen<CharT>(R"(C:\dev\SpawnCamper\SpawnCamper.Tracer\cmake-build-release-amd64)");
+
+    for (uint32_t version = 1; version <= Protocol::MAX_VERSION; version++) {
+        MessageBuffer buffer{};
+        runner.run(name("write_string", version), cmd_line.size(), cmd_line.size() * sizeof(CharT), [&] {
+            auto w = Protocol::Writer(buffer, version);
+            Protocol::String::encode(w, cmd_line.c_str());
+            keep(buffer.size());
+            buffer.clear();
+        });
+    }
+
+    for (auto size : ENV_SIZES) {
+        auto env = make_env<CharT>(size);
+        auto env_bytes = env.size() * sizeof(CharT);
+
+        runner.run(name("peb_size"), size, env_bytes, [&] {
+            keep(Environment::peb_size(env.c_str()));
+        });
+        runner.run(name("peb_iterator"), size, env_bytes, [&] {
+            uint64_t count = 0;
+            for (auto entry : Environment::PebIterator(env.c_str())) {
+                count += (uint64_t)entry[0];
+            }
+            keep(count);
+        });
+        runner.run(name("env_hash"), size, env_bytes, [&] {
+            keep(Environment::hash(env.data(), env_bytes));
+        });
+
+        // a child typically changes a variable or two of its parent's environment
+        auto child_env = env;
+        child_env[child_env.find(CharT('=')) + 1] = CharT('X');
+        runner.run(name("compute_delta"), size, env_bytes, [&] {
+            auto delta = Environment::compute_delta(env.c_str(), child_env.c_str());
+            keep(delta.changed.size() + delta.removed.size());
+        });
+
+        for (uint32_t version = 1; version <= Protocol::MAX_VERSION; version++) {
+            auto sink = std::make_unique<MemorySink>(version);
+            auto& sink_ref = *sink;
+            auto client = LoggerClient(std::move(sink));
+            runner.run(name("log_new_process", version), size, env_bytes, [&] {
+                client.log_new_process<CharT>(1, exe_path.c_str(), cmd_line.c_str(), working_dir.c_str(),
+                                              env.c_str());
+                keep(sink_ref.data().size());
+                sink_ref.clear();
+            });
+
+            auto delta = Environment::compute_delta(env.c_str(), child_env.c_str());
+            auto delta_bytes = (delta.changed.size() + delta.removed.size()) * sizeof(CharT);
+            runner.run(name("log_new_process_delta", version), size, delta_bytes, [&] {
+                client.log_new_process<CharT>(1, exe_path.c_str(), cmd_line.c_str(), working_dir.c_str(),
+                                              child_env.c_str(), 1, 2, delta);
+                keep(sink_ref.data().size());
+                sink_ref.clear();
+            });
+        }
+    }
+}
+
+/// Scans an environment block entry by entry like the hooks do (entry length, then the `=` separator), using
+///  the `Scan` implementation `L`. Returns the total length of the names.
+template<Scan::Level L, typename CharT>
+static size_t scan_env_entries(const CharT* env) {
+    size_t names = 0;
+    while (*env != 0) {
+        const CharT *end, *eq;
+        if constexpr (L == Scan::Level::Scalar) {
+            end = Scan::Scalar::find_first_of<>(env);
+            eq = Scan::Scalar::find(env + 1, end, CharT('='));
+#if SCAN_X86
+        } else if constexpr (L == Scan::Level::Sse2) {
+            end = Scan::Sse2::find_first_of<>(env);
+            eq = Scan::Sse2::find(env + 1, end, CharT('='));
+        } else {
+            end = Scan::Avx2::find_first_of<>(env);
+            eq = Scan::Avx2::find(env + 1, end, CharT('='));
+#endif
+        }
+        names += eq - env;
+        env = end + 1;
+    }
+    return names;
+}
+
+template<Scan::Level L, typename CharT>
+static size_t scan_env_block(const CharT* env) {
+    if constexpr (L == Scan::Level::Scalar) return Scan::Scalar::env_block_length(env);
+#if SCAN_X86
+    else if constexpr (L == Scan::Level::Sse2) return Scan::Sse2::env_block_length(env);
+    else return Scan::Avx2::env_block_length(env);
+#endif
+}
+
+template<Scan::Level L, auto... Chars, typename CharT>
+static const CharT* scan_find_first_of(const CharT* str) {
+    if constexpr (L == Scan::Level::Scalar) return Scan::Scalar::find_first_of<Chars...>(str);
+#if SCAN_X86
+    else if constexpr (L == Scan::Level::Sse2) return Scan::Sse2::find_first_of<Chars...>(str);
+    else return Scan::Avx2::find_first_of<Chars...>(str);
+#endif
+}
+
+/// Compares the `Scan` implementation `L` against the others, on the inputs the hooks scan for each process.
+template<Scan::Level L, typename CharT>
+static void run_scan_benchmarks(Runner& runner, std::string_view encoding, std::string_view level) {
+    auto name = [&](std::string_view benchmark) {
+        return std::string(benchmark) + "/" + std::string(encoding) + "/" + std::string(level);
+    };
+    for (auto size : ENV_SIZES) {
+        auto env = make_env<CharT>(size);
+        auto env_bytes = env.size() * sizeof(CharT);
+        runner.run(name("scan_env_block"), size, env_bytes, [&] {
+            keep(scan_env_block<L>(env.c_str()));
+        });
+        runner.run(name("scan_env_entries"), size, env_bytes, [&] {
+            keep(scan_env_entries<L>(env.c_str()));
+        });
+    }
+
+    // a quoted argv[0] followed by a long argument, see `run_command_line_benchmarks`
+    auto cmd_line = widen<CharT>(R"("C:\Program Files\Microsoft Visual Studio\cl.exe" )")
+                    + std::basic_string<CharT>(4000, 'x');
+    runner.run(name("scan_arg_delimiter"), cmd_line.size(), cmd_line.size() * sizeof(CharT), [&] {
+        // skip the quoted argv[0] and then the long argument, like `CommandLine::find_arg_end`
+        auto quote_end = scan_find_first_of<L, '"'>(cmd_line.c_str() + 1);
+        auto arg_end = scan_find_first_of<L, '"', ' ', '\t'>(quote_end + 2);
+        keep((uint64_t)(arg_end - cmd_line.c_str()));
+    });
+}
+
+template<typename CharT>
+static void run_scan_benchmarks(Runner& runner, std::string_view encoding) {
+    run_scan_benchmarks<Scan::Level::Scalar, CharT>(runner, encoding, "scalar");
+#if SCAN_X86
+    run_scan_benchmarks<Scan::Level::Sse2, CharT>(runner, encoding, "sse2");
+    if (Scan::LEVEL == Scan::Level::Avx2) {
+        run_scan_benchmarks<Scan::Level::Avx2, CharT>(runner, encoding, "avx2");
+    }
+#endif
+}
+
+static void run_command_line_benchmarks(Runner& runner) {
+    std::wstring cmd_lines[] = {
+        LR"(cmd /c exit)",
+        LR"("C:\Program Files\PowerShell\7\pwsh.exe" -NoProfile -Command "Get-ChildItem")",
+        // a long quoted argv[0] with many arguments after it, as produced by build systems
+        LR"("C:\Program Files\Microsoft Visual Studio\2022\Community\VC\Tools\MSVC\14.40.33807\bin\Hostx64\x64\cl.exe")"
+        + std::wstring(2000, L' ') + std::wstring(4000, L'x'),
+    };
+    for (auto& cmd_line : cmd_lines) {
+        runner.run("find_argv1", cmd_line.size(), cmd_line.size() * sizeof(wchar_t), [&] {
+            keep((uint64_t)(CommandLine::find_argv1(cmd_line.c_str()) - cmd_line.c_str()));
+        });
+    }
+}
+
+#ifdef _WIN32
+/// Spawns `count` processes of `cmd /c exit` from `parallel` threads and prints the latency (from `CreateProcessW`
+///  until the process exits) and throughput. With `hook_dll`, the hook is injected into each process like
+///  the tracer does, recording into a temporary trace file, so that no server is needed.
+static void run_spawn_benchmark(uint32_t count, uint32_t parallel, const std::filesystem::path* hook_dll) {
+    auto recording = std::optional<TraceFileRecording>{};
+    auto trace_path = std::filesystem::temp_directory_path() / L"SpawnCamper.Benchmark.trace";
+    auto config = HookConfig{};
+    if (hook_dll) {
+        recording.emplace(trace_path, 256 << 20, Protocol::MAX_VERSION);
+        config.recorder_pid = GetCurrentProcessId();
+        config.protocol_version = Protocol::MAX_VERSION;
+    }
+    // Detours takes a `char*` even in the W variant
+    auto dll_path_str = hook_dll ? hook_dll->string() : std::string{};
+
+    auto spawn = [&] {
+        auto cmd_line = std::wstring(L"cmd.exe /c exit");
+        auto startup_info = STARTUPINFO{sizeof(STARTUPINFO)};
+        auto process_info = PROCESS_INFORMATION{};
+        if (hook_dll) {
+            if (!DetourCreateProcessWithDllExW(nullptr, cmd_line.data(), nullptr, nullptr, false, CREATE_SUSPENDED,
+                                               nullptr, nullptr, &startup_info, &process_info,
+                                               dll_path_str.c_str(), nullptr)) {
+                throw Win32::Win32Error{"DetourCreateProcessWithDllExW"};
+            }
+            if (!Payloads::copy_value(process_info.hProcess, Payloads::CONFIG_GUID, config)) {
+                throw Win32::Win32Error{"DetourCopyPayloadToProcess"};
+            }
+            ResumeThread(process_info.hThread);
+        } else if (!::CreateProcessW(nullptr, cmd_line.data(), nullptr, nullptr, false, 0, nullptr, nullptr,
+                                     &startup_info, &process_info)) {
+            throw Win32::Win32Error{"CreateProcessW"};
+        }
+        Win32::WaitForSingleObject(process_info.hProcess);
+        CloseHandle(process_info.hThread);
+        CloseHandle(process_info.hProcess);
+    };
+
+    spawn(); // warm up the file cache
+    auto latencies = std::vector<double>(count);
+    auto start = Clock::now();
+    auto threads = std::vector<std::jthread>{};
+    for (uint32_t t = 0; t < parallel; t++) {
+        threads.emplace_back([&, t] {
+            Utils::catch_abort([&] {
+                for (auto i = t; i < count; i += parallel) {
+                    auto spawn_start = Clock::now();
+                    spawn();
+                    latencies[i] = std::chrono::duration<double, std::micro>(Clock::now() - spawn_start).count();
+                }
+            });
+        });
+    }
+    threads.clear();
+    auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::ranges::sort(latencies);
+    auto percentile = [&](double p) {
+        return latencies[std::min((size_t)(p * (double)count), (size_t)count - 1)];
+    };
+    printf(R"({"name":"spawn","hook":%s,"parallel":%u,"count":%u,"spawnsPerSecond":%.1f,)"
+           R"("p50Us":%.0f,"p95Us":%.0f,"maxUs":%.0f})" "\n",
+           hook_dll ? "true" : "false", parallel, count, (double)count / elapsed,
+           percentile(0.5), percentile(0.95), latencies.back());
+    fflush(stdout);
+
+    if (recording) {
+        recording.reset();
+        std::filesystem::remove(trace_path);
+    }
+}
+#endif
+
+static int real_main(int argc, char** argv) {
+    auto args = std::vector<std::string_view>(argv + 1, argv + argc);
+    auto spawn = !args.empty() && args[0] == "spawn";
+    if (spawn) {
+        args.erase(args.begin());
+    }
+
+    auto filter = std::string_view{};
+    auto min_time = std::chrono::milliseconds(200);
+    [[maybe_unused]] uint32_t count = 200;
+    [[maybe_unused]] uint32_t parallel = std::max(std::thread::hardware_concurrency() / 2, 1u);
+    for (auto arg : args) {
+        auto eq_i = arg.find('=');
+        auto name = arg.substr(0, eq_i);
+        auto value = eq_i == arg.npos ? std::string_view{} : arg.substr(eq_i + 1);
+        if (!spawn && name == "--filter") filter = value;
+        else if (!spawn && name == "--min-time") min_time = std::chrono::milliseconds(parse_uint(value));
+        else if (spawn && name == "--count") count = parse_uint(value);
+        else if (spawn && name == "--parallel") parallel = parse_uint(value);
+        else usage_error("unknown option: " + std::string(arg));
+    }
+
+    if (spawn) {
+#ifdef _WIN32
+        auto hook_dll = Win32::GetModuleFileNameW();
+        hook_dll.replace_filename(L"hook64.dll");
+        for (auto threads : {1u, parallel}) {
+            run_spawn_benchmark(count, threads, nullptr);
+            run_spawn_benchmark(count, threads, &hook_dll);
+        }
+        return 0;
+#else
+        usage_error("the spawn benchmark is only supported on Windows");
+#endif
+    }
+
+    auto runner = Runner(filter, min_time);
+    run_command_line_benchmarks(runner);
+    run_serialization_benchmarks<char16_t>(runner, "utf16");
+    run_serialization_benchmarks<char>(runner, "utf8");
+    run_scan_benchmarks<char16_t>(runner, "utf16");
+    run_scan_benchmarks<char>(runner, "utf8");
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    return Utils::catch_abort([&] {
+        return real_main(argc, argv);
+    });
+}
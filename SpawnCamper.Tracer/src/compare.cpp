@@ -0,0 +1,321 @@
+// Compares two recorded runs of the same build (see `TraceCompare.hpp`), to find the invocations that made it slower.
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "MappedFile.hpp"
+#include "TraceAnalysis.hpp"
+#include "TraceCompare.hpp"
+#include "TraceIndex.hpp"
+#include "Utils.hpp"
+
+constexpr auto USAGE = R"(Usage:
+  SpawnCamper.Compare <before> <after> [--top=<n>]
+
+Both inputs are trace or index files. Matches the processes of the two runs by their executable, command line and
+position in the process tree, and prints the invocations that were added and removed, the largest changes of
+duration per executable and per invocation, the changed exit codes and environment variables. Changes are sorted by
+their impact on the wall time of the whole run, the change of the time the invocation spent on the critical path.
+)";
+
+/// FILETIME ticks per second.
+constexpr double TICKS_PER_SECOND = 10'000'000;
+/// Longer command lines are shortened in the report.
+constexpr size_t MAX_COMMAND_LINE = 100;
+
+[[noreturn]] static void usage_error(const std::string& message) {
+    std::cerr << "ERROR: " << message << "\n\n" << USAGE;
+    exit(1);
+}
+
+static size_t parse_count(std::string_view str) {
+    size_t value;
+    auto [end, error] = std::from_chars(str.data(), str.data() + str.size(), value);
+    if (error != std::errc{} || end != str.data() + str.size()) {
+        usage_error("invalid number: " + std::string(str));
+    }
+    return value;
+}
+
+static double seconds(uint64_t ticks) {
+    return (double)ticks / TICKS_PER_SECOND;
+}
+
+static double delta_seconds(uint64_t before, uint64_t after) {
+    return ((double)after - (double)before) / TICKS_PER_SECOND;
+}
+
+/// A trace or index file, raw traces are indexed in memory.
+class IndexFile {
+    MappedFile m_file;
+    std::string m_built_index{};
+    std::optional<TraceIndex::View> m_view{};
+
+public:
+    explicit IndexFile(const std::filesystem::path& path) : m_file(path) {
+        auto data = m_file.data();
+        if (!TraceIndex::is_index(data)) {
+            size_t malformed;
+            m_built_index = TraceIndex::build_in_memory(data, malformed);
+            if (malformed > 0) {
+                std::cerr << "WARNING: " << path.string() << ": skipped " << malformed << " malformed records\n";
+            }
+            data = std::as_bytes(std::span(m_built_index));
+        }
+        m_view.emplace(data);
+        if (m_view->header().dropped_messages > 0) {
+            std::cerr << "WARNING: " << path.string() << ": the trace is incomplete, "
+                      << m_view->header().dropped_messages << " messages were dropped during recording\n";
+        }
+    }
+
+    [[nodiscard]] const TraceIndex::View& view() const {
+        return *m_view;
+    }
+};
+
+static void write_report(std::ostream& out, const TraceAnalysis::Timeline& before,
+                         const TraceAnalysis::Timeline& after, size_t top) {
+    auto& a = before.index();
+    auto& b = after.index();
+    auto matching = TraceCompare::match(before, after);
+    auto before_critical = TraceCompare::critical_times(before);
+    auto after_critical = TraceCompare::critical_times(after);
+
+    auto command_line = [](const TraceIndex::View& index, uint32_t row) {
+        auto str = index.command_line(row);
+        return str.size() > MAX_COMMAND_LINE ? std::string(str.substr(0, MAX_COMMAND_LINE)) + "..." : std::string(str);
+    };
+    auto row_column = [&](uint32_t row) {
+        out << "  " << std::setw(7);
+        if (row == TraceIndex::NO_ROW) out << "-";
+        else out << row;
+    };
+
+    /// A matched pair, or an added/removed row with `NO_ROW` on the other side.
+    struct Change {
+        uint32_t before_row;
+        uint32_t after_row;
+        uint64_t before_time;
+        uint64_t after_time;
+        uint64_t before_critical;
+        uint64_t after_critical;
+
+        [[nodiscard]] double impact() const {
+            return delta_seconds(before_critical, after_critical);
+        }
+
+        [[nodiscard]] double delta() const {
+            return delta_seconds(before_time, after_time);
+        }
+    };
+    auto make_change = [&](uint32_t before_row, uint32_t after_row) {
+        auto c = Change{before_row, after_row, 0, 0, 0, 0};
+        if (before_row != TraceIndex::NO_ROW) {
+            c.before_time = before.duration(before_row);
+            c.before_critical = before_critical[before_row];
+        }
+        if (after_row != TraceIndex::NO_ROW) {
+            c.after_time = after.duration(after_row);
+            c.after_critical = after_critical[after_row];
+        }
+        return c;
+    };
+    auto by_impact = [](const Change& x, const Change& y) {
+        auto xi = std::abs(x.impact()), yi = std::abs(y.impact());
+        if (xi != yi) return xi > yi;
+        auto xd = std::abs(x.delta()), yd = std::abs(y.delta());
+        if (xd != yd) return xd > yd;
+        return std::pair(x.before_row, x.after_row) < std::pair(y.before_row, y.after_row);
+    };
+    auto sorted_top = [&](std::vector<Change>& changes) {
+        auto end = changes.begin() + (ptrdiff_t)std::min(top, changes.size());
+        std::ranges::partial_sort(changes, end, by_impact);
+        return std::ranges::subrange(changes.begin(), end);
+    };
+
+    auto matched = std::vector<Change>{}, added = std::vector<Change>{}, removed = std::vector<Change>{};
+    auto exit_codes = std::vector<Change>{};
+    size_t changed_command_lines = 0;
+    for (uint32_t row = 0; row < a.row_count(); row++) {
+        auto other = matching.before_to_after[row];
+        if (other == TraceIndex::NO_ROW) {
+            removed.push_back(make_change(row, TraceIndex::NO_ROW));
+            continue;
+        }
+        matched.push_back(make_change(row, other));
+        if (a.exit_code(row) != b.exit_code(other)) exit_codes.push_back(matched.back());
+        if (a.command_line(row) != b.command_line(other)) changed_command_lines++;
+    }
+    for (uint32_t row = 0; row < b.row_count(); row++) {
+        if (matching.after_to_before[row] == TraceIndex::NO_ROW) added.push_back(make_change(TraceIndex::NO_ROW, row));
+    }
+
+    /// Totals per exe file name, so that a tool moved to another directory is still compared with itself.
+    struct ExeTotals {
+        std::string_view name;
+        uint32_t before_runs = 0;
+        uint32_t after_runs = 0;
+        Change change{TraceIndex::NO_ROW, TraceIndex::NO_ROW, 0, 0, 0, 0};
+    };
+    auto exes = std::vector<ExeTotals>{};
+    auto exe_index = std::unordered_map<std::string, size_t>{};
+    // exe IDs differ between the indices
+    auto exe_totals = [&](const TraceIndex::View& index) {
+        auto totals = std::vector<size_t>(index.exe_count());
+        for (uint32_t exe = 0; exe < index.exe_count(); exe++) {
+            auto path = index.exe_name(exe);
+            auto [it, inserted] = exe_index.try_emplace(TraceCompare::exe_file_name(path), exes.size());
+            if (inserted) exes.push_back({path.substr(path.find_last_of("\\/") + 1)});
+            totals[exe] = it->second;
+        }
+        return totals;
+    };
+    auto before_exes = exe_totals(a);
+    for (uint32_t row = 0; row < a.row_count(); row++) {
+        auto& e = exes[before_exes[a.exe(row)]];
+        e.before_runs++;
+        e.change.before_time += before.duration(row);
+        e.change.before_critical += before_critical[row];
+    }
+    auto after_exes = exe_totals(b);
+    for (uint32_t row = 0; row < b.row_count(); row++) {
+        auto& e = exes[after_exes[b.exe(row)]];
+        e.after_runs++;
+        e.change.after_time += after.duration(row);
+        e.change.after_critical += after_critical[row];
+    }
+
+    auto summed = [](const TraceAnalysis::Timeline& timeline) {
+        uint64_t sum = 0;
+        for (uint32_t row = 0; row < timeline.row_count(); row++) sum += timeline.duration(row);
+        return sum;
+    };
+    auto before_span = before.trace_end() - before.trace_start();
+    auto after_span = after.trace_end() - after.trace_start();
+    auto before_summed = summed(before), after_summed = summed(after);
+
+    out << std::fixed << std::setprecision(3);
+    out << "Processes: " << a.row_count() << " before, " << b.row_count() << " after; " << matched.size()
+        << " matched (" << changed_command_lines << " with a different command line), " << added.size()
+        << " added, " << removed.size() << " removed\n";
+    out << "Trace span: " << seconds(before_span) << " s -> " << seconds(after_span) << " s ("
+        << std::showpos << delta_seconds(before_span, after_span) << std::noshowpos << " s)\n";
+    out << "Summed process time: " << seconds(before_summed) << " s -> " << seconds(after_summed) << " s ("
+        << std::showpos << delta_seconds(before_summed, after_summed) << std::noshowpos << " s)\n";
+
+    auto write_times = [&](const Change& c) {
+        out << "  " << std::setw(10) << std::showpos << c.impact() << "  " << std::setw(10) << c.delta()
+            << std::noshowpos << "  " << std::setw(10) << seconds(c.before_time) << "  " << std::setw(10)
+            << seconds(c.after_time);
+    };
+
+    auto exe_order = std::vector<size_t>(exes.size());
+    for (size_t i = 0; i < exes.size(); i++) exe_order[i] = i;
+    auto exe_end = exe_order.begin() + (ptrdiff_t)std::min(top, exe_order.size());
+    std::ranges::partial_sort(exe_order, exe_end, by_impact, [&](size_t i) { return exes[i].change; });
+    out << "\nExecutables by impact on wall time:\n";
+    out << "  impact [s]   delta [s]  before [s]   after [s]  runs before  runs after  exe\n";
+    for (auto i : std::ranges::subrange(exe_order.begin(), exe_end)) {
+        auto& e = exes[i];
+        write_times(e.change);
+        out << "  " << std::setw(11) << e.before_runs << "  " << std::setw(10) << e.after_runs << "  " << e.name << "\n";
+    }
+
+    out << "\nInvocations by impact on wall time:\n";
+    out << "  impact [s]   delta [s]  before [s]   after [s]  before   after    command line\n";
+    for (auto& c : sorted_top(matched)) {
+        write_times(c);
+        row_column(c.before_row);
+        row_column(c.after_row);
+        out << "  " << command_line(b, c.after_row) << "\n";
+    }
+
+    out << "\nAdded invocations: " << added.size() << "\n";
+    out << "  impact [s]   delta [s]  before [s]   after [s]  before   after    command line\n";
+    for (auto& c : sorted_top(added)) {
+        write_times(c);
+        row_column(c.before_row);
+        row_column(c.after_row);
+        out << "  " << command_line(b, c.after_row) << "\n";
+    }
+
+    out << "\nRemoved invocations: " << removed.size() << "\n";
+    out << "  impact [s]   delta [s]  before [s]   after [s]  before   after    command line\n";
+    for (auto& c : sorted_top(removed)) {
+        write_times(c);
+        row_column(c.before_row);
+        row_column(c.after_row);
+        out << "  " << command_line(a, c.before_row) << "\n";
+    }
+
+    auto exit_code = [&](std::optional<uint32_t> code) {
+        out << "  " << std::setw(11);
+        if (code) out << (int32_t)*code;
+        else out << "-";
+    };
+    out << "\nChanged exit codes: " << exit_codes.size() << "\n";
+    out << "  exit before   exit after  before   after    command line\n";
+    for (auto& c : sorted_top(exit_codes)) {
+        exit_code(a.exit_code(c.before_row));
+        exit_code(b.exit_code(c.after_row));
+        row_column(c.before_row);
+        row_column(c.after_row);
+        out << "  " << command_line(b, c.after_row) << "\n";
+    }
+
+    auto variables = TraceCompare::environment_changes(a, b, matching);
+    out << "\nChanged environment variables: " << variables.size() << "\n";
+    out << "  processes  variable\n";
+    for (auto& v : variables | std::views::take(top)) {
+        auto value = [](std::optional<std::string_view> value) {
+            return value ? "'" + std::string(*value) + "'" : std::string("(not set)");
+        };
+        out << "  " << std::setw(9) << v.processes << "  " << v.name << ": " << value(v.before) << " -> "
+            << value(v.after) << "\n";
+    }
+}
+
+static int real_main(int argc, char** argv) {
+    auto inputs = std::vector<std::filesystem::path>{};
+    size_t top = 20;
+    for (auto& arg : std::span(argv + 1, argv + argc)) {
+        auto str = std::string_view(arg);
+        if (str.starts_with("--top=")) {
+            top = parse_count(str.substr(strlen("--top=")));
+        } else if (str.starts_with("--") || inputs.size() == 2) {
+            usage_error("unknown argument: " + std::string(str));
+        } else {
+            inputs.emplace_back(str);
+        }
+    }
+    if (inputs.size() != 2) {
+        usage_error("expected two trace files");
+    }
+
+    auto before_file = IndexFile(inputs[0]);
+    auto after_file = IndexFile(inputs[1]);
+    auto before = TraceAnalysis::Timeline(before_file.view());
+    auto after = TraceAnalysis::Timeline(after_file.view());
+    write_report(std::cout, before, after, top);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    return Utils::catch_abort([&] {
+        return real_main(argc, argv);
+    });
+}
@@ -0,0 +1,158 @@
+// Builds and queries trace indices (see `TraceIndex.hpp`) from trace files recorded by `SpawnCamper.Tracer --record`.
+#include <charconv>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "Json.hpp"
+#include "MappedFile.hpp"
+#include "TraceIndex.hpp"
+#include "TraceReader.hpp"
+#include "Utils.hpp"
+
+constexpr auto USAGE = R"(Usage:
+  SpawnCamper.Indexer build <trace file> <index file>
+  SpawnCamper.Indexer info <index file>
+  SpawnCamper.Indexer children <index file> <row>
+  SpawnCamper.Indexer exe <index file> <exe path> [<from> <to>]
+  SpawnCamper.Indexer range <index file> <from> <to>
+
+Times are in seconds since the start of the recording. Queries print one JSON object per process.
+)";
+
+/// FILETIME ticks per second.
+constexpr double TICKS_PER_SECOND = 10'000'000;
+
+[[noreturn]] static void usage_error(const std::string& message) {
+    std::cerr << "ERROR: " << message << "\n\n" << USAGE;
+    exit(1);
+}
+
+static uint64_t parse_uint(std::string_view str) {
+    uint64_t value;
+    auto [end, error] = std::from_chars(str.data(), str.data() + str.size(), value);
+    if (error != std::errc{} || end != str.data() + str.size()) {
+        usage_error("invalid number: " + std::string(str));
+    }
+    return value;
+}
+
+/// Parses seconds since the start of the recording into a FILETIME.
+static uint64_t parse_time(const TraceIndex::View& index, std::string_view str) {
+    double seconds;
+    auto [end, error] = std::from_chars(str.data(), str.data() + str.size(), seconds);
+    if (error != std::errc{} || end != str.data() + str.size() || seconds < 0) {
+        usage_error("invalid time: " + std::string(str));
+    }
+    return index.header().start_time + (uint64_t)(seconds * TICKS_PER_SECOND);
+}
+
+static void write_row(std::ostream& out, const TraceIndex::View& index, uint32_t row) {
+    auto seconds = [&](uint64_t time) {
+        return (double)(int64_t)(time - index.header().start_time) / TICKS_PER_SECOND;
+    };
+
+    out << R"({"row":)" << row << R"(,"pid":)" << index.pid(row) << R"(,"parentPid":)" << index.parent_pid(row);
+    out << R"(,"parentRow":)";
+    if (auto parent = index.parent_row(row); parent != TraceIndex::NO_ROW) out << parent;
+    else out << "null";
+    out << R"(,"exePath":)";
+    Json::write_string(out, index.exe_path(row));
+    out << R"(,"commandLine":)";
+    Json::write_string(out, index.command_line(row));
+    out << R"(,"workingDirectory":)";
+    Json::write_string(out, index.working_directory(row));
+    out << R"(,"start":)" << seconds(index.start_time(row)) << R"(,"end":)";
+    if (auto end = index.end_time(row); end != TraceIndex::NO_TIME) out << seconds(end);
+    else out << "null";
+    out << R"(,"exitCode":)";
+    if (auto exit_code = index.exit_code(row)) out << *exit_code;
+    else out << "null";
+    out << R"(,"children":)" << index.children(row).size() << "}\n";
+}
+
+static void build(const std::filesystem::path& trace_path, const std::filesystem::path& index_path) {
+    auto trace_file = MappedFile(trace_path);
+    auto reader = TraceReader(trace_file.data());
+    auto builder = TraceIndex::Builder(reader.start_time(), reader.dropped_messages());
+
+    auto malformed = TraceIndex::add_trace(builder, reader);
+
+    auto out = std::ofstream(index_path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("cannot create the index file: " + index_path.string());
+    }
+    builder.write(out);
+    out.close();
+    if (!out) {
+        throw std::runtime_error("cannot write the index file: " + index_path.string());
+    }
+
+    std::cerr << "Indexed " << builder.row_count() << " processes.\n";
+    if (malformed > 0) {
+        std::cerr << "WARNING: skipped " << malformed << " malformed records\n";
+    }
+    if (reader.dropped_messages() > 0) {
+        std::cerr << "WARNING: the trace is incomplete, " << reader.dropped_messages()
+                  << " messages were dropped during recording\n";
+    }
+}
+
+static int real_main(int argc, char** argv) {
+    if (argc < 3) {
+        usage_error("missing arguments");
+    }
+    auto command = std::string_view(argv[1]);
+    auto arg_count = argc - 2;
+    auto args = argv + 2;
+
+    if (command == "build") {
+        if (arg_count != 2) usage_error("build expects a trace file and an index file");
+        build(args[0], args[1]);
+        return 0;
+    }
+
+    auto index_file = MappedFile(args[0]);
+    auto index = TraceIndex::View(index_file.data());
+    auto& out = std::cout;
+
+    if (command == "info" && arg_count == 1) {
+        auto& header = index.header();
+        out << R"({"processes":)" << index.row_count() << R"(,"executables":)" << index.exe_count()
+            << R"(,"droppedMessages":)" << header.dropped_messages << "}\n";
+    } else if (command == "children" && arg_count == 2) {
+        auto row = parse_uint(args[1]);
+        if (row >= index.row_count()) usage_error("row out of range");
+        for (auto child : index.children((uint32_t)row)) {
+            write_row(out, index, child);
+        }
+    } else if (command == "exe" && (arg_count == 2 || arg_count == 4)) {
+        auto exe = index.find_exe(args[1]);
+        if (!exe) return 0;
+        auto rows = arg_count == 2
+                        ? index.rows_of_exe(*exe)
+                        : index.rows_of_exe_started_between(
+                            *exe, parse_time(index, args[2]), parse_time(index, args[3]));
+        for (auto row : rows) {
+            write_row(out, index, row);
+        }
+    } else if (command == "range" && arg_count == 3) {
+        auto [first, last] = index.rows_started_between(parse_time(index, args[1]), parse_time(index, args[2]));
+        for (auto row = first; row < last; row++) {
+            write_row(out, index, row);
+        }
+    } else {
+        usage_error("unknown command or wrong number of arguments: " + std::string(command));
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    return Utils::catch_abort([&] {
+        return real_main(argc, argv);
+    });
+}
@@ -1,22 +1,380 @@
 #include <Windows.h>
+#include <Psapi.h>
 #include <detours.h>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
 
+#include "AsyncSink.hpp"
+#include "Environment.hpp"
+#include "FileAccessTable.hpp"
+#include "HookConfig.hpp"
 #include "Win32.hpp"
 #include "NtDll.hpp"
 #include "LoggerClient.hpp"
+#include "NamedPipeWriter.hpp"
+#include "Payloads.hpp"
+#include "ProcessFilter.hpp"
+#include "SharedMemoryWriter.hpp"
+#include "TraceFileWriter.hpp"
 #include "Utils.hpp"
 
 constexpr auto SERVER_PIPE_NAME = LR"(\\.\pipe\SpawnCamper)";
+constexpr auto SERVER_RING_NAME = LR"(Local\SpawnCamper.Ring)";
+constexpr auto SERVER_RING_EVENT_NAME = LR"(Local\SpawnCamper.Ring.Event)";
 
 static std::string g_dll_path;
+static HookConfig g_config;
+/// Serialized `ProcessFilter` rules passed by the parent, forwarded to child processes as they are.
+static std::span<const std::byte> g_filter_payload;
+/// Set if this process matched the filter rules, see `HookConfig::filter_action`.
+static std::optional<FilterAction> g_filter_action;
+/// Created on the first use by `logger()`, connecting to the server may block.
 static std::unique_ptr<LoggerClient> g_logger;
+static std::once_flag g_logger_initialized;
+/// Hash of the environment that was last reported to the server, which child processes may reference.
+static std::atomic<uint64_t> g_reported_env_hash;
+/// Set if the file detours are attached, see `HookConfig::trace_files`.
+static bool g_trace_files = false;
+/// Files accessed by this process that were not reported yet; protected by `g_files_mutex`.
+static FileAccessTable<wchar_t> g_files;
+static std::mutex g_files_mutex;
+/// Set while the hook itself accesses files on the current thread (recording an access, connecting to the server),
+///  which are not recorded; this also keeps the file detours from recursing.
+static thread_local bool t_ignore_file_access = false;
+/// Time spent by the hook in this process, reported once the start is reported and again before it exits; set
+///  during the initialization.
+static LoggerClient::HookTimings g_timings;
+/// Set once the start and the first timings were reported; until then, `DLL_PROCESS_DETACH` has nothing to add.
+static std::atomic<bool> g_attach_logged = false;
+/// Set by `log_exit`, after which `DLL_PROCESS_DETACH` does not report the timings again.
+static std::atomic<bool> g_exit_logged = false;
+/// `CreateProcess` calls not reported yet; protected by `g_spawns_mutex`.
+static std::vector<LoggerClient::Spawn> g_spawns;
+static std::mutex g_spawns_mutex;
+/// Held while registering the exit wait of a child, so that the wait callback sees the handle of its wait.
+static std::mutex g_child_waits_mutex;
 
 namespace Real {
     static auto CreateProcessW = ::CreateProcessW;
     static auto CreateProcessA = ::CreateProcessA;
     static auto ExitProcess = ::ExitProcess;
     static auto TerminateProcess = ::TerminateProcess;
+    static auto NtCreateFile = NtDll::get_proc<NtDll::NtCreateFileFn>("NtCreateFile");
+    static auto NtOpenFile = NtDll::get_proc<NtDll::NtOpenFileFn>("NtOpenFile");
+    static auto NtDeleteFile = NtDll::get_proc<NtDll::NtDeleteFileFn>("NtDeleteFile");
+    static auto NtSetInformationFile = NtDll::get_proc<NtDll::NtSetInformationFileFn>("NtSetInformationFile");
+}
+
+static LoggerClient& logger();
+
+/// Snapshots the current environment for a new child process and ensures that the server knows about it.
+static std::optional<std::vector<std::byte>> prepare_env_payload() {
+    if (g_filter_action == FilterAction::Skip || !logger().connected()) {
+        // the server would not know the base environment, let the child send the full block
+        return std::nullopt;
+    }
+
+    auto env = Win32::GetEnvironmentStringsW();
+    auto env_size = Environment::peb_size(env.get());
+    auto env_hash = Environment::hash(env.get(), env_size);
+    if (g_reported_env_hash.exchange(env_hash) != env_hash) {
+        // the environment changed since we last reported it, send it before the child can reference it
+        logger().log_environment(env.get());
+    }
+
+    auto header = Payloads::EnvHeader{env_hash, env_size};
+    auto payload = std::vector<std::byte>(sizeof(header) + env_size + sizeof(wchar_t));
+    memcpy(payload.data(), &header, sizeof(header));
+    memcpy(payload.data() + sizeof(header), env.get(), env_size + sizeof(wchar_t));
+    return payload;
+}
+
+/// Reports the hook timings and the `CreateProcess` calls recorded so far. The totals are cumulative, so the server
+///  only keeps the last report of each process.
+static void log_hook_timings(LoggerClient& client) {
+    auto spawns = decltype(g_spawns){};
+    {
+        std::unique_lock lock(g_spawns_mutex);
+        std::swap(spawns, g_spawns);
+    }
+    client.log_hook_timings(g_timings, spawns);
+}
+
+/// Records a `CreateProcess` call, reported in batches of `SPAWN_BATCH` calls, so that processes starting many
+///  children (e.g., build systems) do not keep all of them in memory.
+static void record_spawn(uint32_t child_pid, uint64_t create_time, uint64_t detour_time) {
+    constexpr size_t SPAWN_BATCH = 256;
+    if (g_filter_action == FilterAction::Skip) {
+        return;
+    }
+    bool full;
+    {
+        std::unique_lock lock(g_spawns_mutex);
+        g_spawns.emplace_back(child_pid, create_time, detour_time);
+        full = g_spawns.size() >= SPAWN_BATCH;
+    }
+    if (full) {
+        log_hook_timings(logger());
+    }
+}
+
+static uint64_t filetime_ticks(FILETIME time) {
+    return (uint64_t)time.dwHighDateTime << 32 | (uint64_t)time.dwLowDateTime;
+}
+
+/// A child whose exit is reported by `watch_child_exit`.
+struct ChildWait {
+    HANDLE process;
+    DWORD pid;
+    HANDLE wait = nullptr;
+};
+
+static void CALLBACK on_child_exit(PVOID context, BOOLEAN /*timed_out*/) {
+    auto child = std::unique_ptr<ChildWait>(static_cast<ChildWait*>(context));
+    {
+        // wait until `watch_child_exit` stored `child->wait`
+        std::unique_lock lock(g_child_waits_mutex);
+    }
+    Utils::catch_abort([&] {
+        DWORD exit_code;
+        FILETIME creation_time, exit_time, kernel_time, user_time;
+        if (GetExitCodeProcess(child->process, &exit_code)
+            && GetProcessTimes(child->process, &creation_time, &exit_time, &kernel_time, &user_time)) {
+            logger().log_child_exit(child->pid, exit_code, filetime_ticks(exit_time));
+        }
+    });
+    // a one-shot wait must still be unregistered; from its own callback, this does not wait for the callback
+    UnregisterWait(child->wait);
+    CloseHandle(child->process);
+}
+
+/// Reports the exit code and exit time of the child when it exits, so that the server learns them even if the child
+///  is killed or crashes before its own hook reports them. The waits are serviced by the shared thread pool, where
+///  a single thread waits for up to 63 children, instead of a thread per child. Children still running when this
+///  process exits are not reported. Returns whether the exit is watched, which the child reports with its start
+///  (see `HookConfig::exit_watched`).
+static bool watch_child_exit(const PROCESS_INFORMATION& process_info) {
+    // `Messages::ChildExit` requires protocol version 2
+    if (g_filter_action == FilterAction::Skip || !logger().connected() || logger().protocol_version() < 2) {
+        return false;
+    }
+    // the caller may close its handle at any time; our handle also keeps the PID from being reused until reported
+    HANDLE process;
+    if (!DuplicateHandle(GetCurrentProcess(), process_info.hProcess, GetCurrentProcess(), &process,
+                         SYNCHRONIZE | PROCESS_QUERY_LIMITED_INFORMATION, FALSE, 0)) {
+        return false;
+    }
+    auto child = std::make_unique<ChildWait>(process, process_info.dwProcessId);
+    std::unique_lock lock(g_child_waits_mutex);
+    if (!RegisterWaitForSingleObject(&child->wait, process, on_child_exit, child.get(), INFINITE,
+                                     WT_EXECUTEONLYONCE)) {
+        CloseHandle(process);
+        return false;
+    }
+    // owned by the callback now
+    child.release();
+    return true;
+}
+
+/// Creates the process using `create_fn` and copies our payloads into it before it starts running.
+static BOOL create_process_with_payload(
+    DWORD creation_flags, LPPROCESS_INFORMATION process_info, auto create_fn
+) {
+    auto detour_start = Utils::performance_counter();
+    auto env_payload = Utils::catch_abort([&] {
+        return prepare_env_payload();
+    });
+
+    // the parent PID is only needed if this process is skipped, avoid the query otherwise
+    auto parent_pid = g_filter_action == FilterAction::Skip && !g_config.reported_ancestor_pid
+                          ? NtDll::GetParentProcessId()
+                          : 0;
+    auto child_config = g_config.for_child(g_filter_action, parent_pid);
+    child_config.spawn_counter = detour_start;
+
+    // create the process suspended, so that the payloads are present before the hook in the child reads them
+    auto create_start = Utils::performance_counter();
+    if (!create_fn(creation_flags | CREATE_SUSPENDED)) {
+        return FALSE;
+    }
+    auto create_time = Utils::performance_counter() - create_start;
+    // the child is still suspended, so it cannot exit before the wait is registered
+    child_config.exit_watched = Utils::catch_abort([&] {
+        return watch_child_exit(*process_info);
+    });
+    // if this fails, the child runs with the default configuration
+    Payloads::copy_value(process_info->hProcess, Payloads::CONFIG_GUID, child_config);
+    if (!g_filter_payload.empty()) {
+        // if this fails, the child is traced in full
+        Payloads::copy(process_info->hProcess, Payloads::FILTER_GUID, g_filter_payload);
+    }
+    if (env_payload) {
+        // if this fails, the child does not find the payload and sends its full environment
+        Payloads::copy(process_info->hProcess, Payloads::ENV_GUID, *env_payload);
+    }
+    if (!(creation_flags & CREATE_SUSPENDED)) {
+        ResumeThread(process_info->hThread);
+    }
+    Utils::catch_abort([&] {
+        record_spawn(process_info->dwProcessId, create_time, Utils::performance_counter() - detour_start);
+    });
+    return TRUE;
+}
+
+/// Resource usage of the current process, reported with its exit code. Returns `std::nullopt` if some of the counters
+///  are not available.
+static std::optional<Protocol::ResourceUsage> get_resource_usage() {
+    auto process = GetCurrentProcess();
+    FILETIME creation_time, exit_time, kernel_time, user_time;
+    PROCESS_MEMORY_COUNTERS memory{};
+    IO_COUNTERS io{};
+    DWORD handle_count = 0;
+    if (!GetProcessTimes(process, &creation_time, &exit_time, &kernel_time, &user_time)
+        || !GetProcessMemoryInfo(process, &memory, sizeof(memory))
+        || !GetProcessIoCounters(process, &io)
+        || !GetProcessHandleCount(process, &handle_count)) {
+        return std::nullopt;
+    }
+
+    return Protocol::ResourceUsage{
+        filetime_ticks(user_time), filetime_ticks(kernel_time), memory.PeakWorkingSetSize, memory.PeakPagefileUsage,
+        io.ReadTransferCount, io.WriteTransferCount, io.ReadOperationCount, io.WriteOperationCount,
+        handle_count, NtDll::GetThreadCount()};
+}
+
+/// Runs `fn`, which records a file access, unless the access comes from the hook itself (see `t_ignore_file_access`).
+///  Preserves the last error, which the caller of the detoured function may check.
+static void trace_file_access(auto fn) {
+    if (t_ignore_file_access) {
+        return;
+    }
+    t_ignore_file_access = true;
+    auto last_error = GetLastError();
+    Utils::catch_abort(fn);
+    SetLastError(last_error);
+    t_ignore_file_access = false;
+}
+
+/// Reports the files recorded so far and starts over.
+static void log_file_accesses() {
+    auto files = FileAccessTable<wchar_t>{};
+    {
+        std::unique_lock lock(g_files_mutex);
+        std::swap(files, g_files);
+    }
+    if (!files.empty()) {
+        logger().log_file_accesses(files);
+    }
+}
+
+/// Records an access through `record_fn(g_files)`. Only call through `trace_file_access`.
+static void record_file_access(auto record_fn) {
+    bool full;
+    {
+        std::unique_lock lock(g_files_mutex);
+        record_fn(g_files);
+        full = g_files.size() >= FileAccessTable<wchar_t>::MAX_ENTRIES;
+    }
+    if (full) {
+        log_file_accesses();
+    }
+}
+
+/// Returns the DOS path of an open file, or an empty string if it's not a file on a drive or a network share.
+static std::wstring handle_path(HANDLE file) {
+    auto path = std::wstring(MAX_PATH, L'\0');
+    while (true) {
+        auto length = GetFinalPathNameByHandleW(file, path.data(), (DWORD)path.size(),
+                                                FILE_NAME_OPENED | VOLUME_NAME_DOS);
+        if (length == 0) {
+            return {};
+        }
+        if (length < path.size()) {
+            path.resize(length);
+            return to_dos_path(path);
+        }
+        // buffer too small, `length` includes the terminator
+        path.resize(length);
+    }
+}
+
+/// Returns the DOS path of the file `name`, relative to the directory `root` if set, or an empty string if it's not
+///  a file on a drive or a network share.
+static std::wstring object_path(HANDLE root, std::wstring_view name) {
+    if (!root) {
+        return to_dos_path(name);
+    }
+    // relative paths are opened relative to a directory handle, e.g., the current directory
+    auto path = handle_path(root);
+    if (!path.empty() && !name.empty()) {
+        if (path.back() != L'\\') path += L'\\';
+        path += name;
+    }
+    return path;
+}
+
+static std::wstring object_path(const OBJECT_ATTRIBUTES* attributes) {
+    if (!attributes || !attributes->ObjectName) {
+        return {};
+    }
+    auto& name = *attributes->ObjectName;
+    return object_path(attributes->RootDirectory, std::wstring_view(name.Buffer, name.Length / sizeof(wchar_t)));
+}
+
+/// Classifies an open by the requested access, disposition and options. For directories, `Read` means listing.
+static FileAccess open_access(ACCESS_MASK access, ULONG disposition, ULONG options) {
+    auto result = FileAccess::None;
+    if (access & (GENERIC_READ | GENERIC_EXECUTE | GENERIC_ALL | MAXIMUM_ALLOWED | FILE_READ_DATA | FILE_EXECUTE)) {
+        result |= FileAccess::Read;
+    }
+    if ((access & (GENERIC_WRITE | GENERIC_ALL | FILE_WRITE_DATA | FILE_APPEND_DATA))
+        || disposition == FILE_SUPERSEDE || disposition == FILE_CREATE
+        || disposition == FILE_OVERWRITE || disposition == FILE_OVERWRITE_IF) {
+        result |= FileAccess::Write;
+    }
+    if (options & FILE_DELETE_ON_CLOSE) {
+        result |= FileAccess::Delete;
+    }
+    return result == FileAccess::None ? FileAccess::Query : result;
+}
+
+static void record_open(const OBJECT_ATTRIBUTES* attributes, FileAccess access, NTSTATUS status) {
+    trace_file_access([&] {
+        auto path = object_path(attributes);
+        if (path.empty()) return;
+        record_file_access([&](auto& files) {
+            files.record_open(path, access, NT_SUCCESS(status));
+        });
+    });
+}
+
+static void log_exit(UINT exit_code) {
+    if (g_filter_action == FilterAction::Skip) {
+        return;
+    }
+    Utils::catch_abort([&] {
+        if (g_trace_files) {
+            trace_file_access([] {
+                log_file_accesses();
+            });
+        }
+        g_exit_logged = true;
+        log_hook_timings(logger());
+        // filtered processes only report the minimum
+        logger().log_ExitProcess(exit_code, g_filter_action ? std::nullopt : get_resource_usage());
+    });
 }
 
 namespace Detours {
@@ -33,10 +391,12 @@ namespace Detours {
         _Out_ LPPROCESS_INFORMATION lpProcessInformation
     ) {
         // CreateProcess is not traced, we just need to ensure that the hook DLL is injected into the new process
-        return DetourCreateProcessWithDllExW(
-            lpApplicationName, lpCommandLine, lpProcessAttributes, lpThreadAttributes, bInheritHandles, dwCreationFlags,
-            lpEnvironment, lpCurrentDirectory, lpStartupInfo, lpProcessInformation,
-            g_dll_path.c_str(), Real::CreateProcessW);
+        return create_process_with_payload(dwCreationFlags, lpProcessInformation, [&](DWORD flags) {
+            return DetourCreateProcessWithDllExW(
+                lpApplicationName, lpCommandLine, lpProcessAttributes, lpThreadAttributes, bInheritHandles, flags,
+                lpEnvironment, lpCurrentDirectory, lpStartupInfo, lpProcessInformation,
+                g_dll_path.c_str(), Real::CreateProcessW);
+        });
     }
 
     static BOOL WINAPI CreateProcessA(
@@ -52,18 +412,18 @@ namespace Detours {
         _Out_ LPPROCESS_INFORMATION lpProcessInformation
     ) {
         // CreateProcess is not traced, we just need to ensure that the hook DLL is injected into the new process
-        return DetourCreateProcessWithDllExA(
-            lpApplicationName, lpCommandLine, lpProcessAttributes, lpThreadAttributes, bInheritHandles, dwCreationFlags,
-            lpEnvironment, lpCurrentDirectory, lpStartupInfo, lpProcessInformation,
-            g_dll_path.c_str(), Real::CreateProcessA);
+        return create_process_with_payload(dwCreationFlags, lpProcessInformation, [&](DWORD flags) {
+            return DetourCreateProcessWithDllExA(
+                lpApplicationName, lpCommandLine, lpProcessAttributes, lpThreadAttributes, bInheritHandles, flags,
+                lpEnvironment, lpCurrentDirectory, lpStartupInfo, lpProcessInformation,
+                g_dll_path.c_str(), Real::CreateProcessA);
+        });
     }
 
     static DECLSPEC_NORETURN VOID WINAPI ExitProcess(
         _In_ UINT uExitCode
     ) {
-        Utils::catch_abort([&] {
-            g_logger->log_ExitProcess(uExitCode);
-        });
+        log_exit(uExitCode);
         Real::ExitProcess(uExitCode);
     }
 
@@ -74,12 +434,91 @@ namespace Detours {
         // some processes (like Git's sh.exe, and probably anything using MSYS2)
         //  kill themselves using `TerminateProcess` instead of using `ExitProcess`
         if (hProcess == GetCurrentProcess()) {
-            Utils::catch_abort([&] {
-                g_logger->log_ExitProcess(uExitCode);
-            });
+            log_exit(uExitCode);
         }
         return Real::TerminateProcess(hProcess, uExitCode);
     }
+
+    // file detours, only attached with `HookConfig::trace_files`; the Win32 file functions (`CreateFileW`,
+    //  `DeleteFileW`, `MoveFileExW`,...) and the C runtime all end up in these
+
+    static NTSTATUS NTAPI NtCreateFile(
+        PHANDLE FileHandle, ACCESS_MASK DesiredAccess, POBJECT_ATTRIBUTES ObjectAttributes,
+        PIO_STATUS_BLOCK IoStatusBlock, PLARGE_INTEGER AllocationSize, ULONG FileAttributes, ULONG ShareAccess,
+        ULONG CreateDisposition, ULONG CreateOptions, PVOID EaBuffer, ULONG EaLength
+    ) {
+        auto status = Real::NtCreateFile(FileHandle, DesiredAccess, ObjectAttributes, IoStatusBlock, AllocationSize,
+                                         FileAttributes, ShareAccess, CreateDisposition, CreateOptions, EaBuffer,
+                                         EaLength);
+        record_open(ObjectAttributes, open_access(DesiredAccess, CreateDisposition, CreateOptions), status);
+        return status;
+    }
+
+    static NTSTATUS NTAPI NtOpenFile(
+        PHANDLE FileHandle, ACCESS_MASK DesiredAccess, POBJECT_ATTRIBUTES ObjectAttributes,
+        PIO_STATUS_BLOCK IoStatusBlock, ULONG ShareAccess, ULONG OpenOptions
+    ) {
+        auto status = Real::NtOpenFile(FileHandle, DesiredAccess, ObjectAttributes, IoStatusBlock, ShareAccess,
+                                       OpenOptions);
+        record_open(ObjectAttributes, open_access(DesiredAccess, FILE_OPEN, OpenOptions), status);
+        return status;
+    }
+
+    static NTSTATUS NTAPI NtDeleteFile(POBJECT_ATTRIBUTES ObjectAttributes) {
+        auto status = Real::NtDeleteFile(ObjectAttributes);
+        if (NT_SUCCESS(status)) {
+            trace_file_access([&] {
+                auto path = object_path(ObjectAttributes);
+                if (path.empty()) return;
+                record_file_access([&](auto& files) {
+                    files.record(path, FileAccess::Delete);
+                });
+            });
+        }
+        return status;
+    }
+
+    static NTSTATUS NTAPI NtSetInformationFile(
+        HANDLE FileHandle, PIO_STATUS_BLOCK IoStatusBlock, PVOID FileInformation, ULONG Length,
+        ULONG FileInformationClass
+    ) {
+        auto is_rename = (FileInformationClass == NtDll::FileRenameInformation
+                          || FileInformationClass == NtDll::FileRenameInformationEx)
+                         && Length >= offsetof(NtDll::RenameInformation, FileName);
+        auto is_delete = (FileInformationClass == NtDll::FileDispositionInformation
+                          && Length >= sizeof(BOOLEAN) && *(const BOOLEAN*)FileInformation)
+                         || (FileInformationClass == NtDll::FileDispositionInformationEx
+                             && Length >= sizeof(ULONG)
+                             && (*(const ULONG*)FileInformation & FILE_DISPOSITION_FLAG_DELETE));
+        // the original path of a renamed file is only available before the rename
+        auto source = std::wstring{};
+        if (is_rename) {
+            trace_file_access([&] { source = handle_path(FileHandle); });
+        }
+
+        auto status = Real::NtSetInformationFile(FileHandle, IoStatusBlock, FileInformation, Length,
+                                                 FileInformationClass);
+        if (!NT_SUCCESS(status) || (!is_rename && !is_delete)) {
+            return status;
+        }
+        trace_file_access([&] {
+            if (is_delete) {
+                auto path = handle_path(FileHandle);
+                if (path.empty()) return;
+                record_file_access([&](auto& files) {
+                    files.record(path, FileAccess::Delete);
+                });
+            } else if (!source.empty()) {
+                // the handle now refers to the new path
+                auto target = handle_path(FileHandle);
+                record_file_access([&](auto& files) {
+                    files.record(source, FileAccess::RenamedFrom);
+                    if (!target.empty()) files.record(target, FileAccess::RenamedTo);
+                });
+            }
+        });
+        return status;
+    }
 }
 
 static void setup_detour(bool attach) {
@@ -91,22 +530,112 @@ static void setup_detour(bool attach) {
         DetourAttach(&Real::CreateProcessA, Detours::CreateProcessA);
         DetourAttach(&Real::ExitProcess, Detours::ExitProcess);
         DetourAttach(&Real::TerminateProcess, Detours::TerminateProcess);
+        if (g_trace_files) {
+            DetourAttach(&Real::NtCreateFile, Detours::NtCreateFile);
+            DetourAttach(&Real::NtOpenFile, Detours::NtOpenFile);
+            DetourAttach(&Real::NtDeleteFile, Detours::NtDeleteFile);
+            DetourAttach(&Real::NtSetInformationFile, Detours::NtSetInformationFile);
+        }
     } else {
         DetourDetach(&Real::CreateProcessW, Detours::CreateProcessW);
         DetourDetach(&Real::CreateProcessA, Detours::CreateProcessA);
         DetourDetach(&Real::ExitProcess, Detours::ExitProcess);
         DetourDetach(&Real::TerminateProcess, Detours::TerminateProcess);
+        if (g_trace_files) {
+            DetourDetach(&Real::NtCreateFile, Detours::NtCreateFile);
+            DetourDetach(&Real::NtOpenFile, Detours::NtOpenFile);
+            DetourDetach(&Real::NtDeleteFile, Detours::NtDeleteFile);
+            DetourDetach(&Real::NtSetInformationFile, Detours::NtSetInformationFile);
+        }
     }
 
     DetourTransactionCommit();
 }
 
-static void log_attach() {
-    auto parent_pid = NtDll::GetParentProcessId();
-    auto exe_path = Win32::GetModuleFileNameW(nullptr);
-    auto working_dir = Win32::GetCurrentDirectoryW();
-    auto env = Win32::GetEnvironmentStringsW();
-    g_logger->log_new_process(parent_pid, exe_path.c_str(), GetCommandLineW(), working_dir.c_str(), env.get());
+static std::unique_ptr<MessageSink> create_sink() {
+    if (g_config.recorder_pid != 0) {
+        // recording into a trace file, the server is not involved at all
+        return std::make_unique<TraceFileWriter>(g_config.recorder_pid);
+    }
+
+    auto sink = std::unique_ptr<MessageSink>{};
+    if (g_config.transport == Transport::SharedMemory) {
+        sink = std::make_unique<SharedMemoryWriter>(SERVER_RING_NAME, SERVER_RING_EVENT_NAME);
+    }
+    if (!sink || !sink->connected()) {
+        sink = std::make_unique<NamedPipeWriter>(SERVER_PIPE_NAME, g_config.protocol_version);
+    }
+    if (g_config.async && sink->connected()) {
+        sink = std::make_unique<AsyncSink>(std::move(sink), g_config.overflow_policy, g_config.queue_capacity);
+    }
+    return sink;
+}
+
+/// Information about the process captured in `DllMain`. Everything that may block (connecting to the server, sending
+///  the message) or take a while (hashing and diffing the environment) is deferred until the loader lock is released.
+struct AttachSnapshot {
+    uint64_t timestamp;
+    uint32_t parent_pid;
+    std::filesystem::path exe_path;
+    /// Not captured for processes reported with `FilterAction::Minimal`.
+    std::filesystem::path working_dir{};
+    decltype(Win32::GetEnvironmentStringsW()) env{};
+};
+
+static std::optional<AttachSnapshot> g_attach_snapshot;
+
+static void log_attach(const AttachSnapshot& snapshot) {
+    auto& [timestamp, parent_pid, exe_path, working_dir, env] = snapshot;
+    auto flags = g_config.exit_watched ? Protocol::StartFlags::ExitWatched : Protocol::StartFlags::None;
+    if (g_filter_action == FilterAction::Minimal) {
+        // the environment is reported later if the process creates a child that references it
+        g_logger->log_new_process_minimal(parent_pid, exe_path.c_str(), timestamp, flags);
+        return;
+    }
+
+    auto env_size = Environment::peb_size(env.get());
+    auto env_hash = Environment::hash(env.get(), env_size);
+
+    auto payload_buffer = Payloads::find(Payloads::ENV_GUID);
+    auto payload = (const Payloads::EnvHeader*)payload_buffer.data();
+    if (payload && payload_buffer.size() >= sizeof(*payload) + payload->env_size + sizeof(wchar_t)) {
+        // the parent passed us its environment, only send the difference
+        auto base_env = (const wchar_t*)(payload + 1);
+        auto delta = payload->env_hash == env_hash
+                         ? Environment::Delta<wchar_t>{}
+                         : Environment::compute_delta(base_env, env.get());
+        g_logger->log_new_process(parent_pid, exe_path.c_str(), GetCommandLineW(), working_dir.c_str(), env.get(),
+                                  env_hash, payload->env_hash, delta, timestamp, flags);
+    } else {
+        g_logger->log_new_process(parent_pid, exe_path.c_str(), GetCommandLineW(), working_dir.c_str(), env.get(),
+                                  timestamp, flags);
+    }
+    g_reported_env_hash = env_hash;
+}
+
+/// Connects to the server and reports the process start on the first call. Called from the worker thread started
+///  in `DllMain`, and from the detours, which wait for it to finish; if the worker did not get to run yet (e.g., the
+///  process exits while still holding the loader lock), the initialization runs on the calling thread instead.
+static LoggerClient& logger() {
+    std::call_once(g_logger_initialized, [] {
+        // the files opened by the sink (e.g., the trace file) are not accessed by the traced program
+        auto ignore_file_access = std::exchange(t_ignore_file_access, true);
+        Utils::catch_abort([&] {
+            auto connect_start = Utils::performance_counter();
+            g_logger = std::make_unique<LoggerClient>(create_sink());
+            auto attach_start = Utils::performance_counter();
+            g_timings.connect = attach_start - connect_start;
+            log_attach(*g_attach_snapshot);
+            g_attach_snapshot.reset();
+            g_timings.log_attach = Utils::performance_counter() - attach_start;
+            // reported right away, so that the overhead of processes that are killed (and never reach `log_exit`)
+            //  is known as well
+            log_hook_timings(*g_logger);
+            g_attach_logged = true;
+        });
+        t_ignore_file_access = ignore_file_access;
+    });
+    return *g_logger;
 }
 
 BOOL WINAPI DllMain(HINSTANCE hInst, DWORD dwReason, LPVOID) {
@@ -115,23 +644,69 @@ BOOL WINAPI DllMain(HINSTANCE hInst, DWORD dwReason, LPVOID) {
     }
 
     switch (dwReason) {
-        case DLL_PROCESS_ATTACH:
+        case DLL_PROCESS_ATTACH: {
+            auto attach_start = Utils::performance_counter();
             DetourRestoreAfterWith();
             // disable DLL_THREAD_ATTACH/DLL_THREAD_DETACH callbacks, we don't need them
             DisableThreadLibraryCalls(hInst);
 
             Utils::catch_abort([&] {
-                g_logger = std::make_unique<LoggerClient>(SERVER_PIPE_NAME);
+                if (auto config = Payloads::find<HookConfig>(Payloads::CONFIG_GUID)) {
+                    g_config = *config;
+                }
+                if (g_config.spawn_counter != 0) {
+                    g_timings.spawn_latency = attach_start - g_config.spawn_counter;
+                }
+                g_filter_payload = Payloads::find(Payloads::FILTER_GUID);
                 g_dll_path = Win32::GetModuleFileNameW(hInst).string();
-                // send process information to the logger server
-                log_attach();
+
+                auto timestamp = Utils::current_filetime();
+                auto exe_path = Win32::GetModuleFileNameW(nullptr);
+                g_filter_action = g_config.match(g_filter_payload, exe_path.native(), GetCommandLineW());
+                if (g_filter_action == FilterAction::Skip) {
+                    // never connect to the server, only propagate the hook to the children
+                    return;
+                }
+
+                auto& snapshot = g_attach_snapshot.emplace(AttachSnapshot{
+                    .timestamp = timestamp,
+                    .parent_pid = g_config.reported_ancestor_pid
+                                      ? g_config.reported_ancestor_pid
+                                      : NtDll::GetParentProcessId(),
+                    .exe_path = std::move(exe_path),
+                });
+                if (!g_filter_action) {
+                    snapshot.working_dir = Win32::GetCurrentDirectoryW();
+                    snapshot.env = Win32::GetEnvironmentStringsW();
+                    // filtered processes are not worth the overhead
+                    g_trace_files = g_config.trace_files;
+                }
+                // the thread only starts running after the loader lock is released, so it does not delay
+                //  the loading of the process, but the server usually learns about the process before its `main` runs
+                try {
+                    std::thread([] { logger(); }).detach();
+                } catch (const std::system_error&) {
+                    // the detours initialize the logger on first use
+                }
             });
 
             setup_detour(true);
+            // the worker thread only reads the timings after the loader lock is released
+            g_timings.attach = Utils::performance_counter() - attach_start;
             break;
+        }
 
         case DLL_PROCESS_DETACH:
             setup_detour(false);
+            // the hook is unloaded, or the process exits without going through the `ExitProcess` detour (e.g.,
+            //  `RtlExitUserProcess`); report the spawns since the last report. `g_logger` is used directly, the worker
+            //  thread may have been terminated without finishing the `call_once` in `logger()`. On exit, this is best
+            //  effort: the other threads are gone, so an `AsyncSink` only queues the message.
+            if (g_attach_logged && !g_exit_logged.exchange(true)) {
+                Utils::catch_abort([] {
+                    log_hook_timings(*g_logger);
+                });
+            }
             break;
 
         default:
@@ -0,0 +1,552 @@
+// Linux counterpart of `lib.cpp`, loaded into traced processes through `LD_PRELOAD`.
+//
+// On Linux, a traced process is a program image: each successful `execve` reports a new start, with the replaced
+//  image (same PID) as its parent. All images executed in a process share a single server connection, which is
+//  handed over through `CONNECTION_VAR`, so the messages stay ordered and the server only sees the connection
+//  close when the process actually exits. Forked children report themselves lazily, since most of them immediately
+//  execute another program, which reports itself instead.
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "LoggerClient.hpp"
+#include "Posix.hpp"
+#include "Protocol.hpp"
+#include "UnixSocketWriter.hpp"
+#include "Utils.hpp"
+
+constexpr auto SERVER_PIPE_NAME = "SpawnCamper";
+/// `<fd>:<protocol version>` of the server connection inherited from the previous image of the process.
+constexpr std::string_view CONNECTION_VAR = "SPAWNCAMPER_FD";
+constexpr std::string_view PRELOAD_VAR = "LD_PRELOAD";
+
+extern char** environ;
+
+/// Path of this library, kept in `LD_PRELOAD` of new images.
+static std::string g_hook_path;
+static std::unique_ptr<LoggerClient> g_logger;
+/// Sink of `g_logger`, used to hand over the connection on `execve`.
+static UnixSocketWriter* g_connection = nullptr;
+/// PID of the process that owns the state above; a `vfork` child shares our memory, but must not touch it.
+static pid_t g_owner_pid = 0;
+/// Set in a forked child until it reports itself; protected by `g_state_mutex`.
+static bool g_start_pending = false;
+static std::mutex g_state_mutex;
+static std::atomic<bool> g_exit_logged = false;
+/// Time spent by the hook in this image, reported once the start is reported, and again before it exits or executes
+///  another image; `spawn_latency` and the spawns are Windows-only.
+static LoggerClient::HookTimings g_timings;
+
+namespace Real {
+    /// Returns the next definition of `fn_name` after this library. The functions are resolved lazily, since other
+    ///  libraries may call them from their constructors before ours runs.
+    template<typename FnT>
+    static FnT* next(const char* fn_name) {
+        auto fn = (FnT*)dlsym(RTLD_NEXT, fn_name);
+        if (!fn) std::abort();
+        return fn;
+    }
+
+    using MainFn = int (*)(int, char**, char**);
+    using LibcStartMainFn = int(MainFn, int, char**, void (*)(), void (*)(), void (*)(), void*);
+
+    static int execve(const char* path, char* const argv[], char* const envp[]) {
+        static auto fn = next<decltype(::execve)>("execve");
+        return fn(path, argv, envp);
+    }
+
+    static int execvpe(const char* file, char* const argv[], char* const envp[]) {
+        static auto fn = next<decltype(::execvpe)>("execvpe");
+        return fn(file, argv, envp);
+    }
+
+    static int posix_spawn(pid_t* pid, const char* path, const posix_spawn_file_actions_t* file_actions,
+                           const posix_spawnattr_t* attrp, char* const argv[], char* const envp[]) {
+        static auto fn = next<decltype(::posix_spawn)>("posix_spawn");
+        return fn(pid, path, file_actions, attrp, argv, envp);
+    }
+
+    static int posix_spawnp(pid_t* pid, const char* file, const posix_spawn_file_actions_t* file_actions,
+                            const posix_spawnattr_t* attrp, char* const argv[], char* const envp[]) {
+        static auto fn = next<decltype(::posix_spawnp)>("posix_spawnp");
+        return fn(pid, file, file_actions, attrp, argv, envp);
+    }
+
+    [[noreturn]] static void exit(int status) {
+        static auto fn = next<decltype(::exit)>("exit");
+        fn(status);
+        std::unreachable();
+    }
+
+    [[noreturn]] static void _exit(int status) {
+        static auto fn = next<decltype(::_exit)>("_exit");
+        fn(status);
+        std::unreachable();
+    }
+
+    [[noreturn]] static void _Exit(int status) {
+        static auto fn = next<decltype(::_Exit)>("_Exit");
+        fn(status);
+        std::unreachable();
+    }
+
+    static int libc_start_main(MainFn main, int argc, char** argv, void (*init)(), void (*fini)(),
+                               void (*rtld_fini)(), void* stack_end) {
+        static auto fn = next<LibcStartMainFn>("__libc_start_main");
+        return fn(main, argc, argv, init, fini, rtld_fini, stack_end);
+    }
+}
+
+static bool owns_state() {
+    return getpid() == g_owner_pid;
+}
+
+static bool is_var(std::string_view entry, std::string_view name) {
+    return entry.starts_with(name) && entry.size() > name.size() && entry[name.size()] == '=';
+}
+
+/// `LD_PRELOAD` entries are separated by colons or spaces.
+static bool contains_library(std::string_view preload, std::string_view library) {
+    while (!preload.empty()) {
+        auto end = preload.find_first_of(": ");
+        if (preload.substr(0, end) == library) {
+            return true;
+        }
+        preload = end == preload.npos ? std::string_view{} : preload.substr(end + 1);
+    }
+    return false;
+}
+
+/// Environment of a new program image. Keeps this library in `LD_PRELOAD` (programs like `env -i` clear it) and
+///  optionally passes our server connection to the new image.
+class ChildEnvironment {
+    std::vector<std::string> m_entries{};
+    std::vector<char*> m_pointers{};
+
+public:
+    ChildEnvironment(char* const* envp, UnixSocketWriter* connection) {
+        auto preload = std::string{};
+        for (auto it = envp; it && *it; it++) {
+            auto entry = std::string_view(*it);
+            if (is_var(entry, CONNECTION_VAR)) {
+                continue;
+            }
+            if (is_var(entry, PRELOAD_VAR)) {
+                preload = entry.substr(PRELOAD_VAR.size() + 1);
+                continue;
+            }
+            m_entries.emplace_back(entry);
+        }
+
+        if (!g_hook_path.empty() && !contains_library(preload, g_hook_path)) {
+            preload = preload.empty() ? g_hook_path : g_hook_path + ":" + preload;
+        }
+        if (!preload.empty()) {
+            m_entries.push_back(std::string(PRELOAD_VAR) + "=" + preload);
+        }
+        if (connection) {
+            m_entries.push_back(std::string(CONNECTION_VAR) + "=" + std::to_string(connection->fd()) + ":"
+                                + std::to_string(connection->protocol_version()));
+        }
+
+        m_pointers.reserve(m_entries.size() + 1);
+        for (auto& entry : m_entries) {
+            m_pointers.push_back(entry.data());
+        }
+        m_pointers.push_back(nullptr);
+    }
+
+    char* const* get() {
+        return m_pointers.data();
+    }
+};
+
+/// Executes a new program image from a `vfork` child, which shares the memory of its parent and must not allocate:
+///  the parent may have been in the middle of `malloc`, or another of its threads may hold the allocator lock. The
+///  environment is passed through if it already preloads this library; otherwise, it is rebuilt on the stack,
+///  unless it does not fit, in which case the new image may not be traced.
+static int exec_vfork_child(char* const* envp, auto exec_fn) {
+    static constexpr size_t MAX_ENTRIES = 2048;
+    static constexpr size_t MAX_PRELOAD = 4096;
+
+    char* entries[MAX_ENTRIES + 2];
+    size_t count = 0;
+    char* preload_entry = nullptr;
+    auto changed = false;
+    for (auto it = envp; it && *it; it++) {
+        auto entry = std::string_view(*it);
+        if (is_var(entry, CONNECTION_VAR)) {
+            changed = true;
+            continue;
+        }
+        if (is_var(entry, PRELOAD_VAR)) {
+            preload_entry = *it;
+            continue;
+        }
+        if (count == MAX_ENTRIES) {
+            return exec_fn(envp);
+        }
+        entries[count++] = *it;
+    }
+
+    char preload[MAX_PRELOAD];
+    auto old_preload = preload_entry ? std::string_view(preload_entry).substr(PRELOAD_VAR.size() + 1) : "";
+    if (g_hook_path.empty() || contains_library(old_preload, g_hook_path)) {
+        if (!changed) {
+            return exec_fn(envp);
+        }
+        if (preload_entry) {
+            entries[count++] = preload_entry;
+        }
+    } else {
+        // `LD_PRELOAD=<hook>[:<old value>]`
+        auto separator = old_preload.empty() ? "" : ":";
+        auto parts = {PRELOAD_VAR, std::string_view("="), std::string_view(g_hook_path), std::string_view(separator),
+                      old_preload};
+        size_t size = 0;
+        for (auto part : parts) {
+            if (size + part.size() >= MAX_PRELOAD) {
+                return exec_fn(envp);
+            }
+            memcpy(preload + size, part.data(), part.size());
+            size += part.size();
+        }
+        preload[size] = '\0';
+        entries[count++] = preload;
+    }
+    entries[count] = nullptr;
+    return exec_fn(entries);
+}
+
+/// Joins the null-separated arguments from `/proc/self/cmdline` into a command line, quoting them like a shell would.
+static std::string format_command_line(std::string_view args) {
+    auto result = std::string{};
+    while (!args.empty()) {
+        auto arg = args.substr(0, args.find('\0'));
+        args = args.substr(std::min(arg.size() + 1, args.size()));
+
+        if (!result.empty()) {
+            result += ' ';
+        }
+        if (!arg.empty() && arg.find_first_of(" \t\n\"'\\$`*?[]{}()<>|&;#~") == arg.npos) {
+            result += arg;
+            continue;
+        }
+        result += '\'';
+        for (auto c : arg) {
+            if (c == '\'') result += R"('\'')";
+            else result += c;
+        }
+        result += '\'';
+    }
+    return result;
+}
+
+/// Converts `environ` to an environment block, which is what the server expects.
+static std::string environment_block() {
+    auto block = std::string{};
+    for (auto it = environ; it && *it; it++) {
+        block += *it;
+        block += '\0';
+    }
+    return block;
+}
+
+static void log_start(pid_t parent_pid) {
+    // the strings are sent as UTF-8, the serializer converts them to UTF-16 for servers that only support version 1
+    auto exe_path = Posix::readlink("/proc/self/exe");
+    auto cmd_line = format_command_line(Posix::read_file("/proc/self/cmdline"));
+    auto working_dir = std::string{};
+    try {
+        working_dir = Posix::getcwd();
+    } catch (const Posix::PosixError&) {
+        // the working directory was deleted
+    }
+    auto env = environment_block();
+    g_logger->log_new_process<char>(
+        (uint32_t)parent_pid, exe_path.c_str(), cmd_line.c_str(), working_dir.c_str(), env.c_str());
+}
+
+static void connect(std::unique_ptr<UnixSocketWriter> sink) {
+    g_connection = sink.get();
+    g_logger = std::make_unique<LoggerClient>(std::move(sink));
+}
+
+/// Reports a forked child that did not execute another program, before it creates children or exits.
+static void report_pending_start() {
+    std::lock_guard lock(g_state_mutex);
+    if (!g_start_pending) {
+        return;
+    }
+    g_start_pending = false;
+    auto connect_start = Utils::performance_counter();
+    connect(std::make_unique<UnixSocketWriter>(UnixSocketWriter::server_path(SERVER_PIPE_NAME)));
+    auto start = Utils::performance_counter();
+    log_start(getppid());
+    g_timings = {.connect = start - connect_start, .log_attach = Utils::performance_counter() - start};
+    g_logger->log_hook_timings(g_timings, {});
+}
+
+static void log_exit(int exit_code) {
+    if (!owns_state() || g_exit_logged.exchange(true)) {
+        return;
+    }
+    report_pending_start();
+    if (g_logger) {
+        g_logger->log_hook_timings(g_timings, {});
+        g_logger->log_ExitProcess((uint32_t)exit_code);
+    }
+}
+
+/// Executes a new program image in this process using `exec_fn`, handing over our server connection to it.
+static int exec_image(char* const* envp, auto exec_fn) {
+    // in a `vfork` child or a forked child that did not report itself, the connection belongs to the parent and the
+    //  new image connects by itself
+    if (!owns_state()) {
+        return exec_vfork_child(envp, exec_fn);
+    }
+    if (g_start_pending || !g_logger) {
+        auto env = ChildEnvironment(envp, nullptr);
+        return exec_fn(env.get());
+    }
+
+    // the final timings of this image; if the exec fails, they are reported again later, which is harmless, since
+    //  the totals are cumulative
+    g_logger->log_hook_timings(g_timings, {});
+    // no other thread may be in the middle of writing a message when the new image takes over the connection
+    return g_logger->with_lock([&] {
+        auto connection = g_connection->connected() ? g_connection : nullptr;
+        auto env = ChildEnvironment(envp, connection);
+        if (!connection) {
+            return exec_fn(env.get());
+        }
+        auto fd = connection->fd();
+
+        // close-on-exec is only cleared for the duration of the call, so that the connection does not leak
+        //  into processes spawned by other threads
+        ::fcntl(fd, F_SETFD, 0);
+        auto result = exec_fn(env.get());
+        // the exec failed, the connection stays with this image
+        auto error = errno;
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+        errno = error;
+        return result;
+    });
+}
+
+/// Collects the arguments of the `execl*` functions into an argv array.
+static std::vector<char*> collect_args(const char* arg0, va_list args) {
+    auto argv = std::vector<char*>{(char*)arg0};
+    while (argv.back() != nullptr) {
+        argv.push_back(va_arg(args, char*));
+    }
+    return argv;
+}
+
+// the interposed functions; the signatures (including `noexcept` where glibc declares them `__THROW`) must match
+//  the glibc headers
+extern "C" {
+    int execve(const char* path, char* const argv[], char* const envp[]) noexcept {
+        return Utils::catch_abort([&] {
+            return exec_image(envp, [&](char* const* env) {
+                return Real::execve(path, argv, env);
+            });
+        });
+    }
+
+    int execvpe(const char* file, char* const argv[], char* const envp[]) noexcept {
+        return Utils::catch_abort([&] {
+            return exec_image(envp, [&](char* const* env) {
+                return Real::execvpe(file, argv, env);
+            });
+        });
+    }
+
+    // glibc implements the other variants by calling `execve` internally, which bypasses `LD_PRELOAD`
+
+    int execv(const char* path, char* const argv[]) noexcept {
+        return execve(path, argv, environ);
+    }
+
+    int execvp(const char* file, char* const argv[]) noexcept {
+        return execvpe(file, argv, environ);
+    }
+
+    int execl(const char* path, const char* arg, ...) noexcept {
+        va_list args;
+        va_start(args, arg);
+        auto argv = collect_args(arg, args);
+        va_end(args);
+        return execve(path, argv.data(), environ);
+    }
+
+    int execlp(const char* file, const char* arg, ...) noexcept {
+        va_list args;
+        va_start(args, arg);
+        auto argv = collect_args(arg, args);
+        va_end(args);
+        return execvpe(file, argv.data(), environ);
+    }
+
+    int execle(const char* path, const char* arg, ...) noexcept {
+        va_list args;
+        va_start(args, arg);
+        auto argv = collect_args(arg, args);
+        // the environment follows the terminating null argument
+        auto envp = va_arg(args, char* const*);
+        va_end(args);
+        return execve(path, argv.data(), envp);
+    }
+
+    int posix_spawn(pid_t* pid, const char* path, const posix_spawn_file_actions_t* file_actions,
+                    const posix_spawnattr_t* attrp, char* const argv[], char* const envp[]) {
+        return Utils::catch_abort([&] {
+            // the new process connects by itself, it just needs to know its parent
+            report_pending_start();
+            auto env = ChildEnvironment(envp, nullptr);
+            return Real::posix_spawn(pid, path, file_actions, attrp, argv, env.get());
+        });
+    }
+
+    int posix_spawnp(pid_t* pid, const char* file, const posix_spawn_file_actions_t* file_actions,
+                     const posix_spawnattr_t* attrp, char* const argv[], char* const envp[]) {
+        return Utils::catch_abort([&] {
+            report_pending_start();
+            auto env = ChildEnvironment(envp, nullptr);
+            return Real::posix_spawnp(pid, file, file_actions, attrp, argv, env.get());
+        });
+    }
+
+    void exit(int status) noexcept {
+        Utils::catch_abort([&] {
+            log_exit(status);
+        });
+        Real::exit(status);
+    }
+
+    void _exit(int status) {
+        Utils::catch_abort([&] {
+            log_exit(status);
+        });
+        Real::_exit(status);
+    }
+
+    void _Exit(int status) noexcept {
+        Utils::catch_abort([&] {
+            log_exit(status);
+        });
+        Real::_Exit(status);
+    }
+}
+
+static Real::MainFn g_main;
+
+static int traced_main(int argc, char** argv, char** envp) {
+    auto exit_code = g_main(argc, argv, envp);
+    // when `main` returns, libc calls `exit` internally, which does not go through our interposed `exit`
+    Utils::catch_abort([&] {
+        log_exit(exit_code);
+    });
+    return exit_code;
+}
+
+extern "C" int __libc_start_main(Real::MainFn main, int argc, char** argv, void (*init)(), void (*fini)(),
+                                 void (*rtld_fini)(), void* stack_end) {
+    g_main = main;
+    return Real::libc_start_main(traced_main, argc, argv, init, fini, rtld_fini, stack_end);
+}
+
+static void before_fork() {
+    // a forked child that forks again must report itself first, otherwise its children would have no parent
+    Utils::catch_abort([] {
+        report_pending_start();
+    });
+    g_state_mutex.lock();
+}
+
+static void after_fork_parent() {
+    g_state_mutex.unlock();
+}
+
+static void after_fork_child() {
+    // the connection belongs to the parent; the logger is leaked instead of destroyed, since another thread
+    //  of the parent might have held its mutex during the fork
+    if (g_connection && g_connection->connected()) {
+        ::close(g_connection->fd());
+    }
+    (void)g_logger.release();
+    g_connection = nullptr;
+    g_owner_pid = getpid();
+    g_start_pending = true;
+    g_exit_logged = false;
+    g_state_mutex.unlock();
+}
+
+/// Takes over the server connection of the image that executed us, returns `nullptr` if there is none.
+static std::unique_ptr<UnixSocketWriter> take_inherited_connection() {
+    auto value = getenv(CONNECTION_VAR.data());
+    if (!value) {
+        return nullptr;
+    }
+    char* end;
+    auto fd = (int)strtol(value, &end, 10);
+    auto version = *end == ':' ? (uint32_t)strtoul(end + 1, nullptr, 10) : 1;
+    // hide the variable from the traced program and its children
+    unsetenv(CONNECTION_VAR.data());
+
+    struct stat info{};
+    if (fd < 0 || ::fstat(fd, &info) != 0 || !S_ISSOCK(info.st_mode)) {
+        return nullptr;
+    }
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return std::make_unique<UnixSocketWriter>(fd, std::clamp(version, 1u, Protocol::MAX_VERSION));
+}
+
+static void attach() {
+    Utils::catch_abort([] {
+        auto attach_start = Utils::performance_counter();
+        Dl_info info{};
+        if (dladdr((void*)&attach, &info) && info.dli_fname) {
+            g_hook_path = info.dli_fname;
+        }
+        g_owner_pid = getpid();
+        pthread_atfork(before_fork, after_fork_parent, after_fork_child);
+
+        auto parent_pid = getppid();
+        auto connect_start = Utils::performance_counter();
+        if (auto connection = take_inherited_connection()) {
+            connect(std::move(connection));
+            // we replaced a traced image of this process, which the server tracks as our parent
+            parent_pid = getpid();
+        } else {
+            connect(std::make_unique<UnixSocketWriter>(UnixSocketWriter::server_path(SERVER_PIPE_NAME)));
+        }
+        // send process information to the logger server
+        auto start = Utils::performance_counter();
+        log_start(parent_pid);
+        auto end = Utils::performance_counter();
+        g_timings = {
+            .attach = connect_start - attach_start, .connect = start - connect_start, .log_attach = end - start,
+        };
+        // reported right away, so that the overhead of processes that are killed is known as well
+        g_logger->log_hook_timings(g_timings, {});
+    });
+}
+
+// a static initializer instead of `__attribute__((constructor))`, which could run before the globals above
+//  are initialized; initializers within a translation unit run in order
+[[maybe_unused]] static const auto g_attached = (attach(), true);
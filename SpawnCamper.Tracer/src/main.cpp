@@ -1,77 +1,200 @@
 #include <Windows.h>
 #include <detours.h>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <filesystem>
+#include <optional>
 
+#include "CommandLine.hpp"
+#include "HookConfig.hpp"
+#include "LoggerClient.hpp"
+#include "NamedPipeWriter.hpp"
+#include "Payloads.hpp"
+#include "ProcessFilter.hpp"
+#include "Protocol.hpp"
+#include "TraceFileWriter.hpp"
 #include "Utils.hpp"
 #include "Win32.hpp"
 
 constexpr auto SERVER_PIPE_NAME = LR"(\\.\pipe\SpawnCamper)";
 
-static const wchar_t* find_argv1(const wchar_t* cmd_line) {
-    // https://learn.microsoft.com/en-us/cpp/c-language/parsing-c-command-line-arguments?view=msvc-170
-    // The first argument (argv[0]) is treated specially. It represents the program name. Because it
-    // must be a valid pathname, parts surrounded by double quote marks (") are allowed. The double
-    // quote marks aren't included in the argv[0] output. The parts surrounded by double quote marks
-    // prevent interpretation of a space or tab character as the end of the argument.
-
-    // CommandLineToArgvW treats whitespace outside of quotation marks as argument delimiters.
-    // However, if lpCmdLine starts with any amount of whitespace, CommandLineToArgvW will consider
-    // the first argument to be an empty string. Excess whitespace at the end of lpCmdLine is ignored.
-
-    // find the end of argv[0]
-    auto inside_quotes = false;
-    auto it = cmd_line;
-    for (; *it != 0; it++) {
-        if (*it == L'"') {
-            inside_quotes = !inside_quotes;
-            continue;
-        }
-        if (!inside_quotes && (*it == L' ' || *it == L'\t')) {
-            // found the end
-            break;
-        }
+[[noreturn]] static void usage_error(const std::string& message) {
+    std::cerr << "ERROR: " << message << "\n";
+    exit(1);
+}
+
+static OverflowPolicy parse_overflow_policy(std::wstring_view value) {
+    if (value == L"block") return OverflowPolicy::Block;
+    if (value == L"drop-newest") return OverflowPolicy::DropNewest;
+    if (value == L"drop-oldest") return OverflowPolicy::DropOldest;
+    usage_error("invalid overflow policy, expected one of 'block', 'drop-newest', 'drop-oldest'");
+}
+
+static Transport parse_transport(std::wstring_view value) {
+    if (value == L"pipe") return Transport::Pipe;
+    if (value == L"shm") return Transport::SharedMemory;
+    usage_error("invalid transport, expected one of 'pipe', 'shm'");
+}
+
+static FilterAction parse_filter_action(std::wstring_view value) {
+    if (value == L"minimal") return FilterAction::Minimal;
+    if (value == L"skip") return FilterAction::Skip;
+    usage_error("invalid filter mode, expected one of 'minimal', 'skip'");
+}
+
+static uint32_t parse_uint(std::wstring_view value, bool allow_zero = false) {
+    auto str = std::wstring(value);
+    wchar_t* end = nullptr;
+    auto result = wcstoul(str.c_str(), &end, 10);
+    if (str.empty() || *end != 0 || (result == 0 && !allow_zero)) {
+        usage_error(std::string(allow_zero ? "expected a non-negative integer: " : "expected a positive integer: ")
+                    + std::filesystem::path(str).string());
     }
+    return (uint32_t)result;
+}
+
+struct TracerOptions {
+    HookConfig config{};
+    /// If set, messages are recorded into this trace file instead of being sent to the server.
+    std::optional<std::filesystem::path> record_path{};
+    uint64_t record_size_mib = 1024;
+    ProcessFilter filter{};
+};
 
-    // skip whitespace before the first arg
-    while (*it != 0 && (*it == L' ' || *it == L'\t')) it++;
+/// Parses tracer options (`--name[=value]`) preceding the traced command, returns the rest of the command line.
+static const wchar_t* parse_options(const wchar_t* args, TracerOptions& options) {
+    auto& config = options.config;
+    while (args[0] == L'-' && args[1] == L'-') {
+        auto end = CommandLine::find_arg_end(args);
+        auto arg = std::wstring_view(args, end - args);
+        args = CommandLine::skip_whitespace(end);
 
-    return it;
+        if (arg == L"--") {
+            break;
+        }
+
+        auto eq_i = arg.find(L'=');
+        auto name = arg.substr(0, eq_i);
+        auto value = eq_i == arg.npos ? std::wstring_view{} : arg.substr(eq_i + 1);
+        if (name == L"--async") {
+            config.async = true;
+            if (!value.empty()) {
+                config.overflow_policy = parse_overflow_policy(value);
+            }
+        } else if (name == L"--transport") {
+            config.transport = parse_transport(value);
+        } else if (name == L"--queue-size") {
+            config.queue_capacity = parse_uint(value);
+        } else if (name == L"--record") {
+            // the path may be quoted, as in `"--record=C:\some dir\trace.bin"`
+            auto path = std::wstring(value);
+            std::erase(path, L'"');
+            if (path.empty()) {
+                usage_error("expected a path: --record=<file>");
+            }
+            options.record_path = path;
+        } else if (name == L"--record-size") {
+            options.record_size_mib = parse_uint(value);
+        } else if (name == L"--filter-exe") {
+            if (value.empty()) usage_error("expected a glob: --filter-exe=<glob>");
+            options.filter.add_exe_glob(value);
+        } else if (name == L"--filter-cmdline") {
+            if (value.empty()) usage_error("expected a substring: --filter-cmdline=<substring>");
+            options.filter.add_command_line(value);
+        } else if (name == L"--filter-mode") {
+            config.filter_action = parse_filter_action(value);
+        } else if (name == L"--max-depth") {
+            config.max_depth = parse_uint(value, true);
+        } else if (name == L"--trace-files") {
+            config.trace_files = true;
+        } else {
+            usage_error("unknown option: " + std::filesystem::path(arg).string());
+        }
+    }
+    return args;
 }
 
 void real_main() {
-    if (GetFileAttributesW(SERVER_PIPE_NAME) == INVALID_FILE_ATTRIBUTES && GetLastError() == ERROR_FILE_NOT_FOUND) {
+    auto orig_cmdline = ::GetCommandLineW();
+    auto options = TracerOptions{};
+    // skip argv[0] and our options, the rest of the command line is invoked as a new process
+    auto args = std::wstring(parse_options(CommandLine::find_argv1(orig_cmdline), options));
+
+    if (args.empty()) {
+        usage_error("command to run not specified");
+    }
+
+    auto recording = std::optional<TraceFileRecording>{};
+    if (options.record_path) {
+        // the hooks append directly to the trace file, the server does not need to run
+        recording.emplace(*options.record_path, options.record_size_mib << 20, Protocol::MAX_VERSION);
+        options.config.recorder_pid = GetCurrentProcessId();
+    } else if (GetFileAttributesW(SERVER_PIPE_NAME) == INVALID_FILE_ATTRIBUTES
+               && GetLastError() == ERROR_FILE_NOT_FOUND) {
         std::cerr << "Could not connect to the SpawnCamper server (UI). Is it running?\n";
         exit(1);
+    } else {
+        options.config.protocol_version = NamedPipeWriter::probe_protocol_version(SERVER_PIPE_NAME);
+        if (options.config.trace_files && options.config.protocol_version < 2) {
+            std::cerr << "WARNING: the server is too old to receive file accesses, --trace-files is ignored\n";
+        }
     }
 
+    // the tracer watches the root like the hooks watch their children, the root may be killed before its hook
+    //  reports the exit; `Messages::ChildExit` requires protocol version 2
+    auto exit_logger = std::optional<LoggerClient>{};
+    if (recording) {
+        exit_logger.emplace(std::make_unique<TraceFileWriter>(GetCurrentProcessId()));
+    } else if (options.config.protocol_version >= 2) {
+        exit_logger.emplace(std::make_unique<NamedPipeWriter>(SERVER_PIPE_NAME, options.config.protocol_version));
+    }
+    options.config.exit_watched = exit_logger && exit_logger->connected() && exit_logger->protocol_version() >= 2;
+
     auto exe_path = Win32::GetModuleFileNameW();
     exe_path.replace_filename(L"hook64.dll");
     // Detours takes a `char*` even in the W variant
     auto dll_path_str = exe_path.string();
 
-    auto orig_cmdline = ::GetCommandLineW();
-    // skip argv[0], the rest of the command line is invoked as a new process
-    auto args = std::wstring(find_argv1(orig_cmdline));
-
-    if (args.empty()) {
-        std::cerr << "ERROR: command to run not specified\n";
-        exit(1);
-    }
-
     auto startup_info = STARTUPINFO{sizeof(STARTUPINFO)};
     auto process_info = PROCESS_INFORMATION{};
+    options.config.spawn_counter = Utils::performance_counter();
     auto success = DetourCreateProcessWithDllExW(
         nullptr, args.data(),
-        nullptr, nullptr, false, 0, nullptr, nullptr,
+        nullptr, nullptr, false, CREATE_SUSPENDED, nullptr, nullptr,
         &startup_info, &process_info, dll_path_str.c_str(), nullptr);
     if (!success) {
         throw Win32::Win32Error{"DetourCreateProcessWithDllExW"};
     }
 
+    // the hook reads the configuration when it's loaded, copy it before the process starts
+    if (!Payloads::copy_value(process_info.hProcess, Payloads::CONFIG_GUID, options.config)) {
+        throw Win32::Win32Error{"DetourCopyPayloadToProcess"};
+    }
+    if (!options.filter.empty()
+        && !Payloads::copy(process_info.hProcess, Payloads::FILTER_GUID, options.filter.serialize())) {
+        throw Win32::Win32Error{"DetourCopyPayloadToProcess"};
+    }
+    ResumeThread(process_info.hThread);
+
     Win32::WaitForSingleObject(process_info.hProcess);
-    ExitProcess(Win32::GetExitCodeProcess(process_info.hProcess));
+    auto exit_code = Win32::GetExitCodeProcess(process_info.hProcess);
+    FILETIME creation_time, exit_time, kernel_time, user_time;
+    if (options.config.exit_watched
+        && GetProcessTimes(process_info.hProcess, &creation_time, &exit_time, &kernel_time, &user_time)) {
+        exit_logger->log_child_exit(process_info.dwProcessId, exit_code,
+                                    (uint64_t)exit_time.dwHighDateTime << 32 | exit_time.dwLowDateTime);
+    }
+    // the writer maps the trace file, unmap it before the recording is finished
+    exit_logger.reset();
+    if (recording) {
+        if (auto dropped = recording->finish(); dropped > 0) {
+            std::cerr << "WARNING: trace file is full, " << dropped << " messages were dropped"
+                      << " (increase --record-size)\n";
+        }
+    }
+    ExitProcess(exit_code);
 }
 
 int main() {
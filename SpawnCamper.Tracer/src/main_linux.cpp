@@ -0,0 +1,72 @@
+// Linux counterpart of `main.cpp`, runs the command with the hook library in `LD_PRELOAD`.
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include "Posix.hpp"
+#include "UnixSocketWriter.hpp"
+#include "Utils.hpp"
+
+constexpr auto SERVER_PIPE_NAME = "SpawnCamper";
+
+[[noreturn]] static void usage_error(const std::string& message) {
+    std::cerr << "ERROR: " << message << "\n";
+    exit(1);
+}
+
+static int real_main(int argc, char** argv) {
+    auto args = argv + 1;
+    if (args != argv + argc && std::string_view(*args) == "--") {
+        args++;
+    } else if (args != argv + argc && std::string_view(*args).starts_with("--")) {
+        // the tracer options are passed to the hook through Detours payloads, which have no Linux counterpart yet
+        usage_error("tracer options are not supported on Linux: " + std::string(*args));
+    }
+    if (args == argv + argc) {
+        usage_error("command to run not specified");
+    }
+
+    struct stat info{};
+    auto server_path = UnixSocketWriter::server_path(SERVER_PIPE_NAME);
+    if (::stat(server_path.c_str(), &info) != 0 || !S_ISSOCK(info.st_mode)) {
+        std::cerr << "Could not connect to the SpawnCamper server (" << server_path << "). Is it running?\n";
+        exit(1);
+    }
+
+    auto hook_path = std::filesystem::path(Posix::readlink("/proc/self/exe")).replace_filename("libhook.so");
+
+    auto pid = ::fork();
+    if (pid < 0) {
+        throw Posix::PosixError{"fork"};
+    }
+    if (pid == 0) {
+        auto preload = hook_path.string();
+        if (auto existing = getenv("LD_PRELOAD"); existing && *existing) {
+            preload += ":" + std::string(existing);
+        }
+        setenv("LD_PRELOAD", preload.c_str(), 1);
+        execvp(args[0], args);
+        perror("SpawnCamper ERROR: execvp");
+        _exit(127);
+    }
+
+    int status;
+    while (::waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            throw Posix::PosixError{"waitpid"};
+        }
+    }
+    // mirror the exit status of the traced command, like a shell does
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+int main(int argc, char** argv) {
+    return Utils::catch_abort([&] {
+        return real_main(argc, argv);
+    });
+}
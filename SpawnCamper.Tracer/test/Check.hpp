@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+/// Assertion for the tests, which do not use a test framework. Unlike `assert`, it is also checked in release builds;
+///  the test exits with a non-zero code on the first failure, which `ctest` reports.
+#define CHECK(cond)                                                                                                    \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);                             \
+            std::exit(1);                                                                                              \
+        }                                                                                                              \
+    } while (0)
@@ -0,0 +1,263 @@
+// Tests of the queue behind `--async`: `BoundedQueue` with concurrent producers and consumers, and `AsyncSink` with
+//  each `OverflowPolicy`, a server that stops reading (the inner sink blocks) and replies read by the writer thread.
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "AsyncSink.hpp"
+#include "BoundedQueue.hpp"
+#include "Check.hpp"
+#include "MessageSink.hpp"
+#include "Protocol.hpp"
+
+static constexpr auto TEST_TIMEOUT = std::chrono::seconds(30);
+
+static void wait_until(auto&& condition) {
+    auto deadline = std::chrono::steady_clock::now() + TEST_TIMEOUT;
+    while (!condition()) {
+        CHECK(std::chrono::steady_clock::now() < deadline);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+static uint32_t message_id(uint32_t producer, uint32_t sequence) {
+    return producer << 20 | sequence;
+}
+
+/// Inner sink standing in for the connection to the server; writes block while `blocked` is set.
+class TestSink final : public MessageSink {
+    std::mutex m_mutex;
+    std::vector<uint32_t> m_messages;
+    std::optional<std::array<std::byte, Protocol::ENVIRONMENT_REPLY_SIZE>> m_reply;
+
+public:
+    std::atomic<bool> blocked{false};
+    std::atomic<uint32_t> writes_started{0};
+    std::atomic<bool> replies_read_on_caller{false};
+    std::thread::id caller = std::this_thread::get_id();
+
+    void write(std::span<const std::span<const std::byte>> chunks) override {
+        writes_started++;
+        while (blocked) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        CHECK(chunks.size() == 1 && chunks[0].size() == sizeof(uint32_t));
+        uint32_t id;
+        memcpy(&id, chunks[0].data(), sizeof(id));
+        std::unique_lock lock(m_mutex);
+        m_messages.push_back(id);
+    }
+
+    bool receives_replies() override {
+        return true;
+    }
+
+    bool read_reply(std::span<std::byte> reply) override {
+        if (std::this_thread::get_id() == caller) {
+            replies_read_on_caller = true;
+        }
+        std::unique_lock lock(m_mutex);
+        if (!m_reply || reply.size() != m_reply->size()) {
+            return false;
+        }
+        memcpy(reply.data(), m_reply->data(), reply.size());
+        m_reply.reset();
+        return true;
+    }
+
+    void send_reply(std::byte tag) {
+        std::unique_lock lock(m_mutex);
+        m_reply.emplace();
+        m_reply->fill(tag);
+    }
+
+    std::vector<uint32_t> messages() {
+        std::unique_lock lock(m_mutex);
+        return m_messages;
+    }
+};
+
+static void write_id(MessageSink& sink, uint32_t id) {
+    auto chunk = std::as_bytes(std::span{&id, 1});
+    sink.write({&chunk, 1});
+}
+
+/// Values of each producer are popped in the order they were pushed, and each exactly once.
+static void test_queue(uint32_t producers, uint32_t consumers) {
+    static constexpr uint32_t VALUES_PER_PRODUCER = 100000;
+    auto queue = BoundedQueue<uint32_t>(64);
+    auto popped = std::vector<std::atomic<uint32_t>>(producers);
+    auto remaining = std::atomic<uint64_t>{(uint64_t)producers * VALUES_PER_PRODUCER};
+    auto threads = std::vector<std::thread>{};
+    for (uint32_t producer = 0; producer < producers; producer++) {
+        threads.emplace_back([&, producer] {
+            for (uint32_t sequence = 0; sequence < VALUES_PER_PRODUCER; sequence++) {
+                while (!queue.try_push([&](uint32_t& value) { value = message_id(producer, sequence); })) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (uint32_t consumer = 0; consumer < consumers; consumer++) {
+        threads.emplace_back([&] {
+            while (remaining > 0) {
+                auto value = uint32_t{};
+                if (!queue.try_pop([&](uint32_t& v) { value = v; })) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                auto producer = value >> 20;
+                CHECK(producer < producers);
+                if (consumers == 1) {
+                    CHECK((value & 0xfffff) == popped[producer]);
+                }
+                popped[producer]++;
+                remaining--;
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (auto& count : popped) {
+        CHECK(count == VALUES_PER_PRODUCER);
+    }
+    CHECK(!queue.try_pop([](uint32_t&) {}));
+}
+
+/// Several threads write through the sink while the server is slow; every message is either written or counted as
+///  dropped, and the messages of each thread keep their order.
+static void test_producers(OverflowPolicy policy) {
+    static constexpr uint32_t PRODUCERS = 4;
+    static constexpr uint32_t MESSAGES_PER_PRODUCER = 5000;
+    auto inner = std::make_unique<TestSink>();
+    auto& test_sink = *inner;
+    auto sink = AsyncSink(std::move(inner), policy, 8);
+    auto threads = std::vector<std::thread>{};
+    for (uint32_t producer = 0; producer < PRODUCERS; producer++) {
+        threads.emplace_back([&, producer] {
+            for (uint32_t sequence = 0; sequence < MESSAGES_PER_PRODUCER; sequence++) {
+                write_id(sink, message_id(producer, sequence));
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    CHECK(sink.drain(TEST_TIMEOUT));
+
+    auto messages = test_sink.messages();
+    auto next = std::array<uint32_t, PRODUCERS>{};
+    for (auto id : messages) {
+        auto producer = id >> 20;
+        CHECK(producer < PRODUCERS);
+        CHECK((id & 0xfffff) >= next[producer]);
+        next[producer] = (id & 0xfffff) + 1;
+    }
+    CHECK(messages.size() + sink.dropped_messages() == PRODUCERS * MESSAGES_PER_PRODUCER);
+    if (policy == OverflowPolicy::Block) {
+        CHECK(sink.dropped_messages() == 0);
+    }
+}
+
+/// With the writer thread stuck in a write, the queue fills up; the policy decides which messages are kept, or
+///  whether the caller waits until the server resumes reading.
+static void test_overflow(OverflowPolicy policy) {
+    static constexpr uint32_t CAPACITY = 8;
+    static constexpr uint32_t OVERFLOW = 5;
+    auto inner = std::make_unique<TestSink>();
+    auto& test_sink = *inner;
+    auto sink = AsyncSink(std::move(inner), policy, CAPACITY);
+    test_sink.blocked = true;
+    write_id(sink, 0);
+    wait_until([&] { return test_sink.writes_started == 1; });
+    auto unblock = std::thread{};
+    if (policy == OverflowPolicy::Block) {
+        unblock = std::thread([&] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            test_sink.blocked = false;
+        });
+    }
+    for (uint32_t id = 1; id <= CAPACITY + OVERFLOW; id++) {
+        write_id(sink, id);
+    }
+    if (unblock.joinable()) {
+        unblock.join();
+    }
+    test_sink.blocked = false;
+    CHECK(sink.drain(TEST_TIMEOUT));
+
+    auto expected = std::vector<uint32_t>{0};
+    auto kept = policy == OverflowPolicy::Block ? CAPACITY + OVERFLOW : CAPACITY;
+    auto first = policy == OverflowPolicy::DropOldest ? 1 + OVERFLOW : 1;
+    for (uint32_t id = first; id < first + kept; id++) {
+        expected.push_back(id);
+    }
+    CHECK(test_sink.messages() == expected);
+    CHECK(sink.dropped_messages() == (policy == OverflowPolicy::Block ? 0 : OVERFLOW));
+}
+
+/// If the queue is not written out in time, the queued messages are dropped, the exit record must not overtake them.
+static void test_drain_timeout() {
+    auto inner = std::make_unique<TestSink>();
+    auto& test_sink = *inner;
+    auto sink = AsyncSink(std::move(inner), OverflowPolicy::Block, 8);
+    test_sink.blocked = true;
+    write_id(sink, 0);
+    wait_until([&] { return test_sink.writes_started == 1; });
+    write_id(sink, 1);
+    write_id(sink, 2);
+    // the server resumes reading after the timeout, while `drain` waits for the write in progress
+    auto unblock = std::thread([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        test_sink.blocked = false;
+    });
+    CHECK(!sink.drain(std::chrono::milliseconds(10)));
+    unblock.join();
+    write_id(sink, 3);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    CHECK((test_sink.messages() == std::vector<uint32_t>{0, 3}));
+    CHECK(sink.dropped_messages() == 2);
+}
+
+/// Replies are read by the writer thread and handed over to the caller, which never touches the inner sink.
+static void test_replies() {
+    auto inner = std::make_unique<TestSink>();
+    auto& test_sink = *inner;
+    auto sink = AsyncSink(std::move(inner), OverflowPolicy::Block, 8);
+    auto reply = std::array<std::byte, Protocol::ENVIRONMENT_REPLY_SIZE>{};
+    CHECK(sink.receives_replies() && !sink.read_reply(reply));
+
+    test_sink.send_reply(std::byte{7});
+    // the writer thread looks for replies after it writes out the queue
+    write_id(sink, 0);
+    wait_until([&] { return sink.read_reply(reply); });
+    CHECK(reply[0] == std::byte{7} && reply.back() == std::byte{7});
+    CHECK(!sink.read_reply(reply));
+    CHECK(!test_sink.replies_read_on_caller);
+
+    // once the writes are synchronous, replies are read directly
+    CHECK(sink.drain(TEST_TIMEOUT));
+    test_sink.send_reply(std::byte{8});
+    CHECK(sink.read_reply(reply) && reply[0] == std::byte{8});
+}
+
+int main() {
+    test_queue(4, 1);
+    test_queue(4, 2);
+    for (auto policy : {OverflowPolicy::Block, OverflowPolicy::DropNewest, OverflowPolicy::DropOldest}) {
+        test_producers(policy);
+        test_overflow(policy);
+    }
+    test_drain_timeout();
+    test_replies();
+    return 0;
+}
@@ -0,0 +1,164 @@
+// Tests the per-process table of accessed files: deduplication of paths ignoring ASCII case, counting of opens,
+//  growth while keeping the order of the first access, and splitting of the table into `FileAccesses` messages.
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Check.hpp"
+#include "FileAccessTable.hpp"
+#include "LoggerClient.hpp"
+#include "MessageSink.hpp"
+#include "Protocol.hpp"
+
+struct Row {
+    std::u16string path;
+    FileAccess access;
+    uint32_t opens;
+    uint32_t failed_opens;
+};
+
+static std::vector<Row> rows(const FileAccessTable<char16_t>& table) {
+    auto result = std::vector<Row>{};
+    table.for_each([&](std::u16string_view path, FileAccess access, uint32_t opens, uint32_t failed_opens) {
+        result.push_back({std::u16string(path), access, opens, failed_opens});
+    });
+    return result;
+}
+
+static std::u16string numbered_path(size_t i) {
+    auto path = std::u16string(u"C:\\src\\include\\header_");
+    for (auto c : std::to_string(i)) path += (char16_t)c;
+    return path + u".h";
+}
+
+static std::u16string to_upper(std::u16string str) {
+    for (auto& c : str) {
+        if (c >= u'a' && c <= u'z') c = (char16_t)(c - u'a' + u'A');
+    }
+    return str;
+}
+
+static void test_deduplication() {
+    auto table = FileAccessTable<char16_t>{};
+    CHECK(table.empty());
+    table.record_open(u"C:\\src\\Main.cpp", FileAccess::Read, true);
+    table.record_open(u"C:\\include\\missing.h", FileAccess::Read, false);
+    table.record_open(u"c:\\SRC\\main.CPP", FileAccess::Query, true);
+    table.record_open(u"C:\\include\\MISSING.h", FileAccess::Read, false);
+    table.record_open(u"C:\\out\\main.obj", FileAccess::Write, true);
+    table.record(u"C:\\OUT\\main.obj", FileAccess::RenamedFrom);
+    table.record(u"C:\\out\\tmp.obj", FileAccess::Delete);
+    // only ASCII letters are folded, like `ProcessFilter` does
+    table.record_open(u"C:\\\u00e9.h", FileAccess::Read, true);
+    table.record_open(u"C:\\\u00c9.h", FileAccess::Read, true);
+    // a prefix of a recorded path is a different path
+    table.record_open(u"C:\\src\\Main.cp", FileAccess::Read, true);
+
+    auto recorded = rows(table);
+    CHECK(table.size() == recorded.size() && recorded.size() == 7);
+    // in the order of the first access, with its spelling
+    CHECK(recorded[0].path == u"C:\\src\\Main.cpp");
+    CHECK(recorded[0].access == (FileAccess::Read | FileAccess::Query));
+    CHECK(recorded[0].opens == 2 && recorded[0].failed_opens == 0);
+    // failed opens do not record the access
+    CHECK(recorded[1].path == u"C:\\include\\missing.h");
+    CHECK(recorded[1].access == FileAccess::None && recorded[1].opens == 0 && recorded[1].failed_opens == 2);
+    CHECK(recorded[2].access == (FileAccess::Write | FileAccess::RenamedFrom) && recorded[2].opens == 1);
+    CHECK(recorded[3].path == u"C:\\out\\tmp.obj");
+    CHECK(recorded[3].access == FileAccess::Delete && recorded[3].opens == 0);
+    CHECK(recorded[4].path == u"C:\\\u00e9.h" && recorded[5].path == u"C:\\\u00c9.h");
+    CHECK(recorded[6].path == u"C:\\src\\Main.cp");
+}
+
+static void test_growth() {
+    // enough paths for the slot array to grow several times
+    constexpr size_t COUNT = 5000;
+    auto table = FileAccessTable<char16_t>{};
+    for (size_t i = 0; i < COUNT; i++) {
+        table.record_open(numbered_path(i), FileAccess::Read, true);
+    }
+    for (size_t i = COUNT; i-- > 0;) {
+        table.record_open(to_upper(numbered_path(i)), FileAccess::Query, i % 2 == 0);
+    }
+    CHECK(table.size() == COUNT);
+    auto recorded = rows(table);
+    for (size_t i = 0; i < COUNT; i++) {
+        CHECK(recorded[i].path == numbered_path(i));
+        CHECK(recorded[i].access == (i % 2 == 0 ? FileAccess::Read | FileAccess::Query : FileAccess::Read));
+        CHECK(recorded[i].opens == (i % 2 == 0 ? 2u : 1u) && recorded[i].failed_opens == (i % 2 == 0 ? 0u : 1u));
+    }
+}
+
+static void test_dos_paths() {
+    CHECK(to_dos_path(LR"(\??\C:\src\a.h)") == LR"(C:\src\a.h)");
+    CHECK(to_dos_path(LR"(\\?\c:\src\a.h)") == LR"(c:\src\a.h)");
+    CHECK(to_dos_path(LR"(\??\C:)") == LR"(C:)");
+    CHECK(to_dos_path(LR"(\??\UNC\server\share\a.h)") == LR"(\\server\share\a.h)");
+    CHECK(to_dos_path(LR"(\\?\unc\server\share\a.h)") == LR"(\\server\share\a.h)");
+    CHECK(to_dos_path(LR"(C:\src\a.h)") == LR"(C:\src\a.h)");
+    CHECK(to_dos_path(LR"(\\server\share\a.h)") == LR"(\\server\share\a.h)");
+    // devices, pipes and relative paths are not files
+    CHECK(to_dos_path(LR"(\??\pipe\spawncamper)").empty());
+    CHECK(to_dos_path(LR"(\\.\pipe\spawncamper)").empty());
+    CHECK(to_dos_path(LR"(\??\CONIN$)").empty());
+    CHECK(to_dos_path(LR"(\Device\HarddiskVolume1\a.h)").empty());
+    CHECK(to_dos_path(LR"(CON)").empty());
+    CHECK(to_dos_path(LR"(src\a.h)").empty());
+    CHECK(to_dos_path(LR"(C:a.h)").empty());
+    CHECK(to_dos_path(LR"(1:\a.h)").empty());
+    CHECK(to_dos_path(L"").empty());
+}
+
+/// The table is reported in messages of at most 256 files, in the order of the first access.
+static void test_batching() {
+    constexpr size_t COUNT = 600;
+    auto table = FileAccessTable<char16_t>{};
+    for (size_t i = 0; i < COUNT; i++) {
+        table.record_open(numbered_path(i), FileAccess::Read, true);
+        if (i % 3 == 0) table.record_open(numbered_path(i), FileAccess::Read, false);
+    }
+
+    auto sink = std::make_unique<MemorySink>(2);
+    auto& data = *sink;
+    auto client = LoggerClient(std::move(sink));
+    client.log_file_accesses(table);
+
+    using namespace Protocol;
+    auto decoder = Decoder{data.data(), 2};
+    auto batch_sizes = std::vector<size_t>{};
+    size_t i = 0;
+    while (auto header = decoder.next()) {
+        CHECK(header->type == MessageType::FileAccesses);
+        auto [files] = decoder.decode<Messages::FileAccesses>();
+        batch_sizes.push_back(files.size());
+        for (auto& [path, access, opens, failed_opens] : files) {
+            CHECK(path.to_utf16() == numbered_path(i));
+            CHECK(access == (uint32_t)FileAccess::Read && opens == 1 && failed_opens == (i % 3 == 0 ? 1u : 0u));
+            i++;
+        }
+    }
+    CHECK(i == COUNT);
+    CHECK((batch_sizes == std::vector<size_t>{256, 256, 88}));
+
+    // an empty table sends nothing
+    data.clear();
+    client.log_file_accesses(FileAccessTable<char16_t>{});
+    CHECK(data.data().empty());
+
+    // version 1 servers do not know the message
+    auto v1_sink = std::make_unique<MemorySink>(1);
+    auto& v1_data = *v1_sink;
+    auto v1_client = LoggerClient(std::move(v1_sink));
+    v1_client.log_file_accesses(table);
+    CHECK(v1_data.data().empty());
+}
+
+int main() {
+    test_deduplication();
+    test_growth();
+    test_dos_paths();
+    test_batching();
+    return 0;
+}
@@ -0,0 +1,148 @@
+// Tests the rules selecting the processes that are not traced in full: exe path globs, command line substrings,
+//  the maximum depth, and how the configuration is inherited by the children of filtered processes.
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "Check.hpp"
+#include "HookConfig.hpp"
+#include "ProcessFilter.hpp"
+
+static bool matches_exe(std::wstring_view glob, std::wstring_view exe_path) {
+    auto filter = ProcessFilter{};
+    filter.add_exe_glob(glob);
+    return filter.matches(exe_path, L"");
+}
+
+static bool matches_command_line(std::wstring_view substring, std::wstring_view command_line) {
+    auto filter = ProcessFilter{};
+    filter.add_command_line(substring);
+    return filter.matches(L"C:\\a.exe", command_line);
+}
+
+static void test_exe_globs() {
+    // globs without a separator match the file name, case-insensitively
+    CHECK(matches_exe(L"conhost.exe", L"C:\\Windows\\System32\\CONHOST.EXE"));
+    CHECK(!matches_exe(L"conhost.exe", L"C:\\Windows\\System32\\xconhost.exe"));
+    CHECK(!matches_exe(L"conhost.exe", L"C:\\conhost.exe\\a.exe"));
+    CHECK(matches_exe(L"con?ost.exe", L"C:\\conhost.exe"));
+    CHECK(!matches_exe(L"con?ost.exe", L"C:\\conost.exe"));
+    CHECK(matches_exe(L"*.exe", L"C:\\a.exe"));
+    CHECK(!matches_exe(L"*.exe", L"C:\\a.exe.bak"));
+    CHECK(matches_exe(L"*", L"C:\\a.exe"));
+    CHECK(matches_exe(L"git*", L"C:\\Git\\bin\\git-remote-https.exe"));
+    // a `*` that first matches too little is retried with longer matches
+    CHECK(matches_exe(L"a*b*c.exe", L"C:\\aXbYbZc.exe"));
+    CHECK(matches_exe(L"a**c.exe", L"C:\\ac.exe"));
+    CHECK(!matches_exe(L"a*b*c.exe", L"C:\\aXbYc.ex"));
+
+    // globs with a separator match the full path, with either kind of separator
+    CHECK(matches_exe(L"*\\Git\\*", L"C:\\Program Files\\git\\bin\\git.exe"));
+    CHECK(matches_exe(L"C:/Program Files/Git/*/git.exe", L"c:\\program files\\git\\bin\\git.exe"));
+    CHECK(!matches_exe(L"C:\\Git\\git.exe", L"D:\\Git\\git.exe"));
+    CHECK(!matches_exe(L"\\git.exe", L"C:\\git.exe"));
+    CHECK(matches_exe(L"*\\git.exe", L"C:\\git.exe"));
+    // Linux paths
+    CHECK(matches_exe(L"/usr/bin/*", L"/usr/bin/cc"));
+    CHECK(matches_exe(L"cc", L"/usr/bin/cc"));
+
+    // only ASCII letters are folded
+    CHECK(!matches_exe(L"\u00e9.exe", L"C:\\\u00c9.exe"));
+}
+
+static void test_command_lines() {
+    CHECK(matches_command_line(L"--version", L"git.exe --VERSION"));
+    CHECK(matches_command_line(L"git", L"git"));
+    CHECK(!matches_command_line(L"--version", L"git.exe --versio"));
+    // command lines are not paths, separators are kept
+    CHECK(!matches_command_line(L"a/b", L"cmd a\\b"));
+    CHECK(matches_command_line(L"", L"anything"));
+}
+
+static void test_rules() {
+    auto filter = ProcessFilter{};
+    CHECK(filter.empty());
+    CHECK(!filter.matches(L"C:\\a.exe", L"a"));
+
+    filter.add_exe_glob(L"conhost.exe");
+    filter.add_exe_glob(L"*\\Git\\*");
+    filter.add_command_line(L"rev-parse");
+    CHECK(!filter.empty());
+    CHECK(filter.matches(L"C:\\conhost.exe", L""));
+    CHECK(filter.matches(L"C:\\Git\\bin\\git.exe", L"git status"));
+    CHECK(filter.matches(L"C:\\tools\\git.exe", L"git rev-parse HEAD"));
+    CHECK(!filter.matches(L"C:\\tools\\git.exe", L"git status"));
+
+    // the hooks receive the rules serialized in a payload
+    auto data = filter.serialize();
+    auto copy = ProcessFilter::deserialize(data);
+    CHECK(copy.serialize() == data);
+    CHECK(copy.matches(L"C:\\Git\\bin\\git.exe", L""));
+    CHECK(copy.matches(L"C:\\tools\\git.exe", L"git REV-PARSE"));
+    CHECK(!copy.matches(L"C:\\tools\\git.exe", L"git status"));
+
+    // truncated data results in the complete rules before it
+    auto truncated = std::span(data).first(data.size() - 3 * sizeof(wchar_t));
+    auto partial = ProcessFilter::deserialize(truncated);
+    CHECK(partial.matches(L"C:\\conhost.exe", L""));
+    CHECK(!partial.matches(L"C:\\tools\\git.exe", L"git rev-parse"));
+    CHECK(ProcessFilter::deserialize({}).empty());
+    CHECK(ProcessFilter::deserialize(std::span(data).first(1)).empty());
+    CHECK(ProcessFilter().serialize().size() == sizeof(wchar_t));
+}
+
+static void test_depth() {
+    auto filter = ProcessFilter{};
+    filter.add_exe_glob(L"conhost.exe");
+    auto rules = filter.serialize();
+
+    auto config = HookConfig{.filter_action = FilterAction::Skip, .max_depth = 1};
+    // the traced command and its children are traced in full, their children are filtered
+    CHECK(!config.match({}, L"C:\\build.exe", L"build"));
+    CHECK(!config.match(rules, L"C:\\build.exe", L"build"));
+    CHECK(config.match(rules, L"C:\\conhost.exe", L"") == FilterAction::Skip);
+
+    auto child = config.for_child(std::nullopt, 100);
+    CHECK(child.depth == 1 && child.reported_ancestor_pid == 0);
+    CHECK(!child.match({}, L"C:\\cl.exe", L"cl"));
+    auto grandchild = child.for_child(std::nullopt, 100);
+    CHECK(grandchild.depth == 2);
+    CHECK(grandchild.match({}, L"C:\\cl.exe", L"cl") == FilterAction::Skip);
+    // set by the parent that watches the child, not by its ancestors
+    auto watched = config;
+    watched.exit_watched = true;
+    CHECK(!watched.for_child(std::nullopt, 100).exit_watched);
+
+    auto unlimited = HookConfig{};
+    CHECK(unlimited.max_depth == UINT32_MAX && !unlimited.match({}, L"C:\\a.exe", L""));
+    CHECK(unlimited.match(rules, L"C:\\conhost.exe", L"") == FilterAction::Minimal);
+}
+
+static void test_skipped_ancestors() {
+    // build.exe (reported, PID 10) -> skipped.exe (PID 20) -> skipped.exe (PID 30) -> cl.exe
+    auto build = HookConfig{.filter_action = FilterAction::Skip};
+    auto skipped = build.for_child(std::nullopt, 1);
+    CHECK(skipped.reported_ancestor_pid == 0);
+    // the children of a skipped process report the parent of the skipped process instead
+    auto nested = skipped.for_child(FilterAction::Skip, 10);
+    CHECK(nested.reported_ancestor_pid == 10);
+    // and keep it through further skipped processes
+    auto cl = nested.for_child(FilterAction::Skip, 20);
+    CHECK(cl.reported_ancestor_pid == 10 && cl.depth == 3);
+    // processes reported with minimal information are known to the server
+    auto minimal = skipped.for_child(FilterAction::Minimal, 10);
+    CHECK(minimal.reported_ancestor_pid == 0);
+    CHECK(cl.for_child(std::nullopt, 30).reported_ancestor_pid == 0);
+}
+
+int main() {
+    test_exe_globs();
+    test_command_lines();
+    test_rules();
+    test_depth();
+    test_skipped_ancestors();
+    return 0;
+}
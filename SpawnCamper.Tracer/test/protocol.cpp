@@ -0,0 +1,304 @@
+// Round-trip test of the wire format: every message type is encoded with the writer used by the hooks and decoded
+//  with the reference decoder (`Protocol::Decoder`), in all protocol versions that support it.
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#include "Check.hpp"
+#include "LoggerClient.hpp"
+#include "MessageSink.hpp"
+#include "Protocol.hpp"
+
+using namespace Protocol;
+
+static constexpr uint64_t TIMESTAMP = 133'000'000'000'000'000;
+
+/// Concatenated messages, as received through a pipe connection after the preamble.
+class Stream {
+    std::vector<std::byte> m_data;
+    MessageBuffer m_buffer;
+
+public:
+    const uint32_t version;
+
+    explicit Stream(uint32_t version) : version(version) {}
+
+    template<typename Msg, typename... Args>
+    Stream& add(const Args&... args) {
+        encode<Msg>(m_buffer, version, TIMESTAMP, args...);
+        for (auto chunk : m_buffer.chunks()) {
+            m_data.insert(m_data.end(), chunk.begin(), chunk.end());
+        }
+        m_buffer.clear();
+        return *this;
+    }
+
+    Decoder decoder() const {
+        return Decoder{m_data, version};
+    }
+
+    [[nodiscard]] std::span<const std::byte> data() const {
+        return m_data;
+    }
+};
+
+/// Decoded strings reference the encoded data, so it is kept until the end of the test.
+static std::deque<Stream> encoded{};
+
+/// Encodes a single message and decodes it again.
+template<typename Msg, typename... Args>
+static typename Msg::values round_trip(uint32_t version, const Args&... args) {
+    auto& stream = encoded.emplace_back(version);
+    stream.add<Msg>(args...);
+    auto decoder = stream.decoder();
+    auto header = decoder.next();
+    CHECK(header && header->type == Msg::type && header->timestamp == TIMESTAMP);
+    auto values = decoder.template decode<Msg>();
+    CHECK(!decoder.next());
+    return values;
+}
+
+static std::string utf8(const StringValue& value) {
+    CHECK(!value.is_null());
+    return value.to_utf8();
+}
+
+static void test_varints() {
+    struct Case {
+        uint64_t value;
+        size_t size;
+    };
+    for (auto [value, size] : {Case{0, 1}, Case{127, 1}, Case{128, 2}, Case{16383, 2}, Case{16384, 3},
+                               Case{std::numeric_limits<uint64_t>::max(), MAX_VARINT_SIZE}}) {
+        std::byte buffer[MAX_VARINT_SIZE];
+        CHECK(encode_varint(value, buffer) == size);
+        auto reader = Reader{std::span{buffer, size}, 2};
+        CHECK(reader.varint() == value);
+        CHECK(reader.at_end());
+
+        auto [count] = round_trip<Messages::DroppedMessages>(2, value);
+        CHECK(count == value);
+        auto [count_v1] = round_trip<Messages::DroppedMessages>(1, value);
+        CHECK(count_v1 == value);
+    }
+
+    // a 32-bit field holding a larger value is rejected instead of being truncated
+    auto stream = Stream{2};
+    stream.add<Messages::DroppedMessages>((uint64_t)std::numeric_limits<uint32_t>::max() + 1);
+    auto decoder = stream.decoder();
+    decoder.next();
+    try {
+        decoder.decode<Message<MessageType::DroppedMessages, UInt<uint32_t>>>();
+        CHECK(!"out of range value was decoded");
+    } catch (const DecodeError&) {}
+
+    // varints longer than 64 bits are malformed
+    std::byte too_long[11];
+    std::ranges::fill(too_long, std::byte{0x80});
+    too_long[10] = std::byte{0};
+    auto reader = Reader{too_long, 2};
+    try {
+        reader.varint();
+        CHECK(!"overlong varint was decoded");
+    } catch (const DecodeError&) {}
+}
+
+static void test_strings(uint32_t version) {
+    auto [ascii] = round_trip<Messages::EnvironmentSnapshot>(version, std::string_view{"PATH=/usr/bin\0A=b\0", 18});
+    CHECK(utf8(ascii) == std::string("PATH=/usr/bin\0A=b\0", 18));
+
+    auto [latin1] = round_trip<Messages::EnvironmentSnapshot>(version, std::u16string_view{u"caf\u00e9"});
+    CHECK(utf8(latin1) == "caf\xc3\xa9");
+    CHECK(latin1.to_utf16() == u"caf\u00e9");
+
+    auto [non_latin1] = round_trip<Messages::EnvironmentSnapshot>(version, std::u16string_view{u"\u010d\U0001f600"});
+    CHECK(non_latin1.to_utf16() == u"\u010d\U0001f600");
+    CHECK(utf8(non_latin1) == "\xc4\x8d\xf0\x9f\x98\x80");
+
+    auto [from_utf8] = round_trip<Messages::EnvironmentSnapshot>(version, std::string_view{"\xc4\x8d"});
+    CHECK(from_utf8.to_utf16() == u"\u010d");
+
+    // Windows strings may contain unpaired surrogates, which are kept exactly
+    auto unpaired = std::u16string{u'a', (char16_t)0xd800, u'b'};
+    auto [raw] = round_trip<Messages::EnvironmentSnapshot>(version, std::u16string_view{unpaired});
+    CHECK(raw.encoding == StringEncoding::Utf16);
+    CHECK(raw.to_utf16() == unpaired);
+
+    auto [empty] = round_trip<Messages::EnvironmentSnapshot>(version, std::string_view{});
+    CHECK(!empty.is_null() && empty.data.empty());
+
+    auto [null] = round_trip<Messages::EnvironmentSnapshot>(version, nullptr);
+    CHECK(null.is_null());
+}
+
+static void test_messages(uint32_t version) {
+    {
+        auto [exit_code, resources] = round_trip<Messages::ExitProcess>(version, 0xdeadbeefu, std::nullopt);
+        CHECK(exit_code == 0xdeadbeef);
+        CHECK(!resources);
+    }
+    {
+        auto [parent, exe, cmd, cwd, env, flags] = round_trip<Messages::ProcessStart>(
+            version, 1234u, u"C:\\Windows\\cmd.exe", u"cmd /c exit", u"C:\\", std::u16string_view{u"A=b\0", 4},
+            std::tuple{(uint32_t)StartFlags::ExitWatched});
+        CHECK(parent == 1234);
+        // not encoded in version 1
+        CHECK(flags.has_value() == (version >= 2));
+        CHECK(!flags || std::get<0>(*flags) == (uint32_t)StartFlags::ExitWatched);
+        CHECK(utf8(exe) == "C:\\Windows\\cmd.exe");
+        CHECK(utf8(cmd) == "cmd /c exit");
+        CHECK(utf8(cwd) == "C:\\");
+        CHECK(utf8(env) == std::string("A=b\0", 4));
+    }
+    {
+        auto [parent, exe, cmd, cwd, env_hash, base_hash, removed, changed, flags] =
+            round_trip<Messages::ProcessStartEnvDelta>(
+                version, 1u, "/bin/sh", "sh -c true", "/tmp", 0x0123456789abcdefull,
+                std::numeric_limits<uint64_t>::max(), std::string_view{"OLD\0", 4}, std::string_view{"NEW=1\0", 6},
+                std::nullopt);
+        CHECK(parent == 1);
+        CHECK(utf8(exe) == "/bin/sh" && utf8(cmd) == "sh -c true" && utf8(cwd) == "/tmp");
+        CHECK(env_hash == 0x0123456789abcdefull);
+        CHECK(base_hash == std::numeric_limits<uint64_t>::max());
+        CHECK(utf8(removed) == std::string("OLD\0", 4));
+        CHECK(utf8(changed) == std::string("NEW=1\0", 6));
+        CHECK(!flags);
+    }
+    {
+        auto [count] = round_trip<Messages::DroppedMessages>(version, 42ull);
+        CHECK(count == 42);
+    }
+    if (version == 1) {
+        return;
+    }
+
+    // messages and fields added in version 2
+    {
+        auto usage = ResourceUsage{1, 2, 3, 4, 5, 6, 7, std::numeric_limits<uint64_t>::max(), 9, 10};
+        auto [exit_code, resources] = round_trip<Messages::ExitProcess>(version, 0u, usage);
+        CHECK(exit_code == 0);
+        CHECK(resources && *resources == usage);
+    }
+    {
+        auto [parent, exe, flags] = round_trip<Messages::ProcessStartMinimal>(version, 7u, u"C:\\a.exe", std::nullopt);
+        CHECK(parent == 7 && utf8(exe) == "C:\\a.exe" && !flags);
+    }
+    {
+        auto files = std::vector<std::tuple<std::u16string_view, uint32_t, uint32_t, uint32_t>>{
+            {u"C:\\a.h", 2, 3, 0}, {u"C:\\missing.h", 1, 0, 128}};
+        auto [decoded] = round_trip<Messages::FileAccesses>(version, files);
+        CHECK(decoded.size() == 2);
+        for (size_t i = 0; i < files.size(); i++) {
+            auto& [path, access, opens, failed] = decoded[i];
+            CHECK(path.to_utf16() == std::get<0>(files[i]));
+            CHECK(access == std::get<1>(files[i]) && opens == std::get<2>(files[i]) && failed == std::get<3>(files[i]));
+        }
+        auto no_files = std::vector<std::tuple<const char*, uint32_t, uint32_t, uint32_t>>{};
+        auto [none] = round_trip<Messages::FileAccesses>(version, no_files);
+        CHECK(none.empty());
+    }
+    {
+        auto spawns = std::vector<std::tuple<uint32_t, uint64_t, uint64_t>>{{100, 5000, 6000}, {101, 0, 127}};
+        auto [attach, connect, busy_waits, log_attach, write_time, writes, spawn_latency, decoded] =
+            round_trip<Messages::HookTimings>(version, 1ull, 128ull, 2u, 3ull, 4ull, 5ull, 0ull, spawns);
+        CHECK(attach == 1 && connect == 128 && busy_waits == 2 && log_attach == 3);
+        CHECK(write_time == 4 && writes == 5 && spawn_latency == 0);
+        CHECK(decoded == spawns);
+    }
+    {
+        auto [child, exit_code] = round_trip<Messages::ChildExit>(version, 4321u, 0xc0000005u);
+        CHECK(child == 4321 && exit_code == 0xc0000005u);
+    }
+}
+
+/// Readers skip message types and trailing fields they do not know, so that messages can be extended.
+static void test_forward_compatibility() {
+    auto usage = ResourceUsage{1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+    auto stream = Stream{2};
+    stream.add<Messages::ExitProcess>(3u, usage)
+          .add<Message<(MessageType)200, String, UInt<uint64_t>>>("from the future", 1ull)
+          .add<Messages::DroppedMessages>(5ull);
+
+    auto decoder = stream.decoder();
+    CHECK(decoder.next()->type == MessageType::ExitProcess);
+    // a reader that predates the resource usage extension
+    auto [exit_code] = decoder.decode<Message<MessageType::ExitProcess, UInt<uint32_t>>>();
+    CHECK(exit_code == 3);
+    CHECK(decoder.next()->type == (MessageType)200);
+    decoder.skip();
+    CHECK(decoder.next()->type == MessageType::DroppedMessages);
+    CHECK(std::get<0>(decoder.decode<Messages::DroppedMessages>()) == 5);
+    CHECK(!decoder.next());
+
+    // a version 1 stream is skipped by decoding the messages
+    auto v1 = Stream{1};
+    v1.add<Messages::ProcessStart>(1u, "a", "b", "c", std::string_view{"\0", 1}, std::nullopt)
+      .add<Messages::DroppedMessages>(7ull);
+    auto v1_decoder = v1.decoder();
+    v1_decoder.next();
+    v1_decoder.skip();
+    v1_decoder.next();
+    CHECK(std::get<0>(v1_decoder.decode<Messages::DroppedMessages>()) == 7);
+}
+
+static void test_malformed() {
+    auto stream = Stream{2};
+    stream.add<Messages::ProcessStartMinimal>(1u, "C:\\a.exe", std::nullopt);
+    auto data = stream.data();
+    // every truncation of the message is detected
+    for (size_t size = 1; size < data.size(); size++) {
+        auto decoder = Decoder{data.first(size), 2};
+        try {
+            decoder.next();
+            decoder.decode<Messages::ProcessStartMinimal>();
+            CHECK(!"truncated message was decoded");
+        } catch (const DecodeError&) {}
+    }
+
+    CHECK(parse_preamble(stream_preamble(2)) == 2);
+    auto v1_start = std::array<std::byte, 8>{};
+    memcpy(v1_start.data(), &TIMESTAMP, sizeof(TIMESTAMP));
+    CHECK(parse_preamble(v1_start) == 1);
+}
+
+/// The hook reports the start of a process after DllMain returns, with the timestamp captured when it attached.
+static void test_deferred_start(uint32_t version) {
+    auto sink = std::make_unique<MemorySink>(version);
+    auto& data = *sink;
+    auto client = LoggerClient(std::move(sink));
+    auto attach_time = TIMESTAMP - 12345;
+    client.log_new_process(1u, "/bin/true", "true", "/", "A=b\0", attach_time, StartFlags::ExitWatched);
+    client.log_ExitProcess(0, ResourceUsage{1, 2, 3, 4, 5, 6, 7, 8, 9, 10});
+
+    auto decoder = Decoder{data.data(), version};
+    auto start = decoder.next();
+    CHECK(start && start->type == MessageType::ProcessStart && start->timestamp == attach_time);
+    auto [parent, exe, cmd, cwd, env, flags] = decoder.decode<Messages::ProcessStart>();
+    CHECK(parent == 1 && utf8(exe) == "/bin/true" && utf8(cmd) == "true" && utf8(env) == std::string("A=b\0", 4));
+    CHECK(flags.has_value() == (version >= 2));
+    auto exit = decoder.next();
+    CHECK(exit && exit->type == MessageType::ExitProcess && exit->timestamp > attach_time);
+    auto [exit_code, resources] = decoder.decode<Messages::ExitProcess>();
+    CHECK(exit_code == 0 && resources.has_value() == (version >= 2));
+    CHECK(!decoder.next());
+}
+
+int main() {
+    test_varints();
+    for (uint32_t version = 1; version <= MAX_VERSION; version++) {
+        test_strings(version);
+        test_messages(version);
+        test_deferred_start(version);
+    }
+    test_forward_compatibility();
+    test_malformed();
+    return 0;
+}
@@ -0,0 +1,162 @@
+// Replies of the server to environment deltas: every connection starts with the version the server offers, followed
+//  by the replies, so the writer must consume the version before `LoggerClient` reads its first reply. The server
+//  side is played by the test, with the same transport the hook uses on each platform.
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Check.hpp"
+#include "LoggerClient.hpp"
+#include "Protocol.hpp"
+
+#ifdef _WIN32
+#include "NamedPipeWriter.hpp"
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "UnixSocketWriter.hpp"
+#endif
+
+using namespace Protocol;
+
+static constexpr uint64_t ENV_HASH = 0x0123456789abcdefull;
+
+/// What the server sends right after accepting the connection: its version, then a reply to the delta.
+static std::vector<std::byte> server_output(uint64_t reply_hash) {
+    auto output = std::vector<std::byte>(sizeof(uint32_t) + ENVIRONMENT_REPLY_SIZE);
+    auto version = MAX_VERSION;
+    memcpy(output.data(), &version, sizeof(version));
+    output[sizeof(version)] = (std::byte)EnvironmentReply::SendFull;
+    memcpy(output.data() + sizeof(version) + 1, &reply_hash, sizeof(reply_hash));
+    return output;
+}
+
+#ifdef _WIN32
+/// Accepts a single connection, sends `output` and returns everything the client wrote until it disconnected.
+class TestServer {
+    std::wstring m_name = L"\\\\.\\pipe\\SpawnCamper.Test." + std::to_wstring(GetCurrentProcessId());
+    HANDLE m_pipe;
+    std::vector<std::byte> m_received;
+    std::thread m_thread;
+
+public:
+    explicit TestServer(std::vector<std::byte> output)
+        : m_pipe(CreateNamedPipeW(m_name.c_str(), PIPE_ACCESS_DUPLEX, PIPE_TYPE_BYTE | PIPE_WAIT, 1, 65536, 65536, 0,
+                                  nullptr)) {
+        CHECK(m_pipe != INVALID_HANDLE_VALUE);
+        m_thread = std::thread([this, output = std::move(output)] {
+            CHECK(ConnectNamedPipe(m_pipe, nullptr) || GetLastError() == ERROR_PIPE_CONNECTED);
+            Win32::WriteFile(m_pipe, output);
+            auto buffer = std::array<std::byte, 4096>{};
+            DWORD bytes_read;
+            while (ReadFile(m_pipe, buffer.data(), (DWORD)buffer.size(), &bytes_read, nullptr) && bytes_read > 0) {
+                m_received.insert(m_received.end(), buffer.begin(), buffer.begin() + bytes_read);
+            }
+            CloseHandle(m_pipe);
+        });
+    }
+
+    std::unique_ptr<MessageSink> connect() {
+        return std::make_unique<NamedPipeWriter>(m_name, MAX_VERSION);
+    }
+
+    std::vector<std::byte> join() {
+        m_thread.join();
+        return m_received;
+    }
+};
+#else
+/// Accepts a single connection, sends `output` and returns everything the client wrote until it disconnected.
+class TestServer {
+    std::string m_path = "/tmp/SpawnCamper.Test." + std::to_string(getpid());
+    int m_listener;
+    std::vector<std::byte> m_received;
+    std::thread m_thread;
+
+public:
+    explicit TestServer(std::vector<std::byte> output) : m_listener(::socket(AF_UNIX, SOCK_STREAM, 0)) {
+        auto address = sockaddr_un{};
+        address.sun_family = AF_UNIX;
+        memcpy(address.sun_path, m_path.c_str(), m_path.size() + 1);
+        ::unlink(m_path.c_str());
+        CHECK(::bind(m_listener, (const sockaddr*)&address, sizeof(address)) == 0);
+        CHECK(::listen(m_listener, 1) == 0);
+        m_thread = std::thread([this, output = std::move(output)] {
+            auto fd = ::accept(m_listener, nullptr, nullptr);
+            CHECK(fd >= 0);
+            CHECK(::send(fd, output.data(), output.size(), 0) == (ssize_t)output.size());
+            auto buffer = std::array<std::byte, 4096>{};
+            ssize_t bytes_read;
+            while ((bytes_read = ::recv(fd, buffer.data(), buffer.size(), 0)) > 0) {
+                m_received.insert(m_received.end(), buffer.begin(), buffer.begin() + bytes_read);
+            }
+            ::close(fd);
+        });
+    }
+
+    ~TestServer() {
+        ::close(m_listener);
+        ::unlink(m_path.c_str());
+    }
+
+    std::unique_ptr<MessageSink> connect() {
+        return std::make_unique<UnixSocketWriter>(m_path);
+    }
+
+    std::vector<std::byte> join() {
+        m_thread.join();
+        return m_received;
+    }
+};
+#endif
+
+/// Sends a delta followed by another message, which picks up the reply. Returns what the server received.
+static std::vector<std::byte> send_delta(uint64_t reply_hash) {
+    auto server = TestServer{server_output(reply_hash)};
+    {
+        auto client = LoggerClient(server.connect());
+        CHECK(client.protocol_version() == MAX_VERSION);
+        auto delta = Environment::Delta<char>{.removed = {}, .changed = std::string("B=c\0", 4)};
+        client.log_new_process(1u, "/bin/true", "true", "/", "A=b\0B=c\0", ENV_HASH, 42, delta);
+        client.log_ExitProcess(0, std::nullopt);
+    }
+    return server.join();
+}
+
+/// The server asked for the environment the delta was based on: it is sent in full, before the next message.
+static void test_send_full() {
+    auto received = send_delta(ENV_HASH);
+    CHECK(received.size() > 8);
+    CHECK(parse_preamble(std::span<const std::byte, 8>{received.data(), 8}) == MAX_VERSION);
+    auto decoder = Decoder{std::span{received}.subspan(8), MAX_VERSION};
+    CHECK(decoder.next()->type == MessageType::ProcessStartEnvDelta);
+    decoder.skip();
+    auto snapshot = decoder.next();
+    CHECK(snapshot && snapshot->type == MessageType::EnvironmentSnapshot);
+    auto [env] = decoder.decode<Messages::EnvironmentSnapshot>();
+    CHECK(env.to_utf8() == std::string("A=b\0B=c\0", 8));
+    CHECK(decoder.next()->type == MessageType::ExitProcess);
+    decoder.skip();
+    CHECK(!decoder.next());
+}
+
+/// A reply to another delta is not a reply to ours, nothing is sent.
+static void test_other_hash() {
+    auto received = send_delta(ENV_HASH + 1);
+    auto decoder = Decoder{std::span{received}.subspan(8), MAX_VERSION};
+    CHECK(decoder.next()->type == MessageType::ProcessStartEnvDelta);
+    decoder.skip();
+    CHECK(decoder.next()->type == MessageType::ExitProcess);
+}
+
+int main() {
+    test_send_full();
+    test_other_hash();
+    return 0;
+}
@@ -0,0 +1,236 @@
+// Compares the vectorized scanning kernels of each level supported by the CPU against the scalar code, for strings
+//  starting and ending at every position within a vector, with the searched character at every position, and for
+//  strings ending right before an inaccessible page, which the aligned reads must never touch.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "Check.hpp"
+#include "Scan.hpp"
+
+/// Longest vector of all levels; strings start at every offset within it, which covers all alignments of all levels.
+static constexpr size_t MAX_WIDTH = 32;
+/// Strings span up to three vectors, so that some contain no match and no terminator.
+static constexpr size_t MAX_LENGTH = 2 * MAX_WIDTH + 2;
+
+/// A readable page followed by an inaccessible one, so that reading past the end of the first page crashes the test.
+class GuardedPage {
+    std::byte* m_data;
+    size_t m_size;
+
+public:
+    GuardedPage() {
+#ifdef _WIN32
+        auto info = SYSTEM_INFO{};
+        GetSystemInfo(&info);
+        m_size = info.dwPageSize;
+        m_data = (std::byte*)VirtualAlloc(nullptr, 2 * m_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        CHECK(m_data != nullptr);
+        DWORD old_protection;
+        CHECK(VirtualProtect(m_data + m_size, m_size, PAGE_NOACCESS, &old_protection));
+#else
+        m_size = (size_t)sysconf(_SC_PAGESIZE);
+        auto data = mmap(nullptr, 2 * m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        CHECK(data != MAP_FAILED);
+        m_data = (std::byte*)data;
+        CHECK(mprotect(m_data + m_size, m_size, PROT_NONE) == 0);
+#endif
+    }
+
+    ~GuardedPage() {
+#ifdef _WIN32
+        VirtualFree(m_data, 0, MEM_RELEASE);
+#else
+        munmap(m_data, 2 * m_size);
+#endif
+    }
+
+    GuardedPage(const GuardedPage&) = delete;
+    GuardedPage& operator=(const GuardedPage&) = delete;
+
+    template<typename CharT>
+    CharT* begin() const {
+        return (CharT*)m_data;
+    }
+
+    template<typename CharT>
+    CharT* end() const {
+        return (CharT*)(m_data + m_size);
+    }
+};
+
+/// The kernels of a single level; `find_first_of` searches for `=` and `"`, like the command line parser.
+template<typename CharT>
+struct Kernels {
+    const char* name;
+    const CharT* (*find_first_of)(const CharT*);
+    const CharT* (*find)(const CharT*, const CharT*, CharT);
+    size_t (*env_block_length)(const CharT*);
+};
+
+template<typename CharT>
+static std::vector<Kernels<CharT>> kernels() {
+    auto result = std::vector<Kernels<CharT>>{};
+    result.push_back({
+        "scalar", [](const CharT* s) { return Scan::Scalar::find_first_of<'=', '"'>(s); },
+        Scan::Scalar::find<CharT>, Scan::Scalar::env_block_length<CharT>,
+    });
+#if SCAN_X86
+    result.push_back({
+        "sse2", [](const CharT* s) { return Scan::Sse2::find_first_of<'=', '"'>(s); },
+        Scan::Sse2::find<CharT>, Scan::Sse2::env_block_length<CharT>,
+    });
+    if (Scan::detect_level() == Scan::Level::Avx2) {
+        result.push_back({
+            "avx2", [](const CharT* s) { return Scan::Avx2::find_first_of<'=', '"'>(s); },
+            Scan::Avx2::find<CharT>, Scan::Avx2::env_block_length<CharT>,
+        });
+    } else {
+        std::printf("AVX2 is not supported by the CPU, skipping its kernels\n");
+    }
+#endif
+    result.push_back({
+        "dispatch", [](const CharT* s) { return Scan::find_first_of<'=', '"'>(s); },
+        Scan::find<CharT>, Scan::env_block_length<CharT>,
+    });
+    return result;
+}
+
+/// Reports the failing case before failing the test.
+#define CHECK_CASE(cond, kernel, start, size, position)                                                                \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            std::fprintf(stderr, "%s, %zu-byte characters: start %zu, size %zu, position %zd\n", (kernel).name,      \
+                         sizeof(CharT), (size_t)(start), (size_t)(size), (ptrdiff_t)(position));                       \
+        }                                                                                                              \
+        CHECK(cond);                                                                                                   \
+    } while (0)
+
+/// Fills the characters before `str` with characters the kernels search for, which they must skip, since the first
+///  aligned vector starts before `str`.
+template<typename CharT>
+static void fill_before(CharT* page_begin, CharT* str) {
+    for (auto it = page_begin; it != str; it++) {
+        *it = (it - page_begin) % 2 ? CharT('=') : CharT(0);
+    }
+}
+
+template<typename CharT>
+static void test_find_first_of(const GuardedPage& page, const Kernels<CharT>& kernel) {
+    for (size_t size = 0; size < MAX_LENGTH; size++) {
+        for (size_t start = 0; start < MAX_WIDTH / sizeof(CharT); start++) {
+            // at the start of the page, and with the terminator as the last character of the page
+            for (auto str : {page.begin<CharT>() + start, page.end<CharT>() - size - 1 - start}) {
+                fill_before(page.begin<CharT>(), str);
+                // -1: no match, the terminator is found
+                for (ptrdiff_t position = -1; position < (ptrdiff_t)size; position++) {
+                    for (size_t i = 0; i < size; i++) str[i] = CharT('a' + i % 26);
+                    if (position >= 0) str[position] = position % 2 ? CharT('"') : CharT('=');
+                    str[size] = 0;
+                    // characters after the terminator must be ignored
+                    if (str + size + 1 < page.end<CharT>()) str[size + 1] = CharT('=');
+
+                    auto expected = position >= 0 ? (size_t)position : size;
+                    CHECK_CASE((size_t)(kernel.find_first_of(str) - str) == expected, kernel, start, size, position);
+                    auto scalar = Scan::Scalar::find_first_of<'=', '"'>(str);
+                    CHECK_CASE((size_t)(scalar - str) == expected, kernel, start, size, position);
+                }
+            }
+        }
+    }
+}
+
+template<typename CharT>
+static void test_find(const GuardedPage& page, const Kernels<CharT>& kernel) {
+    const auto needle = CharT(0x2c2c); // both bytes match a single-byte search, the match must be per character
+    for (size_t size = 0; size < MAX_LENGTH; size++) {
+        for (size_t start = 0; start < MAX_WIDTH / sizeof(CharT); start++) {
+            // at the start of the page, and ending exactly at the end of the page
+            for (auto begin : {page.begin<CharT>() + start, page.end<CharT>() - size - start}) {
+                auto end = begin + size;
+                for (auto it = page.begin<CharT>(); it != begin; it++) *it = needle;
+                for (ptrdiff_t position = -1; position < (ptrdiff_t)size; position++) {
+                    for (size_t i = 0; i < size; i++) begin[i] = CharT('a' + i % 26);
+                    if (position >= 0) begin[position] = needle;
+                    // a match right after the range must not be found
+                    if (end < page.end<CharT>()) *end = needle;
+
+                    auto expected = position >= 0 ? begin + position : end;
+                    CHECK_CASE(kernel.find(begin, end, needle) == expected, kernel, start, size, position);
+                    if (position >= 0) {
+                        // a later match is not reported
+                        end[-1] = needle;
+                        CHECK_CASE(kernel.find(begin, end, needle) == expected, kernel, start, size, position);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/// Writes an environment block of `size` characters (plus the final terminator) at `block`, with an entry ending
+///  at each multiple of `entry_length` and at `extra_null`, if they are not adjacent to another null.
+template<typename CharT>
+static void write_block(CharT* block, size_t size, size_t entry_length, size_t extra_null) {
+    for (size_t i = 0; i < size; i++) block[i] = CharT('A' + i % 26);
+    if (size > 0) {
+        for (size_t i = entry_length; i + 1 < size; i += entry_length) block[i] = 0;
+        if (extra_null > 0 && extra_null + 1 < size) block[extra_null] = 0;
+        // no empty entries, they would end the block
+        for (size_t i = 1; i + 1 < size; i++) {
+            if (block[i] == 0 && block[i - 1] == 0) block[i] = CharT('=');
+        }
+        block[size - 1] = 0;
+        if (size >= 2 && block[size - 2] == 0) block[size - 2] = CharT('=');
+    }
+    block[size] = 0;
+}
+
+template<typename CharT>
+static void test_env_block_length(const GuardedPage& page, const Kernels<CharT>& kernel) {
+    for (size_t size = 0; size < MAX_LENGTH; size++) {
+        // an empty block is a single null; a block with entries ends with an entry terminator and the final one
+        if (size == 1) continue;
+        for (size_t start = 0; start < MAX_WIDTH / sizeof(CharT); start++) {
+            for (auto block : {page.begin<CharT>() + start, page.end<CharT>() - size - 1 - start}) {
+                // nulls right before the block must not be taken for the first null of the terminating pair
+                for (auto it = page.begin<CharT>(); it != block; it++) *it = 0;
+                for (size_t entry_length : {2, 3, 7, 31, 1000}) {
+                    for (size_t extra_null = 0; extra_null < size; extra_null++) {
+                        write_block(block, size, entry_length, extra_null);
+                        CHECK_CASE(Scan::Scalar::env_block_length(block) == size, kernel, start, size, extra_null);
+                        CHECK_CASE(kernel.env_block_length(block) == size, kernel, start, size, extra_null);
+                    }
+                }
+            }
+        }
+    }
+}
+
+template<typename CharT>
+static void test_kernels(const GuardedPage& page) {
+    for (auto& kernel : kernels<CharT>()) {
+        test_find_first_of(page, kernel);
+        test_find(page, kernel);
+        test_env_block_length(page, kernel);
+        std::printf("%s, %zu-byte characters: ok\n", kernel.name, sizeof(CharT));
+    }
+}
+
+int main() {
+    auto page = GuardedPage{};
+    test_kernels<char>(page);
+    test_kernels<char16_t>(page);
+    return 0;
+}
@@ -0,0 +1,171 @@
+// Stress test of `SharedRing`: 16 forked producers write into a small ring while the consumer reads, so that
+//  the ring wraps around and fills up many times. Two records abandoned by "killed" producers block the ring until
+//  the consumer discards them after a timeout, the same way `SharedRingReader` in the server does; a record of
+//  a producer that is only stalled is waited for instead.
+
+#include <chrono>
+#include <cstring>
+#include <optional>
+#include <vector>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Check.hpp"
+#include "SharedRing.hpp"
+
+static constexpr uint32_t PRODUCERS = 16;
+static constexpr uint32_t RECORDS_PER_PRODUCER = 20000;
+static constexpr uint64_t CAPACITY = 64 * 1024;
+static constexpr auto ABANDONED_RECORD_TIMEOUT = std::chrono::milliseconds(200);
+static constexpr auto TEST_TIMEOUT = std::chrono::seconds(60);
+/// Process IDs of the producers that get killed and stalled before they commit their records.
+static constexpr uint32_t KILLED = PRODUCERS;
+static constexpr uint32_t STALLED = PRODUCERS + 1;
+
+struct Payload {
+    uint32_t producer;
+    uint32_t sequence;
+};
+
+static size_t filler_size(uint32_t sequence) {
+    return sequence % 200;
+}
+
+static std::byte filler_byte(uint32_t producer, uint32_t sequence, size_t i) {
+    return (std::byte)(producer * 31 + sequence + i);
+}
+
+static void produce(SharedRing& ring, uint32_t producer) {
+    auto filler = std::vector<std::byte>{};
+    for (uint32_t sequence = 0; sequence < RECORDS_PER_PRODUCER; sequence++) {
+        auto payload = Payload{producer, sequence};
+        filler.resize(filler_size(sequence));
+        for (size_t i = 0; i < filler.size(); i++) {
+            filler[i] = filler_byte(producer, sequence, i);
+        }
+        std::span<const std::byte> chunks[] = {std::as_bytes(std::span{&payload, 1}), filler};
+        while (!ring.try_write(producer, chunks)) {
+            sched_yield(); // the ring is full
+        }
+    }
+}
+
+/// Reserves space like `SharedRing::try_write`, as a producer that gets killed right after the CAS would.
+static SharedRing::RecordHeader* reserve(void* memory, size_t size) {
+    auto header = (SharedRing::Header*)memory;
+    auto position = header->head.fetch_add(size);
+    auto data = (std::byte*)memory + sizeof(SharedRing::Header);
+    return (SharedRing::RecordHeader*)(data + (position & (header->capacity - 1)));
+}
+
+int main() {
+    auto memory_size = sizeof(SharedRing::Header) + CAPACITY;
+    auto memory = mmap(nullptr, memory_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    CHECK(memory != MAP_FAILED);
+    auto ring = SharedRing::initialize(memory, CAPACITY, 2);
+    auto header = (SharedRing::Header*)memory;
+
+    // a producer killed while writing the payload, one that stalls for a while and one killed before writing
+    //  the record size
+    auto killed = reserve(memory, 4 * SharedRing::RECORD_ALIGNMENT);
+    killed->process_id = KILLED;
+    killed->size = 4 * SharedRing::RECORD_ALIGNMENT;
+    auto stalled_position = ring.head();
+    auto stalled = reserve(memory, 2 * SharedRing::RECORD_ALIGNMENT);
+    stalled->process_id = STALLED;
+    stalled->size = 2 * SharedRing::RECORD_ALIGNMENT;
+    reserve(memory, 3 * SharedRing::RECORD_ALIGNMENT);
+    auto process_alive = [](uint32_t process_id) { return process_id != KILLED; };
+
+    // the consumer notices the pending record before the producers start, the records reserved until then are
+    //  discarded together with the one that has no size
+    CHECK(ring.try_read([](auto, auto) {}, 0, process_alive) == SharedRing::ReadResult::Pending);
+    auto pending_since = std::optional{std::chrono::steady_clock::now()};
+    uint64_t pending_head = ring.head();
+
+    auto pids = std::vector<pid_t>{};
+    for (uint32_t producer = 0; producer < PRODUCERS; producer++) {
+        auto pid = fork();
+        CHECK(pid >= 0);
+        if (pid == 0) {
+            produce(ring, producer);
+            _exit(0);
+        }
+        pids.push_back(pid);
+    }
+
+    auto next_sequence = std::vector<uint32_t>(PRODUCERS, 0);
+    uint64_t received = 0;
+    auto stalled_received = false;
+    auto on_record = [&](uint32_t process_id, std::span<const std::byte> payload) {
+        if (process_id == STALLED) {
+            CHECK(!stalled_received && payload.size() == sizeof(Payload));
+            stalled_received = true;
+            return;
+        }
+        CHECK(process_id < PRODUCERS);
+        CHECK(payload.size() >= sizeof(Payload));
+        auto p = Payload{};
+        memcpy(&p, payload.data(), sizeof(p));
+        CHECK(p.producer == process_id);
+        // records of a single producer arrive in order, none is lost
+        CHECK(p.sequence == next_sequence[p.producer]);
+        next_sequence[p.producer]++;
+        auto filler = payload.subspan(sizeof(Payload));
+        CHECK(filler.size() == filler_size(p.sequence));
+        for (size_t i = 0; i < filler.size(); i++) {
+            CHECK(filler[i] == filler_byte(p.producer, p.sequence, i));
+        }
+        received++;
+    };
+
+    auto deadline = std::chrono::steady_clock::now() + TEST_TIMEOUT;
+    uint64_t abandoned_before = 0;
+    while (received < (uint64_t)PRODUCERS * RECORDS_PER_PRODUCER) {
+        auto now = std::chrono::steady_clock::now();
+        CHECK(now < deadline);
+        if (pending_since && now - *pending_since > ABANDONED_RECORD_TIMEOUT) {
+            abandoned_before = pending_head;
+        }
+        switch (ring.try_read(on_record, abandoned_before, process_alive)) {
+            case SharedRing::ReadResult::Read:
+                pending_since.reset();
+                break;
+            case SharedRing::ReadResult::Pending:
+                if (!pending_since) {
+                    pending_since = now;
+                    pending_head = ring.head();
+                }
+                // the killed record was discarded and the consumer waits for the stalled one, which is already
+                //  abandoned by its position; it must not be discarded while its producer is alive
+                if (header->tail.load() == stalled_position && stalled->state == SharedRing::RecordState::Writing
+                    && now - *pending_since > ABANDONED_RECORD_TIMEOUT / 2) {
+                    auto payload = Payload{STALLED, 0};
+                    stalled->payload_size = sizeof(payload);
+                    memcpy((std::byte*)(stalled + 1), &payload, sizeof(payload));
+                    stalled->state.store(SharedRing::RecordState::Committed, std::memory_order_release);
+                }
+                sched_yield();
+                break;
+            case SharedRing::ReadResult::Empty:
+                sched_yield();
+                break;
+        }
+    }
+
+    for (auto pid : pids) {
+        int status = 0;
+        CHECK(waitpid(pid, &status, 0) == pid);
+        CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    // the abandoned records were discarded after the timeout, and nothing else remains in the ring
+    CHECK(abandoned_before > 0 && stalled_received);
+    CHECK(ring.try_read(on_record) == SharedRing::ReadResult::Empty);
+    for (auto sequence : next_sequence) {
+        CHECK(sequence == RECORDS_PER_PRODUCER);
+    }
+    munmap(memory, memory_size);
+    return 0;
+}
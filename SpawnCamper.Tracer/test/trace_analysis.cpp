@@ -0,0 +1,130 @@
+// Test of `TraceAnalysis`: the effective time spans of `Timeline` and the critical path, on small process trees
+//  built directly with `TraceIndex::Builder`.
+
+#include <cstdint>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Check.hpp"
+#include "TraceAnalysis.hpp"
+#include "TraceIndex.hpp"
+
+static constexpr uint64_t START = 133'000'000'000'000'000;
+
+/// Process tree of a trace; times are relative to the start of the recording.
+class TestTree {
+    TraceIndex::Builder m_builder{START, 0};
+    std::string m_data{};
+    std::optional<TraceIndex::View> m_index{};
+
+public:
+    TestTree& start(uint32_t pid, uint32_t parent_pid, uint64_t time) {
+        m_builder.add_start(pid, parent_pid, START + time, "/bin/p" + std::to_string(pid), "", "/", "");
+        return *this;
+    }
+
+    TestTree& exit(uint32_t pid, uint64_t time) {
+        m_builder.add_exit(pid, START + time, 0);
+        return *this;
+    }
+
+    /// Rows are sorted by start time, the tests start the processes in the order of their PIDs.
+    const TraceIndex::View& index() {
+        auto out = std::ostringstream(std::ios::binary);
+        m_builder.write(out);
+        m_data = std::move(out).str();
+        m_index.emplace(std::as_bytes(std::span{m_data}));
+        return *m_index;
+    }
+};
+
+/// Segment with times relative to the start of the recording, for readable expectations.
+struct Step {
+    uint32_t row;
+    uint64_t begin;
+    uint64_t end;
+    bool operator==(const Step&) const = default;
+};
+
+static std::vector<Step> steps(const std::vector<TraceAnalysis::Segment>& path) {
+    auto result = std::vector<Step>{};
+    for (auto& s : path) result.push_back({s.row, s.begin - START, s.end - START});
+    return result;
+}
+
+/// A child that outlives its parent keeps the subtree running; the path continues in it, past the end of the parent.
+static void test_child_outlives_parent() {
+    auto tree = TestTree{};
+    tree.start(1, 0, 0).start(2, 1, 10).start(3, 1, 20).exit(2, 50).exit(1, 100).exit(3, 150);
+    auto& index = tree.index();
+    auto timeline = TraceAnalysis::Timeline(index);
+
+    CHECK(timeline.end(0) == START + 100 && timeline.subtree_end(0) == START + 150);
+    CHECK(timeline.trace_end() == START + 150);
+    CHECK((timeline.roots() == std::vector<uint32_t>{0}));
+    CHECK((timeline.preorder() == std::vector<uint32_t>{0, 1, 2}));
+    CHECK((steps(TraceAnalysis::critical_path(timeline)) == std::vector<Step>{{0, 0, 10}, {1, 10, 20}, {2, 20, 150}}));
+
+    auto times = TraceAnalysis::subtree_times(timeline);
+    CHECK(times[0].wall == 150 && times[0].summed == 100 + 40 + 130 && times[0].processes == 3);
+}
+
+/// Processes whose end was not recorded end with their last descendant, but not before their parent; roots without
+///  an end last until the end of the trace.
+static void test_unrecorded_end() {
+    auto tree = TestTree{};
+    tree.start(1, 0, 0).start(2, 1, 10).start(3, 2, 30).exit(3, 120).exit(1, 200).start(4, 0, 210);
+    auto& index = tree.index();
+    auto timeline = TraceAnalysis::Timeline(index);
+
+    CHECK(index.end_time(1) == TraceIndex::NO_TIME);
+    CHECK(timeline.end(1) == START + 200);
+    CHECK(timeline.trace_end() == START + 210);
+    CHECK(timeline.end(3) == START + 210 && timeline.duration(3) == 0);
+}
+
+/// Between two roots, no traced process was running; the gap is part of the path, without a row.
+static void test_gap() {
+    auto tree = TestTree{};
+    tree.start(1, 0, 0).exit(1, 10).start(2, 0, 30).exit(2, 50);
+    auto& index = tree.index();
+    auto timeline = TraceAnalysis::Timeline(index);
+
+    CHECK((timeline.roots() == std::vector<uint32_t>{0, 1}));
+    CHECK((steps(TraceAnalysis::critical_path(timeline))
+           == std::vector<Step>{{0, 0, 10}, {TraceIndex::NO_ROW, 10, 30}, {1, 30, 50}}));
+
+    auto samples = TraceAnalysis::concurrency(timeline);
+    auto running = std::vector<std::pair<uint64_t, uint32_t>>{};
+    for (auto& s : samples) running.emplace_back(s.time - START, s.running);
+    CHECK((running == std::vector<std::pair<uint64_t, uint32_t>>{{0, 1}, {10, 0}, {30, 1}, {50, 0}}));
+}
+
+/// On Linux, a process that executes another program is replaced by a child row with the same PID; the path runs
+///  through both images, and the child of the new image.
+static void test_image_replacement() {
+    auto tree = TestTree{};
+    tree.start(1, 0, 0).start(1, 1, 40).start(2, 1, 60).exit(2, 90).exit(1, 100);
+    auto& index = tree.index();
+    auto timeline = TraceAnalysis::Timeline(index);
+
+    CHECK(index.flags(0) & TraceIndex::RowFlags::Replaced);
+    CHECK(timeline.end(0) == START + 40 && timeline.subtree_end(0) == START + 100);
+    CHECK((steps(TraceAnalysis::critical_path(timeline))
+           == std::vector<Step>{{0, 0, 40}, {1, 40, 60}, {2, 60, 90}, {1, 90, 100}}));
+
+    // the new image waits for its only child
+    auto waits = TraceAnalysis::single_child_waits(timeline, 0);
+    CHECK(waits.size() == 1 && waits[0].parent == 1 && waits[0].child == 2);
+    CHECK(waits[0].begin == START + 60 && waits[0].end == START + 90);
+}
+
+int main() {
+    test_child_outlives_parent();
+    test_unrecorded_end();
+    test_gap();
+    test_image_replacement();
+    return 0;
+}
@@ -0,0 +1,140 @@
+// Test of `TraceCompare`: the normalization of command lines, the three matching passes and the comparison of the
+//  environments, on two small runs of a build built directly with `TraceIndex::Builder`.
+
+#include <cstdint>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Check.hpp"
+#include "TraceAnalysis.hpp"
+#include "TraceCompare.hpp"
+#include "TraceIndex.hpp"
+
+static constexpr uint64_t START = 133'000'000'000'000'000;
+
+/// Recorded run of a build; times are relative to the start of the recording.
+class TestRun {
+    TraceIndex::Builder m_builder{START, 0};
+    std::string m_data{};
+    std::optional<TraceIndex::View> m_index{};
+
+public:
+    TestRun& process(uint32_t pid, uint32_t parent_pid, uint64_t start, uint64_t end, std::string_view exe,
+                     std::string_view command_line, std::string_view env = {}, bool env_incomplete = false) {
+        m_builder.add_start(pid, parent_pid, START + start, exe, command_line, "/src", env, env_incomplete);
+        m_builder.add_exit(pid, START + end, 0);
+        return *this;
+    }
+
+    const TraceIndex::View& index() {
+        auto out = std::ostringstream(std::ios::binary);
+        m_builder.write(out);
+        m_data = std::move(out).str();
+        m_index.emplace(std::as_bytes(std::span{m_data}));
+        return *m_index;
+    }
+};
+
+static uint32_t row_of(const TraceIndex::View& index, uint32_t pid) {
+    for (uint32_t row = 0; row < index.row_count(); row++) {
+        if (index.pid(row) == pid) return row;
+    }
+    CHECK(false);
+    return TraceIndex::NO_ROW;
+}
+
+static std::string normalize(std::string_view command_line) {
+    auto result = std::string{};
+    TraceCompare::normalize_command_line(command_line, result);
+    return result;
+}
+
+static void test_normalize() {
+    CHECK(normalize("  CL.exe  /c\tFoo.cpp ") == "cl.exe \\c foo.cpp");
+    // PIDs and temporary names
+    CHECK(normalize("cc -o /tmp/cc12345.o") == "cc -o \\tmp\\cc#.o");
+    CHECK(normalize("cc -o /tmp/cc12345.o") == normalize("cc -o /tmp/cc67890.o"));
+    CHECK(normalize("link /out:{1b4e28ba-2fa1-11d2-883f-0016d3cca427}") == "link \\out:{#-2fa1-11d2-883f-#}");
+    // short numbers and words made of hexadecimal letters are kept
+    CHECK(normalize("gcc -O2 -std=c++20 deadbeef") == "gcc -o2 -std=c++20 deadbeef");
+    CHECK(normalize("cc -o /tmp/cc987.o") == "cc -o \\tmp\\cc987.o");
+    CHECK(TraceCompare::exe_file_name("C:\\VS\\bin\\CL.exe") == "cl.exe");
+    CHECK(TraceCompare::exe_file_name("/usr/bin/cc") == "cc");
+}
+
+static constexpr std::string_view ENV{"A=1\0B=2\0", 8};
+/// Only the variables changed by a delta whose base is missing, see `TraceIndex::RowFlags::EnvironmentIncomplete`.
+static constexpr std::string_view PARTIAL_ENV{"C=3\0", 4};
+
+/// The second run moved the link step under a shell, switched to another compiler installation, passes other
+///  arguments to the assembler and the archiver, and runs `echo` instead of `rm`.
+static void test_match() {
+    auto before_run = TestRun{};
+    before_run.process(1, 0, 0, 100, "/usr/bin/make", "make -j8", ENV)
+        .process(2, 1, 10, 40, "/opt/gcc-12/bin/cc", "cc -c a.c -o /tmp/cc1234.o", ENV)
+        .process(3, 2, 20, 30, "/usr/bin/as", "as /tmp/cc1234.s")
+        .process(4, 1, 15, 50, "/opt/gcc-12/bin/cc", "cc -c b.c")
+        .process(5, 1, 60, 90, "/usr/bin/ld", "ld a.o b.o")
+        .process(6, 5, 65, 70, "/usr/bin/ar", "ar x lib.a")
+        .process(7, 1, 91, 92, "/bin/true", "true")
+        .process(8, 1, 93, 94, "/bin/true", "true")
+        .process(9, 1, 95, 96, "/bin/rm", "rm a.o");
+    auto after_run = TestRun{};
+    after_run.process(101, 0, 0, 120, "/usr/bin/make", "make -j8", std::string_view{"A=1\0B=3\0", 8})
+        .process(102, 101, 10, 40, "/opt/gcc-12/bin/cc", "cc -c a.c -o /tmp/cc98765.o", PARTIAL_ENV, true)
+        .process(103, 102, 20, 30, "/usr/bin/as", "as -v /tmp/cc98765.s")
+        .process(104, 101, 15, 50, "/opt/gcc-13/bin/cc", "cc -c b.c")
+        .process(105, 101, 55, 95, "/bin/sh", "sh -c link")
+        .process(106, 105, 60, 90, "/usr/bin/ld", "ld a.o b.o")
+        .process(107, 106, 65, 70, "/usr/bin/ar", "ar t lib.a")
+        .process(108, 101, 96, 97, "/bin/true", "true")
+        .process(109, 101, 98, 99, "/bin/true", "true")
+        .process(110, 101, 100, 101, "/bin/echo", "echo done");
+    auto& before = before_run.index();
+    auto& after = after_run.index();
+    auto before_timeline = TraceAnalysis::Timeline(before);
+    auto after_timeline = TraceAnalysis::Timeline(after);
+    auto matching = TraceCompare::match(before_timeline, after_timeline);
+
+    auto matched = [&](uint32_t before_pid) {
+        auto row = matching.before_to_after[row_of(before, before_pid)];
+        return row == TraceIndex::NO_ROW ? 0 : after.pid(row);
+    };
+    // pass 1, the temporary file names are normalized
+    CHECK(matched(1) == 101 && matched(2) == 102);
+    // pass 2, the invocation moved under `sh`
+    CHECK(matched(5) == 106);
+    // pass 3, by exe file name: other arguments, under a parent matched by pass 1 or 2, and another installation
+    CHECK(matched(3) == 103 && matched(6) == 107 && matched(4) == 104);
+    // repeated invocations are paired in the order they ran
+    CHECK(matched(7) == 108 && matched(8) == 109);
+    CHECK(matched(9) == 0);
+    CHECK(matching.after_to_before[row_of(after, 105)] == TraceIndex::NO_ROW);
+    CHECK(matching.after_to_before[row_of(after, 110)] == TraceIndex::NO_ROW);
+    for (uint32_t row = 0; row < before.row_count(); row++) {
+        auto other = matching.before_to_after[row];
+        CHECK(other == TraceIndex::NO_ROW || matching.after_to_before[other] == row);
+    }
+
+    // the partial environment of the compiler is skipped, it would show `A` and `B` as removed and `C` as added
+    auto changes = TraceCompare::environment_changes(before, after, matching);
+    CHECK(changes.size() == 1);
+    CHECK(changes[0].name == "B" && changes[0].before == "2" && changes[0].after == "3");
+    CHECK(changes[0].processes == 1);
+
+    // `make` runs during the whole trace, the critical path has no gaps
+    auto times = TraceCompare::critical_times(after_timeline);
+    uint64_t total = 0;
+    for (auto time : times) total += time;
+    CHECK(total == after_timeline.trace_end() - after_timeline.trace_start());
+    CHECK(times[row_of(after, 106)] > 0 && times[row_of(after, 103)] == 0);
+}
+
+int main() {
+    test_normalize();
+    test_match();
+    return 0;
+}
@@ -0,0 +1,194 @@
+// Test of `TraceIndex`: a trace file is recorded in memory with the messages the hooks send, then read back with
+//  `TraceReader` and indexed like `SpawnCamper.Indexer build` does.
+
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Check.hpp"
+#include "Environment.hpp"
+#include "MessageBuffer.hpp"
+#include "Protocol.hpp"
+#include "TraceFile.hpp"
+#include "TraceIndex.hpp"
+
+using namespace Protocol;
+
+static constexpr uint64_t START = 133'000'000'000'000'000;
+
+/// Trace file recorded in memory; times are relative to the start of the recording.
+class TestTrace {
+    static constexpr uint64_t CAPACITY = 1024 * 1024;
+
+    std::vector<std::byte> m_file = std::vector<std::byte>(TraceFile::DATA_OFFSET + CAPACITY);
+    MessageBuffer m_buffer;
+
+public:
+    TestTrace() {
+        TraceFile::initialize(m_file.data(), CAPACITY, MAX_VERSION, START);
+    }
+
+    template<typename Msg, typename... Args>
+    TestTrace& add(uint32_t pid, uint64_t time, const Args&... args) {
+        encode<Msg>(m_buffer, MAX_VERSION, START + time, args...);
+        CHECK(TraceFile::append(m_file.data(), pid, m_buffer.chunks()));
+        m_buffer.clear();
+        return *this;
+    }
+
+    TestTrace& start(uint32_t pid, uint32_t parent_pid, uint64_t time, std::string_view exe, std::string_view env) {
+        return add<Messages::ProcessStart>(pid, time, parent_pid, exe, exe, "/src", env, std::nullopt);
+    }
+
+    TestTrace& exit(uint32_t pid, uint64_t time, uint32_t exit_code) {
+        return add<Messages::ExitProcess>(pid, time, exit_code, std::nullopt);
+    }
+
+    [[nodiscard]] std::span<const std::byte> data() const {
+        return m_file;
+    }
+
+    /// The serialized index, which backs the `TraceIndex::View`.
+    [[nodiscard]] std::string index() const {
+        size_t malformed;
+        auto index = TraceIndex::build_in_memory(m_file, malformed);
+        CHECK(malformed == 0);
+        return index;
+    }
+};
+
+static TraceIndex::View view(const std::string& index) {
+    return TraceIndex::View(std::as_bytes(std::span{index}));
+}
+
+static std::vector<uint32_t> rows(std::span<const uint32_t> rows) {
+    return {rows.begin(), rows.end()};
+}
+
+/// The hooks hash the UTF-16 environment block, see `TraceReader::add_environment`.
+static uint64_t env_hash(std::string_view env) {
+    auto utf16 = std::u16string(env.begin(), env.end());
+    return Environment::hash(utf16.data(), utf16.size() * sizeof(char16_t));
+}
+
+static constexpr std::string_view ROOT_ENV{"A=1\0B=2\0", 8};
+
+/// Rows are sorted by start time and linked to their parents; exits are matched to the last image of a PID, exits
+///  reported by the parent only count if the process did not report its own.
+static void test_rows() {
+    auto trace = TestTrace{};
+    trace.start(10, 1, 0, "/usr/bin/make", ROOT_ENV)
+        // recorded before its sibling that started earlier, the connections are independent
+        .start(12, 10, 30, "/usr/bin/cc", ROOT_ENV)
+        .add<Messages::ProcessStartEnvDelta>(11, 20, 10u, "/usr/bin/cc", "cc", "/src", 0x11ull, env_hash(ROOT_ENV),
+                                             std::string_view{"B\0", 2}, std::string_view{"C=3\0", 4}, std::nullopt)
+        // `cc` executes `ld` in the same process
+        .start(11, 11, 40, "/usr/bin/ld", ROOT_ENV)
+        .exit(11, 50, 0)
+        .exit(12, 60, 1)
+        .add<Messages::ChildExit>(10, 61, 12u, 9u)
+        // killed, only its parent reports the exit
+        .start(13, 10, 70, "/usr/bin/cc", ROOT_ENV)
+        .add<Messages::ChildExit>(10, 80, 13u, 137u)
+        .exit(10, 100, 0)
+        // the start was not recorded
+        .exit(99, 90, 0);
+    auto data = trace.index();
+    auto index = view(data);
+
+    CHECK(index.row_count() == 5 && index.exe_count() == 3);
+    CHECK(index.header().start_time == START);
+    auto pids = std::vector<uint32_t>{};
+    for (uint32_t row = 0; row < index.row_count(); row++) pids.push_back(index.pid(row));
+    CHECK((pids == std::vector<uint32_t>{10, 11, 12, 11, 13}));
+    CHECK(index.parent_row(0) == TraceIndex::NO_ROW && index.parent_pid(0) == 1);
+    CHECK(index.parent_row(1) == 0 && index.parent_row(2) == 0 && index.parent_row(3) == 1);
+    CHECK((rows(index.children(0)) == std::vector<uint32_t>{1, 2, 4}));
+    CHECK((rows(index.children(1)) == std::vector<uint32_t>{3}));
+    CHECK(index.children(3).empty());
+
+    // the replaced image ends when the new one starts, without an exit code
+    CHECK(index.flags(1) == TraceIndex::RowFlags::Replaced);
+    CHECK(index.end_time(1) == START + 40 && !index.exit_code(1));
+    CHECK(index.exit_code(3) == 0u && index.end_time(3) == START + 50);
+    CHECK(index.exit_code(2) == 1u && index.end_time(2) == START + 60);
+    CHECK(!(index.flags(2) & TraceIndex::RowFlags::Terminated));
+    CHECK(index.exit_code(4) == 137u && index.end_time(4) == START + 80);
+    CHECK(index.flags(4) == (TraceIndex::RowFlags::Exited | TraceIndex::RowFlags::Terminated));
+    CHECK(index.exit_code(0) == 0u && index.end_time(0) == START + 100);
+
+    CHECK(index.environment(1) == Environment::apply_delta<char>(ROOT_ENV, {"B\0", 2}, {"C=3\0", 4}));
+    CHECK(index.environment(1).find("C=3") != std::string_view::npos);
+    // identical environments are stored once
+    CHECK(index.environment(0) == ROOT_ENV && index.environment(0).data() == index.environment(2).data());
+    CHECK(index.command_line(1) == "cc" && index.working_directory(1) == "/src");
+
+    auto cc = index.find_exe("/usr/bin/cc");
+    CHECK(cc && index.exe_path(1) == "/usr/bin/cc");
+    CHECK(!index.find_exe("/usr/bin/c"));
+    CHECK((rows(index.rows_of_exe(*cc)) == std::vector<uint32_t>{1, 2, 4}));
+    CHECK((rows(index.rows_of_exe_started_between(*cc, START + 25, START + 71))
+           == std::vector<uint32_t>{2, 4}));
+    CHECK((index.rows_started_between(START + 20, START + 41) == std::pair<uint32_t, uint32_t>{1, 4}));
+    CHECK((index.rows_started_between(START + 41, START + 20) == std::pair<uint32_t, uint32_t>{4, 4}));
+}
+
+/// A delta whose base is missing is indexed with the variables it changed and marked incomplete. It is not stored,
+///  so a delta against it is incomplete as well, until the full environment is recorded.
+static void test_incomplete_environment() {
+    static constexpr std::string_view CHILD_ENV{"A=1\0C=3\0", 8};
+    auto add_delta = [](TestTrace& trace, uint32_t pid, uint64_t time, uint64_t base) {
+        trace.add<Messages::ProcessStartEnvDelta>(pid, time, 1u, "/bin/sh", "sh", "/", env_hash(CHILD_ENV), base,
+                                                  std::string_view{"B\0", 2}, std::string_view{"C=3\0", 4},
+                                                  std::nullopt);
+    };
+    auto trace = TestTrace{};
+    add_delta(trace, 20, 0, env_hash(ROOT_ENV));
+    add_delta(trace, 21, 1, env_hash(CHILD_ENV));
+    trace.add<Messages::EnvironmentSnapshot>(21, 2, CHILD_ENV);
+    add_delta(trace, 22, 3, env_hash(CHILD_ENV));
+    auto data = trace.index();
+    auto index = view(data);
+
+    CHECK(index.row_count() == 3);
+    for (uint32_t row : {0u, 1u}) {
+        CHECK(index.flags(row) & TraceIndex::RowFlags::EnvironmentIncomplete);
+        CHECK(index.environment(row) == std::string_view("C=3\0", 4));
+    }
+    CHECK(!(index.flags(2) & TraceIndex::RowFlags::EnvironmentIncomplete));
+    CHECK(index.environment(2) == Environment::apply_delta<char>(CHILD_ENV, {"B\0", 2}, {"C=3\0", 4}));
+}
+
+static void test_invalid() {
+    auto trace = TestTrace{};
+    trace.start(1, 0, 0, "/bin/sh", ROOT_ENV);
+    CHECK(!TraceIndex::is_index(trace.data()));
+    auto data = trace.index();
+    CHECK(TraceIndex::is_index(std::as_bytes(std::span{data})));
+
+    auto threw = false;
+    try {
+        TraceIndex::View(trace.data());
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+    // a section past the end of the file
+    threw = false;
+    try {
+        TraceIndex::View(std::as_bytes(std::span{data}).first(sizeof(TraceIndex::Header) + 1));
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+}
+
+int main() {
+    test_rows();
+    test_incomplete_environment();
+    test_invalid();
+    return 0;
+}